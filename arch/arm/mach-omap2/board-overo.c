@@ -230,7 +230,7 @@ static struct omap_smsc911x_platform_data smsc911x_cfg = {
 	.cs             = OVERO_SMSC911X_CS,
 	.gpio_irq       = OVERO_SMSC911X_GPIO,
 	.gpio_reset     = -EINVAL,
-	.flags		= SMSC911X_USE_32BIT,
+	.flags		= SMSC911X_USE_32BIT | SMSC911X_USE_DMA,
 };
 
 static struct omap_smsc911x_platform_data smsc911x2_cfg = {
@@ -238,7 +238,7 @@ static struct omap_smsc911x_platform_data smsc911x2_cfg = {
 	.cs             = OVERO_SMSC911X2_CS,
 	.gpio_irq       = OVERO_SMSC911X2_GPIO,
 	.gpio_reset     = -EINVAL,
-	.flags		= SMSC911X_USE_32BIT,
+	.flags		= SMSC911X_USE_32BIT | SMSC911X_USE_DMA,
 };
 
 static void __init overo_init_smsc911x(void)
@@ -637,6 +637,11 @@ static struct sc16is7x2_platform_data sc16is7x2_pdata = {
 	.gpio_base	= OMAP_MAX_GPIO_LINES + TWL4030_GPIO_MAX + 4,
     .irq_gpio   = OVERO_GPIO_PENDOWN,
 };
+
+static struct omap2_mcspi_device_config sc16is7x2_mcspi_config = {
+	.chain_dma	= 1,
+	.dma_min_bytes	= 8,
+};
 #endif
 
 static struct spi_board_info overo_spi_board_info[] __initdata = {
@@ -651,6 +656,7 @@ static struct spi_board_info overo_spi_board_info[] __initdata = {
 		.max_speed_hz		= 4000000,
 		.irq			= -1, /* set by driver from GPIO */
 		.platform_data		= &sc16is7x2_pdata,
+		.controller_data	= &sc16is7x2_mcspi_config,
 		.mode			= SPI_MODE_0,
 	},
 #elif !defined(CONFIG_TOUCHSCREEN_ADS7846) && \
@@ -798,6 +804,7 @@ static struct pps_gpio_platform_data pps_gpio_info = {
  .capture_clear = false,
  .gpio_pin=186,
  .gpio_label="EXT GPS PPS",
+ .early_capture = true,
 };
 
 static struct platform_device ext_pps_gpio_device = {
@@ -66,16 +66,13 @@ static u8 console_uart_id = -1;
 static u8 no_console_suspend;
 static u8 uart_debug;
 
-#define DEFAULT_RXDMA_POLLRATE		1	/* RX DMA polling rate (us) */
-#define DEFAULT_RXDMA_BUFSIZE		4096	/* RX DMA buffer size */
-#define DEFAULT_RXDMA_TIMEOUT		(3 * HZ)/* RX DMA timeout (jiffies) */
+#define DEFAULT_RXDMA_BUFSIZE		4096	/* RX DMA ring size */
 
 static struct omap_uart_port_info omap_serial_default_info[] __initdata = {
 	{
 		.dma_enabled	= false,
 		.dma_rx_buf_size = DEFAULT_RXDMA_BUFSIZE,
-		.dma_rx_poll_rate = DEFAULT_RXDMA_POLLRATE,
-		.dma_rx_timeout = DEFAULT_RXDMA_TIMEOUT,
+		.dma_rx_trigger = OMAP_UART_DMA_RX_TRIGGER,
 		.autosuspend_timeout = DEFAULT_AUTOSUSPEND_DELAY,
 	},
 };
@@ -301,8 +298,7 @@ void __init omap_serial_init_port(struct omap_board_data *bdata,
 	omap_up.set_noidle = omap_uart_set_noidle;
 	omap_up.enable_wakeup = omap_uart_enable_wakeup;
 	omap_up.dma_rx_buf_size = info->dma_rx_buf_size;
-	omap_up.dma_rx_timeout = info->dma_rx_timeout;
-	omap_up.dma_rx_poll_rate = info->dma_rx_poll_rate;
+	omap_up.dma_rx_trigger = info->dma_rx_trigger;
 	omap_up.autosuspend_timeout = info->autosuspend_timeout;
 
 	pdata = &omap_up;
@@ -531,6 +531,52 @@ int omap_dm_timer_set_prescaler(struct omap_dm_timer *timer, int prescaler)
 }
 EXPORT_SYMBOL_GPL(omap_dm_timer_set_prescaler);
 
+/*
+ * Latch the counter into TCAR1 on the given edges of the timer's event
+ * pin, or stop capturing with OMAP_TIMER_CAPTURE_NONE. With @second set
+ * the second event is latched into TCAR2 as well, before the capture
+ * interrupt is raised.
+ */
+int omap_dm_timer_set_capture(struct omap_dm_timer *timer, int edges,
+			      int second)
+{
+	u32 l;
+
+	if (unlikely(!timer) || edges & ~OMAP_TIMER_CAPTURE_BOTH)
+		return -EINVAL;
+
+	omap_dm_timer_enable(timer);
+	l = omap_dm_timer_read_reg(timer, OMAP_TIMER_CTRL_REG);
+	l &= ~(OMAP_TIMER_CTRL_GPOCFG | OMAP_TIMER_CTRL_CAPTMODE |
+	       OMAP_TIMER_CTRL_TCM_BOTHEDGES);
+	if (edges) {
+		/* the event pin becomes an input */
+		l |= OMAP_TIMER_CTRL_GPOCFG | (edges << 8);
+		if (second)
+			l |= OMAP_TIMER_CTRL_CAPTMODE;
+	}
+	omap_dm_timer_write_reg(timer, OMAP_TIMER_CTRL_REG, l);
+
+	/* Save the context */
+	timer->context.tclr = l;
+	omap_dm_timer_disable(timer);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(omap_dm_timer_set_capture);
+
+unsigned int omap_dm_timer_read_capture(struct omap_dm_timer *timer,
+					int second)
+{
+	if (unlikely(!timer || pm_runtime_suspended(&timer->pdev->dev))) {
+		pr_err("%s: timer not available or enabled.\n", __func__);
+		return 0;
+	}
+
+	return omap_dm_timer_read_reg(timer, second ? OMAP_TIMER_CAPTURE2_REG :
+				      OMAP_TIMER_CAPTURE_REG);
+}
+EXPORT_SYMBOL_GPL(omap_dm_timer_read_capture);
+
 int omap_dm_timer_set_int_enable(struct omap_dm_timer *timer,
 				  unsigned int value)
 {
@@ -50,6 +50,12 @@
 #define OMAP_TIMER_INT_OVERFLOW			(1 << 1)
 #define OMAP_TIMER_INT_MATCH			(1 << 0)
 
+/* capture edges */
+#define OMAP_TIMER_CAPTURE_NONE			0x00
+#define OMAP_TIMER_CAPTURE_RISING		0x01
+#define OMAP_TIMER_CAPTURE_FALLING		0x02
+#define OMAP_TIMER_CAPTURE_BOTH			0x03
+
 /* trigger types */
 #define OMAP_TIMER_TRIGGER_NONE			0x00
 #define OMAP_TIMER_TRIGGER_OVERFLOW		0x01
@@ -127,6 +133,8 @@ int omap_dm_timer_set_load_start(struct omap_dm_timer *timer, int autoreload, un
 int omap_dm_timer_set_match(struct omap_dm_timer *timer, int enable, unsigned int match);
 int omap_dm_timer_set_pwm(struct omap_dm_timer *timer, int def_on, int toggle, int trigger);
 int omap_dm_timer_set_prescaler(struct omap_dm_timer *timer, int prescaler);
+int omap_dm_timer_set_capture(struct omap_dm_timer *timer, int edges, int second);
+unsigned int omap_dm_timer_read_capture(struct omap_dm_timer *timer, int second);
 
 int omap_dm_timer_set_int_enable(struct omap_dm_timer *timer, unsigned int value);
 
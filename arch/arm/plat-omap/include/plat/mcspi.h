@@ -18,6 +18,12 @@ struct omap2_mcspi_dev_attr {
 
 struct omap2_mcspi_device_config {
 	unsigned turbo_mode:1;
+
+	/* Run each chip select frame of a message as one DMA transfer */
+	unsigned chain_dma:1;
+
+	/* Frames shorter than this use PIO; 0 selects the driver default */
+	unsigned dma_min_bytes;
 };
 
 #endif
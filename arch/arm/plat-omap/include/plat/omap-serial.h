@@ -54,6 +54,10 @@
 
 #define OMAP_UART_DMA_CH_FREE	-1
 
+/* RX DMA ring defaults, see struct omap_uart_port_info */
+#define OMAP_UART_DMA_RX_BUF_MIN	64
+#define OMAP_UART_DMA_RX_TRIGGER	16
+
 #define OMAP_MAX_HSUART_PORTS	4
 
 #define MSR_SAVE_FLAGS		UART_MSR_ANY_DELTA
@@ -65,10 +69,9 @@ struct omap_uart_port_info {
 	bool			dma_enabled;	/* To specify DMA Mode */
 	unsigned int		uartclk;	/* UART clock rate */
 	upf_t			flags;		/* UPF_* flags */
-	unsigned int		dma_rx_buf_size;
-	unsigned int		dma_rx_timeout;
+	unsigned int		dma_rx_buf_size;	/* RX DMA ring size */
+	unsigned int		dma_rx_trigger;		/* RX FIFO DMA level */
 	unsigned int		autosuspend_timeout;
-	unsigned int		dma_rx_poll_rate;
 
 	int (*get_context_loss_count)(struct device *);
 	void (*set_forceidle)(struct platform_device *);
@@ -89,17 +92,17 @@ struct uart_omap_dma {
 	 * comes from port structure.
 	 */
 	unsigned char		*rx_buf;
-	unsigned int		prev_rx_dma_pos;
+	/* ring offset up to which received data went to the tty */
+	unsigned int		rx_tail;
 	int			tx_buf_size;
 	int			tx_dma_used;
 	int			rx_dma_used;
 	spinlock_t		tx_lock;
 	spinlock_t		rx_lock;
-	/* timer to poll activity on rx dma */
-	struct timer_list	rx_timer;
 	unsigned int		rx_buf_size;
-	unsigned int		rx_poll_rate;
-	unsigned int		rx_timeout;
+	unsigned int		rx_trigger;
+	/* time on the line of one character, for back-dating stamps */
+	unsigned int		rx_char_ns;
 };
 
 struct uart_omap_port {
@@ -1382,6 +1382,25 @@ const char *gpiochip_is_requested(struct gpio_chip *chip, unsigned offset)
 }
 EXPORT_SYMBOL_GPL(gpiochip_is_requested);
 
+/**
+ * gpiochip_is_exported - tell whether a signal is exported to userspace
+ * @chip: controller managing the signal
+ * @offset: of signal within controller's 0..(ngpio - 1) range
+ *
+ * Returns nonzero if the GPIO has been exported through sysfs, that is
+ * userspace may drive it.  This lets controller drivers offer their own
+ * userspace interfaces with the same ownership rules as /sys/class/gpio.
+ */
+int gpiochip_is_exported(struct gpio_chip *chip, unsigned offset)
+{
+	unsigned gpio = chip->base + offset;
+
+	if (!gpio_is_valid(gpio) || gpio_desc[gpio].chip != chip)
+		return 0;
+	return test_bit(FLAG_EXPORT, &gpio_desc[gpio].flags);
+}
+EXPORT_SYMBOL_GPL(gpiochip_is_exported);
+
 
 /* Drivers MUST set GPIO direction before making get/set calls.  In
  * some cases this is done in early boot, before IRQs are enabled.
@@ -1748,6 +1767,68 @@ void gpio_set_value_cansleep(unsigned gpio, int value)
 }
 EXPORT_SYMBOL_GPL(gpio_set_value_cansleep);
 
+/**
+ * gpiochip_get_multiple() - read several signals of one chip
+ * @chip: the chip to read
+ * @mask: bitmap of the offsets to read
+ * @bits: bitmap receiving the values of the signals in @mask
+ * Context: process context if the chip can sleep, else any
+ *
+ * Uses the chip's get_multiple() method, or its get() method for each
+ * signal when it has none.  Returns zero or a negative errno.
+ */
+int gpiochip_get_multiple(struct gpio_chip *chip,
+		unsigned long *mask, unsigned long *bits)
+{
+	unsigned		i;
+
+	might_sleep_if(extra_checks && chip->can_sleep);
+	if (chip->get_multiple)
+		return chip->get_multiple(chip, mask, bits);
+	if (!chip->get)
+		return -EIO;
+
+	for_each_set_bit(i, mask, chip->ngpio) {
+		if (chip->get(chip, i))
+			__set_bit(i, bits);
+		else
+			__clear_bit(i, bits);
+	}
+	return 0;
+}
+EXPORT_SYMBOL_GPL(gpiochip_get_multiple);
+
+/**
+ * gpiochip_set_multiple() - assign several signals of one chip
+ * @chip: the chip to update
+ * @mask: bitmap of the offsets to assign
+ * @bits: bitmap holding the values for the signals in @mask
+ * Context: process context if the chip can sleep, else any
+ *
+ * Uses the chip's set_multiple() method, or its set() method for each
+ * signal when it has none; only the former updates the signals as one.
+ * Open drain and open source emulation is not applied, so callers must
+ * not use this on such signals.  Returns zero or a negative errno.
+ */
+int gpiochip_set_multiple(struct gpio_chip *chip,
+		unsigned long *mask, unsigned long *bits)
+{
+	unsigned		i;
+
+	might_sleep_if(extra_checks && chip->can_sleep);
+	if (chip->set_multiple) {
+		chip->set_multiple(chip, mask, bits);
+		return 0;
+	}
+	if (!chip->set)
+		return -EIO;
+
+	for_each_set_bit(i, mask, chip->ngpio)
+		chip->set(chip, i, test_bit(i, bits));
+	return 0;
+}
+EXPORT_SYMBOL_GPL(gpiochip_set_multiple);
+
 
 #ifdef CONFIG_DEBUG_FS
 
@@ -23,6 +23,12 @@
 #include <linux/io.h>
 #include <linux/errno.h>
 #include <linux/platform_device.h>
+#include <linux/bitops.h>
+#include <linux/slab.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/ktime.h>
+#include <linux/kref.h>
 
 #include <linux/gpio.h>
 #include <linux/watchdog.h>
@@ -30,23 +36,61 @@
 
 #define WHOIFPGA_DEBUG 1
 
-//Define the Hardware Spin Lock
-static DEFINE_SPINLOCK(gpio_lock);
+#define WHOIFPGA_GPIO_MASK	((1UL << WHOIFPGA_NR_GPIOS) - 1)
+
+//Size of the register window
+#define WHOIFPGA_MAP_SIZE	1024
+
+//Per FPGA Data
+struct whoifpga {
+	void __iomem		*base;
+
+	//gpio_lock covers the IO_CTRL registers, wd_lock the watchdog ones.
+	//The pins may be driven from hardirq context, e.g. by pps_gen_gpio.
+	spinlock_t		gpio_lock;
+	spinlock_t		wd_lock;
+
+	//Shadow of the IO_CTRL registers, bit 0 is the value and bit 1 the
+	//direction. Only this driver writes them, so updates need no read
+	//back over the GPMC.
+	u16			ctrl_shadow[WHOIFPGA_NR_GPIOS];
+
+	struct gpio_chip	gpio;
+	struct watchdog_device	wd;
+
+	//An open /dev/watchdogN keeps the watchdog core using wd after
+	//remove, so the struct lives until the last reference is dropped
+	struct kref		kref;
+
+	//Interrupt demux, irq is 0 when the FPGA line isn't wired.
+	//irq_lock covers the masks, the input snapshot and the edge records.
+	int			irq;
+	int			irq_base;
+	spinlock_t		irq_lock;
+	unsigned long		irq_enabled;
+	unsigned long		irq_rising;
+	unsigned long		irq_falling;
+	unsigned long		irq_state;
+	ktime_t			edge_time[WHOIFPGA_NR_GPIOS];
+	unsigned long		edge_count[WHOIFPGA_NR_GPIOS];
+};
 
-//GPIO Data
-void __iomem *fpga_base;
+static inline struct whoifpga *to_whoifpga(struct gpio_chip *gc)
+{
+	return container_of(gc, struct whoifpga, gpio);
+}
 
 //HW Verification Function
-static int whoifpga_hw_verification(struct platform_device *pdev)
+static int whoifpga_hw_verification(struct platform_device *pdev,
+				    struct whoifpga *fpga)
 {
+	void __iomem *fpga_base = fpga->base;
 	u16 err = 0;
 	u16 magic1, magic2;
 	u16 test1, test2;
 	u16 test3_1, test3_2;
 	u16 addrtest1, addrtest2;
 
-	spin_lock(&gpio_lock);
-
 	//Verify Magic Numbers
 	magic1 = __raw_readw(fpga_base + MAGIC1);
 	if (magic1 != 0x4572)
@@ -111,32 +155,33 @@ static int whoifpga_hw_verification(struct platform_device *pdev)
 		err +=128;
 	}
 #endif
-	spin_unlock(&gpio_lock);
 	return err;
 }
 
 // GPIO Functions
-static int whoifpga_gpio_direction_in(struct gpio_chip *gc, unsigned  gpio_num)
-{
-	void __iomem *reg = fpga_base;
-	u16 dat;
-
-	spin_lock(&gpio_lock);
 
-	reg += IO_CTRL_BASE;
-	reg += gpio_num * 2;
+//Write a control register and its shadow, called with gpio_lock held
+static void whoifpga_ctrl_write(struct whoifpga *fpga, unsigned gpio_num,
+				u16 dat)
+{
+	fpga->ctrl_shadow[gpio_num] = dat;
+	__raw_writew(dat, fpga->base + IO_CTRL_BASE + gpio_num * 2);
+}
 
-	dat = __raw_readw(reg);
-	dat &= 0x02;
-	__raw_writew(dat, reg);
+static int whoifpga_gpio_direction_in(struct gpio_chip *gc, unsigned  gpio_num)
+{
+	struct whoifpga *fpga = to_whoifpga(gc);
+	unsigned long flags;
 
-	spin_unlock(&gpio_lock);
+	spin_lock_irqsave(&fpga->gpio_lock, flags);
+	whoifpga_ctrl_write(fpga, gpio_num, fpga->ctrl_shadow[gpio_num] & 0x02);
+	spin_unlock_irqrestore(&fpga->gpio_lock, flags);
 	return 0;
 }
 
 static int whoifpga_gpio_get(struct gpio_chip *gc, unsigned gpio_num)
 {
-	void __iomem *reg = fpga_base;
+	void __iomem *reg = to_whoifpga(gc)->base;
 	u16 dat;
 
 	reg += IO_CTRL_STATUS;
@@ -146,131 +191,425 @@ static int whoifpga_gpio_get(struct gpio_chip *gc, unsigned gpio_num)
 	return (int) dat;
 }
 
+//Read the status registers of all pins in mask
+static int whoifpga_gpio_get_multiple(struct gpio_chip *gc,
+					unsigned long *mask, unsigned long *bits)
+{
+	void __iomem *reg = to_whoifpga(gc)->base + IO_CTRL_STATUS;
+	unsigned gpio_num;
+
+	for_each_set_bit(gpio_num, mask, WHOIFPGA_NR_GPIOS) {
+		if (__raw_readw(reg + gpio_num * 2) & 0x01)
+			__set_bit(gpio_num, bits);
+		else
+			__clear_bit(gpio_num, bits);
+	}
+	return 0;
+}
+
 static void whoifpga_gpio_set(struct gpio_chip *gc, unsigned gpio_num, int val)
 {
-	void __iomem *reg = fpga_base;
+	struct whoifpga *fpga = to_whoifpga(gc);
+	unsigned long flags;
 	u16 dat;
 
-	spin_lock(&gpio_lock);
-
-	reg += IO_CTRL_BASE;
-	reg += gpio_num * 2;
+	spin_lock_irqsave(&fpga->gpio_lock, flags);
 
-	dat = __raw_readw(reg);
+	dat = fpga->ctrl_shadow[gpio_num];
 	if (val)
 		dat |= 1;
 	else
 		dat &= ~1;
 
-	__raw_writew(dat, reg);
-	spin_unlock(&gpio_lock);
+	whoifpga_ctrl_write(fpga, gpio_num, dat);
+	spin_unlock_irqrestore(&fpga->gpio_lock, flags);
 }
 
-static int whoifpga_gpio_direction_out(struct gpio_chip *gc,
-					unsigned gpio_num, int val)
+//Update all pins in mask back to back under a single lock
+static void whoifpga_gpio_set_multiple(struct gpio_chip *gc,
+					unsigned long *mask, unsigned long *bits)
 {
-	void __iomem *reg = fpga_base;
+	struct whoifpga *fpga = to_whoifpga(gc);
+	unsigned long flags;
+	unsigned gpio_num;
 	u16 dat;
 
-	spin_lock(&gpio_lock);
+	spin_lock_irqsave(&fpga->gpio_lock, flags);
 
-	reg += IO_CTRL_BASE;
-	reg += gpio_num * 2;
+	for_each_set_bit(gpio_num, mask, WHOIFPGA_NR_GPIOS) {
+		dat = fpga->ctrl_shadow[gpio_num];
+		if (test_bit(gpio_num, bits))
+			dat |= 1;
+		else
+			dat &= ~1;
 
-	dat = __raw_readw(reg);
-	dat |= 0x02;
-	__raw_writew(dat, reg);
+		whoifpga_ctrl_write(fpga, gpio_num, dat);
+	}
+
+	spin_unlock_irqrestore(&fpga->gpio_lock, flags);
+}
+
+static int whoifpga_gpio_direction_out(struct gpio_chip *gc,
+					unsigned gpio_num, int val)
+{
+	struct whoifpga *fpga = to_whoifpga(gc);
+	unsigned long flags;
 
-	spin_unlock(&gpio_lock);
+	spin_lock_irqsave(&fpga->gpio_lock, flags);
+	whoifpga_ctrl_write(fpga, gpio_num, fpga->ctrl_shadow[gpio_num] | 0x02);
+	spin_unlock_irqrestore(&fpga->gpio_lock, flags);
 	return 0;
 }
 
-static struct gpio_chip whoifpga_gpio = {
-	.label			= "whoifpga_gpio",
+static const struct gpio_chip whoifpga_gpio_template = {
 	.owner			= THIS_MODULE,
 	.direction_input	= whoifpga_gpio_direction_in,
 	.get			= whoifpga_gpio_get,
 	.direction_output	= whoifpga_gpio_direction_out,
 	.set			= whoifpga_gpio_set,
+	.get_multiple		= whoifpga_gpio_get_multiple,
+	.set_multiple		= whoifpga_gpio_set_multiple,
 };
 
+//Bulk GPIO access from userspace
+//Reading returns the value of every pin as a hex bitmask, pin 0 in bit 0.
+//Writing "<mask> <value>" in hex updates the output pins selected by mask
+//in a single locked pass. Like /sys/class/gpio, only pins exported to
+//userspace are written; pins configured as inputs or owned by kernel users
+//are left alone.
+static ssize_t whoifpga_lines_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct whoifpga *fpga = dev_get_drvdata(dev);
+	unsigned long mask = WHOIFPGA_GPIO_MASK;
+	unsigned long bits = 0;
+	int ret;
+
+	ret = gpiochip_get_multiple(&fpga->gpio, &mask, &bits);
+	if (ret)
+		return ret;
+	return sprintf(buf, "0x%05lx\n", bits);
+}
+
+static ssize_t whoifpga_lines_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct whoifpga *fpga = dev_get_drvdata(dev);
+	unsigned long mask, bits, outputs = 0;
+	unsigned gpio_num;
+	int ret;
+
+	if (sscanf(buf, "%lx %lx", &mask, &bits) != 2)
+		return -EINVAL;
+
+	for (gpio_num = 0; gpio_num < WHOIFPGA_NR_GPIOS; gpio_num++)
+		if ((fpga->ctrl_shadow[gpio_num] & 0x02) &&
+		    gpiochip_is_exported(&fpga->gpio, gpio_num))
+			outputs |= 1UL << gpio_num;
+
+	mask &= outputs;
+	if (mask) {
+		ret = gpiochip_set_multiple(&fpga->gpio, &mask, &bits);
+		if (ret)
+			return ret;
+	}
+
+	return count;
+}
+
+static DEVICE_ATTR(lines, S_IRUGO | S_IWUSR,
+		   whoifpga_lines_show, whoifpga_lines_store);
+
+//Interrupt Functions
+//The FPGA raises its single interrupt line when a status input changes.
+//The handler snapshots the enabled inputs, compares them with the previous
+//snapshot and dispatches one virtual interrupt per pin that saw a wanted
+//edge. The time of entry is recorded per pin as the edge timestamp.
+
+static void whoifpga_irq_mask(struct irq_data *d)
+{
+	struct whoifpga *fpga = irq_data_get_irq_chip_data(d);
+	unsigned long flags;
+
+	spin_lock_irqsave(&fpga->irq_lock, flags);
+	__clear_bit(d->irq - fpga->irq_base, &fpga->irq_enabled);
+	spin_unlock_irqrestore(&fpga->irq_lock, flags);
+}
+
+static void whoifpga_irq_unmask(struct irq_data *d)
+{
+	struct whoifpga *fpga = irq_data_get_irq_chip_data(d);
+	unsigned gpio_num = d->irq - fpga->irq_base;
+	unsigned long flags;
+
+	spin_lock_irqsave(&fpga->irq_lock, flags);
+	//Start from the current level so no stale edge is reported
+	if (whoifpga_gpio_get(&fpga->gpio, gpio_num))
+		__set_bit(gpio_num, &fpga->irq_state);
+	else
+		__clear_bit(gpio_num, &fpga->irq_state);
+	__set_bit(gpio_num, &fpga->irq_enabled);
+	spin_unlock_irqrestore(&fpga->irq_lock, flags);
+}
+
+static int whoifpga_irq_set_type(struct irq_data *d, unsigned int type)
+{
+	struct whoifpga *fpga = irq_data_get_irq_chip_data(d);
+	unsigned gpio_num = d->irq - fpga->irq_base;
+	unsigned long flags;
+
+	//Levels can't be told apart from edges in a status snapshot
+	if (type & ~IRQ_TYPE_EDGE_BOTH)
+		return -EINVAL;
+
+	spin_lock_irqsave(&fpga->irq_lock, flags);
+	if (type & IRQ_TYPE_EDGE_RISING)
+		__set_bit(gpio_num, &fpga->irq_rising);
+	else
+		__clear_bit(gpio_num, &fpga->irq_rising);
+	if (type & IRQ_TYPE_EDGE_FALLING)
+		__set_bit(gpio_num, &fpga->irq_falling);
+	else
+		__clear_bit(gpio_num, &fpga->irq_falling);
+	spin_unlock_irqrestore(&fpga->irq_lock, flags);
+
+	return 0;
+}
+
+static struct irq_chip whoifpga_irq_chip = {
+	.name			= "whoifpga",
+	.irq_mask		= whoifpga_irq_mask,
+	.irq_unmask		= whoifpga_irq_unmask,
+	.irq_set_type		= whoifpga_irq_set_type,
+};
+
+static int whoifpga_gpio_to_irq(struct gpio_chip *gc, unsigned gpio_num)
+{
+	return to_whoifpga(gc)->irq_base + gpio_num;
+}
+
+static irqreturn_t whoifpga_irq_handler(int irq, void *data)
+{
+	struct whoifpga *fpga = data;
+	ktime_t now = ktime_get();
+	unsigned long enabled, state = 0, changed, pending;
+	unsigned gpio_num;
+
+	spin_lock(&fpga->irq_lock);
+
+	enabled = fpga->irq_enabled;
+	whoifpga_gpio_get_multiple(&fpga->gpio, &enabled, &state);
+
+	changed = (state ^ fpga->irq_state) & enabled;
+	pending = (changed & state & fpga->irq_rising) |
+		  (changed & ~state & fpga->irq_falling);
+	fpga->irq_state ^= changed;
+
+	for_each_set_bit(gpio_num, &pending, WHOIFPGA_NR_GPIOS) {
+		fpga->edge_time[gpio_num] = now;
+		fpga->edge_count[gpio_num]++;
+	}
+
+	spin_unlock(&fpga->irq_lock);
+
+	for_each_set_bit(gpio_num, &pending, WHOIFPGA_NR_GPIOS)
+		generic_handle_irq(fpga->irq_base + gpio_num);
+
+	return IRQ_HANDLED;
+}
+
+//Edge timestamps, one line per pin: "<pin> <edges> <sec>.<nsec>"
+//Pair with poll() on the gpio "value" attribute, then read this file.
+static ssize_t whoifpga_edge_times_show(struct device *dev,
+					struct device_attribute *attr, char *buf)
+{
+	struct whoifpga *fpga = dev_get_drvdata(dev);
+	ktime_t edge_time[WHOIFPGA_NR_GPIOS];
+	unsigned long edge_count[WHOIFPGA_NR_GPIOS];
+	unsigned long flags;
+	ssize_t len = 0;
+	int i;
+
+	spin_lock_irqsave(&fpga->irq_lock, flags);
+	memcpy(edge_time, fpga->edge_time, sizeof(edge_time));
+	memcpy(edge_count, fpga->edge_count, sizeof(edge_count));
+	spin_unlock_irqrestore(&fpga->irq_lock, flags);
+
+	for (i = 0; i < WHOIFPGA_NR_GPIOS; i++) {
+		struct timespec ts = ktime_to_timespec(edge_time[i]);
+
+		len += sprintf(buf + len, "%d %lu %ld.%09ld\n", i,
+			       edge_count[i], ts.tv_sec, ts.tv_nsec);
+	}
+	return len;
+}
+
+static DEVICE_ATTR(edge_times, S_IRUGO, whoifpga_edge_times_show, NULL);
+
+static int __devinit whoifpga_irq_setup(struct platform_device *pdev,
+					struct whoifpga *fpga, int irq)
+{
+	int i;
+
+	spin_lock_init(&fpga->irq_lock);
+
+	fpga->irq_base = irq_alloc_descs(-1, 0, WHOIFPGA_NR_GPIOS, -1);
+	if (fpga->irq_base < 0) {
+		dev_err(&pdev->dev, "WHOI FPGA: no irq descs: %d", fpga->irq_base);
+		return fpga->irq_base;
+	}
+
+	for (i = 0; i < WHOIFPGA_NR_GPIOS; i++) {
+		int virq = fpga->irq_base + i;
+
+		irq_set_chip_data(virq, fpga);
+		irq_set_chip_and_handler(virq, &whoifpga_irq_chip,
+					 handle_simple_irq);
+#ifdef CONFIG_ARM
+		set_irq_flags(virq, IRQF_VALID);
+#else
+		irq_set_noprobe(virq);
+#endif
+	}
+
+	fpga->gpio.to_irq = whoifpga_gpio_to_irq;
+	fpga->irq = irq;
+	return 0;
+}
+
+static int __devinit whoifpga_irq_request(struct platform_device *pdev,
+					  struct whoifpga *fpga,
+					  unsigned long irq_flags)
+{
+	int err;
+
+	err = request_irq(fpga->irq, whoifpga_irq_handler,
+			  irq_flags ? irq_flags : IRQF_TRIGGER_RISING,
+			  dev_name(&pdev->dev), fpga);
+	if (err) {
+		dev_err(&pdev->dev, "WHOI FPGA: request_irq %d failed: %d",
+			fpga->irq, err);
+		return err;
+	}
+
+	err = device_create_file(&pdev->dev, &dev_attr_edge_times);
+	if (err)
+		dev_warn(&pdev->dev, "WHOI FPGA: edge_times attribute failed: %d", err);
+
+	return 0;
+}
+
+static void whoifpga_irq_remove(struct platform_device *pdev,
+				struct whoifpga *fpga, int requested)
+{
+	int i;
+
+	if (requested) {
+		device_remove_file(&pdev->dev, &dev_attr_edge_times);
+		free_irq(fpga->irq, fpga);
+	}
+
+	for (i = 0; i < WHOIFPGA_NR_GPIOS; i++) {
+		int virq = fpga->irq_base + i;
+
+#ifdef CONFIG_ARM
+		set_irq_flags(virq, 0);
+#endif
+		irq_set_chip_and_handler(virq, NULL, NULL);
+		irq_set_chip_data(virq, NULL);
+	}
+	irq_free_descs(fpga->irq_base, WHOIFPGA_NR_GPIOS);
+}
+
 //Watchdog Functions
 
 static int whoifpga_wd_start(struct watchdog_device * wd)
 {
-	void __iomem *reg = fpga_base;
+	struct whoifpga *fpga = watchdog_get_drvdata(wd);
+	void __iomem *reg = fpga->base;
 	u16 dat;
 
-	spin_lock(&gpio_lock);
+	spin_lock(&fpga->wd_lock);
 
 	reg += WATCHDOG_ENABLE;
 
 	dat = 0x0001;
 
 	__raw_writew(dat, reg);
-	spin_unlock(&gpio_lock);
+	spin_unlock(&fpga->wd_lock);
 
 	return 0;
 }
 
 static int whoifpga_wd_stop(struct watchdog_device * wd)
 {
-	void __iomem *reg = fpga_base;
+	struct whoifpga *fpga = watchdog_get_drvdata(wd);
+	void __iomem *reg = fpga->base;
 	u16 dat;
 
-	spin_lock(&gpio_lock);
+	spin_lock(&fpga->wd_lock);
 
 	reg += WATCHDOG_ENABLE;
 
 	dat = 0x0000;
 
 	__raw_writew(dat, reg);
-	spin_unlock(&gpio_lock);
+	spin_unlock(&fpga->wd_lock);
 
 	return 0;
 }
 
 static int whoifpga_wd_kick(struct watchdog_device * wd)
 {
-	void __iomem *reg = fpga_base;
+	struct whoifpga *fpga = watchdog_get_drvdata(wd);
+	void __iomem *reg = fpga->base;
 	u16 dat;
 
-	spin_lock(&gpio_lock);
+	spin_lock(&fpga->wd_lock);
 
 	reg += WATCHDOG_KICK;
 
 	dat = 0x0001;
 
 	__raw_writew(dat, reg);
-	spin_unlock(&gpio_lock);
+	spin_unlock(&fpga->wd_lock);
 
 	return 0;
 }
-/* Future Proofing
-static int whoifpga_wd_get_timeleft(struct watchdog_device * wd)
+
+//Seconds until the FPGA resets us unless kicked
+static unsigned int whoifpga_wd_get_timeleft(struct watchdog_device * wd)
 {
-	void __iomem *reg = fpga_base;
+	struct whoifpga *fpga = watchdog_get_drvdata(wd);
+	void __iomem *reg = fpga->base;
 	u16 time_elapsed, timeout;
 
-	spin_lock(&gpio_lock);
+	spin_lock(&fpga->wd_lock);
 
 	reg += WATCHDOG_TIME;
 
 	time_elapsed = __raw_readw(reg) ;
 
-	reg= fpga_base + WATCHDOG_INTERVAL;
+	reg= fpga->base + WATCHDOG_INTERVAL;
+
+	timeout = __raw_readw(reg) & 0xFFF;
 
-	timeout = __raw_readw(reg);
+	spin_unlock(&fpga->wd_lock);
+
+	if (time_elapsed >= timeout)
+		return 0;
 
 	return timeout - time_elapsed;
 }
-*/
+
 static int whoifpga_wd_set_timeout(struct watchdog_device * wd, unsigned int t)
 {
-	void __iomem *reg = fpga_base;
+	struct whoifpga *fpga = watchdog_get_drvdata(wd);
+	void __iomem *reg = fpga->base;
 	u16 dat;
 
-	spin_lock(&gpio_lock);
+	spin_lock(&fpga->wd_lock);
 
 	reg += WATCHDOG_INTERVAL;
 	
@@ -278,16 +617,38 @@ static int whoifpga_wd_set_timeout(struct watchdog_device * wd, unsigned int t)
 	dat = t & 0xFFF;
 
 	__raw_writew(dat, reg);
-	spin_unlock(&gpio_lock);
+	spin_unlock(&fpga->wd_lock);
 
 	wd->timeout = dat;
 	
 	return 0;
 }
 
+static void whoifpga_release(struct kref *kref)
+{
+	struct whoifpga *fpga = container_of(kref, struct whoifpga, kref);
+
+	kfree(fpga);
+}
+
+static void whoifpga_wd_ref(struct watchdog_device *wd)
+{
+	struct whoifpga *fpga = watchdog_get_drvdata(wd);
+
+	kref_get(&fpga->kref);
+}
+
+static void whoifpga_wd_unref(struct watchdog_device *wd)
+{
+	struct whoifpga *fpga = watchdog_get_drvdata(wd);
+
+	kref_put(&fpga->kref, whoifpga_release);
+}
+
 const struct watchdog_info whoifpga_wd_info = {
 	.identity = "WHOI FPGA Watchdog",
-	.options = WDIOF_SETTIMEOUT | WDIOF_MAGICCLOSE | WDIOF_KEEPALIVEPING,
+	.options = WDIOF_SETTIMEOUT | WDIOF_MAGICCLOSE | WDIOF_KEEPALIVEPING |
+		   WDIOF_PRETIMEOUT,
 };
 
 static struct watchdog_ops whoifpga_wd_ops = {
@@ -296,12 +657,13 @@ static struct watchdog_ops whoifpga_wd_ops = {
 	.stop			= whoifpga_wd_stop,
 	.ping			= whoifpga_wd_kick,
 	.set_timeout		= whoifpga_wd_set_timeout,
-// Future Proofing
-//	.get_timeleft		= whoifpga_wd_get_timeleft,
+	.get_timeleft		= whoifpga_wd_get_timeleft,
+	.ref			= whoifpga_wd_ref,
+	.unref			= whoifpga_wd_unref,
 };
 
 //Watchdog Data
-static struct watchdog_device whoifgpa_wd = {
+static const struct watchdog_device whoifpga_wd_template = {
 	.info 			= &whoifpga_wd_info,
 	.ops			= &whoifpga_wd_ops,
 	.min_timeout		= 3,
@@ -312,7 +674,10 @@ static struct watchdog_device whoifgpa_wd = {
 static int __devinit whoifpga_gpio_probe(struct platform_device *pdev)
 {
 	struct whoifpga_platform_data *pdata;
-	int err;
+	struct whoifpga *fpga;
+	struct resource *res;
+	resource_size_t start;
+	int err, i;
 	u16 api, major, minor, mile, devel;
 	char flag;
 
@@ -323,60 +688,116 @@ static int __devinit whoifpga_gpio_probe(struct platform_device *pdev)
 #endif
 
 	pdata = pdev->dev.platform_data;
-	if (!pdata || !pdata->gpio_base || !pdata->fpga_base_address) {
+	if (!pdata || !pdata->gpio_base) {
+		dev_err(&pdev->dev, "incorrect or missing platform data\n");
+		return -EINVAL;
+	}
+
+	//The register window is either a memory resource or, for older
+	//boards, the GPMC chip select address in the platform data
+	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+	if (res)
+		start = res->start;
+	else
+		start = pdata->fpga_base_address;
+	if (!start) {
 		dev_err(&pdev->dev, "incorrect or missing platform data\n");
 		return -EINVAL;
 	}
 
-	/* Static mapping, never released */
-	fpga_base = ioremap(pdata->fpga_base_address, 1024);
-	if (!fpga_base) {
+	//Not device managed, the watchdog core may outlive the binding
+	fpga = kzalloc(sizeof(*fpga), GFP_KERNEL);
+	if (!fpga)
+		return -ENOMEM;
+
+	kref_init(&fpga->kref);
+	spin_lock_init(&fpga->gpio_lock);
+	spin_lock_init(&fpga->wd_lock);
+
+	if (!devm_request_mem_region(&pdev->dev, start, WHOIFPGA_MAP_SIZE,
+				     dev_name(&pdev->dev))) {
+		dev_err(&pdev->dev, "FPGA window 0x%08lx busy\n",
+			(unsigned long)start);
+		err = -EBUSY;
+		goto err_free;
+	}
+
+	fpga->base = devm_ioremap(&pdev->dev, start, WHOIFPGA_MAP_SIZE);
+	if (!fpga->base) {
 		dev_err(&pdev->dev, "Could not ioremap fpga_base\n");
-		goto err_whoifpga_gpio;
+		err = -ENOMEM;
+		goto err_free;
 	}
 
+	platform_set_drvdata(pdev, fpga);
+
+	//Seed the control register shadow from the hardware
+	for (i = 0; i < WHOIFPGA_NR_GPIOS; i++)
+		fpga->ctrl_shadow[i] =
+			__raw_readw(fpga->base + IO_CTRL_BASE + i * 2);
+
 	//GPIO Configuration
-	whoifpga_gpio.base = pdata->gpio_base;
-	whoifpga_gpio.ngpio = WHOIFPGA_NR_GPIOS;
-	whoifpga_gpio.dev = &pdev->dev;
+	fpga->gpio = whoifpga_gpio_template;
+	fpga->gpio.label = dev_name(&pdev->dev);
+	fpga->gpio.base = pdata->gpio_base;
+	fpga->gpio.ngpio = WHOIFPGA_NR_GPIOS;
+	fpga->gpio.dev = &pdev->dev;
+
+	//Interrupt Configuration, only if the FPGA line is wired
+	if (pdata->irq > 0) {
+		err = whoifpga_irq_setup(pdev, fpga, pdata->irq);
+		if (err)
+			goto err_drvdata;
+	}
 
-	err = gpiochip_add(&whoifpga_gpio);
+	err = gpiochip_add(&fpga->gpio);
 	if (err < 0)
 	{
 		dev_err(&pdev->dev, "WHOI FPGA: gpiochip_add failed: %d", err);
-		goto err_whoifpga_gpio;
+		goto err_irq_descs;
 	}
 
-	err = whoifpga_hw_verification(pdev);
+	err = whoifpga_hw_verification(pdev, fpga);
 #ifndef WHOIFPGA_DEBUG
 	if(err != 0)
 	{
-
-		goto err_whoifpga_gpio;
-
+		err = -ENODEV;
+		goto err_gpiochip;
 	}
 #endif
 
+	if (fpga->irq) {
+		err = whoifpga_irq_request(pdev, fpga, pdata->irq_flags);
+		if (err)
+			goto err_gpiochip;
+	}
+
+	err = device_create_file(&pdev->dev, &dev_attr_lines);
+	if (err)
+		dev_warn(&pdev->dev, "WHOI FPGA: lines attribute failed: %d", err);
+
 	//Watchdog Configuration
 	//Read our timeout from the chip
-	whoifgpa_wd.timeout = __raw_readw(fpga_base + WATCHDOG_INTERVAL) & 0xFFF;
+	fpga->wd = whoifpga_wd_template;
+	fpga->wd.timeout = __raw_readw(fpga->base + WATCHDOG_INTERVAL) & 0xFFF;
+	watchdog_set_drvdata(&fpga->wd, fpga);
 
 	//Register our watchdog with the Kernel Subsystems.
-	err = watchdog_register_device(&whoifgpa_wd);
+	err = watchdog_register_device(&fpga->wd);
 	if(err)
 	{
 		dev_err(&pdev->dev, "WHOI FPGA: watchdog_register_device failed: %d", err);
-		goto err_whoifpga_gpio;
+		goto err_attr;
 
 	}
 
 	//Let's Read the Current Version info of the FPGA API.
-	api = __raw_readw(fpga_base + FPGA_API_LEVEL);
-	major = __raw_readw(fpga_base + FPGA_VER_MAJOR);
-	mile = __raw_readw(fpga_base + FPGA_VER_MILE);
-	minor = __raw_readw(fpga_base + FPGA_VER_MINOR);
-	devel = __raw_readw(fpga_base + FPGA_VER_DEVEL);
-	flag = (char)__raw_readw(fpga_base + FPGA_VER_FLAG);
+	api = __raw_readw(fpga->base + FPGA_API_LEVEL);
+	major = __raw_readw(fpga->base + FPGA_VER_MAJOR);
+	mile = __raw_readw(fpga->base + FPGA_VER_MILE);
+	minor = __raw_readw(fpga->base + FPGA_VER_MINOR);
+	devel = __raw_readw(fpga->base + FPGA_VER_DEVEL);
+	flag = (char)__raw_readw(fpga->base + FPGA_VER_FLAG);
 
 	//Print Version information
 	if(flag != '\0')
@@ -391,16 +812,30 @@ static int __devinit whoifpga_gpio_probe(struct platform_device *pdev)
 	}
 
 	//Print Info about the Location of the GPIO base
-	dev_info(&pdev->dev, "WHOI FPGA(Version %s) at 0x%08x, %d GPIO's based at %d\n", version_string,
-		pdata->fpga_base_address, WHOIFPGA_NR_GPIOS, whoifpga_gpio.base);
+	dev_info(&pdev->dev, "WHOI FPGA(Version %s) at 0x%08lx, %d GPIO's based at %d\n", version_string,
+		(unsigned long)start, WHOIFPGA_NR_GPIOS, fpga->gpio.base);
 
 	//Print Info about the WD
-	dev_info(&pdev->dev, "WHOI FPGA WD(Version %s) with timeout:%d\n", version_string, whoifgpa_wd.timeout);
+	dev_info(&pdev->dev, "WHOI FPGA WD(Version %s) with timeout:%d\n", version_string, fpga->wd.timeout);
 
 	return 0;
 
-err_whoifpga_gpio:
-	fpga_base = 0;
+err_attr:
+	device_remove_file(&pdev->dev, &dev_attr_lines);
+	if (fpga->irq) {
+		device_remove_file(&pdev->dev, &dev_attr_edge_times);
+		free_irq(fpga->irq, fpga);
+	}
+err_gpiochip:
+	if (gpiochip_remove(&fpga->gpio))
+		dev_err(&pdev->dev, "%s failed\n", "gpiochip_remove()");
+err_irq_descs:
+	if (fpga->irq)
+		whoifpga_irq_remove(pdev, fpga, 0);
+err_drvdata:
+	platform_set_drvdata(pdev, NULL);
+err_free:
+	kref_put(&fpga->kref, whoifpga_release);
 
 	return err;
 
@@ -408,21 +843,30 @@ err_whoifpga_gpio:
 
 static int __devexit whoifpga_gpio_remove(struct platform_device *pdev)
 {
-	if (fpga_base) 
-	{
-		int err;
+	struct whoifpga *fpga = platform_get_drvdata(pdev);
+	int err;
 
-		//GPIO Handling
-		err  = gpiochip_remove(&whoifpga_gpio);
-		if (err)
-			dev_err(&pdev->dev, "%s failed, %d\n",
-				"gpiochip_remove()", err);
+	//GPIO Handling, fails while any of our GPIOs is still requested.
+	//The driver core ignores our return value and releases the mapping
+	//anyway, so log it and tear the rest down regardless.
+	err  = gpiochip_remove(&fpga->gpio);
+	if (err)
+		dev_err(&pdev->dev, "%s failed, %d\n",
+			"gpiochip_remove()", err);
 
-		//Watchdog Handling
-		watchdog_unregister_device(&whoifgpa_wd);
+	device_remove_file(&pdev->dev, &dev_attr_lines);
 
-		fpga_base = 0;
-	}
+	//Interrupt Handling
+	if (fpga->irq)
+		whoifpga_irq_remove(pdev, fpga, 1);
+
+	//Watchdog Handling, the core stops calling our ops once this
+	//returns, but may still hold a reference to fpga
+	watchdog_unregister_device(&fpga->wd);
+
+	//The mapping is device managed
+	platform_set_drvdata(pdev, NULL);
+	kref_put(&fpga->kref, whoifpga_release);
 
 	return 0;
 }
@@ -23,6 +23,8 @@
 
 #ifdef CONFIG_MTD_NAND_OMAP_BCH
 #include <linux/bch.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
 #endif
 
 #include <plat/dma.h>
@@ -135,6 +137,21 @@ struct omap_nand_info {
 #ifdef CONFIG_MTD_NAND_OMAP_BCH
 	struct bch_control             *bch;
 	struct nand_ecclayout           ecclayout;
+
+	/* pipelined page reads, see omap3_read_page_bch() */
+	struct mutex			read_lock;
+	int				(*nand_read)(struct mtd_info *mtd,
+					loff_t from, size_t len,
+					size_t *retlen, u_char *buf);
+	void				(*nand_cmdfunc)(struct mtd_info *mtd,
+					unsigned command, int column,
+					int page_addr);
+	struct task_struct		*read_task;	/* mtd read in progress */
+	int				read_last;	/* its last page */
+	int				ra_page;	/* page read ahead, or -1 */
+	u_char				*ra_buf;	/* its first sector */
+	dma_addr_t			ra_dma;
+	bool				ra_by_dma;
 #endif
 };
 
@@ -347,22 +364,19 @@ static void omap_nand_dma_cb(int lch, u16 ch_status, void *data)
 }
 
 /*
- * omap_nand_dma_transfer: configer and start dma transfer
- * @mtd: MTD device structure
- * @addr: virtual address in RAM of source/destination
+ * omap_nand_dma_start: configure and start a prefetch dma transfer
+ * @info: NAND device structure
+ * @dma_addr: bus address in RAM of source/destination
  * @len: number of data bytes to be transferred
  * @is_write: flag for read/write operation
+ *
+ * Returns 0 once the transfer is running, or non zero if the prefetch
+ * engine is busy.
  */
-static inline int omap_nand_dma_transfer(struct mtd_info *mtd, void *addr,
-					unsigned int len, int is_write)
+static int omap_nand_dma_start(struct omap_nand_info *info,
+			dma_addr_t dma_addr, unsigned int len, int is_write)
 {
-	struct omap_nand_info *info = container_of(mtd,
-					struct omap_nand_info, mtd);
-	enum dma_data_direction dir = is_write ? DMA_TO_DEVICE :
-							DMA_FROM_DEVICE;
-	dma_addr_t dma_addr;
 	int ret;
-	unsigned long tim, limit;
 
 	/* The fifo depth is 64 bytes max.
 	 * But configure the FIFO-threahold to 32 to get a sync at each frame
@@ -370,25 +384,6 @@ static inline int omap_nand_dma_transfer(struct mtd_info *mtd, void *addr,
 	 */
 	int buf_len = len >> 6;
 
-	if (addr >= high_memory) {
-		struct page *p1;
-
-		if (((size_t)addr & PAGE_MASK) !=
-			((size_t)(addr + len - 1) & PAGE_MASK))
-			goto out_copy;
-		p1 = vmalloc_to_page(addr);
-		if (!p1)
-			goto out_copy;
-		addr = page_address(p1) + ((size_t)addr & ~PAGE_MASK);
-	}
-
-	dma_addr = dma_map_single(&info->pdev->dev, addr, len, dir);
-	if (dma_mapping_error(&info->pdev->dev, dma_addr)) {
-		dev_err(&info->pdev->dev,
-			"Couldn't DMA map a %d byte buffer\n", len);
-		goto out_copy;
-	}
-
 	if (is_write) {
 	    omap_set_dma_dest_params(info->dma_ch, 0, OMAP_DMA_AMODE_CONSTANT,
 						info->phys_base, 0, 0);
@@ -410,14 +405,22 @@ static inline int omap_nand_dma_transfer(struct mtd_info *mtd, void *addr,
 	ret = gpmc_prefetch_enable(info->gpmc_cs,
 			PREFETCH_FIFOTHRESHOLD_MAX, 0x1, len, is_write);
 	if (ret)
-		/* PFPW engine is busy, use cpu copy method */
-		goto out_copy_unmap;
+		return ret;
 
 	init_completion(&info->comp);
 
 	omap_start_dma(info->dma_ch);
+	return 0;
+}
+
+/*
+ * omap_nand_dma_finish: wait for a transfer started by omap_nand_dma_start
+ * @info: NAND device structure
+ */
+static void omap_nand_dma_finish(struct omap_nand_info *info)
+{
+	unsigned long tim, limit;
 
-	/* setup and start DMA using dma_addr */
 	wait_for_completion(&info->comp);
 	tim = 0;
 	limit = (loops_per_jiffy * msecs_to_jiffies(OMAP_NAND_TIMEOUT_MS));
@@ -426,6 +429,50 @@ static inline int omap_nand_dma_transfer(struct mtd_info *mtd, void *addr,
 
 	/* disable and stop the PFPW engine */
 	gpmc_prefetch_reset(info->gpmc_cs);
+}
+
+/*
+ * omap_nand_dma_transfer: configer and start dma transfer
+ * @mtd: MTD device structure
+ * @addr: virtual address in RAM of source/destination
+ * @len: number of data bytes to be transferred
+ * @is_write: flag for read/write operation
+ */
+static inline int omap_nand_dma_transfer(struct mtd_info *mtd, void *addr,
+					unsigned int len, int is_write)
+{
+	struct omap_nand_info *info = container_of(mtd,
+					struct omap_nand_info, mtd);
+	enum dma_data_direction dir = is_write ? DMA_TO_DEVICE :
+							DMA_FROM_DEVICE;
+	dma_addr_t dma_addr;
+	int ret;
+
+	if (addr >= high_memory) {
+		struct page *p1;
+
+		if (((size_t)addr & PAGE_MASK) !=
+			((size_t)(addr + len - 1) & PAGE_MASK))
+			goto out_copy;
+		p1 = vmalloc_to_page(addr);
+		if (!p1)
+			goto out_copy;
+		addr = page_address(p1) + ((size_t)addr & ~PAGE_MASK);
+	}
+
+	dma_addr = dma_map_single(&info->pdev->dev, addr, len, dir);
+	if (dma_mapping_error(&info->pdev->dev, dma_addr)) {
+		dev_err(&info->pdev->dev,
+			"Couldn't DMA map a %d byte buffer\n", len);
+		goto out_copy;
+	}
+
+	ret = omap_nand_dma_start(info, dma_addr, len, is_write);
+	if (ret)
+		/* PFPW engine is busy, use cpu copy method */
+		goto out_copy_unmap;
+
+	omap_nand_dma_finish(info);
 
 	dma_unmap_single(&info->pdev->dev, dma_addr, len, dir);
 	return 0;
@@ -1023,6 +1070,302 @@ static int omap3_correct_data_bch(struct mtd_info *mtd, u_char *data,
 	return count;
 }
 
+/*
+ * Pipelined page reads: within an mtd read spanning several pages,
+ * omap3_read_page_bch() sends the read command for the next page as soon
+ * as the current page and its oob are in, corrects the current page while
+ * the chip loads the next one from the array, and leaves the first sector
+ * of the next page coming in by DMA. omap_nand_command() then skips the
+ * read command the NAND core issues for that page, and cancels the read
+ * ahead before any other command.
+ */
+static bool pipeline = true;
+module_param(pipeline, bool, 0444);
+MODULE_PARM_DESC(pipeline, "Overlap BCH correction with the next page read in DMA mode");
+
+/**
+ * omap3_read_ahead_cmd - Send the read command for a page without waiting
+ * @mtd: MTD device structure
+ * @page: page to load into the chip
+ */
+static void omap3_read_ahead_cmd(struct mtd_info *mtd, int page)
+{
+	struct nand_chip *chip = mtd->priv;
+	int ctrl = NAND_CTRL_CHANGE | NAND_NCE | NAND_ALE;
+
+	chip->cmd_ctrl(mtd, NAND_CMD_READ0,
+		       NAND_NCE | NAND_CLE | NAND_CTRL_CHANGE);
+	chip->cmd_ctrl(mtd, 0, ctrl);
+	ctrl &= ~NAND_CTRL_CHANGE;
+	chip->cmd_ctrl(mtd, 0, ctrl);
+	chip->cmd_ctrl(mtd, page, ctrl);
+	chip->cmd_ctrl(mtd, page >> 8, NAND_NCE | NAND_ALE);
+	/* One more address cycle for devices > 128MiB */
+	if (chip->chipsize > (128 << 20))
+		chip->cmd_ctrl(mtd, page >> 16, NAND_NCE | NAND_ALE);
+	chip->cmd_ctrl(mtd, NAND_CMD_READSTART,
+		       NAND_NCE | NAND_CLE | NAND_CTRL_CHANGE);
+	chip->cmd_ctrl(mtd, NAND_CMD_NONE, NAND_NCE | NAND_CTRL_CHANGE);
+}
+
+/**
+ * omap3_read_ahead_wait - Wait for the chip to load the page read ahead
+ * @mtd: MTD device structure
+ * @start: time the read command was sent
+ */
+static void omap3_read_ahead_wait(struct mtd_info *mtd, ktime_t start)
+{
+	struct nand_chip *chip = mtd->priv;
+	s64 left;
+
+	if (chip->dev_ready) {
+		ndelay(100);
+		nand_wait_ready(mtd);
+		return;
+	}
+
+	/* the chip delay counts from the command, not from now */
+	left = chip->chip_delay - ktime_us_delta(ktime_get(), start);
+	if (left > 0)
+		udelay(left);
+}
+
+/**
+ * omap3_read_ahead_start - Start reading the first sector of a page
+ * @mtd: MTD device structure
+ * @page: page loaded into the chip by omap3_read_ahead_cmd()
+ */
+static void omap3_read_ahead_start(struct mtd_info *mtd, int page)
+{
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+						   mtd);
+	struct device *dev = &info->pdev->dev;
+	int len = info->nand.ecc.size;
+
+	info->nand.ecc.hwctl(mtd, NAND_ECC_READ);
+
+	info->ra_by_dma = false;
+	info->ra_dma = dma_map_single(dev, info->ra_buf, len, DMA_FROM_DEVICE);
+	if (!dma_mapping_error(dev, info->ra_dma)) {
+		if (!omap_nand_dma_start(info, info->ra_dma, len, 0x0))
+			info->ra_by_dma = true;
+		else
+			dma_unmap_single(dev, info->ra_dma, len,
+					 DMA_FROM_DEVICE);
+	}
+
+	/* PFPW engine is busy, use cpu copy method */
+	if (!info->ra_by_dma)
+		omap_read_buf_pref(mtd, info->ra_buf, len);
+
+	info->ra_page = page;
+}
+
+/**
+ * omap3_read_ahead_finish - Complete the sector read ahead
+ * @mtd: MTD device structure
+ * @buf: where the sector goes, NULL to drop it
+ * @ecc_calc: ecc computed by the hardware over the sector
+ */
+static void omap3_read_ahead_finish(struct mtd_info *mtd, u_char *buf,
+				    u_char *ecc_calc)
+{
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+						   mtd);
+	int len = info->nand.ecc.size;
+
+	if (info->ra_by_dma) {
+		omap_nand_dma_finish(info);
+		dma_unmap_single(&info->pdev->dev, info->ra_dma, len,
+				 DMA_FROM_DEVICE);
+	}
+
+	/* this also releases the ecc engine */
+	info->nand.ecc.calculate(mtd, info->ra_buf, ecc_calc);
+	if (buf)
+		memcpy(buf, info->ra_buf, len);
+
+	info->ra_page = -1;
+}
+
+/**
+ * omap_nand_command - Send a command, unless it reads the page read ahead
+ * @mtd: MTD device structure
+ * @command: command to device
+ * @column: column address
+ * @page_addr: page address
+ */
+static void omap_nand_command(struct mtd_info *mtd, unsigned command,
+			      int column, int page_addr)
+{
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+						   mtd);
+
+	if (info->ra_page >= 0) {
+		if (command == NAND_CMD_READ0 && column == 0 &&
+		    page_addr == info->ra_page)
+			return;
+		omap3_read_ahead_finish(mtd, NULL,
+					info->nand.buffers->ecccalc);
+	}
+
+	info->nand_cmdfunc(mtd, command, column, page_addr);
+}
+
+/**
+ * omap3_read_page_bch - hardware BCH page read, pipelined with the next page
+ * @mtd: MTD device structure
+ * @chip: NAND chip structure
+ * @buf: buffer to store read data
+ * @oob_required: caller requires OOB data read to chip->oob_poi
+ * @page: page number to read
+ *
+ * Same as nand_read_page_hwecc(), except that within a multi page read
+ * the next page is loaded into the chip while this one is corrected.
+ */
+static int omap3_read_page_bch(struct mtd_info *mtd, struct nand_chip *chip,
+			       uint8_t *buf, int oob_required, int page)
+{
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+						   mtd);
+	int i = 0, eccsize = chip->ecc.size;
+	int eccbytes = chip->ecc.bytes;
+	int eccsteps = chip->ecc.steps;
+	uint8_t *p = buf;
+	uint8_t *ecc_calc = chip->buffers->ecccalc;
+	uint8_t *ecc_code = chip->buffers->ecccode;
+	uint32_t *eccpos = chip->ecc.layout->eccpos;
+	unsigned int max_bitflips = 0;
+	ktime_t start;
+	bool ahead;
+
+	/* the first sector was read ahead with the previous page */
+	if (info->ra_page == page) {
+		omap3_read_ahead_finish(mtd, p, ecc_calc);
+		eccsteps--;
+		i += eccbytes;
+		p += eccsize;
+	}
+
+	for (; eccsteps; eccsteps--, i += eccbytes, p += eccsize) {
+		chip->ecc.hwctl(mtd, NAND_ECC_READ);
+		chip->read_buf(mtd, p, eccsize);
+		chip->ecc.calculate(mtd, p, &ecc_calc[i]);
+	}
+	chip->read_buf(mtd, chip->oob_poi, mtd->oobsize);
+
+	for (i = 0; i < chip->ecc.total; i++)
+		ecc_code[i] = chip->oob_poi[eccpos[i]];
+
+	/*
+	 * The next page is part of this read, the chip can load it now. Not if
+	 * the core has it cached though: it would never ask for it then, and
+	 * the read ahead would be left running after the mtd read returns.
+	 */
+	ahead = info->read_task == current && page < info->read_last &&
+		((page + 1) & chip->pagemask) && page + 1 != chip->pagebuf;
+	if (ahead) {
+		omap3_read_ahead_cmd(mtd, page + 1);
+		start = ktime_get();
+	}
+
+	eccsteps = chip->ecc.steps;
+	p = buf;
+
+	for (i = 0 ; eccsteps; eccsteps--, i += eccbytes, p += eccsize) {
+		int stat;
+
+		stat = chip->ecc.correct(mtd, p, &ecc_code[i], &ecc_calc[i]);
+		if (stat < 0) {
+			mtd->ecc_stats.failed++;
+		} else {
+			mtd->ecc_stats.corrected += stat;
+			max_bitflips = max_t(unsigned int, max_bitflips, stat);
+		}
+	}
+
+	if (ahead) {
+		omap3_read_ahead_wait(mtd, start);
+		omap3_read_ahead_start(mtd, page + 1);
+	}
+
+	return max_bitflips;
+}
+
+/**
+ * omap_nand_read - mtd read, noting the pages it covers for read ahead
+ * @mtd: MTD device structure
+ * @from: offset to read from
+ * @len: number of bytes to read
+ * @retlen: pointer to variable to store the number of read bytes
+ * @buf: the databuffer to put data
+ */
+static int omap_nand_read(struct mtd_info *mtd, loff_t from, size_t len,
+			  size_t *retlen, u_char *buf)
+{
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+						   mtd);
+	int ret;
+
+	mutex_lock(&info->read_lock);
+	info->read_task = current;
+	info->read_last = (from + len - 1) >> info->nand.page_shift;
+	ret = info->nand_read(mtd, from, len, retlen, buf);
+	info->read_task = NULL;
+	mutex_unlock(&info->read_lock);
+
+	return ret;
+}
+
+/**
+ * omap3_init_bch_pipeline - Set up pipelined page reads
+ * @mtd: MTD device structure
+ *
+ * Only for single chip, large page devices read in DMA mode. Must run
+ * between nand_scan_ident() and nand_scan_tail().
+ */
+static void omap3_init_bch_pipeline(struct mtd_info *mtd)
+{
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+						   mtd);
+
+	info->ra_page = -1;
+	if (!pipeline || info->nand.read_buf != omap_read_buf_dma_pref ||
+	    info->nand.numchips != 1 || mtd->writesize <= 512)
+		return;
+
+	info->ra_buf = kmalloc(info->nand.ecc.size, GFP_KERNEL);
+	if (!info->ra_buf)
+		return;
+
+	mutex_init(&info->read_lock);
+	info->nand_cmdfunc     = info->nand.cmdfunc;
+	info->nand.cmdfunc     = omap_nand_command;
+	info->nand.ecc.read_page = omap3_read_page_bch;
+	/*
+	 * omap3_read_page_bch() waits for the chip itself. Large page and ONFI
+	 * chips have this set already, it is only made explicit here.
+	 */
+	info->nand.options |= NAND_NO_READRDY;
+}
+
+/**
+ * omap3_init_bch_pipeline_tail - Hook the mtd read for pipelined page reads
+ * @mtd: MTD device structure
+ */
+static void omap3_init_bch_pipeline_tail(struct mtd_info *mtd)
+{
+	struct omap_nand_info *info = container_of(mtd, struct omap_nand_info,
+						   mtd);
+
+	if (!info->ra_buf)
+		return;
+
+	info->nand_read = mtd->_read;
+	mtd->_read = omap_nand_read;
+	pr_info("pipelined BCH page reads enabled\n");
+}
+
 /**
  * omap3_free_bch - Release BCH ecc resources
  * @mtd: MTD device structure
@@ -1035,6 +1378,8 @@ static void omap3_free_bch(struct mtd_info *mtd)
 		free_bch(info->bch);
 		info->bch = NULL;
 	}
+	kfree(info->ra_buf);
+	info->ra_buf = NULL;
 }
 
 /**
@@ -1137,6 +1482,8 @@ static int omap3_init_bch_tail(struct mtd_info *mtd)
 
 	if (!(info->nand.options & NAND_BUSWIDTH_16))
 		info->nand.badblock_pattern = &bb_descrip_flashbased;
+
+	omap3_init_bch_pipeline(mtd);
 	return 0;
 fail:
 	omap3_free_bch(mtd);
@@ -1153,6 +1500,9 @@ static int omap3_init_bch_tail(struct mtd_info *mtd)
 {
 	return -1;
 }
+static void omap3_init_bch_pipeline_tail(struct mtd_info *mtd)
+{
+}
 static void omap3_free_bch(struct mtd_info *mtd)
 {
 }
@@ -1350,6 +1700,8 @@ static int __devinit omap_nand_probe(struct platform_device *pdev)
 		goto out_release_mem_region;
 	}
 
+	omap3_init_bch_pipeline_tail(&info->mtd);
+
 	mtd_device_parse_register(&info->mtd, NULL, NULL, pdata->parts,
 				  pdata->nr_parts);
 
@@ -1122,6 +1122,37 @@ static int late_analysis(struct ubi_device *ubi, struct ubi_attach_info *ai)
 	return 0;
 }
 
+/**
+ * alloc_ai - allocate attaching information.
+ *
+ * This function allocates and initializes an empty &struct ubi_attach_info
+ * object. Returns %NULL if there is no memory.
+ */
+static struct ubi_attach_info *alloc_ai(void)
+{
+	struct ubi_attach_info *ai;
+
+	ai = kzalloc(sizeof(struct ubi_attach_info), GFP_KERNEL);
+	if (!ai)
+		return NULL;
+
+	INIT_LIST_HEAD(&ai->corr);
+	INIT_LIST_HEAD(&ai->free);
+	INIT_LIST_HEAD(&ai->erase);
+	INIT_LIST_HEAD(&ai->alien);
+	ai->volumes = RB_ROOT;
+
+	ai->aeb_slab_cache = kmem_cache_create("ubi_aeb_slab_cache",
+					       sizeof(struct ubi_ainf_peb),
+					       0, 0, NULL);
+	if (!ai->aeb_slab_cache) {
+		kfree(ai);
+		return NULL;
+	}
+
+	return ai;
+}
+
 /**
  * scan_all - scan entire MTD device.
  * @ubi: UBI device description object
@@ -1138,23 +1169,11 @@ static struct ubi_attach_info *scan_all(struct ubi_device *ubi)
 	struct ubi_ainf_peb *aeb;
 	struct ubi_attach_info *ai;
 
-	ai = kzalloc(sizeof(struct ubi_attach_info), GFP_KERNEL);
+	ai = alloc_ai();
 	if (!ai)
 		return ERR_PTR(-ENOMEM);
 
-	INIT_LIST_HEAD(&ai->corr);
-	INIT_LIST_HEAD(&ai->free);
-	INIT_LIST_HEAD(&ai->erase);
-	INIT_LIST_HEAD(&ai->alien);
-	ai->volumes = RB_ROOT;
-
 	err = -ENOMEM;
-	ai->aeb_slab_cache = kmem_cache_create("ubi_aeb_slab_cache",
-					       sizeof(struct ubi_ainf_peb),
-					       0, 0, NULL);
-	if (!ai->aeb_slab_cache)
-		goto out_ai;
-
 	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
 	if (!ech)
 		goto out_ai;
@@ -1223,6 +1242,85 @@ out_ai:
 	return ERR_PTR(err);
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * scan_fast - attach an MTD device using the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function builds the attaching information from the fastmap stored on
+ * the flash. Returns the attaching information in case of success and %NULL
+ * if there is no usable fastmap, in which case the caller has to scan the
+ * entire device.
+ */
+static struct ubi_attach_info *scan_fast(struct ubi_device *ubi)
+{
+	int err;
+	struct ubi_attach_info *ai;
+
+	ai = alloc_ai();
+	if (!ai)
+		return NULL;
+
+	err = ubi_scan_fastmap(ubi, ai);
+	if (!err)
+		return ai;
+
+	ubi_destroy_ai(ai);
+	if (err == UBI_BAD_FASTMAP)
+		ubi_warn("bad fastmap, scanning the entire MTD device");
+	else if (err < 0)
+		ubi_warn("cannot read fastmap, error %d, scanning the entire "
+			 "MTD device", err);
+	return NULL;
+}
+
+/**
+ * erase_stale_fastmap - erase fastmap superblocks found by full scanning.
+ * @ubi: UBI device description object
+ * @ai: attaching information
+ *
+ * A fastmap superblock found by full scanning was not used, and it does not
+ * describe the device any more once the device changes. It is erased right
+ * away instead of by the WL sub-system later, so that it cannot be picked up
+ * by the next attach. Returns zero in case of success and a negative error
+ * code in case of failure.
+ */
+static int erase_stale_fastmap(struct ubi_device *ubi,
+			       struct ubi_attach_info *ai)
+{
+	int err;
+	struct ubi_ainf_peb *aeb, *aeb_tmp;
+
+	if (ubi->ro_mode)
+		return 0;
+
+	list_for_each_entry_safe(aeb, aeb_tmp, &ai->erase, u.list) {
+		if (aeb->vol_id != UBI_FM_SB_VOLUME_ID)
+			continue;
+
+		err = early_erase_peb(ubi, ai, aeb->pnum, aeb->ec + 1);
+		if (err)
+			return err;
+
+		aeb->ec += 1;
+		list_move_tail(&aeb->u.list, &ai->free);
+	}
+
+	return 0;
+}
+#else
+static inline struct ubi_attach_info *scan_fast(struct ubi_device *ubi)
+{
+	return NULL;
+}
+
+static inline int erase_stale_fastmap(struct ubi_device *ubi,
+				      struct ubi_attach_info *ai)
+{
+	return 0;
+}
+#endif
+
 /**
  * ubi_attach - attach an MTD device.
  * @ubi: UBI device descriptor
@@ -1235,9 +1333,16 @@ int ubi_attach(struct ubi_device *ubi)
 	int err;
 	struct ubi_attach_info *ai;
 
-	ai = scan_all(ubi);
-	if (IS_ERR(ai))
-		return PTR_ERR(ai);
+	ai = scan_fast(ubi);
+	if (!ai) {
+		ai = scan_all(ubi);
+		if (IS_ERR(ai))
+			return PTR_ERR(ai);
+
+		err = erase_stale_fastmap(ubi, ai);
+		if (err)
+			goto out_ai;
+	}
 
 	ubi->bad_peb_count = ai->bad_peb_count;
 	ubi->good_peb_count = ubi->peb_count - ubi->bad_peb_count;
@@ -1258,6 +1363,7 @@ int ubi_attach(struct ubi_device *ubi)
 	if (err)
 		goto out_wl;
 
+	ubi_fastmap_init(ubi);
 	ubi_destroy_ai(ai);
 	return 0;
 
@@ -1268,6 +1374,7 @@ out_vtbl:
 	vfree(ubi->vtbl);
 out_ai:
 	ubi_destroy_ai(ai);
+	ubi_fastmap_close(ubi);
 	return err;
 }
 
@@ -40,6 +40,7 @@
 #include <linux/kthread.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
+#include <linux/reboot.h>
 #include "ubi.h"
 
 /* Maximum length of the 'mtd=' parameter */
@@ -103,6 +104,9 @@ static struct class_attribute ubi_version =
 
 static ssize_t dev_attribute_show(struct device *dev,
 				  struct device_attribute *attr, char *buf);
+static ssize_t dev_attribute_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count);
 
 /* UBI device attributes (correspond to files in '/<sysfs>/class/ubi/ubiX') */
 static struct device_attribute dev_eraseblock_size =
@@ -127,6 +131,28 @@ static struct device_attribute dev_bgt_enabled =
 	__ATTR(bgt_enabled, S_IRUGO, dev_attribute_show, NULL);
 static struct device_attribute dev_mtd_num =
 	__ATTR(mtd_num, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_bgt_rate_limit =
+	__ATTR(bgt_rate_limit, S_IRUGO | S_IWUSR, dev_attribute_show,
+	       dev_attribute_store);
+static struct device_attribute dev_bgt_idle_ms =
+	__ATTR(bgt_idle_ms, S_IRUGO | S_IWUSR, dev_attribute_show,
+	       dev_attribute_store);
+static struct device_attribute dev_erase_works_pending =
+	__ATTR(erase_works_pending, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_erase_works_done =
+	__ATTR(erase_works_done, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_scrub_works_pending =
+	__ATTR(scrub_works_pending, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_scrub_works_done =
+	__ATTR(scrub_works_done, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_fm_anchor_works_pending =
+	__ATTR(fm_anchor_works_pending, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_fm_anchor_works_done =
+	__ATTR(fm_anchor_works_done, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_wl_works_pending =
+	__ATTR(wl_works_pending, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_wl_works_done =
+	__ATTR(wl_works_done, S_IRUGO, dev_attribute_show, NULL);
 
 /**
  * ubi_volume_notify - send a volume change notification.
@@ -351,6 +377,28 @@ static ssize_t dev_attribute_show(struct device *dev,
 		ret = sprintf(buf, "%d\n", ubi->thread_enabled);
 	else if (attr == &dev_mtd_num)
 		ret = sprintf(buf, "%d\n", ubi->mtd->index);
+	else if (attr == &dev_bgt_rate_limit)
+		ret = sprintf(buf, "%u\n", ubi->bgt_rate_limit);
+	else if (attr == &dev_bgt_idle_ms)
+		ret = sprintf(buf, "%u\n", ubi->bgt_idle_ms);
+	else if (attr == &dev_erase_works_pending)
+		ret = sprintf(buf, "%d\n", ubi->works_pending[UBI_WORK_ERASE]);
+	else if (attr == &dev_erase_works_done)
+		ret = sprintf(buf, "%lu\n", ubi->works_done[UBI_WORK_ERASE]);
+	else if (attr == &dev_scrub_works_pending)
+		ret = sprintf(buf, "%d\n", ubi->works_pending[UBI_WORK_SCRUB]);
+	else if (attr == &dev_scrub_works_done)
+		ret = sprintf(buf, "%lu\n", ubi->works_done[UBI_WORK_SCRUB]);
+	else if (attr == &dev_fm_anchor_works_pending)
+		ret = sprintf(buf, "%d\n",
+			      ubi->works_pending[UBI_WORK_FM_ANCHOR]);
+	else if (attr == &dev_fm_anchor_works_done)
+		ret = sprintf(buf, "%lu\n",
+			      ubi->works_done[UBI_WORK_FM_ANCHOR]);
+	else if (attr == &dev_wl_works_pending)
+		ret = sprintf(buf, "%d\n", ubi->works_pending[UBI_WORK_WL]);
+	else if (attr == &dev_wl_works_done)
+		ret = sprintf(buf, "%lu\n", ubi->works_done[UBI_WORK_WL]);
 	else
 		ret = -EINVAL;
 
@@ -358,6 +406,40 @@ static ssize_t dev_attribute_show(struct device *dev,
 	return ret;
 }
 
+/* "Store" method for files in '/<sysfs>/class/ubi/ubiX/' */
+static ssize_t dev_attribute_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int err;
+	unsigned int val;
+	struct ubi_device *ubi;
+
+	err = kstrtouint(buf, 0, &val);
+	if (err)
+		return err;
+
+	/* See the comment in 'dev_attribute_show()' */
+	ubi = container_of(dev, struct ubi_device, dev);
+	ubi = ubi_get_device(ubi->ubi_num);
+	if (!ubi)
+		return -ENODEV;
+
+	if (attr == &dev_bgt_rate_limit)
+		ubi->bgt_rate_limit = val;
+	else if (attr == &dev_bgt_idle_ms)
+		ubi->bgt_idle_ms = val;
+	else
+		err = -EINVAL;
+
+	/* The background thread may be waiting with the old settings */
+	if (!err)
+		ubi_wl_wake_bgt(ubi);
+
+	ubi_put_device(ubi);
+	return err ? err : count;
+}
+
 static void dev_release(struct device *dev)
 {
 	struct ubi_device *ubi = container_of(dev, struct ubi_device, dev);
@@ -418,6 +500,36 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
 	if (err)
 		return err;
 	err = device_create_file(&ubi->dev, &dev_mtd_num);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_bgt_rate_limit);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_bgt_idle_ms);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_erase_works_pending);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_erase_works_done);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_scrub_works_pending);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_scrub_works_done);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_fm_anchor_works_pending);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_fm_anchor_works_done);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_wl_works_pending);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_wl_works_done);
 	return err;
 }
 
@@ -427,6 +539,16 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
  */
 static void ubi_sysfs_close(struct ubi_device *ubi)
 {
+	device_remove_file(&ubi->dev, &dev_wl_works_done);
+	device_remove_file(&ubi->dev, &dev_wl_works_pending);
+	device_remove_file(&ubi->dev, &dev_fm_anchor_works_done);
+	device_remove_file(&ubi->dev, &dev_fm_anchor_works_pending);
+	device_remove_file(&ubi->dev, &dev_scrub_works_done);
+	device_remove_file(&ubi->dev, &dev_scrub_works_pending);
+	device_remove_file(&ubi->dev, &dev_erase_works_done);
+	device_remove_file(&ubi->dev, &dev_erase_works_pending);
+	device_remove_file(&ubi->dev, &dev_bgt_idle_ms);
+	device_remove_file(&ubi->dev, &dev_bgt_rate_limit);
 	device_remove_file(&ubi->dev, &dev_mtd_num);
 	device_remove_file(&ubi->dev, &dev_bgt_enabled);
 	device_remove_file(&ubi->dev, &dev_min_io_size);
@@ -882,6 +1004,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	mutex_init(&ubi->buf_mutex);
 	mutex_init(&ubi->ckvol_mutex);
 	mutex_init(&ubi->device_mutex);
+	mutex_init(&ubi->fm_mutex);
+	init_rwsem(&ubi->fm_sem);
 	spin_lock_init(&ubi->volumes_lock);
 
 	ubi_msg("attaching mtd%d to ubi%d", mtd->index, ubi_num);
@@ -968,6 +1092,7 @@ out_uif:
 	uif_close(ubi);
 out_detach:
 	ubi_wl_close(ubi);
+	ubi_fastmap_close(ubi);
 	ubi_free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
 out_debugging:
@@ -1031,6 +1156,9 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
 
+	/* Save the attaching information for the next attach */
+	ubi_update_fastmap(ubi);
+
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
 	 * from freeing the @ubi object.
@@ -1040,6 +1168,7 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	ubi_debugfs_exit_dev(ubi);
 	uif_close(ubi);
 	ubi_wl_close(ubi);
+	ubi_fastmap_close(ubi);
 	ubi_free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
 	put_mtd_device(ubi->mtd);
@@ -1118,6 +1247,32 @@ static struct mtd_info * __init open_mtd_device(const char *mtd_dev)
 	return mtd;
 }
 
+/**
+ * ubi_reboot_notifier - write the fastmaps before the system goes down.
+ * @nb: the notifier block
+ * @event: reboot event
+ * @unused: unused
+ *
+ * UBI devices which are still attached at reboot are never detached, so this
+ * is the last chance to save their attaching information.
+ */
+static int ubi_reboot_notifier(struct notifier_block *nb, unsigned long event,
+			       void *unused)
+{
+	int i;
+
+	mutex_lock(&ubi_devices_mutex);
+	for (i = 0; i < UBI_MAX_DEVICES; i++)
+		if (ubi_devices[i])
+			ubi_update_fastmap(ubi_devices[i]);
+	mutex_unlock(&ubi_devices_mutex);
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ubi_reboot_nb = {
+	.notifier_call = ubi_reboot_notifier,
+};
+
 static int __init ubi_init(void)
 {
 	int err, i, k;
@@ -1161,6 +1316,7 @@ static int __init ubi_init(void)
 	if (err)
 		goto out_slab;
 
+	register_reboot_notifier(&ubi_reboot_nb);
 
 	/* Attach MTD devices */
 	for (i = 0; i < mtd_devs; i++) {
@@ -1210,6 +1366,7 @@ out_detach:
 			ubi_detach_mtd_dev(ubi_devices[k]->ubi_num, 1);
 			mutex_unlock(&ubi_devices_mutex);
 		}
+	unregister_reboot_notifier(&ubi_reboot_nb);
 	ubi_debugfs_exit();
 out_slab:
 	kmem_cache_destroy(ubi_wl_entry_slab);
@@ -1235,6 +1392,7 @@ static void __exit ubi_exit(void)
 			ubi_detach_mtd_dev(ubi_devices[i]->ubi_num, 1);
 			mutex_unlock(&ubi_devices_mutex);
 		}
+	unregister_reboot_notifier(&ubi_reboot_nb);
 	ubi_debugfs_exit();
 	kmem_cache_destroy(ubi_wl_entry_slab);
 	misc_deregister(&ubi_ctrl_cdev);
@@ -0,0 +1,948 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI fastmap.
+ *
+ * Attaching an MTD device normally means reading the EC and VID headers of
+ * every physical eraseblock, so the attach time grows linearly with the flash
+ * size. The fastmap is a snapshot of the attaching information: the state and
+ * erase counter of every PEB and the EBA table of every volume. It is written
+ * to a few PEBs when the device is detached or the system is shut down, and
+ * the next attach reads those instead of scanning the whole device.
+ *
+ * The fastmap is only correct as long as nothing else on the flash changes.
+ * Instead of keeping it up to date, UBI invalidates it: the I/O sub-system
+ * calls 'ubi_fastmap_check()' before every write and erase, and the first
+ * change after the fastmap was written or attached from erases the fastmap
+ * superblock. So if the system crashes, there is no fastmap and UBI falls back
+ * to full scanning, which handles unclean reboots as usual.
+ *
+ * While the fastmap is written, the EBA sub-system is blocked with
+ * @ubi->fm_sem and the WL sub-system with @ubi->work_sem, so the snapshot is
+ * consistent. The fastmap PEBs are taken out of the WL sub-system and are
+ * owned by the fastmap code until the device is detached. They are reused
+ * every time the fastmap is written, and swapped with less worn out free PEBs
+ * when their erase counters get too high.
+ *
+ * Enough PEBs for the largest possible fastmap are reserved when the device
+ * is attached, before the auto-resize volume grows, and the anchor is taken
+ * right away. If none of the first %UBI_FM_MAX_START PEBs is free, which is
+ * the usual case on a device freshly made with ubiformat, the WL sub-system
+ * moves one of them away.
+ *
+ * See the comment at &struct ubi_fm_sb for the on-flash format.
+ */
+
+#include <linux/crc32.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/math64.h>
+#include "ubi.h"
+
+/**
+ * add_aeb - add a physical eraseblock to a list of the attaching information.
+ * @ai: attaching information
+ * @list: the list to add to
+ * @pnum: physical eraseblock number
+ * @ec: erase counter of the physical eraseblock
+ *
+ * Returns zero in case of success and %-ENOMEM in case of failure.
+ */
+static int add_aeb(struct ubi_attach_info *ai, struct list_head *list,
+		   int pnum, int ec)
+{
+	struct ubi_ainf_peb *aeb;
+
+	aeb = kmem_cache_alloc(ai->aeb_slab_cache, GFP_KERNEL);
+	if (!aeb)
+		return -ENOMEM;
+
+	aeb->pnum = pnum;
+	aeb->ec = ec;
+	aeb->vol_id = UBI_UNKNOWN;
+	aeb->lnum = UBI_UNKNOWN;
+	aeb->scrub = aeb->copy_flag = 0;
+	aeb->sqnum = 0;
+	list_add_tail(&aeb->u.list, list);
+	return 0;
+}
+
+/**
+ * find_anchor - find the fastmap superblock.
+ * @ubi: UBI device description object
+ * @vid_hdr: VID header buffer to use
+ *
+ * This function looks for the fastmap superblock PEB in the first
+ * %UBI_FM_MAX_START PEBs. Returns its number, %-ENOENT if there is none, or a
+ * negative error code in case of failure.
+ */
+static int find_anchor(struct ubi_device *ubi, struct ubi_vid_hdr *vid_hdr)
+{
+	int pnum, err, anchor = -ENOENT;
+	unsigned long long sqnum, max_sqnum = 0;
+
+	for (pnum = 0; pnum < UBI_FM_MAX_START && pnum < ubi->peb_count;
+	     pnum++) {
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		if (err)
+			continue;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		if (err < 0)
+			return err;
+		if (err && err != UBI_IO_BITFLIPS)
+			continue;
+		if (be32_to_cpu(vid_hdr->vol_id) != UBI_FM_SB_VOLUME_ID)
+			continue;
+
+		sqnum = be64_to_cpu(vid_hdr->sqnum);
+		dbg_bld("fastmap superblock at PEB %d, sqnum %llu",
+			pnum, sqnum);
+		if (anchor < 0 || sqnum > max_sqnum) {
+			anchor = pnum;
+			max_sqnum = sqnum;
+		}
+	}
+
+	return anchor;
+}
+
+/**
+ * read_fastmap - read the fastmap from the flash.
+ * @ubi: UBI device description object
+ * @anchor: the fastmap superblock PEB
+ * @vid_hdr: VID header buffer to use
+ * @fm_buf: the fastmap is returned here
+ *
+ * This function reads all blocks of the fastmap and checks its CRC. The
+ * buffer returned in @fm_buf starts with the fastmap superblock and has to be
+ * freed with 'vfree()'. Returns zero in case of success, %UBI_BAD_FASTMAP if
+ * the fastmap is not valid, and a negative error code in case of failure.
+ */
+static int read_fastmap(struct ubi_device *ubi, int anchor,
+			struct ubi_vid_hdr *vid_hdr, struct ubi_fm_sb **fm_buf)
+{
+	int i, err, size, used_blocks, len;
+	uint32_t crc;
+	struct ubi_fm_sb *sb;
+	void *buf = NULL;
+
+	sb = kmalloc(sizeof(struct ubi_fm_sb), GFP_KERNEL);
+	if (!sb)
+		return -ENOMEM;
+
+	err = ubi_io_read_data(ubi, sb, anchor, 0, sizeof(struct ubi_fm_sb));
+	if (err && err != UBI_IO_BITFLIPS)
+		goto out;
+
+	size = be32_to_cpu(sb->size);
+	used_blocks = be32_to_cpu(sb->used_blocks);
+	err = UBI_BAD_FASTMAP;
+	if (be32_to_cpu(sb->magic) != UBI_FM_SB_MAGIC) {
+		ubi_err("bad fastmap superblock magic %#08x",
+			be32_to_cpu(sb->magic));
+		goto out;
+	}
+	if (sb->version != UBI_FM_FMT_VERSION) {
+		ubi_err("unsupported fastmap version %d", sb->version);
+		goto out;
+	}
+	if (used_blocks < 1 || used_blocks > UBI_FM_MAX_BLOCKS ||
+	    be32_to_cpu(sb->block_loc[0]) != anchor) {
+		ubi_err("bad fastmap block list");
+		goto out;
+	}
+	if (be32_to_cpu(sb->peb_count) != ubi->peb_count) {
+		ubi_err("fastmap is for %d PEBs, but there are %d",
+			be32_to_cpu(sb->peb_count), ubi->peb_count);
+		goto out;
+	}
+	if (size <= 0 || size < sizeof(struct ubi_fm_sb) +
+		   ubi->peb_count * sizeof(struct ubi_fm_peb) ||
+	    size > used_blocks * ubi->leb_size) {
+		ubi_err("bad fastmap size %d", size);
+		goto out;
+	}
+
+	err = -ENOMEM;
+	buf = vmalloc(size);
+	if (!buf)
+		goto out;
+
+	for (i = 0; i * ubi->leb_size < size; i++) {
+		int pnum = be32_to_cpu(sb->block_loc[i]);
+
+		err = UBI_BAD_FASTMAP;
+		if (pnum < 0 || pnum >= ubi->peb_count)
+			goto out;
+
+		if (i > 0) {
+			err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+			if (err < 0)
+				goto out;
+			if ((err && err != UBI_IO_BITFLIPS) ||
+			    be32_to_cpu(vid_hdr->vol_id) !=
+						UBI_FM_DATA_VOLUME_ID ||
+			    be32_to_cpu(vid_hdr->lnum) != i) {
+				ubi_err("bad fastmap block %d at PEB %d",
+					i, pnum);
+				err = UBI_BAD_FASTMAP;
+				goto out;
+			}
+		}
+
+		len = min_t(int, size - i * ubi->leb_size, ubi->leb_size);
+		err = ubi_io_read_data(ubi, buf + i * ubi->leb_size, pnum, 0,
+				       len);
+		if (err && err != UBI_IO_BITFLIPS)
+			goto out;
+	}
+
+	kfree(sb);
+	sb = buf;
+	crc = be32_to_cpu(sb->data_crc);
+	sb->data_crc = 0;
+	if (crc32(UBI_CRC32_INIT, buf, size) != crc) {
+		ubi_err("bad fastmap CRC");
+		vfree(buf);
+		return UBI_BAD_FASTMAP;
+	}
+
+	*fm_buf = buf;
+	return 0;
+
+out:
+	vfree(buf);
+	kfree(sb);
+	/* Uncorrectable ECC errors mean a damaged fastmap, not a failure */
+	return err == -EBADMSG ? UBI_BAD_FASTMAP : err;
+}
+
+/**
+ * ubi_scan_fastmap - attach an MTD device using the fastmap.
+ * @ubi: UBI device description object
+ * @ai: attaching information to fill
+ *
+ * This function reads the fastmap and builds the attaching information from
+ * it. Returns zero in case of success, %UBI_NO_FASTMAP if there is no
+ * fastmap, %UBI_BAD_FASTMAP if the fastmap is not usable, and a negative error
+ * code in case of failure. In case of failure @ai has to be destroyed by the
+ * caller.
+ */
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_attach_info *ai)
+{
+	int i, err, anchor, size, used_blocks, vol_count, fm_blocks = 0;
+	int pnum, ec, state;
+	void *buf, *end;
+	struct ubi_fm_sb *sb = NULL;
+	struct ubi_fm_peb *fmpeb;
+	struct ubi_fm_volhdr *fmvh;
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_fastmap_layout *fm;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		return -ENOMEM;
+
+	anchor = find_anchor(ubi, vid_hdr);
+	if (anchor < 0) {
+		err = anchor == -ENOENT ? UBI_NO_FASTMAP : anchor;
+		goto out_vid;
+	}
+
+	ubi_msg("attaching from fastmap at PEB %d", anchor);
+	err = read_fastmap(ubi, anchor, vid_hdr, &sb);
+	if (err)
+		goto out_vid;
+
+	buf = sb;
+	size = be32_to_cpu(sb->size);
+	end = buf + size;
+	used_blocks = be32_to_cpu(sb->used_blocks);
+	vol_count = be32_to_cpu(sb->vol_count);
+	fmpeb = buf + sizeof(struct ubi_fm_sb);
+	err = UBI_BAD_FASTMAP;
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		ec = be32_to_cpu(fmpeb[pnum].ec);
+		state = fmpeb[pnum].state;
+
+		if (state != UBI_FM_PEB_BAD) {
+			if (ec < 0 || ec >= UBI_MAX_ERASECOUNTER) {
+				ubi_err("bad EC %d of PEB %d", ec, pnum);
+				goto out_sb;
+			}
+			ai->ec_sum += ec;
+			ai->ec_count += 1;
+			if (ec > ai->max_ec)
+				ai->max_ec = ec;
+		}
+
+		switch (state) {
+		case UBI_FM_PEB_FREE:
+			err = add_aeb(ai, &ai->free, pnum, ec);
+			break;
+		case UBI_FM_PEB_ERASE:
+			err = add_aeb(ai, &ai->erase, pnum, ec);
+			break;
+		case UBI_FM_PEB_CORR:
+			err = add_aeb(ai, &ai->corr, pnum, ec);
+			ai->corr_peb_count += 1;
+			break;
+		case UBI_FM_PEB_BAD:
+			ai->bad_peb_count += 1;
+			break;
+		case UBI_FM_PEB_FM:
+			fm_blocks += 1;
+			break;
+		case UBI_FM_PEB_USED:
+		case UBI_FM_PEB_SCRUB:
+			/* Added when the EBA tables are processed */
+			break;
+		default:
+			ubi_err("bad state %d of PEB %d", state, pnum);
+			goto out_sb;
+		}
+		if (err < 0)
+			goto out_sb;
+		err = UBI_BAD_FASTMAP;
+	}
+
+	if (fm_blocks != used_blocks)
+		goto out_bad_blocks;
+	for (i = 0; i < used_blocks; i++) {
+		pnum = be32_to_cpu(sb->block_loc[i]);
+		if (pnum < 0 || pnum >= ubi->peb_count ||
+		    fmpeb[pnum].state != UBI_FM_PEB_FM)
+			goto out_bad_blocks;
+	}
+
+	fmvh = (void *)&fmpeb[ubi->peb_count];
+	for (i = 0; i < vol_count; i++) {
+		int lnum, vol_id, vol_type, leb_count, used_ebs, data_pad;
+		int last_eb_bytes;
+		__be32 *eba;
+
+		if ((void *)(fmvh + 1) > end ||
+		    be32_to_cpu(fmvh->magic) != UBI_FM_VOL_MAGIC) {
+			ubi_err("bad fastmap volume record %d", i);
+			goto out_sb;
+		}
+
+		vol_id = be32_to_cpu(fmvh->vol_id);
+		vol_type = fmvh->vol_type;
+		leb_count = be32_to_cpu(fmvh->leb_count);
+		used_ebs = be32_to_cpu(fmvh->used_ebs);
+		data_pad = be32_to_cpu(fmvh->data_pad);
+		last_eb_bytes = be32_to_cpu(fmvh->last_eb_bytes);
+		eba = (__be32 *)(fmvh + 1);
+
+		if ((vol_id < 0 || vol_id >= UBI_MAX_VOLUMES) &&
+		    vol_id != UBI_LAYOUT_VOLUME_ID) {
+			ubi_err("bad volume ID %d in fastmap", vol_id);
+			goto out_sb;
+		}
+		if ((vol_type != UBI_VID_DYNAMIC &&
+		     vol_type != UBI_VID_STATIC) ||
+		    leb_count < 0 || leb_count > ubi->peb_count ||
+		    (void *)(eba + leb_count) > end ||
+		    ubi_find_av(ai, vol_id)) {
+			ubi_err("bad fastmap record of volume %d", vol_id);
+			goto out_sb;
+		}
+
+		memset(vid_hdr, 0, ubi->vid_hdr_alsize);
+		vid_hdr->vol_type = vol_type;
+		vid_hdr->vol_id = cpu_to_be32(vol_id);
+		vid_hdr->data_pad = cpu_to_be32(data_pad);
+		if (vol_id == UBI_LAYOUT_VOLUME_ID)
+			vid_hdr->compat = UBI_LAYOUT_VOLUME_COMPAT;
+		if (vol_type == UBI_VID_STATIC)
+			vid_hdr->used_ebs = cpu_to_be32(used_ebs);
+
+		for (lnum = 0; lnum < leb_count; lnum++) {
+			pnum = be32_to_cpu(eba[lnum]);
+			if (pnum == UBI_LEB_UNMAPPED)
+				continue;
+
+			if (pnum < 0 || pnum >= ubi->peb_count) {
+				ubi_err("bad PEB %d of LEB %d:%d",
+					pnum, vol_id, lnum);
+				goto out_sb;
+			}
+			state = fmpeb[pnum].state;
+			if (state != UBI_FM_PEB_USED &&
+			    state != UBI_FM_PEB_SCRUB) {
+				ubi_err("LEB %d:%d is mapped to PEB %d in "
+					"state %d", vol_id, lnum, pnum, state);
+				goto out_sb;
+			}
+			/* Mark the PEB as referred to catch double mappings */
+			fmpeb[pnum].state = UBI_FM_PEB_FM;
+
+			vid_hdr->lnum = cpu_to_be32(lnum);
+			if (vol_type == UBI_VID_STATIC)
+				vid_hdr->data_size = cpu_to_be32(
+					lnum == used_ebs - 1 ? last_eb_bytes :
+					ubi->leb_size - data_pad);
+
+			err = ubi_add_to_av(ubi, ai, pnum,
+					    be32_to_cpu(fmpeb[pnum].ec),
+					    vid_hdr,
+					    state == UBI_FM_PEB_SCRUB);
+			if (err)
+				goto out_sb;
+			err = UBI_BAD_FASTMAP;
+		}
+
+		fmvh = (void *)(eba + leb_count);
+	}
+
+	if ((void *)fmvh != end) {
+		ubi_err("%d garbage bytes at the end of the fastmap",
+			(int)(end - (void *)fmvh));
+		goto out_sb;
+	}
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++)
+		if (fmpeb[pnum].state == UBI_FM_PEB_USED ||
+		    fmpeb[pnum].state == UBI_FM_PEB_SCRUB) {
+			ubi_err("PEB %d is used but not mapped", pnum);
+			goto out_sb;
+		}
+
+	err = -ENOMEM;
+	fm = kzalloc(sizeof(struct ubi_fastmap_layout), GFP_KERNEL);
+	if (!fm)
+		goto out_sb;
+
+	fm->used_blocks = used_blocks;
+	for (i = 0; i < used_blocks; i++) {
+		fm->pnum[i] = be32_to_cpu(sb->block_loc[i]);
+		fm->ec[i] = be32_to_cpu(sb->block_ec[i]);
+	}
+
+	if (ai->ec_count)
+		ai->mean_ec = div_u64(ai->ec_sum, ai->ec_count);
+	ai->max_sqnum = be64_to_cpu(sb->sqnum);
+	ubi->image_seq = be32_to_cpu(sb->image_seq);
+	ubi->fm = fm;
+	ubi->fm_valid = 1;
+
+	ubi_msg("fastmap: %d PEBs, %d volumes, %d bytes",
+		used_blocks, vol_count, size);
+	vfree(sb);
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return 0;
+
+out_bad_blocks:
+	ubi_err("fastmap block list does not match the PEB states");
+out_sb:
+	vfree(sb);
+out_vid:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return err;
+}
+
+/**
+ * get_fm_blocks - make sure the fastmap owns enough physical eraseblocks.
+ * @ubi: UBI device description object
+ * @blocks: how many physical eraseblocks are needed
+ *
+ * This function takes physical eraseblocks from the WL sub-system until the
+ * fastmap owns at least @blocks of them. They were reserved by
+ * 'ubi_fastmap_init()'. The first one has to be one of the first
+ * %UBI_FM_MAX_START PEBs. Returns zero in case of success and a negative error
+ * code in case of failure.
+ */
+static int get_fm_blocks(struct ubi_device *ubi, int blocks)
+{
+	int pnum, ec, max_pnum;
+	struct ubi_fastmap_layout *fm = ubi->fm;
+
+	if (blocks > fm->max_blocks) {
+		ubi_warn("fastmap needs %d PEBs, only %d are reserved",
+			 blocks, fm->max_blocks);
+		return -ENOSPC;
+	}
+
+	while (fm->used_blocks < blocks) {
+		max_pnum = fm->used_blocks ? ubi->peb_count : UBI_FM_MAX_START;
+		pnum = ubi_wl_get_fm_peb(ubi, max_pnum, &ec);
+		if (pnum < 0) {
+			ubi_warn("no free PEB below %d for the fastmap",
+				 max_pnum);
+			return pnum;
+		}
+
+		dbg_gen("fastmap block %d is PEB %d", fm->used_blocks, pnum);
+		fm->pnum[fm->used_blocks] = pnum;
+		fm->ec[fm->used_blocks] = ec;
+		fm->used_blocks += 1;
+	}
+
+	return 0;
+}
+
+/**
+ * erase_fm_blocks - erase the fastmap physical eraseblocks.
+ * @ubi: UBI device description object
+ *
+ * This function erases all physical eraseblocks owned by the fastmap and
+ * writes their EC headers. Worn out ones are replaced by free physical
+ * eraseblocks with lower erase counters. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+static int erase_fm_blocks(struct ubi_device *ubi)
+{
+	int i, err = 0;
+	struct ubi_ec_hdr *ec_hdr;
+	struct ubi_fastmap_layout *fm = ubi->fm;
+
+	ec_hdr = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ec_hdr)
+		return -ENOMEM;
+
+	for (i = 0; i < fm->used_blocks; i++) {
+		err = ubi_io_sync_erase(ubi, fm->pnum[i], 0);
+		if (err < 0)
+			break;
+
+		fm->ec[i] += err;
+		if (fm->ec[i] > UBI_MAX_ERASECOUNTER) {
+			ubi_err("erase counter overflow at PEB %d, EC %d",
+				fm->pnum[i], fm->ec[i]);
+			err = -EINVAL;
+			break;
+		}
+
+		ec_hdr->ec = cpu_to_be64(fm->ec[i]);
+		err = ubi_io_write_ec_hdr(ubi, fm->pnum[i], ec_hdr);
+		if (err)
+			break;
+
+		fm->pnum[i] = ubi_wl_swap_fm_peb(ubi, fm->pnum[i], &fm->ec[i],
+					i ? ubi->peb_count : UBI_FM_MAX_START);
+	}
+
+	kfree(ec_hdr);
+	return err;
+}
+
+/**
+ * fill_peb_states - record the state of every physical eraseblock.
+ * @ubi: UBI device description object
+ * @fmpeb: the physical eraseblock records to fill
+ *
+ * Returns zero in case of success, %-EINVAL if the in-RAM state of the device
+ * cannot be expressed by a fastmap, and a negative error code in case of
+ * failure.
+ */
+static int fill_peb_states(struct ubi_device *ubi, struct ubi_fm_peb *fmpeb)
+{
+	int i, pnum, lnum, err, bad = 0, corr = 0;
+	struct ubi_fastmap_layout *fm = ubi->fm;
+	struct ubi_volume *vol;
+	struct ubi_wl_entry *e;
+	struct rb_node *rb;
+
+	/*
+	 * Every PEB known to the WL sub-system is free, used, or about to be
+	 * erased. Start with the latter and refine from the trees and the
+	 * EBA tables.
+	 */
+	spin_lock(&ubi->wl_lock);
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		e = ubi->lookuptbl[pnum];
+		if (e) {
+			fmpeb[pnum].ec = cpu_to_be32(e->ec);
+			fmpeb[pnum].state = UBI_FM_PEB_ERASE;
+		} else
+			fmpeb[pnum].state = UBI_FM_PEB_CORR;
+	}
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		fmpeb[e->pnum].state = UBI_FM_PEB_FREE;
+	ubi_rb_for_each_entry(rb, e, &ubi->scrub, u.rb)
+		fmpeb[e->pnum].state = UBI_FM_PEB_SCRUB;
+	spin_unlock(&ubi->wl_lock);
+
+	for (i = 0; i < fm->used_blocks; i++) {
+		fmpeb[fm->pnum[i]].ec = cpu_to_be32(fm->ec[i]);
+		fmpeb[fm->pnum[i]].state = UBI_FM_PEB_FM;
+	}
+
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		vol = ubi->volumes[i];
+		if (!vol)
+			continue;
+
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			pnum = vol->eba_tbl[lnum];
+			if (pnum < 0)
+				continue;
+
+			if (fmpeb[pnum].state == UBI_FM_PEB_ERASE)
+				fmpeb[pnum].state = UBI_FM_PEB_USED;
+			else if (fmpeb[pnum].state != UBI_FM_PEB_SCRUB) {
+				ubi_err("LEB %d:%d is mapped to PEB %d in "
+					"state %d", vol->vol_id, lnum, pnum,
+					fmpeb[pnum].state);
+				return -EINVAL;
+			}
+		}
+	}
+
+	/* What the WL sub-system does not know about is bad or corrupted */
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (fmpeb[pnum].state != UBI_FM_PEB_CORR)
+			continue;
+
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		if (err) {
+			fmpeb[pnum].state = UBI_FM_PEB_BAD;
+			bad += 1;
+		} else
+			corr += 1;
+	}
+
+	if (bad != ubi->bad_peb_count || corr != ubi->corr_peb_count) {
+		ubi_err("%d bad and %d corrupted PEBs found, expected %d "
+			"and %d", bad, corr, ubi->bad_peb_count,
+			ubi->corr_peb_count);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * write_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function has to be called with the EBA and WL sub-systems blocked and
+ * with @ubi->fm_mutex held. Returns zero in case of success and a negative
+ * error code in case of failure.
+ */
+static int write_fastmap(struct ubi_device *ubi)
+{
+	int i, err, size, blocks, vol_count = 0;
+	unsigned long long sqnum[UBI_FM_MAX_BLOCKS];
+	struct ubi_fastmap_layout *fm;
+	struct ubi_fm_sb *sb;
+	struct ubi_fm_volhdr *fmvh;
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_volume *vol;
+	void *buf;
+
+	size = sizeof(struct ubi_fm_sb) +
+	       ubi->peb_count * sizeof(struct ubi_fm_peb);
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		vol = ubi->volumes[i];
+		if (!vol)
+			continue;
+
+		if (vol->updating || vol->changing_leb) {
+			ubi_warn("volume %d is being updated", vol->vol_id);
+			return -EBUSY;
+		}
+		size += sizeof(struct ubi_fm_volhdr) +
+			vol->reserved_pebs * sizeof(__be32);
+		vol_count += 1;
+	}
+
+	blocks = DIV_ROUND_UP(size, ubi->leb_size);
+	if (blocks > UBI_FM_MAX_BLOCKS) {
+		ubi_warn("fastmap needs %d PEBs, maximum is %d",
+			 blocks, UBI_FM_MAX_BLOCKS);
+		return -E2BIG;
+	}
+
+	err = get_fm_blocks(ubi, blocks);
+	if (err)
+		return err;
+	fm = ubi->fm;
+
+	err = erase_fm_blocks(ubi);
+	if (err)
+		return err;
+
+	buf = vzalloc(ALIGN(size, ubi->min_io_size));
+	if (!buf)
+		return -ENOMEM;
+
+	err = -ENOMEM;
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		goto out_buf;
+
+	sb = buf;
+	err = fill_peb_states(ubi, buf + sizeof(struct ubi_fm_sb));
+	if (err)
+		goto out_vid;
+
+	fmvh = buf + sizeof(struct ubi_fm_sb) +
+	       ubi->peb_count * sizeof(struct ubi_fm_peb);
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		__be32 *eba;
+		int lnum;
+
+		vol = ubi->volumes[i];
+		if (!vol)
+			continue;
+
+		fmvh->magic = cpu_to_be32(UBI_FM_VOL_MAGIC);
+		fmvh->vol_id = cpu_to_be32(vol->vol_id);
+		fmvh->data_pad = cpu_to_be32(vol->data_pad);
+		fmvh->leb_count = cpu_to_be32(vol->reserved_pebs);
+		if (vol->vol_type == UBI_DYNAMIC_VOLUME)
+			fmvh->vol_type = UBI_VID_DYNAMIC;
+		else {
+			fmvh->vol_type = UBI_VID_STATIC;
+			fmvh->used_ebs = cpu_to_be32(vol->used_ebs);
+			fmvh->last_eb_bytes = cpu_to_be32(vol->last_eb_bytes);
+		}
+
+		eba = (__be32 *)(fmvh + 1);
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++)
+			eba[lnum] = cpu_to_be32(vol->eba_tbl[lnum]);
+		fmvh = (void *)(eba + vol->reserved_pebs);
+	}
+
+	/* The superblock gets the highest sequence number */
+	for (i = fm->used_blocks - 1; i >= 0; i--)
+		sqnum[i] = ubi_next_sqnum(ubi);
+
+	sb->magic = cpu_to_be32(UBI_FM_SB_MAGIC);
+	sb->version = UBI_FM_FMT_VERSION;
+	sb->size = cpu_to_be32(size);
+	sb->used_blocks = cpu_to_be32(fm->used_blocks);
+	for (i = 0; i < fm->used_blocks; i++) {
+		sb->block_loc[i] = cpu_to_be32(fm->pnum[i]);
+		sb->block_ec[i] = cpu_to_be32(fm->ec[i]);
+	}
+	sb->sqnum = cpu_to_be64(sqnum[0]);
+	sb->image_seq = cpu_to_be32(ubi->image_seq);
+	sb->peb_count = cpu_to_be32(ubi->peb_count);
+	sb->vol_count = cpu_to_be32(vol_count);
+	sb->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, buf, size));
+
+	/* Write the superblock last, a fastmap without it does not exist */
+	vid_hdr->vol_type = UBI_VID_DYNAMIC;
+	vid_hdr->compat = UBI_FM_VOLUME_COMPAT;
+	for (i = fm->used_blocks - 1; i >= 0; i--) {
+		int offs = i * ubi->leb_size;
+
+		vid_hdr->vol_id = cpu_to_be32(i ? UBI_FM_DATA_VOLUME_ID :
+						  UBI_FM_SB_VOLUME_ID);
+		vid_hdr->lnum = cpu_to_be32(i);
+		vid_hdr->sqnum = cpu_to_be64(sqnum[i]);
+		err = ubi_io_write_vid_hdr(ubi, fm->pnum[i], vid_hdr);
+		if (err)
+			goto out_vid;
+
+		if (offs >= size)
+			continue;
+		err = ubi_io_write_data(ubi, buf + offs, fm->pnum[i], 0,
+					ALIGN(min(size - offs, ubi->leb_size),
+					      ubi->min_io_size));
+		if (err)
+			goto out_vid;
+	}
+
+	ubi->fm_valid = 1;
+	ubi_msg("fastmap written: %d PEBs, %d volumes, %d bytes, superblock "
+		"at PEB %d", fm->used_blocks, vol_count, size, fm->pnum[0]);
+
+out_vid:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+out_buf:
+	vfree(buf);
+	return err;
+}
+
+/**
+ * ubi_fastmap_init - reserve physical eraseblocks for the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function is called at the end of attaching, after the EBA and WL
+ * sub-systems have reserved their physical eraseblocks. It reserves enough
+ * physical eraseblocks for a fastmap of the whole device, so that volumes
+ * cannot take them later, and takes the anchor. If that is not possible, the
+ * fastmap is disabled for this device.
+ */
+void ubi_fastmap_init(struct ubi_device *ubi)
+{
+	int size, blocks, need, pnum, ec;
+	struct ubi_fastmap_layout *fm = ubi->fm;
+
+	/* Every PEB may be mapped, so the EBA tables are bounded by the PEBs */
+	size = sizeof(struct ubi_fm_sb) +
+	       ubi->peb_count * sizeof(struct ubi_fm_peb) +
+	       (ubi->vtbl_slots + UBI_INT_VOL_COUNT) *
+			sizeof(struct ubi_fm_volhdr) +
+	       ubi->peb_count * sizeof(__be32);
+	blocks = min_t(int, DIV_ROUND_UP(size, ubi->leb_size),
+		       UBI_FM_MAX_BLOCKS);
+
+	if (!fm) {
+		fm = kzalloc(sizeof(struct ubi_fastmap_layout), GFP_KERNEL);
+		if (!fm) {
+			ubi_warn("cannot allocate fastmap, fastmap disabled");
+			return;
+		}
+		ubi->fm = fm;
+	}
+
+	/* The PEBs the fastmap already owns are not available for volumes */
+	blocks = max(blocks, fm->used_blocks);
+	need = blocks - fm->used_blocks;
+	if (need > ubi->avail_pebs) {
+		if (!fm->used_blocks) {
+			ubi_warn("%d PEBs needed for fastmap, %d available, "
+				 "fastmap disabled", need, ubi->avail_pebs);
+			ubi_fastmap_close(ubi);
+			return;
+		}
+		ubi_warn("%d PEBs needed for fastmap, %d available",
+			 need, ubi->avail_pebs);
+		blocks = fm->used_blocks;
+		need = 0;
+	}
+
+	ubi->avail_pebs -= need;
+	ubi->rsvd_pebs += blocks;
+	fm->max_blocks = blocks;
+	dbg_gen("%d PEBs reserved for fastmap", blocks);
+
+	if (fm->used_blocks)
+		return;
+
+	pnum = ubi_wl_get_fm_peb(ubi, UBI_FM_MAX_START, &ec);
+	if (pnum < 0) {
+		ubi_msg("no free PEB below %d for fastmap, freeing one",
+			UBI_FM_MAX_START);
+		ubi_wl_produce_fm_anchor(ubi);
+		return;
+	}
+
+	dbg_gen("fastmap anchor is PEB %d", pnum);
+	fm->pnum[0] = pnum;
+	fm->ec[0] = ec;
+	fm->used_blocks = 1;
+}
+
+/**
+ * ubi_update_fastmap - write the fastmap if it is not up to date.
+ * @ubi: UBI device description object
+ *
+ * This function finishes the pending works, blocks the EBA and WL sub-systems
+ * and writes a fastmap describing the current state of the device, unless the
+ * fastmap on the flash is still valid. It is called when the device is
+ * detached and when the system goes down. Returns zero in case of success and
+ * a negative error code in case of failure, in which case the next attach
+ * falls back to full scanning.
+ */
+int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	int err;
+
+	if (ubi->ro_mode || !ubi->fm)
+		return 0;
+
+	mutex_lock(&ubi->device_mutex);
+	err = ubi_wl_flush(ubi, UBI_ALL, UBI_ALL);
+	if (err)
+		goto out_unlock;
+
+	down_write(&ubi->fm_sem);
+	down_write(&ubi->work_sem);
+	mutex_lock(&ubi->fm_mutex);
+	if (!ubi->fm_valid && !ubi->ro_mode)
+		err = write_fastmap(ubi);
+	mutex_unlock(&ubi->fm_mutex);
+	up_write(&ubi->work_sem);
+	up_write(&ubi->fm_sem);
+
+out_unlock:
+	mutex_unlock(&ubi->device_mutex);
+	if (err)
+		ubi_warn("cannot write fastmap, error %d", err);
+	return err;
+}
+
+/**
+ * ubi_fastmap_invalidate - invalidate the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function is called by the I/O sub-system before the flash is changed
+ * while the fastmap on the flash is valid. It erases the fastmap superblock,
+ * so that the next attach scans the entire device. If that fails, the device
+ * is switched to read-only mode, because the fastmap would not match the flash
+ * any more. Returns zero in case of success and a negative error code in case
+ * of failure.
+ */
+int ubi_fastmap_invalidate(struct ubi_device *ubi)
+{
+	int err = 0, pnum;
+	struct ubi_ec_hdr *ec_hdr;
+
+	mutex_lock(&ubi->fm_mutex);
+	if (!ubi->fm_valid)
+		goto out_unlock;
+
+	err = -ENOMEM;
+	ec_hdr = kzalloc(ubi->ec_hdr_alsize, GFP_NOFS);
+	if (!ec_hdr)
+		goto out_unlock;
+
+	pnum = ubi->fm->pnum[0];
+	dbg_gen("invalidate fastmap at PEB %d", pnum);
+	err = ubi_io_sync_erase(ubi, pnum, 0);
+	if (err < 0)
+		goto out_free;
+
+	ubi->fm->ec[0] += err;
+	ec_hdr->ec = cpu_to_be64(ubi->fm->ec[0]);
+	err = ubi_io_write_ec_hdr(ubi, pnum, ec_hdr);
+	if (!err)
+		ubi->fm_valid = 0;
+
+out_free:
+	kfree(ec_hdr);
+out_unlock:
+	mutex_unlock(&ubi->fm_mutex);
+	if (err) {
+		ubi_err("cannot invalidate fastmap, error %d", err);
+		ubi_ro_mode(ubi);
+	}
+	return err;
+}
+
+/**
+ * ubi_fastmap_close - free the fastmap data structures.
+ * @ubi: UBI device description object
+ */
+void ubi_fastmap_close(struct ubi_device *ubi)
+{
+	kfree(ubi->fm);
+	ubi->fm = NULL;
+	ubi->fm_valid = 0;
+}
@@ -375,4 +375,136 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __packed;
 
+/* UBI fastmap on-flash data structures */
+
+#define UBI_FM_SB_VOLUME_ID	(UBI_INTERNAL_VOL_START + 1)
+#define UBI_FM_DATA_VOLUME_ID	(UBI_INTERNAL_VOL_START + 2)
+#define UBI_FM_VOLUME_COMPAT	UBI_COMPAT_DELETE
+
+/* Fastmap superblock magic number (ASCII "UBIF") */
+#define UBI_FM_SB_MAGIC		0x55424946
+/* Fastmap volume record magic number (ASCII "UBIV") */
+#define UBI_FM_VOL_MAGIC	0x55424956
+
+/* The fastmap format version supported by this implementation */
+#define UBI_FM_FMT_VERSION	1
+
+/* The fastmap superblock has to be in one of the first UBI_FM_MAX_START PEBs */
+#define UBI_FM_MAX_START	64
+
+/* Maximum number of PEBs a fastmap may occupy */
+#define UBI_FM_MAX_BLOCKS	32
+
+/*
+ * Physical eraseblock states recorded in the fastmap.
+ *
+ * @UBI_FM_PEB_FREE: free, contains only the EC header
+ * @UBI_FM_PEB_USED: mapped to a logical eraseblock
+ * @UBI_FM_PEB_SCRUB: mapped to a logical eraseblock, has to be scrubbed
+ * @UBI_FM_PEB_ERASE: has to be erased
+ * @UBI_FM_PEB_BAD: bad physical eraseblock
+ * @UBI_FM_PEB_CORR: corrupted, preserved and not used by UBI
+ * @UBI_FM_PEB_FM: belongs to the fastmap itself
+ */
+enum {
+	UBI_FM_PEB_FREE = 0,
+	UBI_FM_PEB_USED,
+	UBI_FM_PEB_SCRUB,
+	UBI_FM_PEB_ERASE,
+	UBI_FM_PEB_BAD,
+	UBI_FM_PEB_CORR,
+	UBI_FM_PEB_FM
+};
+
+/**
+ * struct ubi_fm_sb - UBI fastmap superblock.
+ * @magic: fastmap superblock magic number (%UBI_FM_SB_MAGIC)
+ * @version: format version of this fastmap
+ * @padding1: reserved for future, zeroes
+ * @data_crc: CRC32 checksum of the whole fastmap, with this field set to zero
+ * @size: size of the fastmap in bytes, including this superblock
+ * @used_blocks: number of PEBs used by this fastmap
+ * @block_loc: the PEBs used by this fastmap, the first one is the anchor
+ * @block_ec: erase counters of the PEBs used by this fastmap
+ * @sqnum: highest sequence number in use when the fastmap was written
+ * @image_seq: image sequence number of the UBI device
+ * @peb_count: number of PEBs on the MTD device
+ * @vol_count: number of &struct ubi_fm_volhdr records in this fastmap
+ * @padding2: reserved for future, zeroes
+ *
+ * The fastmap is a snapshot of the attaching information of an UBI device. It
+ * is a byte stream which starts with this superblock, continues with one
+ * &struct ubi_fm_peb record for every physical eraseblock of the device, and
+ * ends with a &struct ubi_fm_volhdr record for every volume, each followed by
+ * the EBA table of that volume. The stream is stored in the data areas of the
+ * @used_blocks PEBs, one LEB worth of data after another.
+ *
+ * The first PEB, the anchor, belongs to the %UBI_FM_SB_VOLUME_ID internal
+ * volume and is always one of the first %UBI_FM_MAX_START PEBs, so that it
+ * may be found quickly. The other PEBs belong to the %UBI_FM_DATA_VOLUME_ID
+ * internal volume, the LEB number of each of them is its index in
+ * @block_loc. Both internal volumes are "delete" compatible, so UBI
+ * implementations which do not know about fastmaps just get rid of them.
+ *
+ * The fastmap is only valid as long as nothing else on the flash changes. UBI
+ * erases the anchor before it changes the flash, and attaching falls back to
+ * full scanning if there is no anchor or the fastmap is inconsistent.
+ */
+struct ubi_fm_sb {
+	__be32  magic;
+	__u8    version;
+	__u8    padding1[3];
+	__be32  data_crc;
+	__be32  size;
+	__be32  used_blocks;
+	__be32  block_loc[UBI_FM_MAX_BLOCKS];
+	__be32  block_ec[UBI_FM_MAX_BLOCKS];
+	__be64  sqnum;
+	__be32  image_seq;
+	__be32  peb_count;
+	__be32  vol_count;
+	__u8    padding2[24];
+} __packed;
+
+/**
+ * struct ubi_fm_peb - fastmap record of a physical eraseblock.
+ * @ec: erase counter
+ * @state: state of the physical eraseblock (%UBI_FM_PEB_FREE, etc)
+ * @padding: reserved for future, zeroes
+ */
+struct ubi_fm_peb {
+	__be32  ec;
+	__u8    state;
+	__u8    padding[3];
+} __packed;
+
+/**
+ * struct ubi_fm_volhdr - fastmap record of a volume.
+ * @magic: fastmap volume record magic number (%UBI_FM_VOL_MAGIC)
+ * @vol_id: volume ID
+ * @vol_type: volume type (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @padding1: reserved for future, zeroes
+ * @data_pad: how many bytes are not used at the end of physical eraseblocks
+ * @used_ebs: number of used logical eraseblocks (static volumes only)
+ * @last_eb_bytes: number of bytes in the last logical eraseblock (static
+ *                 volumes only)
+ * @leb_count: number of entries in the EBA table which follows this record
+ * @padding2: reserved for future, zeroes
+ *
+ * The record is followed by @leb_count big endian 32-bit physical eraseblock
+ * numbers, one per logical eraseblock, where un-mapped logical eraseblocks
+ * are marked with %0xFFFFFFFF.
+ */
+struct ubi_fm_volhdr {
+	__be32  magic;
+	__be32  vol_id;
+	__u8    vol_type;
+	__u8    padding1[3];
+	__be32  data_pad;
+	__be32  used_ebs;
+	__be32  last_eb_bytes;
+	__be32  leb_count;
+	__u8    padding2[12];
+} __packed;
+
 #endif /* !__UBI_MEDIA_H__ */
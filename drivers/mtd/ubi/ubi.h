@@ -136,6 +136,33 @@ enum {
 	MOVE_RETRY,
 };
 
+/*
+ * Classes of the works done by the WL sub-system, in the order of priority.
+ *
+ * UBI_WORK_ERASE: erasure of a physical eraseblock, produces free PEBs
+ * UBI_WORK_SCRUB: moving data out of a physical eraseblock with bit-flips
+ * UBI_WORK_FM_ANCHOR: moving data out of a PEB the fastmap wants as anchor
+ * UBI_WORK_WL: moving data to level the erase counters
+ */
+enum {
+	UBI_WORK_ERASE,
+	UBI_WORK_SCRUB,
+	UBI_WORK_FM_ANCHOR,
+	UBI_WORK_WL,
+	UBI_WORK_CLASSES,
+};
+
+/*
+ * Return codes of the 'ubi_scan_fastmap()' function.
+ *
+ * UBI_NO_FASTMAP: no fastmap superblock was found
+ * UBI_BAD_FASTMAP: a fastmap was found, but it is corrupted or inconsistent
+ */
+enum {
+	UBI_NO_FASTMAP = 1,
+	UBI_BAD_FASTMAP,
+};
+
 /**
  * struct ubi_wl_entry - wear-leveling entry.
  * @u.rb: link in the corresponding (free/used) RB-tree
@@ -298,6 +325,26 @@ struct ubi_volume_desc {
 
 struct ubi_wl_entry;
 
+/**
+ * struct ubi_fastmap_layout - physical eraseblocks used by the fastmap.
+ * @used_blocks: number of physical eraseblocks owned by the fastmap
+ * @max_blocks: number of physical eraseblocks reserved for the fastmap
+ * @pnum: the physical eraseblocks, the first one is the anchor
+ * @ec: erase counters of the physical eraseblocks
+ *
+ * The fastmap physical eraseblocks do not belong to the WL sub-system. They
+ * are kept by the fastmap code for as long as the UBI device is attached and
+ * re-used every time the fastmap is written. @max_blocks physical eraseblocks
+ * are reserved when the device is attached, @used_blocks of them are taken
+ * out of the WL sub-system so far.
+ */
+struct ubi_fastmap_layout {
+	int used_blocks;
+	int max_blocks;
+	int pnum[UBI_FM_MAX_BLOCKS];
+	int ec[UBI_FM_MAX_BLOCKS];
+};
+
 /**
  * struct ubi_device - UBI device description structure
  * @dev: UBI device object to use the the Linux device model
@@ -345,7 +392,8 @@ struct ubi_wl_entry;
  * @pq_head: protection queue head
  * @wl_lock: protects the @used, @free, @pq, @pq_head, @lookuptbl, @move_from,
  *	     @move_to, @move_to_put @erase_pending, @wl_scheduled, @works,
- *	     @erroneous, and @erroneous_peb_count fields
+ *	     @works_pending, @works_done, @bgt_next, @erroneous, and
+ *	     @erroneous_peb_count fields
  * @move_mutex: serializes eraseblock moves
  * @work_sem: synchronizes the WL worker with use tasks
  * @wl_scheduled: non-zero if the wear-leveling was scheduled
@@ -354,11 +402,30 @@ struct ubi_wl_entry;
  * @move_from: physical eraseblock from where the data is being moved
  * @move_to: physical eraseblock where the data is being moved to
  * @move_to_put: if the "to" PEB was put
- * @works: list of pending works
+ * @works: lists of pending works, one per work class (%UBI_WORK_ERASE, etc)
  * @works_count: count of pending works
+ * @works_pending: count of pending works of each class
+ * @works_done: count of successfully done works of each class
  * @bgt_thread: background thread description object
  * @thread_enabled: if the background thread is enabled
  * @bgt_name: background thread name
+ * @bgt_rate_limit: how many KiB per second the background thread may move
+ *                  when scrubbing and wear-leveling (0 if unlimited)
+ * @bgt_idle_ms: wear-leveling is postponed until no LEB was changed for this
+ *               many milliseconds (0 if wear-leveling is not postponed)
+ * @bgt_next: when the background thread may move the next LEB (jiffies)
+ * @last_write: when an LEB was changed the last time (jiffies)
+ *
+ * @fm: physical eraseblocks owned by the fastmap (%NULL if there are none)
+ * @fm_valid: non-zero if the fastmap on the flash describes the current state
+ *            of the device and has to be invalidated before the flash is
+ *            changed
+ * @fm_mutex: serializes writing and invalidating the fastmap
+ * @fm_sem: held in read mode while an LEB is being changed and in write mode
+ *          while the fastmap is written, to give it a consistent snapshot
+ * @fm_anchor_wanted: non-zero if the WL sub-system has to free one of the
+ *                    first %UBI_FM_MAX_START PEBs for the fastmap anchor
+ *                    (protected by @wl_lock)
  *
  * @flash_size: underlying MTD device size (in bytes)
  * @peb_count: count of physical eraseblocks on the MTD device
@@ -442,11 +509,24 @@ struct ubi_device {
 	struct ubi_wl_entry *move_from;
 	struct ubi_wl_entry *move_to;
 	int move_to_put;
-	struct list_head works;
+	struct list_head works[UBI_WORK_CLASSES];
 	int works_count;
+	int works_pending[UBI_WORK_CLASSES];
+	unsigned long works_done[UBI_WORK_CLASSES];
 	struct task_struct *bgt_thread;
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
+	unsigned int bgt_rate_limit;
+	unsigned int bgt_idle_ms;
+	unsigned long bgt_next;
+	unsigned long last_write;
+
+	/* Fastmap stuff */
+	struct ubi_fastmap_layout *fm;
+	int fm_valid;
+	struct mutex fm_mutex;
+	struct rw_semaphore fm_sem;
+	int fm_anchor_wanted;
 
 	/* I/O sub-system's stuff */
 	long long flash_size;
@@ -664,6 +744,7 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		     struct ubi_vid_hdr *vid_hdr);
 int ubi_eba_init(struct ubi_device *ubi, struct ubi_attach_info *ai);
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
 
 /* wl.c */
 int ubi_wl_get_peb(struct ubi_device *ubi);
@@ -674,6 +755,11 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init(struct ubi_device *ubi, struct ubi_attach_info *ai);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+void ubi_wl_wake_bgt(struct ubi_device *ubi);
+int ubi_wl_get_fm_peb(struct ubi_device *ubi, int max_pnum, int *ec);
+int ubi_wl_swap_fm_peb(struct ubi_device *ubi, int pnum, int *ec,
+		       int max_pnum);
+int ubi_wl_produce_fm_anchor(struct ubi_device *ubi);
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
@@ -706,6 +792,19 @@ int ubi_notify_all(struct ubi_device *ubi, int ntype,
 int ubi_enumerate_volumes(struct notifier_block *nb);
 void ubi_free_internal_volumes(struct ubi_device *ubi);
 
+/* fastmap.c */
+#ifdef CONFIG_MTD_UBI_FASTMAP
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_attach_info *ai);
+void ubi_fastmap_init(struct ubi_device *ubi);
+int ubi_update_fastmap(struct ubi_device *ubi);
+int ubi_fastmap_invalidate(struct ubi_device *ubi);
+void ubi_fastmap_close(struct ubi_device *ubi);
+#else
+static inline void ubi_fastmap_init(struct ubi_device *ubi) {}
+static inline int ubi_update_fastmap(struct ubi_device *ubi) { return 0; }
+static inline void ubi_fastmap_close(struct ubi_device *ubi) {}
+#endif
+
 /* kapi.c */
 void ubi_do_get_device_info(struct ubi_device *ubi, struct ubi_device_info *di);
 void ubi_do_get_volume_info(struct ubi_device *ubi, struct ubi_volume *vol,
@@ -818,6 +917,25 @@ static inline void ubi_ro_mode(struct ubi_device *ubi)
 	}
 }
 
+/**
+ * ubi_fastmap_check - prepare for changing a physical eraseblock.
+ * @ubi: UBI device description object
+ * @pnum: the physical eraseblock which is about to be written or erased
+ *
+ * If the fastmap on the flash is valid, it is invalidated before anything else
+ * on the flash is changed. Changes of the fastmap anchor itself are done by
+ * the fastmap code and let through. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+static inline int ubi_fastmap_check(struct ubi_device *ubi, int pnum)
+{
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (unlikely(ubi->fm_valid) && pnum != ubi->fm->pnum[0])
+		return ubi_fastmap_invalidate(ubi);
+#endif
+	return 0;
+}
+
 /**
  * vol_id2idx - get table index by volume ID.
  * @ubi: UBI device description object
@@ -824,6 +824,9 @@ int ubi_read_volume_table(struct ubi_device *ubi, struct ubi_attach_info *ai)
 	}
 
 	ubi->avail_pebs = ubi->good_peb_count - ubi->corr_peb_count;
+	/* The fastmap PEBs are not available for volumes */
+	if (ubi->fm)
+		ubi->avail_pebs -= ubi->fm->used_blocks;
 
 	/*
 	 * The layout volume is OK, initialize the corresponding in-RAM data
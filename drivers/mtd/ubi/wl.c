@@ -135,10 +135,20 @@
  */
 #define WL_MAX_FAILURES 32
 
+/*
+ * The background thread postpones wear-leveling while LEBs are being changed
+ * and limits the rate of moving data if asked to (see the @bgt_idle_ms and
+ * @bgt_rate_limit fields of &struct ubi_device). But if the difference between
+ * erase counters grows to %WL_URGENT_DIFF, wear-leveling is done right away
+ * regardless, so the wear-leveling guarantees hold.
+ */
+#define WL_URGENT_DIFF (2*UBI_WL_THRESHOLD)
+
 /**
  * struct ubi_work - UBI work description data structure.
  * @list: a link in the list of pending works
  * @func: worker function
+ * @class: class of the work (%UBI_WORK_ERASE, etc)
  * @e: physical eraseblock to erase
  * @vol_id: the volume ID on which this erasure is being performed
  * @lnum: the logical eraseblock number
@@ -147,11 +157,13 @@
  * The @func pointer points to the worker function. If the @cancel argument is
  * not zero, the worker has to free the resources and exit immediately. The
  * worker has to return zero in case of success and a negative error code in
- * case of failure.
+ * case of failure. A return of zero does not mean anything was done, so the
+ * worker itself calls 'work_done()' when it erased or moved something.
  */
 struct ubi_work {
 	struct list_head list;
 	int (*func)(struct ubi_device *ubi, struct ubi_work *wrk, int cancel);
+	int class;
 	/* The below fields are only relevant to erasure works */
 	struct ubi_wl_entry *e;
 	int vol_id;
@@ -201,12 +213,68 @@ static void wl_tree_add(struct ubi_wl_entry *e, struct rb_root *root)
 	rb_insert_color(&e->u.rb, root);
 }
 
+/**
+ * next_work - find the next pending work.
+ * @ubi: UBI device description object
+ *
+ * This function returns the oldest pending work of the highest priority class,
+ * or %NULL if there are no pending works. Caller has to hold @ubi->wl_lock.
+ */
+static struct ubi_work *next_work(struct ubi_device *ubi)
+{
+	int i;
+
+	for (i = 0; i < UBI_WORK_CLASSES; i++)
+		if (!list_empty(&ubi->works[i]))
+			return list_first_entry(&ubi->works[i],
+						struct ubi_work, list);
+	return NULL;
+}
+
+/**
+ * dequeue_work - remove a work from the list of pending works.
+ * @ubi: UBI device description object
+ * @wrk: the work to remove
+ *
+ * Caller has to hold @ubi->wl_lock.
+ */
+static void dequeue_work(struct ubi_device *ubi, struct ubi_work *wrk)
+{
+	list_del(&wrk->list);
+	ubi->works_count -= 1;
+	ubi->works_pending[wrk->class] -= 1;
+	ubi_assert(ubi->works_count >= 0);
+}
+
+/**
+ * work_done - account a successfully done work.
+ * @ubi: UBI device description object
+ * @class: class of the work
+ *
+ * Workers call this when they have erased a PEB or moved an LEB, not when they
+ * were canceled or gave up. Moving data counts against the rate limit of the
+ * background thread.
+ */
+static void work_done(struct ubi_device *ubi, int class)
+{
+	unsigned int rate;
+
+	spin_lock(&ubi->wl_lock);
+	ubi->works_done[class] += 1;
+	rate = ubi->bgt_rate_limit;
+	if (class != UBI_WORK_ERASE && rate)
+		ubi->bgt_next = jiffies + div64_u64((u64)ubi->leb_size * HZ,
+						    (u64)rate * 1024);
+	spin_unlock(&ubi->wl_lock);
+}
+
 /**
  * do_work - do one pending work.
  * @ubi: UBI device description object
  *
- * This function returns zero in case of success and a negative error code in
- * case of failure.
+ * This function does the oldest pending work of the highest priority class.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
  */
 static int do_work(struct ubi_device *ubi)
 {
@@ -223,16 +291,14 @@ static int do_work(struct ubi_device *ubi)
 	 */
 	down_read(&ubi->work_sem);
 	spin_lock(&ubi->wl_lock);
-	if (list_empty(&ubi->works)) {
+	wrk = next_work(ubi);
+	if (!wrk) {
 		spin_unlock(&ubi->wl_lock);
 		up_read(&ubi->work_sem);
 		return 0;
 	}
 
-	wrk = list_entry(ubi->works.next, struct ubi_work, list);
-	list_del(&wrk->list);
-	ubi->works_count -= 1;
-	ubi_assert(ubi->works_count >= 0);
+	dequeue_work(ubi, wrk);
 	spin_unlock(&ubi->wl_lock);
 
 	/*
@@ -254,8 +320,9 @@ static int do_work(struct ubi_device *ubi)
  *
  * This function tries to make a free PEB by means of synchronous execution of
  * pending works. This may be needed if, for example the background thread is
- * disabled. Returns zero in case of success and a negative error code in case
- * of failure.
+ * disabled. Pending erasures are done first, so the caller does not wait for
+ * wear-leveling unless there is nothing else to do. Returns zero in case of
+ * success and a negative error code in case of failure.
  */
 static int produce_free_peb(struct ubi_device *ubi)
 {
@@ -386,7 +453,7 @@ retry:
 	spin_lock(&ubi->wl_lock);
 	if (!ubi->free.rb_node) {
 		if (ubi->works_count == 0) {
-			ubi_assert(list_empty(&ubi->works));
+			ubi_assert(!next_work(ubi));
 			ubi_err("no free eraseblocks");
 			spin_unlock(&ubi->wl_lock);
 			return -ENOSPC;
@@ -563,14 +630,15 @@ repeat:
  * @wrk: the work to schedule
  *
  * This function adds a work defined by @wrk to the tail of the pending works
- * list.
+ * list of its class.
  */
 static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 {
 	spin_lock(&ubi->wl_lock);
-	list_add_tail(&wrk->list, &ubi->works);
+	list_add_tail(&wrk->list, &ubi->works[wrk->class]);
 	ubi_assert(ubi->works_count >= 0);
 	ubi->works_count += 1;
+	ubi->works_pending[wrk->class] += 1;
 	if (ubi->thread_enabled && !ubi_dbg_is_bgt_disabled(ubi))
 		wake_up_process(ubi->bgt_thread);
 	spin_unlock(&ubi->wl_lock);
@@ -603,6 +671,7 @@ static int schedule_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 		return -ENOMEM;
 
 	wl_wrk->func = &erase_worker;
+	wl_wrk->class = UBI_WORK_ERASE;
 	wl_wrk->e = e;
 	wl_wrk->vol_id = vol_id;
 	wl_wrk->lnum = lnum;
@@ -612,6 +681,73 @@ static int schedule_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 	return 0;
 }
 
+/**
+ * give_fm_anchor - give an erased physical eraseblock to the fastmap.
+ * @ubi: UBI device description object
+ * @e: the WL entry of the physical eraseblock, not in any tree
+ *
+ * If the fastmap has no anchor yet and @e is one of the first
+ * %UBI_FM_MAX_START PEBs, this function gives @e to the fastmap as its anchor
+ * and frees the WL entry. It has to be called with @ubi->wl_lock held and from
+ * a worker, which cannot run while the fastmap is written. Returns non-zero if
+ * @e was taken and zero if not.
+ */
+static int give_fm_anchor(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	struct ubi_fastmap_layout *fm = ubi->fm;
+
+	if (!fm || fm->used_blocks || e->pnum >= UBI_FM_MAX_START)
+		return 0;
+
+	dbg_wl("PEB %d EC %d is the fastmap anchor", e->pnum, e->ec);
+	fm->pnum[0] = e->pnum;
+	fm->ec[0] = e->ec;
+	fm->used_blocks = 1;
+	ubi->fm_anchor_wanted = 0;
+	ubi->lookuptbl[e->pnum] = NULL;
+	kmem_cache_free(ubi_wl_entry_slab, e);
+	return 1;
+}
+
+/**
+ * find_fm_anchor_move - find a move which frees a fastmap anchor.
+ * @ubi: UBI device description object
+ * @e1: the used physical eraseblock to move is returned here
+ * @e2: the free physical eraseblock to move it to is returned here
+ *
+ * If the fastmap waits for an anchor, this function looks for a used physical
+ * eraseblock among the first %UBI_FM_MAX_START PEBs and a free one beyond
+ * them. Once @e1 is moved and erased, 'give_fm_anchor()' hands it over to the
+ * fastmap. It has to be called with @ubi->wl_lock held. Returns non-zero if a
+ * suitable pair was found and zero if not.
+ */
+static int find_fm_anchor_move(struct ubi_device *ubi,
+			       struct ubi_wl_entry **e1,
+			       struct ubi_wl_entry **e2)
+{
+	struct rb_node *rb;
+	struct ubi_wl_entry *e;
+
+	if (!ubi->fm_anchor_wanted)
+		return 0;
+
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		if (e->pnum >= UBI_FM_MAX_START)
+			break;
+	if (!rb)
+		return 0;
+	*e2 = e;
+
+	ubi_rb_for_each_entry(rb, e, &ubi->used, u.rb)
+		if (e->pnum < UBI_FM_MAX_START)
+			break;
+	if (!rb)
+		return 0;
+	*e1 = e;
+
+	return 1;
+}
+
 /**
  * wear_leveling_worker - wear-leveling worker function.
  * @ubi: UBI device description object
@@ -620,13 +756,13 @@ static int schedule_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
  *
  * This function copies a more worn out physical eraseblock to a less worn out
  * one. Returns zero in case of success and a negative error code in case of
- * failure.
+ * failure. Only a move which was actually done is accounted as a done work.
  */
 static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 				int cancel)
 {
 	int err, scrubbing = 0, torture = 0, protect = 0, erroneous = 0;
-	int vol_id = -1, uninitialized_var(lnum);
+	int vol_id = -1, uninitialized_var(lnum), class = wrk->class;
 	struct ubi_wl_entry *e1, *e2;
 	struct ubi_vid_hdr *vid_hdr;
 
@@ -660,7 +796,13 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		goto out_cancel;
 	}
 
-	if (!ubi->scrub.rb_node) {
+	if (!ubi->scrub.rb_node && find_fm_anchor_move(ubi, &e1, &e2)) {
+		/* Free one of the first PEBs for the fastmap anchor */
+		self_check_in_wl_tree(ubi, e1, &ubi->used);
+		rb_erase(&e1->u.rb, &ubi->used);
+		dbg_wl("move PEB %d EC %d to PEB %d EC %d for the fastmap",
+		       e1->pnum, e1->ec, e2->pnum, e2->ec);
+	} else if (!ubi->scrub.rb_node) {
 		/*
 		 * Now pick the least worn-out used physical eraseblock and a
 		 * highly worn-out free physical eraseblock. If the erase
@@ -796,6 +938,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		ubi_msg("scrubbed PEB %d (LEB %d:%d), data moved to PEB %d",
 			e1->pnum, vol_id, lnum, e2->pnum);
 	ubi_free_vid_hdr(ubi, vid_hdr);
+	work_done(ubi, class);
 
 	spin_lock(&ubi->wl_lock);
 	if (!ubi->move_to_put) {
@@ -908,21 +1051,48 @@ out_cancel:
  */
 static int ensure_wear_leveling(struct ubi_device *ubi)
 {
-	int err = 0;
+	int err = 0, class = UBI_WORK_SCRUB;
 	struct ubi_wl_entry *e1;
 	struct ubi_wl_entry *e2;
 	struct ubi_work *wrk;
 
 	spin_lock(&ubi->wl_lock);
-	if (ubi->wl_scheduled)
-		/* Wear-leveling is already in the work queue */
+	if (ubi->wl_scheduled) {
+		/*
+		 * Wear-leveling is already in the work queue. If it waits as
+		 * a wear-leveling or fastmap anchor work, but there is
+		 * something to scrub now, the worker will scrub first. Make it
+		 * a scrubbing work, which is not postponed.
+		 */
+		class = list_empty(&ubi->works[UBI_WORK_WL]) ?
+			UBI_WORK_FM_ANCHOR : UBI_WORK_WL;
+		if (ubi->scrub.rb_node && !list_empty(&ubi->works[class])) {
+			wrk = list_first_entry(&ubi->works[class],
+					       struct ubi_work, list);
+			list_move_tail(&wrk->list,
+				       &ubi->works[UBI_WORK_SCRUB]);
+			ubi->works_pending[class] -= 1;
+			ubi->works_pending[UBI_WORK_SCRUB] += 1;
+			wrk->class = UBI_WORK_SCRUB;
+			if (ubi->thread_enabled &&
+			    !ubi_dbg_is_bgt_disabled(ubi))
+				wake_up_process(ubi->bgt_thread);
+		}
 		goto out_unlock;
+	}
 
 	/*
 	 * If the ubi->scrub tree is not empty, scrubbing is needed, and the
-	 * the WL worker has to be scheduled anyway.
+	 * the WL worker has to be scheduled anyway. The same is true if a PEB
+	 * has to be moved to free the fastmap anchor.
 	 */
-	if (!ubi->scrub.rb_node) {
+	if (ubi->scrub.rb_node)
+		dbg_wl("schedule scrubbing");
+	else if (find_fm_anchor_move(ubi, &e1, &e2)) {
+		dbg_wl("schedule moving PEB %d for the fastmap anchor",
+		       e1->pnum);
+		class = UBI_WORK_FM_ANCHOR;
+	} else {
 		if (!ubi->used.rb_node || !ubi->free.rb_node)
 			/* No physical eraseblocks - no deal */
 			goto out_unlock;
@@ -939,8 +1109,8 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD))
 			goto out_unlock;
 		dbg_wl("schedule wear-leveling");
-	} else
-		dbg_wl("schedule scrubbing");
+		class = UBI_WORK_WL;
+	}
 
 	ubi->wl_scheduled = 1;
 	spin_unlock(&ubi->wl_lock);
@@ -952,6 +1122,7 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 	}
 
 	wrk->func = &wear_leveling_worker;
+	wrk->class = class;
 	schedule_ubi_work(ubi, wrk);
 	return err;
 
@@ -996,9 +1167,11 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 	if (!err) {
 		/* Fine, we've erased it successfully */
 		kfree(wl_wrk);
+		work_done(ubi, UBI_WORK_ERASE);
 
 		spin_lock(&ubi->wl_lock);
-		wl_tree_add(e, &ubi->free);
+		if (!give_fm_anchor(ubi, e))
+			wl_tree_add(e, &ubi->free);
 		spin_unlock(&ubi->wl_lock);
 
 		/*
@@ -1264,16 +1437,19 @@ int ubi_wl_flush(struct ubi_device *ubi, int vol_id, int lnum)
 
 	while (found) {
 		struct ubi_work *wrk;
+		int i;
 		found = 0;
 
 		down_read(&ubi->work_sem);
 		spin_lock(&ubi->wl_lock);
-		list_for_each_entry(wrk, &ubi->works, list) {
-			if ((vol_id == UBI_ALL || wrk->vol_id == vol_id) &&
-			    (lnum == UBI_ALL || wrk->lnum == lnum)) {
-				list_del(&wrk->list);
-				ubi->works_count -= 1;
-				ubi_assert(ubi->works_count >= 0);
+		for (i = 0; i < UBI_WORK_CLASSES && !found; i++)
+			list_for_each_entry(wrk, &ubi->works[i], list) {
+				if ((vol_id != UBI_ALL &&
+				     wrk->vol_id != vol_id) ||
+				    (lnum != UBI_ALL && wrk->lnum != lnum))
+					continue;
+
+				dequeue_work(ubi, wrk);
 				spin_unlock(&ubi->wl_lock);
 
 				err = wrk->func(ubi, wrk, 0);
@@ -1286,7 +1462,6 @@ int ubi_wl_flush(struct ubi_device *ubi, int vol_id, int lnum)
 				found = 1;
 				break;
 			}
-		}
 		spin_unlock(&ubi->wl_lock);
 		up_read(&ubi->work_sem);
 	}
@@ -1301,6 +1476,116 @@ int ubi_wl_flush(struct ubi_device *ubi, int vol_id, int lnum)
 	return err;
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * ubi_wl_get_fm_peb - take a free physical eraseblock for the fastmap.
+ * @ubi: UBI device description object
+ * @max_pnum: the physical eraseblock number has to be lower than this
+ * @ec: the erase counter of the physical eraseblock is returned here
+ *
+ * This function takes the least worn out free physical eraseblock with number
+ * lower than @max_pnum out of the WL sub-system. The caller owns it from now
+ * on. Returns the physical eraseblock number in case of success and %-ENOSPC
+ * if there is no suitable free physical eraseblock.
+ */
+int ubi_wl_get_fm_peb(struct ubi_device *ubi, int max_pnum, int *ec)
+{
+	int pnum;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		if (e->pnum < max_pnum)
+			break;
+	if (!rb) {
+		spin_unlock(&ubi->wl_lock);
+		return -ENOSPC;
+	}
+
+	self_check_in_wl_tree(ubi, e, &ubi->free);
+	rb_erase(&e->u.rb, &ubi->free);
+	ubi->lookuptbl[e->pnum] = NULL;
+	spin_unlock(&ubi->wl_lock);
+
+	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
+	pnum = e->pnum;
+	*ec = e->ec;
+	kmem_cache_free(ubi_wl_entry_slab, e);
+	return pnum;
+}
+
+/**
+ * ubi_wl_swap_fm_peb - replace a worn out fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @pnum: the fastmap physical eraseblock, erased and with an EC header
+ * @ec: erase counter of @pnum, the erase counter of the returned physical
+ *      eraseblock is stored here
+ * @max_pnum: the new physical eraseblock number has to be lower than this
+ *
+ * The fastmap physical eraseblocks are erased every time the fastmap is
+ * written, so they wear out faster than the others. If there is a free
+ * physical eraseblock with number lower than @max_pnum and an erase counter
+ * lower than @ec by more than the WL threshold, this function gives @pnum to
+ * the WL sub-system as a free physical eraseblock and returns the other one
+ * instead. Otherwise @pnum is returned.
+ */
+int ubi_wl_swap_fm_peb(struct ubi_device *ubi, int pnum, int *ec,
+		       int max_pnum)
+{
+	int new_pnum;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb) {
+		if (e->ec + UBI_WL_THRESHOLD >= *ec) {
+			/* The free tree is sorted by erase counter */
+			rb = NULL;
+			break;
+		}
+		if (e->pnum < max_pnum)
+			break;
+	}
+	if (!rb) {
+		spin_unlock(&ubi->wl_lock);
+		return pnum;
+	}
+
+	dbg_wl("replace fastmap PEB %d EC %d by PEB %d EC %d",
+	       pnum, *ec, e->pnum, e->ec);
+	rb_erase(&e->u.rb, &ubi->free);
+	ubi->lookuptbl[e->pnum] = NULL;
+	new_pnum = e->pnum;
+	swap(e->ec, *ec);
+	e->pnum = pnum;
+	wl_tree_add(e, &ubi->free);
+	ubi->lookuptbl[pnum] = e;
+	spin_unlock(&ubi->wl_lock);
+
+	return new_pnum;
+}
+
+/**
+ * ubi_wl_produce_fm_anchor - free a physical eraseblock for the fastmap anchor.
+ * @ubi: UBI device description object
+ *
+ * This function is called when none of the first %UBI_FM_MAX_START PEBs is
+ * free. It makes the WL sub-system move one of them away, and the fastmap
+ * takes it as its anchor once it has been erased. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+int ubi_wl_produce_fm_anchor(struct ubi_device *ubi)
+{
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_anchor_wanted = 1;
+	spin_unlock(&ubi->wl_lock);
+
+	dbg_wl("free a PEB for the fastmap anchor");
+	return ensure_wear_leveling(ubi);
+}
+#endif
+
 /**
  * tree_destroy - destroy an RB-tree.
  * @root: the root of the tree to destroy
@@ -1332,6 +1617,72 @@ static void tree_destroy(struct rb_root *root)
 	}
 }
 
+/**
+ * wl_urgent - check if wear-leveling has to be done right away.
+ * @ubi: UBI device description object
+ *
+ * Caller has to hold @ubi->wl_lock.
+ */
+static int wl_urgent(struct ubi_device *ubi)
+{
+	struct ubi_wl_entry *e1, *e2;
+
+	if (!ubi->used.rb_node || !ubi->free.rb_node)
+		return 0;
+
+	e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
+	e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+	return e2->ec - e1->ec >= WL_URGENT_DIFF;
+}
+
+/**
+ * bgt_delay - find out when the background thread may do the next work.
+ * @ubi: UBI device description object
+ *
+ * Erasures are done right away. Scrubbing, fastmap anchor moves and
+ * wear-leveling wait for the rate limit, and wear-leveling also waits until
+ * LEBs have not been changed for @ubi->bgt_idle_ms, unless it is urgent.
+ * Returns how many jiffies to wait before doing the next pending work, or zero
+ * if it may be done now. Caller has to hold @ubi->wl_lock.
+ */
+static long bgt_delay(struct ubi_device *ubi)
+{
+	struct ubi_work *wrk = next_work(ubi);
+	unsigned long now = jiffies, t = now, idle;
+
+	if (!wrk || wrk->class == UBI_WORK_ERASE)
+		return 0;
+
+	if (wrk->class == UBI_WORK_WL && wl_urgent(ubi))
+		return 0;
+
+	if (ubi->bgt_rate_limit && time_after(ubi->bgt_next, t))
+		t = ubi->bgt_next;
+
+	if (wrk->class == UBI_WORK_WL && ubi->bgt_idle_ms) {
+		idle = ubi->last_write + msecs_to_jiffies(ubi->bgt_idle_ms);
+		if (time_after(idle, t))
+			t = idle;
+	}
+
+	return t - now;
+}
+
+/**
+ * ubi_wl_wake_bgt - wake up the background thread.
+ * @ubi: UBI device description object
+ *
+ * This function is called when the scheduling parameters of the background
+ * thread change, so that it re-considers a postponed work.
+ */
+void ubi_wl_wake_bgt(struct ubi_device *ubi)
+{
+	spin_lock(&ubi->wl_lock);
+	if (ubi->thread_enabled && !ubi_dbg_is_bgt_disabled(ubi))
+		wake_up_process(ubi->bgt_thread);
+	spin_unlock(&ubi->wl_lock);
+}
+
 /**
  * ubi_thread - UBI background thread.
  * @u: the UBI device description object pointer
@@ -1347,6 +1698,7 @@ int ubi_thread(void *u)
 	set_freezable();
 	for (;;) {
 		int err;
+		long delay;
 
 		if (kthread_should_stop())
 			break;
@@ -1355,13 +1707,21 @@ int ubi_thread(void *u)
 			continue;
 
 		spin_lock(&ubi->wl_lock);
-		if (list_empty(&ubi->works) || ubi->ro_mode ||
+		if (!ubi->works_count || ubi->ro_mode ||
 		    !ubi->thread_enabled || ubi_dbg_is_bgt_disabled(ubi)) {
 			set_current_state(TASK_INTERRUPTIBLE);
 			spin_unlock(&ubi->wl_lock);
 			schedule();
 			continue;
 		}
+
+		delay = bgt_delay(ubi);
+		if (delay > 0) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			spin_unlock(&ubi->wl_lock);
+			schedule_timeout(delay);
+			continue;
+		}
 		spin_unlock(&ubi->wl_lock);
 
 		err = do_work(ubi);
@@ -1395,14 +1755,11 @@ int ubi_thread(void *u)
  */
 static void cancel_pending(struct ubi_device *ubi)
 {
-	while (!list_empty(&ubi->works)) {
-		struct ubi_work *wrk;
+	struct ubi_work *wrk;
 
-		wrk = list_entry(ubi->works.next, struct ubi_work, list);
-		list_del(&wrk->list);
+	while ((wrk = next_work(ubi))) {
+		dequeue_work(ubi, wrk);
 		wrk->func(ubi, wrk, 1);
-		ubi->works_count -= 1;
-		ubi_assert(ubi->works_count >= 0);
 	}
 }
 
@@ -1427,7 +1784,9 @@ int ubi_wl_init(struct ubi_device *ubi, struct ubi_attach_info *ai)
 	mutex_init(&ubi->move_mutex);
 	init_rwsem(&ubi->work_sem);
 	ubi->max_ec = ai->max_ec;
-	INIT_LIST_HEAD(&ubi->works);
+	for (i = 0; i < UBI_WORK_CLASSES; i++)
+		INIT_LIST_HEAD(&ubi->works[i]);
+	ubi->last_write = ubi->bgt_next = jiffies;
 
 	sprintf(ubi->bgt_name, UBI_BGT_NAME_PATTERN, ubi->ubi_num);
 
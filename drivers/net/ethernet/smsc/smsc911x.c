@@ -59,8 +59,14 @@
 #include <linux/of_device.h>
 #include <linux/of_gpio.h>
 #include <linux/of_net.h>
+#include <linux/dma-mapping.h>
 #include "smsc911x.h"
 
+#ifdef CONFIG_ARCH_OMAP2PLUS
+#include <plat/dma.h>
+#define SMSC_USE_OMAP_DMA
+#endif
+
 #define SMSC_CHIPNAME		"smsc911x"
 #define SMSC_MDIONAME		"smsc911x-mdio"
 #define SMSC_DRV_VERSION	"2008-10-21"
@@ -78,6 +84,14 @@ static int debug = 3;
 module_param(debug, int, 0);
 MODULE_PARM_DESC(debug, "Debug level (0=none,...,16=all)");
 
+#ifdef SMSC_USE_OMAP_DMA
+static int dma_threshold = 256;
+
+module_param(dma_threshold, int, 0644);
+MODULE_PARM_DESC(dma_threshold,
+		 "Smallest frame in bytes moved by FIFO DMA (0=PIO only)");
+#endif
+
 struct smsc911x_data;
 
 struct smsc911x_ops {
@@ -142,6 +156,30 @@ struct smsc911x_data {
 	/* register access functions */
 	const struct smsc911x_ops *ops;
 
+	/* RX interrupt coalescing, see smsc911x_ethtool_set_coalesce() */
+	struct ethtool_coalesce coal;
+	unsigned int rx_frames;		/* in effect, adaptive mode picks */
+	unsigned int rx_usecs;		/* them from the low/high sets */
+	unsigned int rx_holdoff;	/* waiting for rx_frames or the GPT */
+	unsigned long rate_stamp;	/* adaptive rate sample start */
+	unsigned int rate_packets;
+
+#ifdef SMSC_USE_OMAP_DMA
+	/* FIFO DMA, channels are -1 when the FIFOs are moved by PIO only */
+	resource_size_t phys;
+	int rx_dma_ch;
+	int tx_dma_ch;
+	struct sk_buff *rx_dma_skb;	/* frame being read by DMA */
+	dma_addr_t rx_dma_addr;
+	unsigned int rx_dma_len;
+	unsigned int rx_dma_pktlength;
+	int rx_dma_status;		/* -EINPROGRESS until the callback */
+	struct sk_buff *tx_dma_skb;	/* frame being written by DMA */
+	dma_addr_t tx_dma_addr;
+	unsigned int tx_dma_len;
+	unsigned int tx_dma_failed;	/* the FIFO holds a partial frame */
+#endif
+
 	/* regulators */
 	struct regulator_bulk_data supplies[SMSC911X_NUM_SUPPLIES];
 };
@@ -236,6 +274,19 @@ static inline void smsc911x_reg_write(struct smsc911x_data *pdata, u32 reg,
 	spin_unlock_irqrestore(&pdata->dev_lock, flags);
 }
 
+/* Read-modify-write of a register shared by several contexts */
+static void smsc911x_reg_update(struct smsc911x_data *pdata, u32 reg,
+				u32 mask, u32 val)
+{
+	unsigned long flags;
+	u32 temp;
+
+	spin_lock_irqsave(&pdata->dev_lock, flags);
+	temp = pdata->ops->reg_read(pdata, reg);
+	pdata->ops->reg_write(pdata, reg, (temp & ~mask) | val);
+	spin_unlock_irqrestore(&pdata->dev_lock, flags);
+}
+
 /* Writes a packet to the TX_DATA_FIFO */
 static inline void
 smsc911x_tx_writefifo(struct smsc911x_data *pdata, unsigned int *buf,
@@ -1102,13 +1153,24 @@ static unsigned int smsc911x_tx_get_txstatcount(struct smsc911x_data *pdata)
 		& TX_FIFO_INF_TSUSED_) >> 16;
 }
 
-/* Reads tx statuses and increments counters where necessary */
+/* Drains the tx status FIFO, increments counters where necessary and
+ * reports the completed frames to BQL. Runs from the NAPI poll, or once
+ * NAPI is disabled. */
 static void smsc911x_tx_update_txcounters(struct net_device *dev)
 {
 	struct smsc911x_data *pdata = netdev_priv(dev);
-	unsigned int tx_stat;
+	unsigned int pkts = 0, bytes = 0;
+	unsigned int count, tx_stat;
+	unsigned long flags;
 
-	while ((tx_stat = smsc911x_tx_get_txstatus(pdata)) != 0) {
+	count = smsc911x_tx_get_txstatcount(pdata);
+	if (!count)
+		return;
+
+	/* Statuses are read back to back under a single lock hold */
+	spin_lock_irqsave(&pdata->dev_lock, flags);
+	while (count--) {
+		tx_stat = pdata->ops->reg_read(pdata, TX_STATUS_FIFO);
 		if (unlikely(tx_stat & 0x80000000)) {
 			/* In this driver the packet tag is used as the packet
 			 * length. Since a packet length can never reach the
@@ -1119,6 +1181,8 @@ static void smsc911x_tx_update_txcounters(struct net_device *dev)
 			 */
 			SMSC_WARN(pdata, hw, "Packet tag reserved bit is high");
 		} else {
+			pkts++;
+			bytes += tx_stat >> 16;
 			if (unlikely(tx_stat & TX_STS_ES_)) {
 				dev->stats.tx_errors++;
 			} else {
@@ -1140,6 +1204,9 @@ static void smsc911x_tx_update_txcounters(struct net_device *dev)
 			}
 		}
 	}
+	spin_unlock_irqrestore(&pdata->dev_lock, flags);
+
+	netdev_completed_queue(dev, pkts, bytes);
 }
 
 /* Increments the Rx error counters */
@@ -1187,6 +1254,450 @@ smsc911x_rx_fastforward(struct smsc911x_data *pdata, unsigned int pktwords)
 	}
 }
 
+/* Hands a received frame to the stack */
+static void smsc911x_rx_deliver(struct net_device *dev, struct sk_buff *skb,
+				unsigned int pktlength)
+{
+	/* Align IP on 16B boundary */
+	skb_reserve(skb, NET_IP_ALIGN);
+	skb_put(skb, pktlength - 4);
+	skb->protocol = eth_type_trans(skb, dev);
+	skb_checksum_none_assert(skb);
+	netif_receive_skb(skb);
+
+	/* Update counters */
+	dev->stats.rx_packets++;
+	dev->stats.rx_bytes += (pktlength - 4);
+}
+
+/* Stops the queue until the TX data FIFO has room for a full frame */
+static void smsc911x_tx_wait_space(struct smsc911x_data *pdata)
+{
+	netif_stop_queue(pdata->dev);
+	smsc911x_reg_update(pdata, FIFO_INT, FIFO_INT_TX_AVAIL_LEVEL_,
+			    0x32000000);
+}
+
+#ifdef SMSC_USE_OMAP_DMA
+/*
+ * FIFO DMA through the OMAP system DMA. Frames of at least dma_threshold
+ * bytes are moved between memory and the data FIFOs by a software
+ * triggered channel per direction while the CPU goes on. The GPMC
+ * prefetch engine is not used, it is a single engine owned by the NAND
+ * driver. RX completion reschedules NAPI, which hands the frame up, TX
+ * completion frees the skb and restarts the queue. Only 32 bit buses
+ * without software byte swapping qualify: on a 16 bit bus a DMA access
+ * could split the two halves of a register access made by the CPU.
+ */
+
+static struct device *smsc911x_dma_dev(struct smsc911x_data *pdata)
+{
+	return pdata->dev->dev.parent;
+}
+
+static dma_addr_t smsc911x_fifo_phys(struct smsc911x_data *pdata, u32 reg)
+{
+	return pdata->phys + __smsc_shift(pdata, reg);
+}
+
+static void smsc911x_rx_dma_callback(int lch, u16 ch_status, void *data)
+{
+	struct smsc911x_data *pdata = data;
+
+	pdata->rx_dma_status = (ch_status & OMAP_DMA_BLOCK_IRQ) ? 0 : -EIO;
+	smp_wmb();
+	napi_schedule(&pdata->napi);
+}
+
+static bool smsc911x_rx_dma_busy(struct smsc911x_data *pdata)
+{
+	return pdata->rx_dma_skb &&
+		ACCESS_ONCE(pdata->rx_dma_status) == -EINPROGRESS;
+}
+
+/* Returns 0 if the frame is being read by DMA, else the caller uses PIO */
+static int smsc911x_rx_dma_start(struct smsc911x_data *pdata,
+				 struct sk_buff *skb, unsigned int pktlength,
+				 unsigned int pktwords)
+{
+	struct device *dev = smsc911x_dma_dev(pdata);
+	unsigned int len = pktwords << 2;
+	dma_addr_t addr;
+
+	if (pdata->rx_dma_ch < 0 || !dma_threshold || len < dma_threshold)
+		return -EINVAL;
+
+	addr = dma_map_single(dev, skb->data, len, DMA_FROM_DEVICE);
+	if (dma_mapping_error(dev, addr))
+		return -ENOMEM;
+
+	pdata->rx_dma_skb = skb;
+	pdata->rx_dma_addr = addr;
+	pdata->rx_dma_len = len;
+	pdata->rx_dma_pktlength = pktlength;
+	pdata->rx_dma_status = -EINPROGRESS;
+
+	omap_set_dma_transfer_params(pdata->rx_dma_ch, OMAP_DMA_DATA_TYPE_S32,
+				     pktwords, 1, OMAP_DMA_SYNC_ELEMENT,
+				     OMAP_DMA_NO_DEVICE, 0);
+	omap_set_dma_src_params(pdata->rx_dma_ch, 0, OMAP_DMA_AMODE_CONSTANT,
+				smsc911x_fifo_phys(pdata, RX_DATA_FIFO), 0, 0);
+	omap_set_dma_dest_params(pdata->rx_dma_ch, 0, OMAP_DMA_AMODE_POST_INC,
+				 addr, 0, 0);
+	omap_start_dma(pdata->rx_dma_ch);
+	return 0;
+}
+
+/* Returns 1 if a frame read by DMA was completed, 0 if there was none and
+ * -EINPROGRESS while the DMA is still running */
+static int smsc911x_rx_dma_complete(struct smsc911x_data *pdata)
+{
+	struct net_device *dev = pdata->dev;
+	struct sk_buff *skb = pdata->rx_dma_skb;
+	int status;
+
+	if (!skb)
+		return 0;
+	status = ACCESS_ONCE(pdata->rx_dma_status);
+	if (status == -EINPROGRESS)
+		return -EINPROGRESS;
+	smp_rmb();
+
+	dma_unmap_single(smsc911x_dma_dev(pdata), pdata->rx_dma_addr,
+			 pdata->rx_dma_len, DMA_FROM_DEVICE);
+	pdata->rx_dma_skb = NULL;
+
+	if (unlikely(status)) {
+		/* Where the FIFO stands is unknown, drop its contents */
+		SMSC_WARN(pdata, rx_err, "RX DMA failed");
+		smsc911x_reg_write(pdata, RX_CFG,
+				   (NET_IP_ALIGN << 8) | RX_CFG_RX_DUMP_);
+		dev_kfree_skb(skb);
+		dev->stats.rx_dropped++;
+		return 1;
+	}
+
+	smsc911x_rx_deliver(dev, skb, pdata->rx_dma_pktlength);
+	return 1;
+}
+
+static void smsc911x_tx_dma_callback(int lch, u16 ch_status, void *data)
+{
+	struct smsc911x_data *pdata = data;
+	struct net_device *dev = pdata->dev;
+	struct sk_buff *skb = xchg(&pdata->tx_dma_skb, NULL);
+	unsigned int freespace;
+
+	/* Lost a race with smsc911x_dma_stop() */
+	if (!skb)
+		return;
+
+	dma_unmap_single(smsc911x_dma_dev(pdata), pdata->tx_dma_addr,
+			 pdata->tx_dma_len, DMA_TO_DEVICE);
+	dev_kfree_skb_irq(skb);
+
+	if (unlikely(!(ch_status & OMAP_DMA_BLOCK_IRQ))) {
+		SMSC_WARN(pdata, tx_err, "TX DMA failed, status 0x%04x",
+			  ch_status);
+		dev->stats.tx_errors++;
+		/* The FIFO holds part of a frame, the poll drops what is
+		 * queued and restarts the queue */
+		pdata->tx_dma_failed = 1;
+		smp_wmb();
+		napi_schedule(&pdata->napi);
+		return;
+	}
+
+	freespace = smsc911x_reg_read(pdata, TX_FIFO_INF) & TX_FIFO_INF_TDFREE_;
+	if (freespace < TX_FIFO_LOW_THRESHOLD)
+		smsc911x_tx_wait_space(pdata);
+	else
+		netif_wake_queue(dev);
+}
+
+static bool smsc911x_tx_dma_busy(struct smsc911x_data *pdata)
+{
+	return ACCESS_ONCE(pdata->tx_dma_skb) != NULL;
+}
+
+/* Recovers from a failed TX DMA. Dumping the data FIFO also drops the
+ * frames queued before the failed one, which then never get a status, so
+ * the transmitter is stopped first, the statuses of the frames it sent are
+ * drained and BQL starts over from an empty FIFO. */
+static void smsc911x_tx_dma_reclaim(struct smsc911x_data *pdata)
+{
+	struct net_device *dev = pdata->dev;
+	unsigned int timeout;
+
+	if (!xchg(&pdata->tx_dma_failed, 0))
+		return;
+
+	/* Let the frame on the wire finish, up to 1518 bytes at 10Mbps */
+	smsc911x_reg_write(pdata, TX_CFG, TX_CFG_STOP_TX_);
+	for (timeout = 0; timeout < 2000; timeout++) {
+		if (smsc911x_reg_read(pdata, INT_STS) & INT_STS_TXSTOP_INT_)
+			break;
+		udelay(1);
+	}
+	if (timeout == 2000)
+		SMSC_WARN(pdata, tx_err, "Timed out waiting for TX to stop");
+	smsc911x_reg_write(pdata, INT_STS, INT_STS_TXSTOP_INT_);
+
+	smsc911x_reg_write(pdata, TX_CFG, TX_CFG_TXD_DUMP_);
+	smsc911x_tx_update_txcounters(dev);
+	netdev_reset_queue(dev);
+
+	smsc911x_reg_write(pdata, TX_CFG, TX_CFG_TX_ON_);
+	netif_wake_queue(dev);
+}
+
+/* Returns 0 if the frame is being written by DMA, else the caller uses PIO.
+ * The queue stays stopped until the DMA is done, frames must reach the
+ * FIFO in order. */
+static int smsc911x_tx_dma_start(struct smsc911x_data *pdata,
+				 struct sk_buff *skb, ulong bufp,
+				 unsigned int wrsz)
+{
+	struct device *dev = smsc911x_dma_dev(pdata);
+	unsigned int len = wrsz << 2;
+	dma_addr_t addr;
+
+	if (pdata->tx_dma_ch < 0 || !dma_threshold || skb->len < dma_threshold)
+		return -EINVAL;
+
+	addr = dma_map_single(dev, (void *)bufp, len, DMA_TO_DEVICE);
+	if (dma_mapping_error(dev, addr))
+		return -ENOMEM;
+
+	pdata->tx_dma_addr = addr;
+	pdata->tx_dma_len = len;
+	netif_stop_queue(pdata->dev);
+	smp_wmb();
+	pdata->tx_dma_skb = skb;
+
+	/* Make sure the command words written by the CPU are in the chip
+	 * before the DMA writes the data */
+	smsc911x_reg_read(pdata, TX_FIFO_INF);
+
+	omap_set_dma_transfer_params(pdata->tx_dma_ch, OMAP_DMA_DATA_TYPE_S32,
+				     wrsz, 1, OMAP_DMA_SYNC_ELEMENT,
+				     OMAP_DMA_NO_DEVICE, 0);
+	omap_set_dma_src_params(pdata->tx_dma_ch, 0, OMAP_DMA_AMODE_POST_INC,
+				addr, 0, 0);
+	omap_set_dma_dest_params(pdata->tx_dma_ch, 0, OMAP_DMA_AMODE_CONSTANT,
+				 smsc911x_fifo_phys(pdata, TX_DATA_FIFO), 0, 0);
+	omap_start_dma(pdata->tx_dma_ch);
+	return 0;
+}
+
+/* Abandons transfers in flight, NAPI and the queue must be stopped */
+static void smsc911x_dma_stop(struct smsc911x_data *pdata)
+{
+	struct device *dev = smsc911x_dma_dev(pdata);
+	struct sk_buff *skb;
+
+	if (pdata->rx_dma_skb) {
+		omap_stop_dma(pdata->rx_dma_ch);
+		dma_unmap_single(dev, pdata->rx_dma_addr, pdata->rx_dma_len,
+				 DMA_FROM_DEVICE);
+		dev_kfree_skb(pdata->rx_dma_skb);
+		pdata->rx_dma_skb = NULL;
+	}
+
+	if (pdata->tx_dma_ch >= 0)
+		omap_stop_dma(pdata->tx_dma_ch);
+	skb = xchg(&pdata->tx_dma_skb, NULL);
+	if (skb) {
+		dma_unmap_single(dev, pdata->tx_dma_addr, pdata->tx_dma_len,
+				 DMA_TO_DEVICE);
+		dev_kfree_skb(skb);
+	}
+	pdata->tx_dma_failed = 0;
+}
+
+static void smsc911x_dma_init(struct smsc911x_data *pdata,
+			      resource_size_t phys)
+{
+	struct device *dev = smsc911x_dma_dev(pdata);
+	unsigned int flags = pdata->config.flags;
+
+	pdata->phys = phys;
+	pdata->rx_dma_ch = -1;
+	pdata->tx_dma_ch = -1;
+
+	if (!(flags & SMSC911X_USE_DMA))
+		return;
+
+	if (!(flags & SMSC911X_USE_32BIT) || (flags & SMSC911X_SWAP_FIFO)) {
+		dev_warn(dev, "FIFO DMA needs a 32 bit bus, using PIO\n");
+		return;
+	}
+
+	if (omap_request_dma(OMAP_DMA_NO_DEVICE, "smsc911x rx",
+			     smsc911x_rx_dma_callback, pdata,
+			     &pdata->rx_dma_ch)) {
+		pdata->rx_dma_ch = -1;
+		goto fail;
+	}
+	if (omap_request_dma(OMAP_DMA_NO_DEVICE, "smsc911x tx",
+			     smsc911x_tx_dma_callback, pdata,
+			     &pdata->tx_dma_ch)) {
+		omap_free_dma(pdata->rx_dma_ch);
+		pdata->rx_dma_ch = -1;
+		pdata->tx_dma_ch = -1;
+		goto fail;
+	}
+
+	/* Burst on the memory side, the FIFO is a single address */
+	omap_set_dma_dest_burst_mode(pdata->rx_dma_ch, OMAP_DMA_DATA_BURST_16);
+	omap_set_dma_src_burst_mode(pdata->tx_dma_ch, OMAP_DMA_DATA_BURST_16);
+
+	dev_info(dev, "FIFO DMA on channels %d (rx) and %d (tx)\n",
+		 pdata->rx_dma_ch, pdata->tx_dma_ch);
+	return;
+
+fail:
+	dev_warn(dev, "no DMA channel available, using PIO\n");
+}
+
+static void smsc911x_dma_free(struct smsc911x_data *pdata)
+{
+	if (pdata->rx_dma_ch >= 0)
+		omap_free_dma(pdata->rx_dma_ch);
+	if (pdata->tx_dma_ch >= 0)
+		omap_free_dma(pdata->tx_dma_ch);
+	pdata->rx_dma_ch = -1;
+	pdata->tx_dma_ch = -1;
+}
+#else
+static inline bool smsc911x_rx_dma_busy(struct smsc911x_data *pdata)
+{
+	return false;
+}
+
+static inline int smsc911x_rx_dma_start(struct smsc911x_data *pdata,
+		struct sk_buff *skb, unsigned int pktlength,
+		unsigned int pktwords)
+{
+	return -EINVAL;
+}
+
+static inline int smsc911x_rx_dma_complete(struct smsc911x_data *pdata)
+{
+	return 0;
+}
+
+static inline bool smsc911x_tx_dma_busy(struct smsc911x_data *pdata)
+{
+	return false;
+}
+
+static inline void smsc911x_tx_dma_reclaim(struct smsc911x_data *pdata)
+{
+}
+
+static inline int smsc911x_tx_dma_start(struct smsc911x_data *pdata,
+		struct sk_buff *skb, ulong bufp, unsigned int wrsz)
+{
+	return -EINVAL;
+}
+
+static inline void smsc911x_dma_stop(struct smsc911x_data *pdata)
+{
+}
+
+static inline void smsc911x_dma_init(struct smsc911x_data *pdata,
+				     resource_size_t phys)
+{
+}
+
+static inline void smsc911x_dma_free(struct smsc911x_data *pdata)
+{
+}
+#endif /* SMSC_USE_OMAP_DMA */
+
+/*
+ * RX interrupt coalescing. The first frame after a poll raises RSFL as
+ * usual. With rx_frames above one the interrupt handler then raises the
+ * RX status level to rx_frames - 1 and starts the general purpose timer
+ * for rx_usecs instead of polling, so the poll happens once rx_frames
+ * are in or the timer expires, whichever is first. INT_DEAS additionally
+ * keeps the interrupt line quiet for rx_coalesce_usecs_irq after each
+ * interrupt. In adaptive mode the poll measures the frame rate and
+ * switches between the low, normal and high settings.
+ */
+
+#define SMSC_GPT_TICK_US	100	/* general purpose timer tick */
+#define SMSC_DEAS_TICK_US	10	/* INT_DEAS tick */
+#define SMSC_COAL_MAX_FRAMES	32	/* keeps full frames within the FIFO */
+
+static void smsc911x_rx_holdoff_start(struct smsc911x_data *pdata)
+{
+	unsigned int ticks = DIV_ROUND_UP(pdata->rx_usecs, SMSC_GPT_TICK_US);
+
+	pdata->rx_holdoff = 1;
+	smsc911x_reg_update(pdata, FIFO_INT, FIFO_INT_RX_STS_LEVEL_,
+			    pdata->rx_frames - 1);
+	smsc911x_reg_write(pdata, INT_STS, INT_STS_RSFL_);
+	smsc911x_reg_write(pdata, GPT_CFG,
+			   GPT_CFG_TIMER_EN_ | clamp(ticks, 1U, 0xFFFFU));
+}
+
+static void smsc911x_rx_holdoff_end(struct smsc911x_data *pdata)
+{
+	if (!pdata->rx_holdoff)
+		return;
+	pdata->rx_holdoff = 0;
+	smsc911x_reg_write(pdata, GPT_CFG, 0);
+	smsc911x_reg_write(pdata, INT_STS, INT_STS_GPT_INT_);
+	smsc911x_reg_update(pdata, FIFO_INT, FIFO_INT_RX_STS_LEVEL_, 0);
+}
+
+/* Takes the settings in effect until the next rate sample */
+static void smsc911x_rx_coal_select(struct smsc911x_data *pdata,
+				    unsigned int rate)
+{
+	struct ethtool_coalesce *ec = &pdata->coal;
+
+	if (ec->use_adaptive_rx_coalesce && rate < ec->pkt_rate_low) {
+		pdata->rx_frames = ec->rx_max_coalesced_frames_low;
+		pdata->rx_usecs = ec->rx_coalesce_usecs_low;
+	} else if (ec->use_adaptive_rx_coalesce && rate > ec->pkt_rate_high) {
+		pdata->rx_frames = ec->rx_max_coalesced_frames_high;
+		pdata->rx_usecs = ec->rx_coalesce_usecs_high;
+	} else {
+		pdata->rx_frames = ec->rx_max_coalesced_frames;
+		pdata->rx_usecs = ec->rx_coalesce_usecs;
+	}
+}
+
+static void smsc911x_rx_coal_sample(struct smsc911x_data *pdata,
+				    int npackets)
+{
+	unsigned long elapsed = jiffies - pdata->rate_stamp;
+
+	pdata->rate_packets += npackets;
+	if (elapsed < pdata->coal.rate_sample_interval * HZ)
+		return;
+
+	smsc911x_rx_coal_select(pdata, pdata->rate_packets * HZ / elapsed);
+	pdata->rate_stamp = jiffies;
+	pdata->rate_packets = 0;
+}
+
+/* Leaves polling mode and unmasks the given status interrupts. The INT_STS
+ * and INT_EN bits are the same. Tx statuses that came in after the drain
+ * at the start of the poll may not raise TSFL again, so look once more. */
+static void smsc911x_poll_complete(struct smsc911x_data *pdata, u32 ints)
+{
+	smsc911x_reg_write(pdata, INT_STS, ints);
+	napi_complete(&pdata->napi);
+	smsc911x_reg_update(pdata, INT_EN, 0, ints);
+
+	if (smsc911x_tx_get_txstatcount(pdata))
+		napi_schedule(&pdata->napi);
+}
+
 /* NAPI poll function */
 static int smsc911x_poll(struct napi_struct *napi, int budget)
 {
@@ -1194,22 +1705,28 @@ static int smsc911x_poll(struct napi_struct *napi, int budget)
 		container_of(napi, struct smsc911x_data, napi);
 	struct net_device *dev = pdata->dev;
 	int npackets = 0;
+	int ret;
+
+	/* Tx completion is batched here rather than done per frame */
+	smsc911x_tx_update_txcounters(dev);
+	smsc911x_tx_dma_reclaim(pdata);
+
+	/* Finish the frame the DMA callback rescheduled us for */
+	ret = smsc911x_rx_dma_complete(pdata);
+	if (ret > 0)
+		npackets++;
 
-	while (npackets < budget) {
+	while (ret != -EINPROGRESS && npackets < budget) {
 		unsigned int pktlength;
 		unsigned int pktwords;
 		struct sk_buff *skb;
 		unsigned int rxstat = smsc911x_rx_get_rxstatus(pdata);
 
 		if (!rxstat) {
-			unsigned int temp;
 			/* We processed all packets available.  Tell NAPI it can
-			 * stop polling then re-enable rx interrupts */
-			smsc911x_reg_write(pdata, INT_STS, INT_STS_RSFL_);
-			napi_complete(napi);
-			temp = smsc911x_reg_read(pdata, INT_EN);
-			temp |= INT_EN_RSFL_EN_;
-			smsc911x_reg_write(pdata, INT_EN, temp);
+			 * stop polling then re-enable rx and tx interrupts */
+			smsc911x_poll_complete(pdata,
+					       INT_STS_RSFL_ | INT_STS_TSFL_);
 			break;
 		}
 
@@ -1241,21 +1758,30 @@ static int smsc911x_poll(struct napi_struct *napi, int budget)
 			break;
 		}
 
+		ret = smsc911x_rx_dma_start(pdata, skb, pktlength, pktwords);
+		if (!ret) {
+			/* Counted when the DMA is done, in a later poll */
+			npackets--;
+			ret = -EINPROGRESS;
+			break;
+		}
+
 		pdata->ops->rx_readfifo(pdata,
 				 (unsigned int *)skb->data, pktwords);
+		smsc911x_rx_deliver(dev, skb, pktlength);
+	}
 
-		/* Align IP on 16B boundary */
-		skb_reserve(skb, NET_IP_ALIGN);
-		skb_put(skb, pktlength - 4);
-		skb->protocol = eth_type_trans(skb, dev);
-		skb_checksum_none_assert(skb);
-		netif_receive_skb(skb);
-
-		/* Update counters */
-		dev->stats.rx_packets++;
-		dev->stats.rx_bytes += (pktlength - 4);
+	if (ret == -EINPROGRESS) {
+		/* Rx interrupts stay disabled, the DMA callback schedules
+		 * the next poll */
+		smsc911x_poll_complete(pdata, INT_STS_TSFL_);
+		if (!smsc911x_rx_dma_busy(pdata))
+			napi_schedule(napi);
 	}
 
+	if (pdata->coal.use_adaptive_rx_coalesce)
+		smsc911x_rx_coal_sample(pdata, npackets);
+
 	/* Return total received packets */
 	return npackets;
 }
@@ -1497,8 +2023,9 @@ static int smsc911x_open(struct net_device *dev)
 	smsc911x_reg_write(pdata, INT_EN, 0);
 	smsc911x_reg_write(pdata, INT_STS, 0xFFFFFFFF);
 
-	/* Set interrupt deassertion to 100uS */
-	intcfg = ((10 << 24) | INT_CFG_IRQ_EN_);
+	/* Set the interrupt deassertion interval */
+	intcfg = ((pdata->coal.rx_coalesce_usecs_irq / SMSC_DEAS_TICK_US) << 24)
+		| INT_CFG_IRQ_EN_;
 
 	if (pdata->config.irq_polarity) {
 		SMSC_TRACE(pdata, ifup, "irq polarity: active high");
@@ -1555,19 +2082,27 @@ static int smsc911x_open(struct net_device *dev)
 	temp |= HW_CFG_SF_;
 	smsc911x_reg_write(pdata, HW_CFG, temp);
 
+	/* Status levels of zero: RSFL and TSFL fire on the first status */
 	temp = smsc911x_reg_read(pdata, FIFO_INT);
 	temp |= FIFO_INT_TX_AVAIL_LEVEL_;
-	temp &= ~(FIFO_INT_RX_STS_LEVEL_);
+	temp &= ~(FIFO_INT_RX_STS_LEVEL_ | FIFO_INT_TX_STS_LEVEL_);
 	smsc911x_reg_write(pdata, FIFO_INT, temp);
 
 	/* set RX Data offset to 2 bytes for alignment */
 	smsc911x_reg_write(pdata, RX_CFG, (NET_IP_ALIGN << 8));
 
+	/* the soft reset stopped the general purpose timer */
+	pdata->rx_holdoff = 0;
+	pdata->rate_stamp = jiffies;
+	pdata->rate_packets = 0;
+	smsc911x_rx_coal_select(pdata, 0);
+
 	/* enable NAPI polling before enabling RX interrupts */
 	napi_enable(&pdata->napi);
 
 	temp = smsc911x_reg_read(pdata, INT_EN);
-	temp |= (INT_EN_TDFA_EN_ | INT_EN_RSFL_EN_ | INT_EN_RXSTOP_INT_EN_);
+	temp |= (INT_EN_TDFA_EN_ | INT_EN_RSFL_EN_ | INT_EN_RXSTOP_INT_EN_ |
+		 INT_EN_GPT_INT_EN_ | INT_EN_TSFL_EN_);
 	smsc911x_reg_write(pdata, INT_EN, temp);
 
 	spin_lock_irq(&pdata->mac_lock);
@@ -1578,6 +2113,7 @@ static int smsc911x_open(struct net_device *dev)
 
 	smsc911x_reg_write(pdata, TX_CFG, TX_CFG_TX_ON_);
 
+	netdev_reset_queue(dev);
 	netif_start_queue(dev);
 	return 0;
 }
@@ -1596,10 +2132,12 @@ static int smsc911x_stop(struct net_device *dev)
 	/* Stop Tx and Rx polling */
 	netif_stop_queue(dev);
 	napi_disable(&pdata->napi);
+	smsc911x_dma_stop(pdata);
 
 	/* At this point all Rx and Tx activity is stopped */
 	dev->stats.rx_dropped += smsc911x_reg_read(pdata, RX_DROP);
 	smsc911x_tx_update_txcounters(dev);
+	netdev_reset_queue(dev);
 
 	/* Bring the PHY down */
 	if (pdata->phy_dev)
@@ -1616,13 +2154,18 @@ static int smsc911x_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	unsigned int freespace;
 	unsigned int tx_cmd_a;
 	unsigned int tx_cmd_b;
-	unsigned int temp;
 	u32 wrsz;
 	ulong bufp;
 
+	bufp = (ulong)skb->data & (~0x3);
+	wrsz = (u32)skb->len + 3;
+	wrsz += (u32)((ulong)skb->data & 0x3);
+	wrsz >>= 2;
+
 	freespace = smsc911x_reg_read(pdata, TX_FIFO_INF) & TX_FIFO_INF_TDFREE_;
 
-	if (unlikely(freespace < TX_FIFO_LOW_THRESHOLD))
+	/* The queue is stopped before the FIFO gets this full */
+	if (unlikely(freespace < (wrsz << 2) + 8))
 		SMSC_WARN(pdata, tx_err,
 			  "Tx data fifo low, space available: %d", freespace);
 
@@ -1634,29 +2177,25 @@ static int smsc911x_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	tx_cmd_b = ((unsigned int)skb->len) << 16;
 	tx_cmd_b |= (unsigned int)skb->len;
 
+	skb_tx_timestamp(skb);
+
+	/* Accounted before the frame reaches the FIFO, its status can only
+	 * be drained after that */
+	netdev_sent_queue(dev, skb->len);
+
 	smsc911x_reg_write(pdata, TX_DATA_FIFO, tx_cmd_a);
 	smsc911x_reg_write(pdata, TX_DATA_FIFO, tx_cmd_b);
 
-	bufp = (ulong)skb->data & (~0x3);
-	wrsz = (u32)skb->len + 3;
-	wrsz += (u32)((ulong)skb->data & 0x3);
-	wrsz >>= 2;
+	/* The DMA completion frees the skb and restarts the queue */
+	if (!smsc911x_tx_dma_start(pdata, skb, bufp, wrsz))
+		return NETDEV_TX_OK;
 
 	pdata->ops->tx_writefifo(pdata, (unsigned int *)bufp, wrsz);
-	freespace -= (skb->len + 32);
-	skb_tx_timestamp(skb);
+	freespace -= (wrsz << 2) + 8;
 	dev_kfree_skb(skb);
 
-	if (unlikely(smsc911x_tx_get_txstatcount(pdata) >= 30))
-		smsc911x_tx_update_txcounters(dev);
-
-	if (freespace < TX_FIFO_LOW_THRESHOLD) {
-		netif_stop_queue(dev);
-		temp = smsc911x_reg_read(pdata, FIFO_INT);
-		temp &= 0x00FFFFFF;
-		temp |= 0x32000000;
-		smsc911x_reg_write(pdata, FIFO_INT, temp);
-	}
+	if (freespace < TX_FIFO_LOW_THRESHOLD)
+		smsc911x_tx_wait_space(pdata);
 
 	return NETDEV_TX_OK;
 }
@@ -1665,7 +2204,6 @@ static int smsc911x_hard_start_xmit(struct sk_buff *skb, struct net_device *dev)
 static struct net_device_stats *smsc911x_get_stats(struct net_device *dev)
 {
 	struct smsc911x_data *pdata = netdev_priv(dev);
-	smsc911x_tx_update_txcounters(dev);
 	dev->stats.rx_dropped += smsc911x_reg_read(pdata, RX_DROP);
 	return &dev->stats;
 }
@@ -1752,6 +2290,7 @@ static irqreturn_t smsc911x_irqhandler(int irq, void *dev_id)
 	u32 intsts = smsc911x_reg_read(pdata, INT_STS);
 	u32 inten = smsc911x_reg_read(pdata, INT_EN);
 	int serviced = IRQ_NONE;
+	bool poll = false;
 	u32 temp;
 
 	if (unlikely(intsts & inten & INT_STS_SW_INT_)) {
@@ -1775,11 +2314,12 @@ static irqreturn_t smsc911x_irqhandler(int irq, void *dev_id)
 	}
 
 	if (intsts & inten & INT_STS_TDFA_) {
-		temp = smsc911x_reg_read(pdata, FIFO_INT);
-		temp |= FIFO_INT_TX_AVAIL_LEVEL_;
-		smsc911x_reg_write(pdata, FIFO_INT, temp);
+		smsc911x_reg_update(pdata, FIFO_INT, FIFO_INT_TX_AVAIL_LEVEL_,
+				    FIFO_INT_TX_AVAIL_LEVEL_);
 		smsc911x_reg_write(pdata, INT_STS, INT_STS_TDFA_);
-		netif_wake_queue(dev);
+		/* A TX DMA in flight restarts the queue when done */
+		if (!smsc911x_tx_dma_busy(pdata))
+			netif_wake_queue(dev);
 		serviced = IRQ_HANDLED;
 	}
 
@@ -1789,20 +2329,32 @@ static irqreturn_t smsc911x_irqhandler(int irq, void *dev_id)
 		serviced = IRQ_HANDLED;
 	}
 
-	if (likely(intsts & inten & INT_STS_RSFL_)) {
-		if (likely(napi_schedule_prep(&pdata->napi))) {
-			/* Disable Rx interrupts */
-			temp = smsc911x_reg_read(pdata, INT_EN);
-			temp &= (~INT_EN_RSFL_EN_);
-			smsc911x_reg_write(pdata, INT_EN, temp);
-			/* Schedule a NAPI poll */
-			__napi_schedule(&pdata->napi);
+	/* Tx statuses are drained by the NAPI poll */
+	if (intsts & inten & INT_STS_TSFL_) {
+		poll = true;
+		serviced = IRQ_HANDLED;
+	}
+
+	if (likely(intsts & inten & (INT_STS_RSFL_ | INT_STS_GPT_INT_))) {
+		if (!poll && !pdata->rx_holdoff && pdata->rx_frames > 1) {
+			/* First frame since the last poll, wait for more */
+			smsc911x_rx_holdoff_start(pdata);
 		} else {
-			SMSC_WARN(pdata, rx_err, "napi_schedule_prep failed");
+			poll = true;
 		}
 		serviced = IRQ_HANDLED;
 	}
 
+	if (poll) {
+		smsc911x_rx_holdoff_end(pdata);
+		/* Disable Rx and Tx status interrupts, the poll may already
+		 * be scheduled by a DMA callback and unmasks them when done */
+		smsc911x_reg_update(pdata, INT_EN,
+				    INT_EN_RSFL_EN_ | INT_EN_TSFL_EN_, 0);
+		/* Schedule a NAPI poll */
+		napi_schedule(&pdata->napi);
+	}
+
 	return serviced;
 }
 
@@ -2053,6 +2605,78 @@ static int smsc911x_ethtool_set_eeprom(struct net_device *dev,
 	return ret;
 }
 
+static int smsc911x_ethtool_get_coalesce(struct net_device *dev,
+					 struct ethtool_coalesce *ec)
+{
+	struct smsc911x_data *pdata = netdev_priv(dev);
+	struct ethtool_coalesce *coal = &pdata->coal;
+
+	ec->rx_coalesce_usecs = coal->rx_coalesce_usecs;
+	ec->rx_max_coalesced_frames = coal->rx_max_coalesced_frames;
+	ec->rx_coalesce_usecs_irq = coal->rx_coalesce_usecs_irq;
+	ec->use_adaptive_rx_coalesce = coal->use_adaptive_rx_coalesce;
+	ec->pkt_rate_low = coal->pkt_rate_low;
+	ec->rx_coalesce_usecs_low = coal->rx_coalesce_usecs_low;
+	ec->rx_max_coalesced_frames_low = coal->rx_max_coalesced_frames_low;
+	ec->pkt_rate_high = coal->pkt_rate_high;
+	ec->rx_coalesce_usecs_high = coal->rx_coalesce_usecs_high;
+	ec->rx_max_coalesced_frames_high = coal->rx_max_coalesced_frames_high;
+	ec->rate_sample_interval = coal->rate_sample_interval;
+	return 0;
+}
+
+/* More than one frame needs the timer to pick up the last ones */
+static bool smsc911x_coal_valid(u32 frames, u32 usecs)
+{
+	if (frames < 1 || frames > SMSC_COAL_MAX_FRAMES)
+		return false;
+	if (usecs > 0xFFFF * SMSC_GPT_TICK_US)
+		return false;
+	return frames == 1 || usecs;
+}
+
+static int smsc911x_ethtool_set_coalesce(struct net_device *dev,
+					 struct ethtool_coalesce *ec)
+{
+	struct smsc911x_data *pdata = netdev_priv(dev);
+	struct ethtool_coalesce *coal = &pdata->coal;
+
+	if (ec->rx_coalesce_usecs_irq > 0xFF * SMSC_DEAS_TICK_US)
+		return -EINVAL;
+	if (!smsc911x_coal_valid(ec->rx_max_coalesced_frames,
+				 ec->rx_coalesce_usecs))
+		return -EINVAL;
+	if (ec->use_adaptive_rx_coalesce &&
+	    (!smsc911x_coal_valid(ec->rx_max_coalesced_frames_low,
+				  ec->rx_coalesce_usecs_low) ||
+	     !smsc911x_coal_valid(ec->rx_max_coalesced_frames_high,
+				  ec->rx_coalesce_usecs_high) ||
+	     ec->pkt_rate_low > ec->pkt_rate_high ||
+	     !ec->rate_sample_interval))
+		return -EINVAL;
+
+	coal->rx_coalesce_usecs = ec->rx_coalesce_usecs;
+	coal->rx_max_coalesced_frames = ec->rx_max_coalesced_frames;
+	coal->rx_coalesce_usecs_irq = ec->rx_coalesce_usecs_irq;
+	coal->use_adaptive_rx_coalesce = ec->use_adaptive_rx_coalesce;
+	coal->pkt_rate_low = ec->pkt_rate_low;
+	coal->rx_coalesce_usecs_low = ec->rx_coalesce_usecs_low;
+	coal->rx_max_coalesced_frames_low = ec->rx_max_coalesced_frames_low;
+	coal->pkt_rate_high = ec->pkt_rate_high;
+	coal->rx_coalesce_usecs_high = ec->rx_coalesce_usecs_high;
+	coal->rx_max_coalesced_frames_high = ec->rx_max_coalesced_frames_high;
+	coal->rate_sample_interval = ec->rate_sample_interval;
+
+	/* The interrupt handler only ever sees valid pairs */
+	smsc911x_rx_coal_select(pdata, 0);
+
+	if (netif_running(dev))
+		smsc911x_reg_update(pdata, INT_CFG, INT_CFG_INT_DEAS_,
+				    (coal->rx_coalesce_usecs_irq /
+				     SMSC_DEAS_TICK_US) << 24);
+	return 0;
+}
+
 static const struct ethtool_ops smsc911x_ethtool_ops = {
 	.get_settings = smsc911x_ethtool_getsettings,
 	.set_settings = smsc911x_ethtool_setsettings,
@@ -2066,6 +2690,8 @@ static const struct ethtool_ops smsc911x_ethtool_ops = {
 	.get_eeprom_len = smsc911x_ethtool_get_eeprom_len,
 	.get_eeprom = smsc911x_ethtool_get_eeprom,
 	.set_eeprom = smsc911x_ethtool_set_eeprom,
+	.get_coalesce = smsc911x_ethtool_get_coalesce,
+	.set_coalesce = smsc911x_ethtool_set_coalesce,
 	.get_ts_info = ethtool_op_get_ts_info,
 };
 
@@ -2218,6 +2844,17 @@ static int __devinit smsc911x_init(struct net_device *dev)
 	/* Disable all interrupt sources until we bring the device up */
 	smsc911x_reg_write(pdata, INT_EN, 0);
 
+	/* Interrupt per frame and 100us deassertion, as before coalescing
+	 * became tunable; the adaptive sets only apply once enabled */
+	pdata->coal.rx_max_coalesced_frames = 1;
+	pdata->coal.rx_coalesce_usecs_irq = 100;
+	pdata->coal.pkt_rate_low = 1000;
+	pdata->coal.rx_max_coalesced_frames_low = 1;
+	pdata->coal.pkt_rate_high = 8000;
+	pdata->coal.rx_max_coalesced_frames_high = 6;
+	pdata->coal.rx_coalesce_usecs_high = 500;
+	pdata->coal.rate_sample_interval = 1;
+
 	ether_setup(dev);
 	dev->flags |= IFF_MULTICAST;
 	netif_napi_add(dev, &pdata->napi, smsc911x_poll, SMSC_NAPI_WEIGHT);
@@ -2250,6 +2887,7 @@ static int __devexit smsc911x_drv_remove(struct platform_device *pdev)
 	platform_set_drvdata(pdev, NULL);
 	unregister_netdev(dev);
 	free_irq(dev->irq, dev);
+	smsc911x_dma_free(pdata);
 	res = platform_get_resource_byname(pdev, IORESOURCE_MEM,
 					   "smsc911x-memory");
 	if (!res)
@@ -2420,10 +3058,12 @@ static int __devinit smsc911x_drv_probe(struct platform_device *pdev)
 	if (pdata->config.shift)
 		pdata->ops = &shifted_smsc911x_ops;
 
+	smsc911x_dma_init(pdata, res->start);
+
 	retval = smsc911x_init(dev);
 	if (retval < 0) {
 		retval = -ENODEV;
-		goto out_disable_resources;
+		goto out_free_dma;
 	}
 
 	/* configure irq polarity and type before connecting isr */
@@ -2444,7 +3084,7 @@ static int __devinit smsc911x_drv_probe(struct platform_device *pdev)
 	if (retval) {
 		SMSC_WARN(pdata, probe,
 			  "Unable to claim requested irq: %d", dev->irq);
-		goto out_disable_resources;
+		goto out_free_dma;
 	}
 
 	retval = register_netdev(dev);
@@ -2501,6 +3141,8 @@ out_unregister_netdev_5:
 	unregister_netdev(dev);
 out_free_irq:
 	free_irq(dev->irq, dev);
+out_free_dma:
+	smsc911x_dma_free(pdata);
 out_disable_resources:
 	(void)smsc911x_disable_resources(pdev);
 out_enable_resources_fail:
@@ -0,0 +1,426 @@
+/*
+ * pps-dmtimer.c -- PPS client driver using OMAP dmtimer input capture
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * The PPS signal drives the event pin of a free running dmtimer, which
+ * latches its counter into TCAR1 on the assert edge. The interrupt handler
+ * reads the counter around the system time stamp and moves the time stamp
+ * back by the number of ticks elapsed since the capture, so the result
+ * does not depend on interrupt latency.
+ *
+ * With simulate=1 the driver registers a device of its own backed by a
+ * software model of the timer, which latches at every second of the system
+ * clock and interrupts after a random delay.
+ */
+
+#define PPS_DMTIMER_NAME "pps-dmtimer"
+#define pr_fmt(fmt) PPS_DMTIMER_NAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/interrupt.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/pps_kernel.h>
+#include <linux/pps-dmtimer.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/time.h>
+
+#ifdef CONFIG_OMAP_DM_TIMER
+#include <linux/clk.h>
+#include <plat/dmtimer.h>
+#endif
+
+static bool simulate;
+module_param(simulate, bool, 0444);
+MODULE_PARM_DESC(simulate, "Register a PPS source backed by a simulated timer");
+
+static unsigned int sim_rate = 13000000;
+module_param(sim_rate, uint, 0444);
+MODULE_PARM_DESC(sim_rate, "Counter rate of the simulated timer in Hz");
+
+static unsigned int sim_latency_us = 50;
+module_param(sim_latency_us, uint, 0644);
+MODULE_PARM_DESC(sim_latency_us, "Maximum interrupt latency of the simulated timer");
+
+struct pps_dmtimer_device_data;
+
+/* Timer backend */
+struct pps_dmtimer_ops {
+	int (*start)(struct pps_dmtimer_device_data *data);
+	void (*stop)(struct pps_dmtimer_device_data *data);
+	u32 (*read_counter)(struct pps_dmtimer_device_data *data);
+};
+
+/* Info for each registered platform device */
+struct pps_dmtimer_device_data {
+	struct pps_device *pps;		/* PPS source device */
+	struct pps_source_info info;	/* PPS source information */
+	const struct pps_dmtimer_platform_data *pdata;
+	const struct pps_dmtimer_ops *ops;
+	unsigned long rate;		/* counter rate in Hz */
+#ifdef CONFIG_OMAP_DM_TIMER
+	struct omap_dm_timer *timer;
+	int irq;
+#endif
+	/* simulated timer */
+	struct hrtimer sim_timer;
+	ktime_t sim_base;		/* system time at counter zero */
+	ktime_t sim_edge;		/* next simulated assert edge */
+};
+
+/*
+ * Move the time stamp back to the edge
+ */
+
+static void pps_dmtimer_compensate(struct pps_event_time *ts, u64 ns)
+{
+	struct timespec delay = ns_to_timespec(ns);
+
+	ts->ts_real = timespec_sub(ts->ts_real, delay);
+#ifdef CONFIG_NTP_PPS
+	ts->ts_raw = timespec_sub(ts->ts_raw, delay);
+#endif
+}
+
+/*
+ * Report the PPS event latched at counter value @capture
+ */
+
+static void pps_dmtimer_event(struct pps_dmtimer_device_data *data,
+		u32 capture)
+{
+	struct pps_event_time ts;
+	u32 before, after, now;
+	u64 ns;
+
+	/* The time stamp is taken somewhere between the two counter reads */
+	before = data->ops->read_counter(data);
+	pps_get_ts(&ts);
+	after = data->ops->read_counter(data);
+
+	now = before + (after - before) / 2;
+	ns = div_u64((u64)(now - capture) * NSEC_PER_SEC, data->rate);
+
+	/* Past half a second the edge could belong to either second */
+	if (ns >= NSEC_PER_SEC / 2) {
+		pr_warn_ratelimited("capture %u ticks old, event dropped\n",
+				now - capture);
+		return;
+	}
+
+	pps_dmtimer_compensate(&ts, ns);
+	pps_event(data->pps, &ts, PPS_CAPTUREASSERT, NULL);
+
+	dev_dbg(data->pps->dev, "latency %llu ns, read window %u ticks\n",
+			(unsigned long long)ns, after - before);
+}
+
+/*
+ * Simulated timer
+ */
+
+static u32 pps_dmtimer_sim_counter(struct pps_dmtimer_device_data *data,
+		ktime_t t)
+{
+	u64 ns = ktime_to_ns(ktime_sub(t, data->sim_base));
+	u32 rem;
+	u64 sec = div_u64_rem(ns, NSEC_PER_SEC, &rem);
+
+	/* counter wraps at 32 bits, exactly like the hardware */
+	return (u32)(sec * data->rate) +
+		(u32)div_u64((u64)rem * data->rate, NSEC_PER_SEC);
+}
+
+static u32 pps_dmtimer_sim_read_counter(struct pps_dmtimer_device_data *data)
+{
+	return pps_dmtimer_sim_counter(data, ktime_get_real());
+}
+
+static ktime_t pps_dmtimer_sim_expiry(struct pps_dmtimer_device_data *data)
+{
+	u32 delay = 0;
+
+	if (sim_latency_us)
+		delay = random32() % (sim_latency_us * NSEC_PER_USEC);
+
+	return ktime_add_ns(data->sim_edge, delay);
+}
+
+static enum hrtimer_restart pps_dmtimer_sim_fire(struct hrtimer *t)
+{
+	struct pps_dmtimer_device_data *data =
+		container_of(t, struct pps_dmtimer_device_data, sim_timer);
+
+	pps_dmtimer_event(data, pps_dmtimer_sim_counter(data, data->sim_edge));
+
+	data->sim_edge = ktime_add_ns(data->sim_edge, NSEC_PER_SEC);
+	hrtimer_set_expires(t, pps_dmtimer_sim_expiry(data));
+
+	return HRTIMER_RESTART;
+}
+
+static int pps_dmtimer_sim_start(struct pps_dmtimer_device_data *data)
+{
+	struct timespec now;
+
+	if (!sim_rate)
+		return -EINVAL;
+	data->rate = sim_rate;
+
+	data->sim_base = ktime_get_real();
+	now = ktime_to_timespec(data->sim_base);
+	data->sim_edge = ktime_set(now.tv_sec + 1, 0);
+
+	hrtimer_init(&data->sim_timer, CLOCK_REALTIME, HRTIMER_MODE_ABS);
+	data->sim_timer.function = pps_dmtimer_sim_fire;
+	hrtimer_start(&data->sim_timer, pps_dmtimer_sim_expiry(data),
+			HRTIMER_MODE_ABS);
+
+	return 0;
+}
+
+static void pps_dmtimer_sim_stop(struct pps_dmtimer_device_data *data)
+{
+	hrtimer_cancel(&data->sim_timer);
+}
+
+static const struct pps_dmtimer_ops pps_dmtimer_sim_ops = {
+	.start		= pps_dmtimer_sim_start,
+	.stop		= pps_dmtimer_sim_stop,
+	.read_counter	= pps_dmtimer_sim_read_counter,
+};
+
+/*
+ * OMAP dmtimer
+ */
+
+#ifdef CONFIG_OMAP_DM_TIMER
+
+static u32 pps_dmtimer_omap_read_counter(struct pps_dmtimer_device_data *data)
+{
+	return omap_dm_timer_read_counter(data->timer);
+}
+
+static irqreturn_t pps_dmtimer_irq_handler(int irq, void *dev_id)
+{
+	struct pps_dmtimer_device_data *data = dev_id;
+	unsigned int status;
+
+	status = omap_dm_timer_read_status(data->timer);
+	if (!(status & OMAP_TIMER_INT_CAPTURE))
+		return IRQ_NONE;
+
+	pps_dmtimer_event(data, omap_dm_timer_read_capture(data->timer, 0));
+	omap_dm_timer_write_status(data->timer, OMAP_TIMER_INT_CAPTURE);
+
+	return IRQ_HANDLED;
+}
+
+static int pps_dmtimer_omap_start(struct pps_dmtimer_device_data *data)
+{
+	const struct pps_dmtimer_platform_data *pdata = data->pdata;
+	int ret;
+
+	data->timer = omap_dm_timer_request_specific(pdata->timer_id);
+	if (!data->timer) {
+		pr_err("failed to request dmtimer %d\n", pdata->timer_id);
+		return -EBUSY;
+	}
+
+	ret = omap_dm_timer_set_source(data->timer, pdata->clk_source);
+	if (ret)
+		goto err_free;
+
+	data->rate = clk_get_rate(omap_dm_timer_get_fclk(data->timer));
+	data->irq = omap_dm_timer_get_irq(data->timer);
+	if (!data->rate || data->irq < 0) {
+		ret = -EINVAL;
+		goto err_free;
+	}
+
+	ret = omap_dm_timer_set_capture(data->timer, pdata->assert_falling_edge ?
+			OMAP_TIMER_CAPTURE_FALLING : OMAP_TIMER_CAPTURE_RISING, 0);
+	if (ret)
+		goto err_free;
+
+	ret = request_irq(data->irq, pps_dmtimer_irq_handler, IRQF_NO_THREAD,
+			data->info.name, data);
+	if (ret) {
+		pr_err("failed to acquire IRQ %d\n", data->irq);
+		goto err_free;
+	}
+
+	/* Free running, wrapping at 32 bits */
+	omap_dm_timer_set_load_start(data->timer, 1, 0);
+	omap_dm_timer_set_int_enable(data->timer, OMAP_TIMER_INT_CAPTURE);
+
+	return 0;
+
+err_free:
+	omap_dm_timer_free(data->timer);
+	return ret;
+}
+
+static void pps_dmtimer_omap_stop(struct pps_dmtimer_device_data *data)
+{
+	omap_dm_timer_set_int_enable(data->timer, 0);
+	omap_dm_timer_set_capture(data->timer, OMAP_TIMER_CAPTURE_NONE, 0);
+	omap_dm_timer_stop(data->timer);
+	free_irq(data->irq, data);
+	omap_dm_timer_free(data->timer);
+}
+
+static const struct pps_dmtimer_ops pps_dmtimer_omap_ops = {
+	.start		= pps_dmtimer_omap_start,
+	.stop		= pps_dmtimer_omap_stop,
+	.read_counter	= pps_dmtimer_omap_read_counter,
+};
+
+#endif
+
+static int pps_dmtimer_probe(struct platform_device *pdev)
+{
+	struct pps_dmtimer_device_data *data;
+	const struct pps_dmtimer_platform_data *pdata = pdev->dev.platform_data;
+	int ret;
+
+	if (!pdata)
+		return -EINVAL;
+
+	data = kzalloc(sizeof(struct pps_dmtimer_device_data), GFP_KERNEL);
+	if (data == NULL)
+		return -ENOMEM;
+
+	data->pdata = pdata;
+	if (pdata->simulate)
+		data->ops = &pps_dmtimer_sim_ops;
+#ifdef CONFIG_OMAP_DM_TIMER
+	else
+		data->ops = &pps_dmtimer_omap_ops;
+#endif
+	if (!data->ops) {
+		pr_err("no dmtimer support, only simulate is available\n");
+		ret = -ENODEV;
+		goto err_free;
+	}
+
+	/* initialize PPS specific parts of the bookkeeping data structure. */
+	data->info.mode = PPS_CAPTUREASSERT | PPS_OFFSETASSERT |
+		PPS_ECHOASSERT | PPS_CANWAIT | PPS_TSFMT_TSPEC;
+	data->info.owner = THIS_MODULE;
+	snprintf(data->info.name, PPS_MAX_NAME_LEN - 1, "%s.%d",
+		 pdev->name, pdev->id);
+
+	/* register PPS source */
+	data->pps = pps_register_source(&data->info,
+			PPS_CAPTUREASSERT | PPS_OFFSETASSERT);
+	if (data->pps == NULL) {
+		pr_err("failed to register %s as PPS source\n",
+				data->info.name);
+		ret = -EINVAL;
+		goto err_free;
+	}
+
+	platform_set_drvdata(pdev, data);
+
+	ret = data->ops->start(data);
+	if (ret)
+		goto err_unregister;
+
+	dev_info(data->pps->dev, "Registered %s timer at %lu Hz as PPS source\n",
+		 pdata->simulate ? "simulated" : "dmtimer", data->rate);
+
+	return 0;
+
+err_unregister:
+	platform_set_drvdata(pdev, NULL);
+	pps_unregister_source(data->pps);
+err_free:
+	kfree(data);
+	return ret;
+}
+
+static int pps_dmtimer_remove(struct platform_device *pdev)
+{
+	struct pps_dmtimer_device_data *data = platform_get_drvdata(pdev);
+
+	data->ops->stop(data);
+	platform_set_drvdata(pdev, NULL);
+	pps_unregister_source(data->pps);
+	kfree(data);
+	return 0;
+}
+
+static struct platform_driver pps_dmtimer_driver = {
+	.probe		= pps_dmtimer_probe,
+	.remove		= __devexit_p(pps_dmtimer_remove),
+	.driver		= {
+		.name	= PPS_DMTIMER_NAME,
+		.owner	= THIS_MODULE
+	},
+};
+
+static const struct pps_dmtimer_platform_data pps_dmtimer_sim_pdata = {
+	.simulate	= true,
+};
+
+static struct platform_device *pps_dmtimer_sim_device;
+
+static int __init pps_dmtimer_init(void)
+{
+	int ret = platform_driver_register(&pps_dmtimer_driver);
+	if (ret < 0) {
+		pr_err("failed to register platform driver\n");
+		return ret;
+	}
+
+	if (simulate) {
+		pps_dmtimer_sim_device = platform_device_register_data(NULL,
+				PPS_DMTIMER_NAME, -1,
+				&pps_dmtimer_sim_pdata,
+				sizeof(pps_dmtimer_sim_pdata));
+		if (IS_ERR(pps_dmtimer_sim_device)) {
+			platform_driver_unregister(&pps_dmtimer_driver);
+			pr_err("failed to register simulated device\n");
+			return PTR_ERR(pps_dmtimer_sim_device);
+		}
+	}
+
+	return 0;
+}
+
+static void __exit pps_dmtimer_exit(void)
+{
+	if (pps_dmtimer_sim_device)
+		platform_device_unregister(pps_dmtimer_sim_device);
+	platform_driver_unregister(&pps_dmtimer_driver);
+	pr_debug("unregistered platform driver\n");
+}
+
+module_init(pps_dmtimer_init);
+module_exit(pps_dmtimer_exit);
+
+MODULE_DESCRIPTION("Use OMAP dmtimer input capture as PPS source");
+MODULE_LICENSE("GPL");
+MODULE_VERSION("1.0.0");
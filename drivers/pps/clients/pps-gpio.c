@@ -26,6 +26,7 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/interrupt.h>
+#include <linux/irq.h>
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/slab.h>
@@ -33,6 +34,8 @@
 #include <linux/pps-gpio.h>
 #include <linux/gpio.h>
 #include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/time.h>
 
 /* Info for each registered platform device */
 struct pps_gpio_device_data {
@@ -40,16 +43,106 @@ struct pps_gpio_device_data {
 	struct pps_device *pps;		/* PPS source device */
 	struct pps_source_info info;	/* PPS source information */
 	const struct pps_gpio_platform_data *pdata;
+	unsigned int latency_ns;	/* edge to timestamp delay */
+	spinlock_t lock;		/* protects jitter and early_ts */
+	struct pps_jitter jitter;
+	struct timespec last;		/* previous assert time */
+	irq_flow_handler_t flow;	/* flow handler early capture wraps */
+	const char *flow_name;
+	struct pps_event_time early_ts;	/* taken by the flow handler */
+	bool early_valid;
 };
 
+/*
+ * Move the time stamp back to the edge
+ */
+
+static void pps_gpio_compensate(struct pps_event_time *ts, unsigned int ns)
+{
+	struct timespec delay = ns_to_timespec(ns);
+
+	ts->ts_real = timespec_sub(ts->ts_real, delay);
+#ifdef CONFIG_NTP_PPS
+	ts->ts_raw = timespec_sub(ts->ts_raw, delay);
+#endif
+}
+
+/*
+ * Account the period since the previous assert event
+ */
+
+static void pps_gpio_jitter_update(struct pps_gpio_device_data *info,
+		const struct timespec *ts)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&info->lock, flags);
+
+	if (info->last.tv_sec || info->last.tv_nsec)
+		pps_jitter_add(&info->jitter, timespec_to_ns(ts) -
+				timespec_to_ns(&info->last) - NSEC_PER_SEC);
+	info->last = *ts;
+
+	spin_unlock_irqrestore(&info->lock, flags);
+}
+
+/*
+ * Early capture: take the time stamp in the flow handler, before the IRQ
+ * core locks the descriptor, acks the line and walks the actions, and
+ * before a forced IRQ thread could defer the handler.
+ */
+
+static void pps_gpio_flow_handler(unsigned int irq, struct irq_desc *desc)
+{
+	struct pps_gpio_device_data *info = desc->action->dev_id;
+	struct pps_event_time ts;
+
+	pps_get_ts(&ts);
+
+	spin_lock(&info->lock);
+	info->early_ts = ts;
+	info->early_valid = true;
+	spin_unlock(&info->lock);
+
+	info->flow(irq, desc);
+}
+
+/*
+ * Wrap the flow handler request_irq() set up for the trigger type. It is
+ * put back before the IRQ is freed. Nothing locks the handler against
+ * another request_irq() or free_irq() on the line, so the IRQ must not
+ * be shared.
+ */
+
+static int pps_gpio_early_enable(struct pps_gpio_device_data *info)
+{
+	struct irq_desc *desc = irq_to_desc(info->irq);
+
+	if (!desc)
+		return -EINVAL;
+
+	info->flow = desc->handle_irq;
+	info->flow_name = desc->name;
+	__irq_set_handler(info->irq, pps_gpio_flow_handler, 0,
+			info->flow_name);
+	return 0;
+}
+
+static void pps_gpio_early_disable(struct pps_gpio_device_data *info)
+{
+	if (info->flow)
+		__irq_set_handler(info->irq, info->flow, 0, info->flow_name);
+}
+
 /*
  * Report the PPS event
  */
 
 static irqreturn_t pps_gpio_irq_handler(int irq, void *data)
 {
-	const struct pps_gpio_device_data *info;
+	struct pps_gpio_device_data *info;
 	struct pps_event_time ts;
+	unsigned long flags;
 	int rising_edge;
 
 	/* Get the time stamp first */
@@ -57,11 +150,36 @@ static irqreturn_t pps_gpio_irq_handler(int irq, void *data)
 
 	info = data;
 
-	rising_edge = gpio_get_value(info->pdata->gpio_pin);
+	/* Prefer the one the flow handler took for this edge. A forced
+	 * IRQ thread runs with interrupts on, so keep the flow handler
+	 * from taking the lock under us.
+	 */
+	if (info->flow) {
+		spin_lock_irqsave(&info->lock, flags);
+		if (info->early_valid) {
+			ts = info->early_ts;
+			info->early_valid = false;
+		}
+		spin_unlock_irqrestore(&info->lock, flags);
+	}
+
+	if (info->latency_ns)
+		pps_gpio_compensate(&ts, info->latency_ns);
+
+	/* With a single edge the IRQ trigger already tells the polarity;
+	 * skip reading back the pin, which may have changed again by the
+	 * time a late handler gets to it.
+	 */
+	if (!info->pdata->capture_clear)
+		rising_edge = !info->pdata->assert_falling_edge;
+	else
+		rising_edge = gpio_get_value(info->pdata->gpio_pin);
+
 	if ((rising_edge && !info->pdata->assert_falling_edge) ||
-			(!rising_edge && info->pdata->assert_falling_edge))
+			(!rising_edge && info->pdata->assert_falling_edge)) {
 		pps_event(info->pps, &ts, PPS_CAPTUREASSERT, NULL);
-	else if (info->pdata->capture_clear &&
+		pps_gpio_jitter_update(info, &ts.ts_real);
+	} else if (info->pdata->capture_clear &&
 			((rising_edge && info->pdata->assert_falling_edge) ||
 			 (!rising_edge && !info->pdata->assert_falling_edge)))
 		pps_event(info->pps, &ts, PPS_CAPTURECLEAR, NULL);
@@ -104,6 +222,73 @@ get_irqf_trigger_flags(const struct pps_gpio_platform_data *pdata)
 	return flags;
 }
 
+/*
+ * Sysfs attributes
+ */
+
+static ssize_t latency_ns_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", data->latency_ns);
+}
+
+static ssize_t latency_ns_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+	unsigned int ns;
+
+	if (kstrtouint(buf, 0, &ns) || ns >= NSEC_PER_SEC)
+		return -EINVAL;
+
+	data->latency_ns = ns;
+	return count;
+}
+
+static DEVICE_ATTR(latency_ns, S_IRUGO | S_IWUSR, latency_ns_show,
+		latency_ns_store);
+
+static ssize_t jitter_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+	struct pps_jitter j;
+
+	spin_lock_irq(&data->lock);
+	j = data->jitter;
+	spin_unlock_irq(&data->lock);
+
+	return pps_jitter_print(&j, "outliers", buf);
+}
+
+/* Any write restarts the statistics */
+static ssize_t jitter_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct pps_gpio_device_data *data = dev_get_drvdata(dev);
+
+	spin_lock_irq(&data->lock);
+	memset(&data->jitter, 0, sizeof(data->jitter));
+	memset(&data->last, 0, sizeof(data->last));
+	spin_unlock_irq(&data->lock);
+
+	return count;
+}
+
+static DEVICE_ATTR(jitter, S_IRUGO | S_IWUSR, jitter_show, jitter_store);
+
+static struct attribute *pps_gpio_attrs[] = {
+	&dev_attr_latency_ns.attr,
+	&dev_attr_jitter.attr,
+	NULL,
+};
+
+static const struct attribute_group pps_gpio_attr_group = {
+	.attrs = pps_gpio_attrs,
+};
+
 static int pps_gpio_probe(struct platform_device *pdev)
 {
 	struct pps_gpio_device_data *data;
@@ -158,11 +343,15 @@ static int pps_gpio_probe(struct platform_device *pdev)
 
 	data->irq = irq;
 	data->pdata = pdata;
+	data->latency_ns = pdata->latency_ns;
+	spin_lock_init(&data->lock);
+	platform_set_drvdata(pdev, data);
 
 	/* register IRQ interrupt handler */
 	ret = request_irq(irq, pps_gpio_irq_handler,
 			get_irqf_trigger_flags(pdata), data->info.name, data);
 	if (ret) {
+		platform_set_drvdata(pdev, NULL);
 		pps_unregister_source(data->pps);
 		kfree(data);
 		pr_err("failed to acquire IRQ %d\n", irq);
@@ -170,8 +359,21 @@ static int pps_gpio_probe(struct platform_device *pdev)
 		goto return_error;
 	}
 
-	platform_set_drvdata(pdev, data);
-	dev_info(data->pps->dev, "Registered IRQ %d as PPS source\n", irq);
+	if (pdata->early_capture && pps_gpio_early_enable(data)) {
+		free_irq(irq, data);
+		platform_set_drvdata(pdev, NULL);
+		pps_unregister_source(data->pps);
+		kfree(data);
+		pr_err("failed to set up early capture on IRQ %d\n", irq);
+		err = -EINVAL;
+		goto return_error;
+	}
+
+	if (sysfs_create_group(&pdev->dev.kobj, &pps_gpio_attr_group))
+		pr_warning("failed to create sysfs attributes\n");
+
+	dev_info(data->pps->dev, "Registered IRQ %d as PPS source%s\n", irq,
+			data->flow ? " with early capture" : "");
 
 	return 0;
 
@@ -185,7 +387,9 @@ static int pps_gpio_remove(struct platform_device *pdev)
 	struct pps_gpio_device_data *data = platform_get_drvdata(pdev);
 	const struct pps_gpio_platform_data *pdata = data->pdata;
 
+	sysfs_remove_group(&pdev->dev.kobj, &pps_gpio_attr_group);
 	platform_set_drvdata(pdev, NULL);
+	pps_gpio_early_disable(data);
 	free_irq(data->irq, data);
 	gpio_free(pdata->gpio_pin);
 	pps_unregister_source(data->pps);
@@ -0,0 +1,508 @@
+/*
+ * pps_gen_gpio.c -- PPS signal generator on a GPIO or dmtimer PWM pin
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * The assert edge is placed at the top of each second of the system
+ * clock, the same way pps_gen_parport does it: a hrtimer fires a little
+ * early, then the handler busy waits with interrupts off until the edge
+ * is due. The early margin follows the measured hrtimer latency. Each
+ * edge is time stamped and the deviation from the second is accounted in
+ * the "jitter" sysfs attribute.
+ *
+ * In echo mode the pin instead follows the events of another PPS source,
+ * driven from its echo function right when the event is reported.
+ */
+
+#define PPS_GEN_GPIO_NAME "pps-gen-gpio"
+#define pr_fmt(fmt) PPS_GEN_GPIO_NAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/time.h>
+#include <linux/hrtimer.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/gpio.h>
+#include <linux/spinlock.h>
+#include <linux/pps_kernel.h>
+#include <linux/pps_gen_gpio.h>
+
+#ifdef CONFIG_OMAP_DM_TIMER
+#include <plat/dmtimer.h>
+#endif
+
+#define SAFETY_INTERVAL	3000	/* set the hrtimer earlier for safety (ns) */
+#define MAX_TIMER_ERROR	(200 * NSEC_PER_USEC)	/* bounds the busy wait */
+#define DEFAULT_WIDTH	(100 * NSEC_PER_MSEC)
+
+/* Info for each registered platform device */
+struct pps_gen_gpio_device {
+	const struct pps_gen_gpio_platform_data *pdata;
+	void (*set)(struct pps_gen_gpio_device *dev, int level);
+#ifdef CONFIG_OMAP_DM_TIMER
+	struct omap_dm_timer *dmtimer;
+#endif
+	struct hrtimer timer;
+	struct timespec target;		/* next assert edge */
+	bool asserted;
+	unsigned int width;		/* pulse width (ns) */
+	long write_time;		/* calibrated pin write time (ns) */
+	long timer_error;		/* calibrated hrtimer latency (ns) */
+	struct pps_device *echo;	/* source being echoed */
+	spinlock_t lock;		/* protects jitter */
+	struct pps_jitter jitter;
+};
+
+/* only one source can be echoed, the echo function has no context */
+static struct pps_gen_gpio_device *pps_gen_gpio_echo_dev;
+
+/*
+ * Pin access
+ */
+
+static void pps_gen_gpio_set_gpio(struct pps_gen_gpio_device *dev, int level)
+{
+	gpio_set_value(dev->pdata->gpio_pin, level ^ dev->pdata->active_low);
+}
+
+#ifdef CONFIG_OMAP_DM_TIMER
+/* With the timer stopped the PWM pin follows the default level */
+static void pps_gen_gpio_set_dmtimer(struct pps_gen_gpio_device *dev,
+		int level)
+{
+	omap_dm_timer_set_pwm(dev->dmtimer, level ^ dev->pdata->active_low,
+			0, OMAP_TIMER_TRIGGER_NONE);
+}
+#endif
+
+/* calibrate pin write time */
+#define PIN_NTESTS_SHIFT	5
+static void pps_gen_gpio_calibrate(struct pps_gen_gpio_device *dev)
+{
+	int i;
+	long acc = 0;
+
+	for (i = 0; i < (1 << PIN_NTESTS_SHIFT); i++) {
+		struct timespec a, b;
+		unsigned long irq_flags;
+
+		local_irq_save(irq_flags);
+		getnstimeofday(&a);
+		dev->set(dev, 0);
+		getnstimeofday(&b);
+		local_irq_restore(irq_flags);
+
+		b = timespec_sub(b, a);
+		acc += timespec_to_ns(&b);
+	}
+
+	dev->write_time = acc >> PIN_NTESTS_SHIFT;
+}
+
+/*
+ * Generator
+ */
+
+static void pps_gen_gpio_jitter_update(struct pps_gen_gpio_device *dev,
+		s64 err, bool late)
+{
+	spin_lock(&dev->lock);
+	if (late)
+		dev->jitter.outliers++;
+	else
+		pps_jitter_add(&dev->jitter, err);
+	spin_unlock(&dev->lock);
+}
+
+static ktime_t pps_gen_gpio_next_assert(struct pps_gen_gpio_device *dev)
+{
+	return ktime_sub_ns(timespec_to_ktime(dev->target),
+			SAFETY_INTERVAL + 2 * dev->timer_error +
+			dev->write_time);
+}
+
+static enum hrtimer_restart pps_gen_gpio_event(struct hrtimer *timer)
+{
+	struct pps_gen_gpio_device *dev =
+		container_of(timer, struct pps_gen_gpio_device, timer);
+	struct timespec ts1, ts2, ts3;
+	s64 expires, target, lim, edge, delta;
+	ktime_t next = ktime_set(0, 0);
+	unsigned long flags;
+
+	if (dev->echo) {
+		dev->set(dev, 0);
+		return HRTIMER_NORESTART;
+	}
+
+	if (dev->asserted) {
+		dev->set(dev, 0);
+		dev->asserted = false;
+		hrtimer_set_expires(timer, pps_gen_gpio_next_assert(dev));
+		return HRTIMER_RESTART;
+	}
+
+	/* Interrupts stay off while polling the clock, so that other
+	 * handlers cannot delay the edge. The wait is bounded by the
+	 * early margin, at most SAFETY_INTERVAL + 2 * MAX_TIMER_ERROR.
+	 */
+	local_irq_save(flags);
+
+	getnstimeofday(&ts1);
+	expires = ktime_to_ns(hrtimer_get_softexpires(timer));
+	target = timespec_to_ns(&dev->target);
+	lim = target - dev->write_time / 2;
+
+	/* check if we are late */
+	if (timespec_to_ns(&ts1) > lim) {
+		local_irq_restore(flags);
+		pps_gen_gpio_jitter_update(dev, 0, true);
+		dev->target.tv_sec = ts1.tv_sec + 1;
+		dev->target.tv_nsec = 0;
+		goto done;
+	}
+
+	/* busy loop until the time is right for the assert edge */
+	do {
+		getnstimeofday(&ts2);
+	} while (timespec_to_ns(&ts2) < lim);
+
+	dev->set(dev, 1);
+
+	getnstimeofday(&ts3);
+
+	local_irq_restore(flags);
+
+	/* the pin changed somewhere between the two time stamps */
+	edge = (timespec_to_ns(&ts2) + timespec_to_ns(&ts3)) / 2;
+	pps_gen_gpio_jitter_update(dev, edge - target, false);
+
+	/* update calibrated pin write time */
+	ts3 = timespec_sub(ts3, ts2);
+	dev->write_time = (dev->write_time + timespec_to_ns(&ts3)) >> 1;
+
+	dev->asserted = true;
+	next = ktime_add_ns(timespec_to_ktime(dev->target), dev->width);
+	dev->target.tv_sec++;
+
+done:
+	/* update calibrated hrtimer error: follow increases at once,
+	 * decreases slowly
+	 */
+	delta = timespec_to_ns(&ts1) - expires;
+	if (delta >= dev->timer_error)
+		dev->timer_error = min_t(s64, delta, MAX_TIMER_ERROR);
+	else
+		dev->timer_error = max_t(s64, 0,
+				(3 * dev->timer_error + delta) >> 2);
+
+	if (!dev->asserted)
+		next = pps_gen_gpio_next_assert(dev);
+	hrtimer_set_expires(timer, next);
+
+	return HRTIMER_RESTART;
+}
+
+static void pps_gen_gpio_start(struct pps_gen_gpio_device *dev)
+{
+	struct timespec ts;
+
+	getnstimeofday(&ts);
+	dev->target.tv_sec = ts.tv_sec +
+		((ts.tv_nsec > 990 * NSEC_PER_MSEC) ? 2 : 1);
+	dev->target.tv_nsec = 0;
+	dev->timer_error = SAFETY_INTERVAL;
+
+	hrtimer_init(&dev->timer, CLOCK_REALTIME, HRTIMER_MODE_ABS);
+	dev->timer.function = pps_gen_gpio_event;
+	hrtimer_start(&dev->timer, pps_gen_gpio_next_assert(dev),
+			HRTIMER_MODE_ABS);
+}
+
+/*
+ * Echo
+ */
+
+/* Called by pps_event() with the source lock held and interrupts off */
+static void pps_gen_gpio_echo(struct pps_device *pps, int event, void *data)
+{
+	struct pps_gen_gpio_device *dev = pps_gen_gpio_echo_dev;
+
+	if (!dev)
+		return;
+
+	if (event & PPS_CAPTUREASSERT) {
+		dev->set(dev, 1);
+		/* end the pulse ourselves unless the source reports clears */
+		if (!(pps->info.mode & PPS_CAPTURECLEAR))
+			hrtimer_start(&dev->timer, ns_to_ktime(dev->width),
+					HRTIMER_MODE_REL);
+	} else if (event & PPS_CAPTURECLEAR) {
+		hrtimer_try_to_cancel(&dev->timer);
+		dev->set(dev, 0);
+	}
+}
+
+static int pps_gen_gpio_echo_start(struct pps_gen_gpio_device *dev)
+{
+	struct pps_device *pps;
+
+	if (pps_gen_gpio_echo_dev)
+		return -EBUSY;
+
+	pps = pps_lookup_source(dev->pdata->echo_source);
+	if (!pps)
+		return -EPROBE_DEFER;
+
+	hrtimer_init(&dev->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dev->timer.function = pps_gen_gpio_event;
+
+	dev->echo = pps;
+	pps_gen_gpio_echo_dev = dev;
+	pps_set_echo(pps, pps_gen_gpio_echo, PPS_ECHOASSERT | PPS_ECHOCLEAR);
+
+	return 0;
+}
+
+static void pps_gen_gpio_echo_stop(struct pps_gen_gpio_device *dev)
+{
+	/* once this returns the echo function is no longer running */
+	pps_set_echo(dev->echo, NULL, 0);
+	pps_gen_gpio_echo_dev = NULL;
+	put_device(dev->echo->dev);
+}
+
+/*
+ * Sysfs attributes
+ */
+
+static ssize_t jitter_show(struct device *d,
+		struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_device *dev = dev_get_drvdata(d);
+	struct pps_jitter j;
+
+	spin_lock_irq(&dev->lock);
+	j = dev->jitter;
+	spin_unlock_irq(&dev->lock);
+
+	return pps_jitter_print(&j, "misses", buf);
+}
+
+/* Any write restarts the statistics */
+static ssize_t jitter_store(struct device *d,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct pps_gen_gpio_device *dev = dev_get_drvdata(d);
+
+	spin_lock_irq(&dev->lock);
+	memset(&dev->jitter, 0, sizeof(dev->jitter));
+	spin_unlock_irq(&dev->lock);
+
+	return count;
+}
+
+static DEVICE_ATTR(jitter, S_IRUGO | S_IWUSR, jitter_show, jitter_store);
+
+static ssize_t calibration_show(struct device *d,
+		struct device_attribute *attr, char *buf)
+{
+	struct pps_gen_gpio_device *dev = dev_get_drvdata(d);
+
+	return sprintf(buf, "write %ld timer %ld\n",
+			dev->write_time, dev->timer_error);
+}
+
+static DEVICE_ATTR(calibration, S_IRUGO, calibration_show, NULL);
+
+static struct attribute *pps_gen_gpio_attrs[] = {
+	&dev_attr_jitter.attr,
+	&dev_attr_calibration.attr,
+	NULL,
+};
+
+static const struct attribute_group pps_gen_gpio_attr_group = {
+	.attrs = pps_gen_gpio_attrs,
+};
+
+/*
+ * Platform driver
+ */
+
+static int pps_gen_gpio_request_pin(struct pps_gen_gpio_device *dev)
+{
+	const struct pps_gen_gpio_platform_data *pdata = dev->pdata;
+	int ret;
+
+	if (pdata->timer_id > 0) {
+#ifdef CONFIG_OMAP_DM_TIMER
+		dev->dmtimer = omap_dm_timer_request_specific(pdata->timer_id);
+		if (!dev->dmtimer) {
+			pr_err("failed to request dmtimer %d\n",
+					pdata->timer_id);
+			return -EBUSY;
+		}
+		/* keep it powered, the pin is driven from atomic context */
+		omap_dm_timer_enable(dev->dmtimer);
+		dev->set = pps_gen_gpio_set_dmtimer;
+		dev->set(dev, 0);
+		return 0;
+#else
+		pr_err("no dmtimer support\n");
+		return -ENODEV;
+#endif
+	}
+
+	ret = gpio_request(pdata->gpio_pin, pdata->gpio_label);
+	if (ret) {
+		pr_warning("failed to request GPIO %u\n", pdata->gpio_pin);
+		return ret;
+	}
+
+	/* the pin is driven from hrtimer and hardirq context */
+	if (gpio_cansleep(pdata->gpio_pin)) {
+		pr_err("GPIO %u can sleep\n", pdata->gpio_pin);
+		gpio_free(pdata->gpio_pin);
+		return -EINVAL;
+	}
+
+	ret = gpio_direction_output(pdata->gpio_pin, pdata->active_low);
+	if (ret) {
+		pr_warning("failed to set pin direction\n");
+		gpio_free(pdata->gpio_pin);
+		return ret;
+	}
+
+	dev->set = pps_gen_gpio_set_gpio;
+	return 0;
+}
+
+static void pps_gen_gpio_free_pin(struct pps_gen_gpio_device *dev)
+{
+	dev->set(dev, 0);
+#ifdef CONFIG_OMAP_DM_TIMER
+	if (dev->dmtimer) {
+		omap_dm_timer_disable(dev->dmtimer);
+		omap_dm_timer_free(dev->dmtimer);
+		return;
+	}
+#endif
+	gpio_free(dev->pdata->gpio_pin);
+}
+
+static int pps_gen_gpio_probe(struct platform_device *pdev)
+{
+	const struct pps_gen_gpio_platform_data *pdata = pdev->dev.platform_data;
+	struct pps_gen_gpio_device *dev;
+	int ret;
+
+	if (!pdata)
+		return -EINVAL;
+
+	dev = kzalloc(sizeof(struct pps_gen_gpio_device), GFP_KERNEL);
+	if (dev == NULL)
+		return -ENOMEM;
+
+	dev->pdata = pdata;
+	dev->width = pdata->width_ns ? : DEFAULT_WIDTH;
+	if (dev->width >= NSEC_PER_SEC / 2) {
+		pr_err("pulse width %u ns too long\n", dev->width);
+		ret = -EINVAL;
+		goto err_free;
+	}
+	spin_lock_init(&dev->lock);
+
+	ret = pps_gen_gpio_request_pin(dev);
+	if (ret)
+		goto err_free;
+
+	pps_gen_gpio_calibrate(dev);
+
+	platform_set_drvdata(pdev, dev);
+
+	if (pdata->echo_source) {
+		ret = pps_gen_gpio_echo_start(dev);
+		if (ret)
+			goto err_pin;
+	} else {
+		pps_gen_gpio_start(dev);
+	}
+
+	if (sysfs_create_group(&pdev->dev.kobj, &pps_gen_gpio_attr_group))
+		pr_warning("failed to create sysfs attributes\n");
+
+	dev_info(&pdev->dev, "%s on %s %u, pin write takes %ldns\n",
+			pdata->echo_source ? "echo" : "1PPS",
+			pdata->timer_id > 0 ? "dmtimer" : "GPIO",
+			pdata->timer_id > 0 ? pdata->timer_id : pdata->gpio_pin,
+			dev->write_time);
+
+	return 0;
+
+err_pin:
+	platform_set_drvdata(pdev, NULL);
+	pps_gen_gpio_free_pin(dev);
+err_free:
+	kfree(dev);
+	return ret;
+}
+
+static int pps_gen_gpio_remove(struct platform_device *pdev)
+{
+	struct pps_gen_gpio_device *dev = platform_get_drvdata(pdev);
+
+	sysfs_remove_group(&pdev->dev.kobj, &pps_gen_gpio_attr_group);
+	if (dev->echo)
+		pps_gen_gpio_echo_stop(dev);
+	hrtimer_cancel(&dev->timer);
+	pps_gen_gpio_free_pin(dev);
+	platform_set_drvdata(pdev, NULL);
+	kfree(dev);
+	return 0;
+}
+
+static struct platform_driver pps_gen_gpio_driver = {
+	.probe		= pps_gen_gpio_probe,
+	.remove		= __devexit_p(pps_gen_gpio_remove),
+	.driver		= {
+		.name	= PPS_GEN_GPIO_NAME,
+		.owner	= THIS_MODULE
+	},
+};
+
+static int __init pps_gen_gpio_init(void)
+{
+	int ret = platform_driver_register(&pps_gen_gpio_driver);
+	if (ret < 0)
+		pr_err("failed to register platform driver\n");
+	return ret;
+}
+
+static void __exit pps_gen_gpio_exit(void)
+{
+	platform_driver_unregister(&pps_gen_gpio_driver);
+	pr_debug("unregistered platform driver\n");
+}
+
+module_init(pps_gen_gpio_init);
+module_exit(pps_gen_gpio_exit);
+
+MODULE_DESCRIPTION("PPS signal generator on a GPIO or dmtimer PWM pin");
+MODULE_LICENSE("GPL");
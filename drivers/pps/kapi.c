@@ -31,6 +31,7 @@
 #include <linux/fs.h>
 #include <linux/pps_kernel.h>
 #include <linux/slab.h>
+#include <linux/math64.h>
 
 #include "kc.h"
 
@@ -125,6 +126,8 @@ struct pps_device *pps_register_source(struct pps_source_info *info,
 		goto kfree_pps;
 	}
 
+	pps_kc_add(pps);
+
 	dev_info(pps->dev, "new PPS source %s\n", info->name);
 
 	return pps;
@@ -156,6 +159,95 @@ void pps_unregister_source(struct pps_device *pps)
 }
 EXPORT_SYMBOL(pps_unregister_source);
 
+/* pps_set_echo - redirect the echo of a PPS source
+ * @pps: the PPS source
+ * @echo: the echo function, NULL to remove it
+ * @mode: echo mode bits (PPS_ECHOASSERT, PPS_ECHOCLEAR) to enable
+ *
+ * This function lets another driver, e.g. a PPS generator, feed back the
+ * events of a source. The function is kept apart from the source's own
+ * echo and the echo bits of its parameters, so it is called whatever
+ * userland sets with PPS_SETPARAMS, and removing it leaves the source's
+ * echo as it was.
+ */
+
+void pps_set_echo(struct pps_device *pps,
+		void (*echo)(struct pps_device *pps, int event, void *data),
+		int mode)
+{
+	spin_lock_irq(&pps->lock);
+	pps->echo_hook = echo;
+	pps->echo_hook_mode = 0;
+	if (echo)
+		pps->echo_hook_mode = mode & (PPS_ECHOASSERT | PPS_ECHOCLEAR);
+	spin_unlock_irq(&pps->lock);
+}
+EXPORT_SYMBOL(pps_set_echo);
+
+/* pps_jitter_add - account the deviation of a pulse from the second
+ * @j: the statistics
+ * @err: the deviation in ns
+ *
+ * Deviations outside PPS_JITTER_WINDOW are only counted as outliers.
+ */
+
+void pps_jitter_add(struct pps_jitter *j, s64 err)
+{
+	if (err < -PPS_JITTER_WINDOW || err > PPS_JITTER_WINDOW) {
+		j->outliers++;
+		return;
+	}
+
+	if (!j->samples || err < j->min)
+		j->min = err;
+	if (!j->samples || err > j->max)
+		j->max = err;
+	j->sum += err;
+	j->sumsq += err * err;
+	j->samples++;
+}
+EXPORT_SYMBOL(pps_jitter_add);
+
+/* Square root of a 64 bit value, precise enough for a standard deviation */
+static unsigned long pps_jitter_sqrt(u64 v)
+{
+	unsigned int shift = 0;
+
+	while (v > ULONG_MAX) {
+		v >>= 2;
+		shift++;
+	}
+	return int_sqrt(v) << shift;
+}
+
+/* pps_jitter_print - format jitter statistics for a sysfs attribute
+ * @j: a snapshot of the statistics
+ * @outliers: the name the outlier count is reported under
+ * @buf: the attribute buffer
+ */
+
+ssize_t pps_jitter_print(const struct pps_jitter *j, const char *outliers,
+		char *buf)
+{
+	s64 min = 0, max = 0, mean = 0;
+	u64 var = 0;
+
+	if (j->samples) {
+		min = j->min;
+		max = j->max;
+		mean = div64_s64(j->sum, j->samples);
+		var = div64_u64(j->sumsq, j->samples);
+		var = var > mean * mean ? var - mean * mean : 0;
+	}
+
+	return sprintf(buf, "samples %llu %s %lu min %lld max %lld "
+			"mean %lld stddev %lu\n",
+			(unsigned long long)j->samples, outliers, j->outliers,
+			(long long)min, (long long)max, (long long)mean,
+			pps_jitter_sqrt(var));
+}
+EXPORT_SYMBOL(pps_jitter_print);
+
 /* pps_event - register a PPS event into the system
  * @pps: the PPS device
  * @ts: the event timestamp
@@ -189,6 +281,11 @@ void pps_event(struct pps_device *pps, struct pps_event_time *ts, int event,
 	/* Must call the echo function? */
 	if ((pps->params.mode & (PPS_ECHOASSERT | PPS_ECHOCLEAR)))
 		pps->info.echo(pps, event, data);
+	if (((event & PPS_CAPTUREASSERT) &&
+			(pps->echo_hook_mode & PPS_ECHOASSERT)) ||
+			((event & PPS_CAPTURECLEAR) &&
+			(pps->echo_hook_mode & PPS_ECHOCLEAR)))
+		pps->echo_hook(pps, event, data);
 
 	/* Check the event */
 	pps->current_mode = pps->params.mode;
@@ -25,6 +25,12 @@
 #include <linux/device.h>
 #include <linux/init.h>
 #include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/timex.h>
+#include <linux/uaccess.h>
 #include <linux/pps_kernel.h>
 
 #include "kc.h"
@@ -39,6 +45,175 @@ DEFINE_SPINLOCK(pps_kc_hardpps_lock);
 struct pps_device *pps_kc_hardpps_dev;	/* unique pointer to device */
 int pps_kc_hardpps_mode;		/* mode bits for kernel consumer */
 
+static struct dentry *pps_kc_debugfs_dir;
+
+/*
+ * hardpps() telemetry
+ *
+ * After each pulse passed to hardpps() the discipline state is appended
+ * to a ring in the source. Each open of debugfs pps/ppsN gets its own
+ * read position, starting with the samples still in the ring; read()
+ * returns whole struct pps_kc_sample records and poll() reports new ones.
+ * A reader falling more than a ring behind skips ahead, which shows up
+ * as a gap in the sequence numbers.
+ */
+
+struct pps_kc_reader {
+	struct pps_device *pps;
+	__u32 tail;			/* next sample to read */
+};
+
+/* Must be called with pps_kc_hardpps_lock held */
+static void pps_kc_record(struct pps_device *pps, struct pps_event_time *ts)
+{
+	struct pps_kc_sample *s;
+	struct timex txc;
+	long offset;
+
+	hardpps_fill_timex(&txc);
+
+	offset = ts->ts_real.tv_nsec;
+	if (offset > NSEC_PER_SEC / 2)
+		offset -= NSEC_PER_SEC;
+
+	s = &pps->kc_ring[pps->kc_seq & (PPS_KC_RING_SIZE - 1)];
+	timespec_to_pps_ktime(&s->ts, ts->ts_real);
+	s->ts.flags = 0;
+	s->sequence = pps->kc_seq;
+	s->offset = offset;
+	s->jitter = txc.jitter;
+	s->shift = txc.shift;
+	s->freq = txc.ppsfreq;
+	s->stabil = txc.stabil;
+	s->status = txc.status;
+	s->calcnt = txc.calcnt;
+	s->jitcnt = txc.jitcnt;
+	s->stbcnt = txc.stbcnt;
+	s->errcnt = txc.errcnt;
+	s->reserved = 0;
+	pps->kc_seq++;
+
+	wake_up_interruptible(&pps->kc_queue);
+}
+
+static int pps_kc_open(struct inode *inode, struct file *file)
+{
+	struct pps_device *pps = inode->i_private;
+	struct pps_kc_reader *r;
+
+	r = kmalloc(sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+
+	/* keep the source around while the file is open */
+	get_device(pps->dev);
+	r->pps = pps;
+
+	spin_lock_irq(&pps_kc_hardpps_lock);
+	r->tail = pps->kc_seq > PPS_KC_RING_SIZE ?
+			pps->kc_seq - PPS_KC_RING_SIZE : 0;
+	spin_unlock_irq(&pps_kc_hardpps_lock);
+
+	file->private_data = r;
+	return nonseekable_open(inode, file);
+}
+
+static int pps_kc_release(struct inode *inode, struct file *file)
+{
+	struct pps_kc_reader *r = file->private_data;
+
+	put_device(r->pps->dev);
+	kfree(r);
+	return 0;
+}
+
+static bool pps_kc_pending(struct pps_kc_reader *r)
+{
+	return r->tail != ACCESS_ONCE(r->pps->kc_seq);
+}
+
+static ssize_t pps_kc_read(struct file *file, char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct pps_kc_reader *r = file->private_data;
+	struct pps_device *pps = r->pps;
+	struct pps_kc_sample s;
+	ssize_t done = 0;
+	int err;
+
+	if (count < sizeof(s))
+		return -EINVAL;
+
+	while (count - done >= sizeof(s)) {
+		spin_lock_irq(&pps_kc_hardpps_lock);
+		if (r->tail == pps->kc_seq) {
+			spin_unlock_irq(&pps_kc_hardpps_lock);
+			if (done)
+				break;
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			err = wait_event_interruptible(pps->kc_queue,
+					pps_kc_pending(r));
+			if (err)
+				return err;
+			continue;
+		}
+		if (pps->kc_seq - r->tail > PPS_KC_RING_SIZE)
+			r->tail = pps->kc_seq - PPS_KC_RING_SIZE;
+		s = pps->kc_ring[r->tail & (PPS_KC_RING_SIZE - 1)];
+		r->tail++;
+		spin_unlock_irq(&pps_kc_hardpps_lock);
+
+		if (copy_to_user(buf + done, &s, sizeof(s)))
+			return done ? done : -EFAULT;
+		done += sizeof(s);
+	}
+
+	return done;
+}
+
+static unsigned int pps_kc_poll(struct file *file, poll_table *wait)
+{
+	struct pps_kc_reader *r = file->private_data;
+
+	poll_wait(file, &r->pps->kc_queue, wait);
+
+	return pps_kc_pending(r) ? POLLIN | POLLRDNORM : 0;
+}
+
+static const struct file_operations pps_kc_fops = {
+	.owner		= THIS_MODULE,
+	.llseek		= no_llseek,
+	.open		= pps_kc_open,
+	.release	= pps_kc_release,
+	.read		= pps_kc_read,
+	.poll		= pps_kc_poll,
+};
+
+/* pps_kc_add - create the telemetry file of a new PPS source
+ * @pps: the PPS source
+ */
+void pps_kc_add(struct pps_device *pps)
+{
+	init_waitqueue_head(&pps->kc_queue);
+
+	if (IS_ERR_OR_NULL(pps_kc_debugfs_dir))
+		return;
+	pps->kc_dentry = debugfs_create_file(dev_name(pps->dev), S_IRUSR,
+			pps_kc_debugfs_dir, pps, &pps_kc_fops);
+}
+
+void pps_kc_init(void)
+{
+	pps_kc_debugfs_dir = debugfs_create_dir("pps", NULL);
+}
+
+void pps_kc_exit(void)
+{
+	if (!IS_ERR_OR_NULL(pps_kc_debugfs_dir))
+		debugfs_remove_recursive(pps_kc_debugfs_dir);
+}
+
 /* pps_kc_bind - control PPS kernel consumer binding
  * @pps: the PPS source
  * @bind_args: kernel consumer bind parameters
@@ -91,6 +266,9 @@ int pps_kc_bind(struct pps_device *pps, struct pps_bind_args *bind_args)
  */
 void pps_kc_remove(struct pps_device *pps)
 {
+	if (!IS_ERR_OR_NULL(pps->kc_dentry))
+		debugfs_remove(pps->kc_dentry);
+
 	spin_lock_irq(&pps_kc_hardpps_lock);
 	if (pps == pps_kc_hardpps_dev) {
 		pps_kc_hardpps_mode = 0;
@@ -116,7 +294,9 @@ void pps_kc_event(struct pps_device *pps, struct pps_event_time *ts,
 
 	/* Pass some events to kernel consumer if activated */
 	spin_lock_irqsave(&pps_kc_hardpps_lock, flags);
-	if (pps == pps_kc_hardpps_dev && event & pps_kc_hardpps_mode)
+	if (pps == pps_kc_hardpps_dev && event & pps_kc_hardpps_mode) {
 		hardpps(&ts->ts_real, &ts->ts_raw);
+		pps_kc_record(pps, ts);
+	}
 	spin_unlock_irqrestore(&pps_kc_hardpps_lock, flags);
 }
@@ -28,18 +28,24 @@
 
 extern int pps_kc_bind(struct pps_device *pps,
 		struct pps_bind_args *bind_args);
+extern void pps_kc_add(struct pps_device *pps);
 extern void pps_kc_remove(struct pps_device *pps);
 extern void pps_kc_event(struct pps_device *pps,
 		struct pps_event_time *ts, int event);
+extern void pps_kc_init(void);
+extern void pps_kc_exit(void);
 
 
 #else /* CONFIG_NTP_PPS */
 
 static inline int pps_kc_bind(struct pps_device *pps,
 		struct pps_bind_args *bind_args) { return -EOPNOTSUPP; }
+static inline void pps_kc_add(struct pps_device *pps) {}
 static inline void pps_kc_remove(struct pps_device *pps) {}
 static inline void pps_kc_event(struct pps_device *pps,
 		struct pps_event_time *ts, int event) {}
+static inline void pps_kc_init(void) {}
+static inline void pps_kc_exit(void) {}
 
 #endif /* CONFIG_NTP_PPS */
 
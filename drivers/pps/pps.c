@@ -354,12 +354,38 @@ void pps_unregister_cdev(struct pps_device *pps)
 	cdev_del(&pps->cdev);
 }
 
+static int pps_match_name(struct device *dev, void *data)
+{
+	struct pps_device *pps = dev_get_drvdata(dev);
+
+	return pps && !strcmp(pps->info.name, data);
+}
+
+/* pps_lookup_source - find a PPS source by name
+ * @name: the name the source was registered with
+ *
+ * Returns the source with a reference held on its device, to be dropped
+ * with put_device(pps->dev), or NULL if there is no such source.
+ */
+struct pps_device *pps_lookup_source(const char *name)
+{
+	struct device *dev;
+
+	dev = class_find_device(pps_class, NULL, (void *)name, pps_match_name);
+	if (!dev)
+		return NULL;
+
+	return dev_get_drvdata(dev);
+}
+EXPORT_SYMBOL(pps_lookup_source);
+
 /*
  * Module stuff
  */
 
 static void __exit pps_exit(void)
 {
+	pps_kc_exit();
 	class_destroy(pps_class);
 	unregister_chrdev_region(pps_devt, PPS_MAX_SOURCES);
 }
@@ -381,6 +407,8 @@ static int __init pps_init(void)
 		goto remove_class;
 	}
 
+	pps_kc_init();
+
 	pr_info("LinuxPPS API ver. %d registered\n", PPS_API_VERS);
 	pr_info("Software ver. %s - Copyright 2005-2007 Rodolfo Giometti "
 		"<giometti@linux.it>\n", PPS_VERSION);
@@ -108,6 +108,12 @@ struct omap2_mcspi_dma {
  */
 #define DMA_MIN_BYTES			160
 
+/* chained DMA runs a whole chip select frame, i.e. several transfers, out of
+ * a coherent bounce buffer of this size per direction; small frames then cost
+ * one DMA setup and no cache maintenance.
+ */
+#define DMA_CHAIN_BYTES			(PAGE_SIZE / 2)
+
 
 /*
  * Used for context save and restore, structure members to be updated whenever
@@ -134,6 +140,10 @@ struct omap2_mcspi_cs {
 	void __iomem		*base;
 	unsigned long		phys;
 	int			word_len;
+	unsigned		dma_min_bytes;
+	/* Chained DMA bounce buffer, TX half followed by RX half */
+	void			*chain_buf;
+	dma_addr_t		chain_dma;
 	struct list_head	node;
 	/* Context save and restore shadow register */
 	u32			chconf0;
@@ -300,7 +310,8 @@ static int mcspi_wait_for_reg_bit(void __iomem *reg, unsigned long bit)
 }
 
 static unsigned
-omap2_mcspi_txrx_dma(struct spi_device *spi, struct spi_transfer *xfer)
+omap2_mcspi_txrx_dma(struct spi_device *spi, struct spi_transfer *xfer,
+		int unmap)
 {
 	struct omap2_mcspi	*mcspi;
 	struct omap2_mcspi_cs	*cs = spi->controller_state;
@@ -387,7 +398,9 @@ omap2_mcspi_txrx_dma(struct spi_device *spi, struct spi_transfer *xfer)
 
 	if (tx != NULL) {
 		wait_for_completion(&mcspi_dma->dma_tx_completion);
-		dma_unmap_single(&spi->dev, xfer->tx_dma, count, DMA_TO_DEVICE);
+		if (unmap)
+			dma_unmap_single(&spi->dev, xfer->tx_dma, count,
+					DMA_TO_DEVICE);
 
 		/* for TX_ONLY mode, be sure all words have shifted out */
 		if (rx == NULL) {
@@ -402,7 +415,9 @@ omap2_mcspi_txrx_dma(struct spi_device *spi, struct spi_transfer *xfer)
 
 	if (rx != NULL) {
 		wait_for_completion(&mcspi_dma->dma_rx_completion);
-		dma_unmap_single(&spi->dev, xfer->rx_dma, count, DMA_FROM_DEVICE);
+		if (unmap)
+			dma_unmap_single(&spi->dev, xfer->rx_dma, count,
+					DMA_FROM_DEVICE);
 		omap2_mcspi_set_enable(spi, 0);
 
 		if (l & OMAP2_MCSPI_CHCONF_TURBO) {
@@ -451,6 +466,100 @@ omap2_mcspi_txrx_dma(struct spi_device *spi, struct spi_transfer *xfer)
 	return count;
 }
 
+/*
+ * Return the number of bytes in the chip select frame starting at @first, or
+ * 0 if it can't be run as one chained DMA transfer.  A frame ends with the
+ * message, at cs_change or delay_usecs, or before a transfer that changes the
+ * clock or word size.  @last is set to the final transfer of the frame.
+ */
+static unsigned omap2_mcspi_chain_len(struct spi_device *spi,
+		struct spi_message *m, struct spi_transfer *first,
+		struct spi_transfer **last)
+{
+	struct omap2_mcspi_cs	*cs = spi->controller_state;
+	struct spi_transfer	*t = first;
+	unsigned		len = 0;
+
+	if (!cs->chain_buf || m->is_dma_mapped)
+		return 0;
+
+	for (;;) {
+		if (len + t->len > DMA_CHAIN_BYTES)
+			break;
+		len += t->len;
+		*last = t;
+
+		if (t->cs_change || t->delay_usecs
+				|| list_is_last(&t->transfer_list, &m->transfers))
+			break;
+
+		t = list_entry(t->transfer_list.next, struct spi_transfer,
+				transfer_list);
+		if (t->speed_hz != first->speed_hz
+				|| t->bits_per_word != first->bits_per_word)
+			break;
+	}
+
+	if (!len || len < cs->dma_min_bytes)
+		return 0;
+	return len;
+}
+
+/*
+ * Run the transfers @first to @last as a single full duplex DMA transfer
+ * through the bounce buffer; TX-less transfers clock out zeroes and the RX
+ * data of RX-less transfers is dropped.
+ */
+static unsigned
+omap2_mcspi_txrx_chain(struct spi_device *spi, struct spi_message *m,
+		struct spi_transfer *first, struct spi_transfer *last,
+		unsigned len)
+{
+	struct omap2_mcspi_cs	*cs = spi->controller_state;
+	struct spi_transfer	frame;
+	struct spi_transfer	*t;
+	u8			*tx = cs->chain_buf;
+	u8			*rx = tx + DMA_CHAIN_BYTES;
+	unsigned		count, offset;
+
+	offset = 0;
+	t = first;
+	list_for_each_entry_from(t, &m->transfers, transfer_list) {
+		if (t->tx_buf != NULL)
+			memcpy(tx + offset, t->tx_buf, t->len);
+		else
+			memset(tx + offset, 0, t->len);
+		offset += t->len;
+		if (t == last)
+			break;
+	}
+	/* the bounce buffer is write-combined, drain it before the DMA */
+	wmb();
+
+	memset(&frame, 0, sizeof frame);
+	frame.tx_buf = tx;
+	frame.rx_buf = rx;
+	frame.len = len;
+	frame.tx_dma = cs->chain_dma;
+	frame.rx_dma = cs->chain_dma + DMA_CHAIN_BYTES;
+	count = omap2_mcspi_txrx_dma(spi, &frame, 0);
+
+	offset = 0;
+	t = first;
+	list_for_each_entry_from(t, &m->transfers, transfer_list) {
+		if (offset >= count)
+			break;
+		if (t->rx_buf != NULL)
+			memcpy(t->rx_buf, rx + offset,
+					min(t->len, count - offset));
+		offset += t->len;
+		if (t == last)
+			break;
+	}
+
+	return count;
+}
+
 static unsigned
 omap2_mcspi_txrx_pio(struct spi_device *spi, struct spi_transfer *xfer)
 {
@@ -790,6 +899,7 @@ static int omap2_mcspi_setup(struct spi_device *spi)
 	struct omap2_mcspi_regs	*ctx = &mcspi->ctx;
 	struct omap2_mcspi_dma	*mcspi_dma;
 	struct omap2_mcspi_cs	*cs = spi->controller_state;
+	struct omap2_mcspi_device_config *cd;
 
 	if (spi->bits_per_word < 4 || spi->bits_per_word > 32) {
 		dev_dbg(&spi->dev, "setup: unsupported %d bit words\n",
@@ -811,6 +921,19 @@ static int omap2_mcspi_setup(struct spi_device *spi)
 		list_add_tail(&cs->node, &ctx->cs);
 	}
 
+	cd = spi->controller_data;
+	cs->dma_min_bytes = DMA_MIN_BYTES;
+	if (cd && cd->dma_min_bytes)
+		cs->dma_min_bytes = cd->dma_min_bytes;
+
+	if (cd && cd->chain_dma && !cs->chain_buf) {
+		cs->chain_buf = dma_alloc_coherent(mcspi->dev,
+				2 * DMA_CHAIN_BYTES, &cs->chain_dma,
+				GFP_KERNEL);
+		if (!cs->chain_buf)
+			dev_warn(&spi->dev, "no chained DMA buffer\n");
+	}
+
 	if (mcspi_dma->dma_rx_channel == -1
 			|| mcspi_dma->dma_tx_channel == -1) {
 		ret = omap2_mcspi_request_dma(spi);
@@ -841,6 +964,9 @@ static void omap2_mcspi_cleanup(struct spi_device *spi)
 		cs = spi->controller_state;
 		list_del(&cs->node);
 
+		if (cs->chain_buf)
+			dma_free_coherent(mcspi->dev, 2 * DMA_CHAIN_BYTES,
+					cs->chain_buf, cs->chain_dma);
 		kfree(cs);
 	}
 
@@ -870,6 +996,8 @@ static void omap2_mcspi_work(struct omap2_mcspi *mcspi, struct spi_message *m)
 
 	struct spi_device		*spi;
 	struct spi_transfer		*t = NULL;
+	struct spi_transfer		*last = NULL;
+	unsigned			chain_len;
 	int				cs_active = 0;
 	struct omap2_mcspi_cs		*cs;
 	struct omap2_mcspi_device_config *cd;
@@ -901,16 +1029,19 @@ static void omap2_mcspi_work(struct omap2_mcspi *mcspi, struct spi_message *m)
 			cs_active = 1;
 		}
 
+		chain_len = omap2_mcspi_chain_len(spi, m, t, &last);
+
 		chconf = mcspi_cached_chconf0(spi);
 		chconf &= ~OMAP2_MCSPI_CHCONF_TRM_MASK;
 		chconf &= ~OMAP2_MCSPI_CHCONF_TURBO;
 
-		if (t->tx_buf == NULL)
+		/* chained frames always run full duplex */
+		if (!chain_len && t->tx_buf == NULL)
 			chconf |= OMAP2_MCSPI_CHCONF_TRM_RX_ONLY;
-		else if (t->rx_buf == NULL)
+		else if (!chain_len && t->rx_buf == NULL)
 			chconf |= OMAP2_MCSPI_CHCONF_TRM_TX_ONLY;
 
-		if (cd && cd->turbo_mode && t->tx_buf == NULL) {
+		if (cd && cd->turbo_mode && t->tx_buf == NULL && !chain_len) {
 			/* Turbo mode is for more than one word */
 			if (t->len > ((cs->word_len + 7) >> 3))
 				chconf |= OMAP2_MCSPI_CHCONF_TURBO;
@@ -918,7 +1049,23 @@ static void omap2_mcspi_work(struct omap2_mcspi *mcspi, struct spi_message *m)
 
 		mcspi_write_chconf0(spi, chconf);
 
-		if (t->len) {
+		if (chain_len) {
+			unsigned	count;
+
+			count = omap2_mcspi_txrx_chain(spi, m, t, last,
+					chain_len);
+			m->actual_length += count;
+
+			if (count != chain_len) {
+				status = -EIO;
+				break;
+			}
+
+			/* continue after the frame; its last transfer
+			 * carries the delay and cs_change of the frame
+			 */
+			t = last;
+		} else if (t->len) {
 			unsigned	count;
 
 			/* RX_ONLY mode needs dummy data in TX reg */
@@ -926,8 +1073,8 @@ static void omap2_mcspi_work(struct omap2_mcspi *mcspi, struct spi_message *m)
 				__raw_writel(0, cs->base
 						+ OMAP2_MCSPI_TX0);
 
-			if (m->is_dma_mapped || t->len >= DMA_MIN_BYTES)
-				count = omap2_mcspi_txrx_dma(spi, t);
+			if (m->is_dma_mapped || t->len >= cs->dma_min_bytes)
+				count = omap2_mcspi_txrx_dma(spi, t, 1);
 			else
 				count = omap2_mcspi_txrx_pio(spi, t);
 			m->actual_length += count;
@@ -966,6 +1113,7 @@ static int omap2_mcspi_transfer_one_message(struct spi_master *master,
 						struct spi_message *m)
 {
 	struct omap2_mcspi	*mcspi;
+	struct omap2_mcspi_cs	*cs = m->spi->controller_state;
 	struct spi_transfer	*t;
 
 	mcspi = spi_master_get_devdata(master);
@@ -1000,7 +1148,11 @@ static int omap2_mcspi_transfer_one_message(struct spi_master *master,
 			return -EINVAL;
 		}
 
-		if (m->is_dma_mapped || len < DMA_MIN_BYTES)
+		if (m->is_dma_mapped || len < cs->dma_min_bytes)
+			continue;
+
+		/* these are bounced by omap2_mcspi_txrx_chain() instead */
+		if (cs->chain_buf && len <= DMA_CHAIN_BYTES)
 			continue;
 
 		if (tx_buf != NULL) {
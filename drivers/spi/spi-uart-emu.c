@@ -0,0 +1,843 @@
+/*
+ * SPI UART emulator
+ *
+ * A software SPI master with a single slave that behaves like an NXP
+ * SC16IS7x2 dual UART: the 16550 compatible register file, 64 byte FIFOs,
+ * the TXLVL/RXLVL/IO registers and the SPI command framing. The
+ * sc16is7x2 driver binds to it unmodified, so the serial path can be
+ * exercised and benchmarked without hardware, e.g. under QEMU.
+ *
+ * Characters are shifted in and out at the baud rate programmed through
+ * DLL/DLM, SPI transfers take the time the programmed bus clock would
+ * need, and the interrupt line is a software IRQ with level semantics.
+ * Statistics and the RX traffic generator live in debugfs:
+ *
+ *   /sys/kernel/debug/spi-uart-emu/stats	  read: results, write: reset
+ *   /sys/kernel/debug/spi-uart-emu/rx_inject  "<channel> <bytes>"
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/delay.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/platform_device.h>
+#include <linux/serial_reg.h>
+#include <linux/spi/spi.h>
+#include <linux/serial_sc16is7x2.h>
+
+#define DRV_NAME		"spi-uart-emu"
+
+#define EMU_MAX_FIFO		64
+#define EMU_HIST_BUCKETS	16	/* log2 microseconds */
+
+/* SC16IS7x2 specific registers */
+#define EMU_REG_TXLVL		0x08
+#define EMU_REG_RXLVL		0x09
+#define EMU_REG_IOD		0x0A
+#define EMU_REG_IOS		0x0B
+#define EMU_REG_IOI		0x0C
+#define EMU_REG_IOC		0x0E
+#define EMU_REG_EFCR		0x0F
+
+#define EMU_IOC_SRESET		0x08
+#define EMU_MCR_TCRTLR		0x04
+#define EMU_LCR_EFR_ACCESS	0xBF
+
+static unsigned uartclk = 22118400;
+module_param(uartclk, uint, S_IRUGO);
+MODULE_PARM_DESC(uartclk, "Emulated crystal frequency in Hz");
+
+static unsigned fifo_size = EMU_MAX_FIFO;
+module_param(fifo_size, uint, S_IRUGO);
+MODULE_PARM_DESC(fifo_size, "RX/TX FIFO depth (8-64)");
+
+static unsigned spi_hz = 4000000;
+module_param(spi_hz, uint, S_IRUGO);
+MODULE_PARM_DESC(spi_hz, "Emulated SPI clock when a transfer sets none, 0: no bus delay");
+
+static unsigned uart_base = 2;
+module_param(uart_base, uint, S_IRUGO);
+MODULE_PARM_DESC(uart_base, "Line number of the first UART (even)");
+
+static unsigned gpio_base = 240;
+module_param(gpio_base, uint, S_IRUGO);
+MODULE_PARM_DESC(gpio_base, "Number of the first GPIO");
+
+struct uart_emu_fifo {
+	u8		data[EMU_MAX_FIFO];
+	unsigned	head, count;
+};
+
+struct uart_emu_chan {
+	struct uart_emu		*emu;
+	unsigned		ch;
+	struct hrtimer		char_timer;	/* one tick per character */
+
+	u8		ier, fcr, lcr, mcr, spr, efr, tcr, tlr, efcr;
+	u8		dll, dlm;
+	u8		lsr_err;	/* sticky OE/PE/FE/BI */
+	bool		thr_irq;	/* THR interrupt pending */
+	bool		timeout_irq;	/* RX timeout interrupt pending */
+	unsigned	idle_chars;	/* char times since the last RX byte */
+	struct uart_emu_fifo rx, tx;
+
+	unsigned long	inject;		/* generator bytes still to send */
+	u8		inject_seq;
+
+	/* statistics */
+	unsigned long	rx_injected, rx_read, tx_written, rx_overruns;
+};
+
+struct uart_emu {
+	struct spi_master	*master;
+	struct platform_device	*pdev;
+	spinlock_t		lock;
+	struct uart_emu_chan	chan[2];
+	u8			iodir, iostate, ioint, ioctl;
+
+	int			irq;
+	bool			irq_line;	/* line asserted */
+	bool			irq_masked;
+	bool			irq_read;	/* RX read since the assert */
+	ktime_t			irq_time;	/* when the line was asserted */
+	struct tasklet_struct	irq_tasklet;
+
+	/* CS frame decoding */
+	int			cmd;		/* -1: next byte is a command */
+
+	/* statistics */
+	ktime_t			start;
+	unsigned long		irqs, messages, transfers, bytes;
+	unsigned long		hist[EMU_HIST_BUCKETS];
+
+	struct dentry		*debugfs;
+};
+
+/* ******************************** FIFO ******************************** */
+
+static bool emu_fifo_put(struct uart_emu_fifo *f, u8 c)
+{
+	if (f->count >= fifo_size)
+		return false;
+	f->data[(f->head + f->count) % EMU_MAX_FIFO] = c;
+	f->count++;
+	return true;
+}
+
+static u8 emu_fifo_get(struct uart_emu_fifo *f)
+{
+	u8 c;
+
+	if (!f->count)
+		return 0;
+	c = f->data[f->head];
+	f->head = (f->head + 1) % EMU_MAX_FIFO;
+	f->count--;
+	return c;
+}
+
+static void emu_fifo_clear(struct uart_emu_fifo *f)
+{
+	f->head = f->count = 0;
+}
+
+/* ******************************** UART ******************************** */
+
+static unsigned emu_rx_trigger(struct uart_emu_chan *c)
+{
+	static const u8 fcr_levels[] = { 8, 16, 56, 60 };
+
+	if (c->tlr >> 4)
+		return (c->tlr >> 4) * 4;
+	return fcr_levels[c->fcr >> 6];
+}
+
+/* Free TX FIFO space at or above which the THR interrupt fires */
+static unsigned emu_tx_trigger(struct uart_emu_chan *c)
+{
+	static const u8 fcr_levels[] = { 8, 16, 32, 56 };
+
+	if (c->tlr & 0x0f)
+		return (c->tlr & 0x0f) * 4;
+	return fcr_levels[(c->fcr >> 4) & 3];
+}
+
+static u8 emu_iir(struct uart_emu_chan *c)
+{
+	u8 fifo = (c->fcr & UART_FCR_ENABLE_FIFO) ? 0xc0 : 0;
+
+	if ((c->ier & UART_IER_RLSI) && c->lsr_err)
+		return fifo | UART_IIR_RLSI;
+	if (c->ier & UART_IER_RDI) {
+		if (c->rx.count >= emu_rx_trigger(c))
+			return fifo | UART_IIR_RDI;
+		if (c->timeout_irq)
+			return fifo | 0x0c;
+	}
+	if ((c->ier & UART_IER_THRI) && c->thr_irq)
+		return fifo | UART_IIR_THRI;
+	return fifo | UART_IIR_NO_INT;
+}
+
+/* Recompute the shared IRQ line, called with emu->lock held */
+static void emu_update_irq(struct uart_emu *emu)
+{
+	bool line = !(emu_iir(&emu->chan[0]) & UART_IIR_NO_INT) ||
+		    !(emu_iir(&emu->chan[1]) & UART_IIR_NO_INT);
+
+	if (line && !emu->irq_line) {
+		emu->irq_time = ktime_get();
+		emu->irq_read = false;
+	}
+	emu->irq_line = line;
+
+	if (line && !emu->irq_masked)
+		tasklet_schedule(&emu->irq_tasklet);
+}
+
+static u64 emu_char_ns(struct uart_emu_chan *c)
+{
+	unsigned quot = (c->dlm << 8) | c->dll;
+	unsigned bits;
+
+	/* start + data + stop (+ parity) */
+	bits = 1 + 5 + (c->lcr & UART_LCR_WLEN8) + 1;
+	if (c->lcr & UART_LCR_STOP)
+		bits++;
+	if (c->lcr & UART_LCR_PARITY)
+		bits++;
+
+	return div_u64((u64)bits * NSEC_PER_SEC * 16 * (quot ? quot : 1),
+			uartclk);
+}
+
+static bool emu_chan_busy(struct uart_emu_chan *c)
+{
+	return c->tx.count || c->inject || (c->rx.count && !c->timeout_irq);
+}
+
+static void emu_kick(struct uart_emu_chan *c)
+{
+	if (emu_chan_busy(c) && !hrtimer_active(&c->char_timer))
+		hrtimer_start(&c->char_timer, ns_to_ktime(emu_char_ns(c)),
+				HRTIMER_MODE_REL);
+}
+
+static void emu_rx_char(struct uart_emu_chan *c, u8 ch)
+{
+	c->idle_chars = 0;
+	c->timeout_irq = false;
+	if (!emu_fifo_put(&c->rx, ch)) {
+		c->lsr_err |= UART_LSR_OE;
+		c->rx_overruns++;
+	}
+}
+
+/* One character time elapsed on this channel */
+static enum hrtimer_restart emu_char_tick(struct hrtimer *t)
+{
+	struct uart_emu_chan *c = container_of(t, struct uart_emu_chan,
+			char_timer);
+	struct uart_emu *emu = c->emu;
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	unsigned long flags;
+
+	spin_lock_irqsave(&emu->lock, flags);
+
+	if (c->tx.count) {
+		u8 ch = emu_fifo_get(&c->tx);
+
+		if (c->mcr & UART_MCR_LOOP)
+			emu_rx_char(c, ch);
+		if (fifo_size - c->tx.count >= emu_tx_trigger(c) ||
+		    !c->tx.count)
+			c->thr_irq = true;
+	}
+
+	if (c->inject) {
+		c->inject--;
+		c->rx_injected++;
+		emu_rx_char(c, c->inject_seq++);
+	} else if (c->rx.count && ++c->idle_chars >= 4) {
+		c->timeout_irq = true;
+	}
+
+	emu_update_irq(emu);
+
+	if (emu_chan_busy(c)) {
+		hrtimer_forward_now(t, ns_to_ktime(emu_char_ns(c)));
+		ret = HRTIMER_RESTART;
+	}
+
+	spin_unlock_irqrestore(&emu->lock, flags);
+	return ret;
+}
+
+static void emu_reset_chan(struct uart_emu_chan *c)
+{
+	hrtimer_try_to_cancel(&c->char_timer);
+	c->ier = c->fcr = c->mcr = c->spr = c->efr = c->tcr = c->tlr = 0;
+	c->efcr = 0;
+	c->lcr = UART_LCR_WLEN8;
+	c->dll = 1;
+	c->dlm = 0;
+	c->lsr_err = 0;
+	c->thr_irq = true;
+	c->timeout_irq = false;
+	c->inject = 0;
+	emu_fifo_clear(&c->rx);
+	emu_fifo_clear(&c->tx);
+}
+
+static u8 emu_read_reg(struct uart_emu *emu, struct uart_emu_chan *c,
+		unsigned reg)
+{
+	bool efr_access = c->lcr == EMU_LCR_EFR_ACCESS;
+	bool dlab = (c->lcr & UART_LCR_DLAB) && !efr_access;
+	bool tcrtlr = (c->mcr & EMU_MCR_TCRTLR) && (c->efr & UART_EFR_ECB);
+	u8 val;
+
+	switch (reg) {
+	case UART_RX:
+		if (dlab)
+			return c->dll;
+		if (!emu->irq_read && emu->irq_line) {
+			s64 us = ktime_us_delta(ktime_get(), emu->irq_time);
+
+			emu->hist[min_t(unsigned, us > 0 ? ilog2(us) + 1 : 0,
+					EMU_HIST_BUCKETS - 1)]++;
+			emu->irq_read = true;
+		}
+		if (c->rx.count)
+			c->rx_read++;
+		val = emu_fifo_get(&c->rx);
+		if (!c->rx.count)
+			c->timeout_irq = false;
+		return val;
+	case UART_IER:
+		return dlab ? c->dlm : c->ier;
+	case UART_IIR:
+		if (efr_access)
+			return c->efr;
+		val = emu_iir(c);
+		if ((val & 0x3f) == UART_IIR_THRI)
+			c->thr_irq = false;
+		return val;
+	case UART_LCR:
+		return c->lcr;
+	case UART_MCR:
+		return c->mcr;
+	case UART_LSR:
+		val = c->lsr_err;
+		c->lsr_err = 0;
+		if (c->rx.count)
+			val |= UART_LSR_DR;
+		if (!c->tx.count)
+			val |= UART_LSR_THRE | UART_LSR_TEMT;
+		return val;
+	case UART_MSR:
+		return tcrtlr ? c->tcr : 0;
+	case UART_SCR:
+		return tcrtlr ? c->tlr : c->spr;
+	case EMU_REG_TXLVL:
+		return fifo_size - c->tx.count;
+	case EMU_REG_RXLVL:
+		return c->rx.count;
+	case EMU_REG_IOD:
+		return emu->iodir;
+	case EMU_REG_IOS:
+		return emu->iostate & emu->iodir;
+	case EMU_REG_IOI:
+		return emu->ioint;
+	case EMU_REG_IOC:
+		return emu->ioctl;
+	case EMU_REG_EFCR:
+		return c->efcr;
+	}
+	return 0;
+}
+
+static void emu_write_reg(struct uart_emu *emu, struct uart_emu_chan *c,
+		unsigned reg, u8 val)
+{
+	bool efr_access = c->lcr == EMU_LCR_EFR_ACCESS;
+	bool dlab = (c->lcr & UART_LCR_DLAB) && !efr_access;
+	bool tcrtlr = (c->mcr & EMU_MCR_TCRTLR) && (c->efr & UART_EFR_ECB);
+
+	switch (reg) {
+	case UART_TX:
+		if (dlab) {
+			c->dll = val;
+			break;
+		}
+		c->tx_written++;
+		c->thr_irq = false;
+		emu_fifo_put(&c->tx, val);
+		emu_kick(c);
+		break;
+	case UART_IER:
+		if (dlab)
+			c->dlm = val;
+		else
+			c->ier = val;
+		break;
+	case UART_FCR:
+		if (efr_access) {
+			c->efr = val;
+			break;
+		}
+		if (val & UART_FCR_CLEAR_RCVR) {
+			emu_fifo_clear(&c->rx);
+			c->timeout_irq = false;
+		}
+		if (val & UART_FCR_CLEAR_XMIT) {
+			emu_fifo_clear(&c->tx);
+			c->thr_irq = true;
+		}
+		/* TX trigger bits are only writable with EFR[4] set */
+		if (!(c->efr & UART_EFR_ECB))
+			val = (val & ~0x30) | (c->fcr & 0x30);
+		c->fcr = val & ~(UART_FCR_CLEAR_RCVR | UART_FCR_CLEAR_XMIT);
+		break;
+	case UART_LCR:
+		c->lcr = val;
+		break;
+	case UART_MCR:
+		c->mcr = val;
+		break;
+	case UART_MSR:
+		if (tcrtlr)
+			c->tcr = val;
+		break;
+	case UART_SCR:
+		if (tcrtlr)
+			c->tlr = val;
+		else
+			c->spr = val;
+		break;
+	case EMU_REG_IOD:
+		emu->iodir = val;
+		break;
+	case EMU_REG_IOS:
+		emu->iostate = val;
+		break;
+	case EMU_REG_IOI:
+		emu->ioint = val;
+		break;
+	case EMU_REG_IOC:
+		if (val & EMU_IOC_SRESET) {
+			emu_reset_chan(&emu->chan[0]);
+			emu_reset_chan(&emu->chan[1]);
+			emu->iodir = emu->iostate = emu->ioint = 0;
+			val &= ~EMU_IOC_SRESET;
+		}
+		emu->ioctl = val;
+		break;
+	case EMU_REG_EFCR:
+		c->efcr = val;
+		break;
+	}
+}
+
+/* One byte on the bus, the first of each CS frame is the command */
+static u8 emu_xfer_byte(struct uart_emu *emu, u8 out)
+{
+	struct uart_emu_chan *c;
+	unsigned reg;
+
+	if (emu->cmd < 0) {
+		emu->cmd = out;
+		return 0xff;
+	}
+
+	c = &emu->chan[(emu->cmd >> 1) & 1];
+	reg = (emu->cmd >> 3) & 0xf;
+	if (emu->cmd & 0x80)
+		return emu_read_reg(emu, c, reg);
+
+	emu_write_reg(emu, c, reg, out);
+	return 0xff;
+}
+
+/* ******************************** IRQ ********************************* */
+
+static void emu_irq_mask(struct irq_data *d)
+{
+	struct uart_emu *emu = irq_data_get_irq_chip_data(d);
+
+	emu->irq_masked = true;
+}
+
+static void emu_irq_unmask(struct irq_data *d)
+{
+	struct uart_emu *emu = irq_data_get_irq_chip_data(d);
+
+	emu->irq_masked = false;
+	/* Level semantics: still asserted, deliver again */
+	if (emu->irq_line)
+		tasklet_schedule(&emu->irq_tasklet);
+}
+
+static struct irq_chip emu_irq_chip = {
+	.name		= DRV_NAME,
+	.irq_mask	= emu_irq_mask,
+	.irq_unmask	= emu_irq_unmask,
+};
+
+static void emu_irq_deliver(unsigned long data)
+{
+	struct uart_emu *emu = (struct uart_emu *)data;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	if (emu->irq_line && !emu->irq_masked) {
+		emu->irqs++;
+		generic_handle_irq(emu->irq);
+	}
+	local_irq_restore(flags);
+}
+
+static void emu_irq_teardown(struct uart_emu *emu)
+{
+#ifdef CONFIG_ARM
+	set_irq_flags(emu->irq, 0);
+#endif
+	irq_set_chip_and_handler(emu->irq, NULL, NULL);
+	irq_set_chip_data(emu->irq, NULL);
+	irq_free_desc(emu->irq);
+}
+
+/* ******************************** SPI ********************************* */
+
+static int emu_setup(struct spi_device *spi)
+{
+	return 0;
+}
+
+static void emu_bus_delay(struct spi_device *spi, struct spi_transfer *t)
+{
+	u32 hz = t->speed_hz ? t->speed_hz : spi->max_speed_hz;
+	u64 ns;
+
+	if (!spi_hz)
+		return;
+	if (!hz || hz > spi_hz)
+		hz = spi_hz;
+
+	ns = div_u64((u64)t->len * 8 * NSEC_PER_SEC, hz);
+	if (ns >= 20 * NSEC_PER_USEC)
+		usleep_range(div_u64(ns, NSEC_PER_USEC),
+				div_u64(ns, NSEC_PER_USEC) + 10);
+	else
+		ndelay(ns);
+}
+
+static int emu_transfer_one_message(struct spi_master *master,
+		struct spi_message *m)
+{
+	struct uart_emu *emu = spi_master_get_devdata(master);
+	struct spi_transfer *t;
+	unsigned long flags;
+	unsigned i;
+
+	emu->cmd = -1;
+	emu->messages++;
+
+	list_for_each_entry(t, &m->transfers, transfer_list) {
+		const u8 *tx = t->tx_buf;
+		u8 *rx = t->rx_buf;
+
+		emu_bus_delay(m->spi, t);
+
+		spin_lock_irqsave(&emu->lock, flags);
+		for (i = 0; i < t->len; i++) {
+			u8 in = emu_xfer_byte(emu, tx ? tx[i] : 0);
+
+			if (rx)
+				rx[i] = in;
+		}
+		emu_update_irq(emu);
+		spin_unlock_irqrestore(&emu->lock, flags);
+
+		emu->transfers++;
+		emu->bytes += t->len;
+		m->actual_length += t->len;
+
+		if (t->delay_usecs)
+			udelay(t->delay_usecs);
+		/* A new chip select frame starts with a command byte */
+		if (t->cs_change)
+			emu->cmd = -1;
+	}
+
+	m->status = 0;
+	spi_finalize_current_message(master);
+	return 0;
+}
+
+/* ****************************** DEBUGFS ******************************* */
+
+static void emu_reset_stats(struct uart_emu *emu)
+{
+	unsigned long flags;
+	unsigned ch;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	emu->start = ktime_get();
+	emu->irqs = emu->messages = emu->transfers = emu->bytes = 0;
+	memset(emu->hist, 0, sizeof(emu->hist));
+	for (ch = 0; ch < 2; ch++) {
+		struct uart_emu_chan *c = &emu->chan[ch];
+
+		c->rx_injected = c->rx_read = c->tx_written = 0;
+		c->rx_overruns = 0;
+	}
+	spin_unlock_irqrestore(&emu->lock, flags);
+}
+
+static int emu_stats_show(struct seq_file *s, void *unused)
+{
+	struct uart_emu *emu = s->private;
+	u64 us = ktime_us_delta(ktime_get(), emu->start);
+	unsigned long data = 0;
+	unsigned ch, i;
+
+	seq_printf(s, "elapsed_us: %llu\n", (unsigned long long)us);
+	seq_printf(s, "irqs: %lu\n", emu->irqs);
+	seq_printf(s, "spi_messages: %lu\n", emu->messages);
+	seq_printf(s, "spi_transfers: %lu\n", emu->transfers);
+	seq_printf(s, "spi_bytes: %lu\n", emu->bytes);
+
+	for (ch = 0; ch < 2; ch++) {
+		struct uart_emu_chan *c = &emu->chan[ch];
+
+		seq_printf(s, "ch%u: baud %llu rx_injected %lu rx_read %lu "
+				"tx_written %lu overruns %lu\n", ch,
+				div_u64((u64)uartclk, 16 *
+					(((c->dlm << 8) | c->dll) ? : 1)),
+				c->rx_injected, c->rx_read, c->tx_written,
+				c->rx_overruns);
+		seq_printf(s, "ch%u: rx_bytes_per_sec %llu tx_bytes_per_sec %llu\n",
+				ch,
+				us ? div64_u64((u64)c->rx_read * USEC_PER_SEC, us) : 0,
+				us ? div64_u64((u64)c->tx_written * USEC_PER_SEC, us) : 0);
+		data += c->rx_read + c->tx_written;
+	}
+
+	/* per mille, to stay in integer arithmetic */
+	seq_printf(s, "spi_messages_per_1000_bytes: %lu\n",
+			data ? emu->messages * 1000 / data : 0);
+	seq_printf(s, "irqs_per_1000_bytes: %lu\n",
+			data ? emu->irqs * 1000 / data : 0);
+
+	seq_printf(s, "irq_to_rx_read_us:\n");
+	seq_printf(s, "  <1: %lu\n", emu->hist[0]);
+	for (i = 1; i < EMU_HIST_BUCKETS; i++)
+		seq_printf(s, "  %lu-%lu: %lu\n", 1UL << (i - 1),
+				(1UL << i) - 1, emu->hist[i]);
+
+	return 0;
+}
+
+static int emu_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, emu_stats_show, inode->i_private);
+}
+
+static ssize_t emu_stats_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+
+	emu_reset_stats(s->private);
+	return count;
+}
+
+static const struct file_operations emu_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= emu_stats_open,
+	.read		= seq_read,
+	.write		= emu_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static ssize_t emu_inject_write(struct file *file, const char __user *ubuf,
+		size_t count, loff_t *ppos)
+{
+	struct uart_emu *emu = file->private_data;
+	unsigned long flags, bytes;
+	unsigned ch;
+	char buf[32];
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	if (sscanf(buf, "%u %lu", &ch, &bytes) != 2 || ch > 1)
+		return -EINVAL;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	emu->chan[ch].inject += bytes;
+	emu_kick(&emu->chan[ch]);
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	return count;
+}
+
+static int emu_inject_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static const struct file_operations emu_inject_fops = {
+	.owner		= THIS_MODULE,
+	.open		= emu_inject_open,
+	.write		= emu_inject_write,
+	.llseek		= no_llseek,
+};
+
+/* ******************************** INIT ******************************** */
+
+static struct sc16is7x2_platform_data emu_pdata;
+
+static struct platform_device *emu_pdev;
+
+static int __init uart_emu_init(void)
+{
+	struct spi_board_info info = {
+		.modalias	= "sc16is7x2",
+		.chip_select	= 0,
+		.mode		= SPI_MODE_0,
+		.platform_data	= &emu_pdata,
+	};
+	struct spi_master *master;
+	struct uart_emu *emu;
+	unsigned ch;
+	int ret;
+
+	if (fifo_size < 8 || fifo_size > EMU_MAX_FIFO || uart_base & 1 ||
+	    !gpio_base || !uartclk)
+		return -EINVAL;
+
+	emu_pdev = platform_device_register_simple(DRV_NAME, -1, NULL, 0);
+	if (IS_ERR(emu_pdev))
+		return PTR_ERR(emu_pdev);
+
+	master = spi_alloc_master(&emu_pdev->dev, sizeof(*emu));
+	if (!master) {
+		ret = -ENOMEM;
+		goto err_pdev;
+	}
+
+	emu = spi_master_get_devdata(master);
+	emu->master = master;
+	emu->pdev = emu_pdev;
+	spin_lock_init(&emu->lock);
+	tasklet_init(&emu->irq_tasklet, emu_irq_deliver, (unsigned long)emu);
+	for (ch = 0; ch < 2; ch++) {
+		struct uart_emu_chan *c = &emu->chan[ch];
+
+		c->emu = emu;
+		c->ch = ch;
+		hrtimer_init(&c->char_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		c->char_timer.function = emu_char_tick;
+		emu_reset_chan(c);
+	}
+	emu_reset_stats(emu);
+
+	emu->irq = irq_alloc_desc(numa_node_id());
+	if (emu->irq < 0) {
+		ret = emu->irq;
+		goto err_master;
+	}
+	irq_set_chip_and_handler(emu->irq, &emu_irq_chip, handle_level_irq);
+	irq_set_chip_data(emu->irq, emu);
+#ifdef CONFIG_ARM
+	set_irq_flags(emu->irq, IRQF_VALID);
+#else
+	irq_set_noprobe(emu->irq);
+#endif
+	emu->irq_masked = true;
+
+	master->bus_num = -1;
+	master->num_chipselect = 1;
+	master->mode_bits = SPI_CPOL | SPI_CPHA;
+	master->setup = emu_setup;
+	master->transfer_one_message = emu_transfer_one_message;
+	platform_set_drvdata(emu_pdev, master);
+
+	ret = spi_register_master(master);
+	if (ret)
+		goto err_irq;
+
+	emu->debugfs = debugfs_create_dir(DRV_NAME, NULL);
+	if (!IS_ERR_OR_NULL(emu->debugfs)) {
+		debugfs_create_file("stats", S_IRUGO | S_IWUSR, emu->debugfs,
+				emu, &emu_stats_fops);
+		debugfs_create_file("rx_inject", S_IWUSR, emu->debugfs,
+				emu, &emu_inject_fops);
+	}
+
+	emu_pdata.uartclk = uartclk;
+	emu_pdata.uart_base = uart_base;
+	emu_pdata.gpio_base = gpio_base;
+	emu_pdata.label = DRV_NAME;
+	info.irq = emu->irq;
+	info.max_speed_hz = spi_hz;
+	if (!spi_new_device(master, &info))
+		dev_warn(&emu_pdev->dev, "failed to add sc16is7x2 slave\n");
+
+	dev_info(&emu_pdev->dev, "SC16IS7x2 emulator on SPI bus %d, irq %d\n",
+			master->bus_num, emu->irq);
+	return 0;
+
+err_irq:
+	emu_irq_teardown(emu);
+err_master:
+	spi_master_put(master);
+err_pdev:
+	platform_device_unregister(emu_pdev);
+	return ret;
+}
+module_init(uart_emu_init);
+
+static void __exit uart_emu_exit(void)
+{
+	struct spi_master *master = platform_get_drvdata(emu_pdev);
+	struct uart_emu *emu = spi_master_get_devdata(master);
+	unsigned ch;
+
+	debugfs_remove_recursive(emu->debugfs);
+
+	/* Keep the master alive until we are done with emu */
+	spi_master_get(master);
+	spi_unregister_master(master);
+
+	for (ch = 0; ch < 2; ch++)
+		hrtimer_cancel(&emu->chan[ch].char_timer);
+	tasklet_kill(&emu->irq_tasklet);
+	emu_irq_teardown(emu);
+
+	spi_master_put(master);
+	platform_device_unregister(emu_pdev);
+}
+module_exit(uart_emu_exit);
+
+MODULE_DESCRIPTION("SC16IS7x2 compatible SPI UART emulator");
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,716 @@
+/*
+ * n_frame.c -- framed receive line discipline
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * N_FRAME cuts the receive stream of a serial device into frames in the
+ * kernel, so that a reader is woken once per complete frame instead of
+ * once per flip buffer push, and gets exactly one frame per read().
+ *
+ * Frames are assembled straight into preallocated buffers, which are
+ * copied to user space once by read(). A frame that arrives while all
+ * buffers are queued is counted as dropped. Each frame carries the
+ * CLOCK_REALTIME time at which the driver drained its first byte from the
+ * receive FIFO when the tty has receive timestamps enabled, otherwise the
+ * time at which the line discipline saw it.
+ *
+ * Writes are passed to the driver unchanged. See include/linux/n_frame.h
+ * for the user interface.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/sched.h>
+#include <linux/poll.h>
+#include <linux/tty.h>
+#include <linux/ktime.h>
+#include <linux/crc-ccitt.h>
+#include <linux/n_frame.h>
+
+#include <asm/uaccess.h>
+
+#define N_FRAME_MAX_FRAME	65535
+#define N_FRAME_MAX_QUEUE	(1024 * 1024)	/* bytes of frame buffers */
+
+enum n_frame_state {
+	NF_HUNT,	/* waiting for the first byte of a frame */
+	NF_FRAME,	/* assembling a frame */
+	NF_SKIP,	/* oversize frame, waiting for its end */
+};
+
+struct n_frame_buf {
+	struct list_head	list;
+	struct n_frame_hdr	hdr;
+	unsigned int		off;	/* first byte returned to the reader */
+	unsigned int		gen;	/* configuration it was sized for */
+	u8			data[0];
+};
+
+struct n_frame {
+	struct tty_struct	*tty;
+	spinlock_t		lock;
+	struct n_frame_config	cfg;
+	unsigned int		gen;		/* bumped by every SETCONF */
+	struct n_frame_stats	stats;
+	struct list_head	rx_queue;	/* complete frames */
+	struct list_head	rx_free;
+	struct n_frame_buf	*scratch;	/* assembly when rx_free is empty */
+	struct n_frame_buf	*cur;		/* frame being assembled */
+	enum n_frame_state	state;
+	unsigned int		count;		/* bytes in cur */
+	unsigned int		need;		/* LENGTH mode frame size */
+};
+
+static const struct n_frame_config n_frame_default_config = {
+	.mode		= N_FRAME_MODE_DELIM,
+	.flags		= N_FRAME_F_START | N_FRAME_F_HEADER,
+	.csum		= N_FRAME_CSUM_NMEA,
+	.max_frame	= 1024,
+	.rx_frames	= 16,
+	.start		= '$',
+	.end		= '\n',
+};
+
+static void n_frame_free_bufs(struct list_head *bufs)
+{
+	struct n_frame_buf *b, *tmp;
+
+	list_for_each_entry_safe(b, tmp, bufs, list)
+		kfree(b);
+}
+
+static int n_frame_alloc_bufs(struct list_head *bufs,
+			      const struct n_frame_config *cfg)
+{
+	struct n_frame_buf *b;
+	int i;
+
+	/* One more than can be queued, for the scratch buffer */
+	for (i = 0; i <= cfg->rx_frames; i++) {
+		b = kmalloc(sizeof(*b) + cfg->max_frame, GFP_KERNEL);
+		if (!b) {
+			n_frame_free_bufs(bufs);
+			return -ENOMEM;
+		}
+		list_add(&b->list, bufs);
+	}
+	return 0;
+}
+
+static int n_frame_check_config(const struct n_frame_config *cfg)
+{
+	if (cfg->max_frame < 8 || cfg->max_frame > N_FRAME_MAX_FRAME)
+		return -EINVAL;
+	if (cfg->rx_frames < 1 ||
+	    cfg->rx_frames > N_FRAME_MAX_QUEUE / cfg->max_frame)
+		return -EINVAL;
+	if (cfg->csum > N_FRAME_CSUM_CRC16)
+		return -EINVAL;
+
+	switch (cfg->mode) {
+	case N_FRAME_MODE_DELIM:
+		if ((cfg->flags & N_FRAME_F_START) && cfg->start == cfg->end)
+			return -EINVAL;
+		break;
+	case N_FRAME_MODE_LENGTH:
+		if (cfg->len_offset < 1 ||
+		    (cfg->len_size != 1 && cfg->len_size != 2) ||
+		    cfg->len_offset + cfg->len_size > cfg->max_frame)
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * n_frame_set_config - install a configuration and its buffers
+ * @nf: line discipline instance
+ * @cfg: validated configuration
+ *
+ * Queued frames and a frame in progress are discarded. A frame a reader is
+ * copying out belongs to the old configuration and may be too small for the
+ * new one; the reader frees it rather than returning it to the pool.
+ */
+static int n_frame_set_config(struct n_frame *nf,
+			      const struct n_frame_config *cfg)
+{
+	struct n_frame_buf *b;
+	LIST_HEAD(bufs);
+	LIST_HEAD(old);
+	unsigned long flags;
+	int ret;
+
+	ret = n_frame_alloc_bufs(&bufs, cfg);
+	if (ret)
+		return ret;
+
+	spin_lock_irqsave(&nf->lock, flags);
+	list_splice_init(&nf->rx_queue, &old);
+	list_splice_init(&nf->rx_free, &old);
+	if (nf->scratch)
+		list_add(&nf->scratch->list, &old);
+	if (nf->cur && nf->cur != nf->scratch)
+		list_add(&nf->cur->list, &old);
+
+	nf->cfg = *cfg;
+	nf->gen++;
+	list_for_each_entry(b, &bufs, list)
+		b->gen = nf->gen;
+	nf->scratch = list_first_entry(&bufs, struct n_frame_buf, list);
+	list_del(&nf->scratch->list);
+	list_splice(&bufs, &nf->rx_free);
+	nf->cur = NULL;
+	nf->state = NF_HUNT;
+	spin_unlock_irqrestore(&nf->lock, flags);
+
+	n_frame_free_bufs(&old);
+	return 0;
+}
+
+/* Caller holds nf->lock */
+static void n_frame_abort(struct n_frame *nf)
+{
+	if (nf->cur && nf->cur != nf->scratch)
+		list_add(&nf->cur->list, &nf->rx_free);
+	nf->cur = NULL;
+	nf->state = NF_HUNT;
+}
+
+/* Caller holds nf->lock */
+static void n_frame_begin(struct n_frame *nf, ktime_t *now, unsigned long seq)
+{
+	struct timespec ts;
+	ktime_t t;
+
+	if (nf->cur) {
+		nf->stats.discarded += nf->count;
+		n_frame_abort(nf);
+	}
+
+	if (list_empty(&nf->rx_free)) {
+		nf->cur = nf->scratch;
+	} else {
+		nf->cur = list_first_entry(&nf->rx_free, struct n_frame_buf,
+					   list);
+		list_del(&nf->cur->list);
+	}
+
+	if (tty_rx_stamp(nf->tty, seq, &t)) {
+		nf->cur->hdr.tsrc = N_FRAME_TS_DRIVER;
+	} else {
+		if (!now->tv64)
+			*now = ktime_get_real();
+		t = *now;
+		nf->cur->hdr.tsrc = N_FRAME_TS_LDISC;
+	}
+	ts = ktime_to_timespec(t);
+	nf->cur->hdr.tv_sec = ts.tv_sec;
+	nf->cur->hdr.tv_nsec = ts.tv_nsec;
+	nf->count = 0;
+	nf->need = 0;
+	nf->state = NF_FRAME;
+}
+
+static bool n_frame_check_nmea(const u8 *p, unsigned int len)
+{
+	unsigned int i;
+	int hi, lo;
+	u8 sum = 0;
+
+	/* Sentences end in "\r\n", the end delimiter is the '\n' */
+	while (len && p[len - 1] == '\r')
+		len--;
+	/* Without a start delimiter the talker '$' or '!' is still here */
+	if (len && (p[0] == '$' || p[0] == '!')) {
+		p++;
+		len--;
+	}
+	if (len < 3 || p[len - 3] != '*')
+		return false;
+
+	hi = hex_to_bin(p[len - 2]);
+	lo = hex_to_bin(p[len - 1]);
+	if (hi < 0 || lo < 0)
+		return false;
+
+	for (i = 0; i < len - 3; i++)
+		sum ^= p[i];
+	return sum == (hi << 4 | lo);
+}
+
+/**
+ * n_frame_check - verify the checksum of a frame
+ * @nf: line discipline instance
+ * @p: frame without its delimiters
+ * @len: length of @p
+ */
+static bool n_frame_check(struct n_frame *nf, const u8 *p, unsigned int len)
+{
+	unsigned int i;
+	u8 sum = 0;
+
+	switch (nf->cfg.csum) {
+	case N_FRAME_CSUM_NMEA:
+		return n_frame_check_nmea(p, len);
+	case N_FRAME_CSUM_SUM8:
+		if (len < 1)
+			return false;
+		for (i = 0; i < len - 1; i++)
+			sum += p[i];
+		return sum == p[len - 1];
+	case N_FRAME_CSUM_XOR8:
+		if (len < 1)
+			return false;
+		for (i = 0; i < len - 1; i++)
+			sum ^= p[i];
+		return sum == p[len - 1];
+	case N_FRAME_CSUM_CRC16:
+		if (len < 2)
+			return false;
+		return crc_ccitt(0xffff, p, len - 2) ==
+			(p[len - 2] | p[len - 1] << 8);
+	}
+	return true;
+}
+
+/**
+ * n_frame_end - finish the frame being assembled
+ * @nf: line discipline instance
+ *
+ * Returns true if a frame was queued for the reader.
+ * Caller holds nf->lock.
+ */
+static bool n_frame_end(struct n_frame *nf)
+{
+	struct n_frame_config *cfg = &nf->cfg;
+	struct n_frame_buf *b = nf->cur;
+	unsigned int head, len = nf->count;
+	bool ok;
+
+	head = (cfg->mode == N_FRAME_MODE_LENGTH ||
+		(cfg->flags & N_FRAME_F_START)) ? 1 : 0;
+	len -= head;
+	if (cfg->mode == N_FRAME_MODE_DELIM)
+		len--;
+
+	ok = n_frame_check(nf, b->data + head, len);
+	if (!ok) {
+		nf->stats.csum_errors++;
+		if (!(cfg->flags & N_FRAME_F_KEEP_BAD)) {
+			n_frame_abort(nf);
+			return false;
+		}
+	}
+
+	if (cfg->flags & N_FRAME_F_STRIP) {
+		b->off = head;
+		b->hdr.len = len;
+	} else {
+		b->off = 0;
+		b->hdr.len = nf->count;
+	}
+	b->hdr.status = ok ? N_FRAME_OK : N_FRAME_BAD_CSUM;
+
+	nf->cur = NULL;
+	nf->state = NF_HUNT;
+	if (b == nf->scratch) {
+		nf->stats.dropped++;
+		return false;
+	}
+	list_add_tail(&b->list, &nf->rx_queue);
+	nf->stats.frames++;
+	return true;
+}
+
+/**
+ * n_frame_rx_byte - run one received byte through the framer
+ * @nf: line discipline instance
+ * @c: the byte
+ * @now: receive time, read on first use
+ * @seq: stream offset of the byte, for the driver timestamp
+ *
+ * Returns true if the byte completed a frame that was queued.
+ * Caller holds nf->lock.
+ */
+static bool n_frame_rx_byte(struct n_frame *nf, u8 c, ktime_t *now,
+			    unsigned long seq)
+{
+	struct n_frame_config *cfg = &nf->cfg;
+	bool sync = cfg->mode == N_FRAME_MODE_LENGTH ||
+		(cfg->flags & N_FRAME_F_START);
+
+	switch (nf->state) {
+	case NF_SKIP:
+		if (sync && c == cfg->start) {
+			n_frame_begin(nf, now, seq);
+			break;
+		}
+		nf->stats.discarded++;
+		if (cfg->mode == N_FRAME_MODE_DELIM && c == cfg->end)
+			nf->state = NF_HUNT;
+		return false;
+	case NF_HUNT:
+		if (sync ? c != cfg->start : c == cfg->end) {
+			nf->stats.discarded++;
+			return false;
+		}
+		n_frame_begin(nf, now, seq);
+		break;
+	case NF_FRAME:
+		/* A new start delimiter resynchronises a delimited stream */
+		if (cfg->mode == N_FRAME_MODE_DELIM && sync && c == cfg->start)
+			n_frame_begin(nf, now, seq);
+		break;
+	}
+
+	if (nf->count == cfg->max_frame) {
+		nf->stats.oversize++;
+		nf->stats.discarded += nf->count + 1;
+		n_frame_abort(nf);
+		if (cfg->mode == N_FRAME_MODE_DELIM && c != cfg->end)
+			nf->state = NF_SKIP;
+		return false;
+	}
+	nf->cur->data[nf->count++] = c;
+
+	if (cfg->mode == N_FRAME_MODE_DELIM)
+		return c == cfg->end ? n_frame_end(nf) : false;
+
+	if (!nf->need && nf->count == cfg->len_offset + cfg->len_size) {
+		const u8 *p = nf->cur->data + cfg->len_offset;
+		int len = p[0];
+
+		if (cfg->len_size == 2)
+			len = (cfg->flags & N_FRAME_F_LEN_BE) ?
+				(p[0] << 8 | p[1]) : (p[0] | p[1] << 8);
+		len += cfg->len_adjust;
+		if (len < nf->count || len > cfg->max_frame) {
+			nf->stats.oversize++;
+			nf->stats.discarded += nf->count;
+			n_frame_abort(nf);
+			return false;
+		}
+		nf->need = len;
+	}
+	return nf->need && nf->count == nf->need ? n_frame_end(nf) : false;
+}
+
+static void n_frame_receive_buf(struct tty_struct *tty, const unsigned char *cp,
+				char *fp, int count)
+{
+	struct n_frame *nf = tty->disc_data;
+	ktime_t now = { .tv64 = 0 };
+	unsigned long flags;
+	bool queued = false;
+	int i;
+
+	spin_lock_irqsave(&nf->lock, flags);
+	for (i = 0; i < count; i++) {
+		/* Line errors break the frame they fall in */
+		if (fp && fp[i] != TTY_NORMAL) {
+			if (nf->cur)
+				nf->stats.discarded += nf->count;
+			nf->stats.discarded++;
+			n_frame_abort(nf);
+			continue;
+		}
+		if (n_frame_rx_byte(nf, cp[i], &now, tty->buf.rx_seq + i))
+			queued = true;
+	}
+	spin_unlock_irqrestore(&nf->lock, flags);
+
+	if (queued) {
+		wake_up_interruptible(&tty->read_wait);
+		kill_fasync(&tty->fasync, SIGIO, POLL_IN);
+	}
+}
+
+static void n_frame_flush_buffer(struct tty_struct *tty)
+{
+	struct n_frame *nf = tty->disc_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&nf->lock, flags);
+	list_splice_init(&nf->rx_queue, &nf->rx_free);
+	n_frame_abort(nf);
+	spin_unlock_irqrestore(&nf->lock, flags);
+}
+
+static ssize_t n_frame_read(struct tty_struct *tty, struct file *file,
+			    unsigned char __user *buf, size_t nr)
+{
+	struct n_frame *nf = tty->disc_data;
+	struct n_frame_buf *b = NULL;
+	DECLARE_WAITQUEUE(wait, current);
+	unsigned long flags;
+	size_t hlen = 0, len = 0;
+	ssize_t ret = 0;
+
+	add_wait_queue(&tty->read_wait, &wait);
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+
+		if (test_bit(TTY_OTHER_CLOSED, &tty->flags)) {
+			ret = -EIO;
+			break;
+		}
+		if (tty_hung_up_p(file))
+			break;
+
+		spin_lock_irqsave(&nf->lock, flags);
+		if (!list_empty(&nf->rx_queue)) {
+			b = list_first_entry(&nf->rx_queue,
+					     struct n_frame_buf, list);
+			hlen = (nf->cfg.flags & N_FRAME_F_HEADER) ?
+				sizeof(b->hdr) : 0;
+			len = b->hdr.len;
+			/* Leave a frame that does not fit for the next read */
+			if (hlen + len > nr) {
+				b = NULL;
+				ret = -EOVERFLOW;
+			} else {
+				list_del(&b->list);
+			}
+		}
+		spin_unlock_irqrestore(&nf->lock, flags);
+		if (b || ret)
+			break;
+
+		if (file->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			break;
+		}
+		schedule();
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+	}
+	__set_current_state(TASK_RUNNING);
+	remove_wait_queue(&tty->read_wait, &wait);
+
+	if (!b)
+		return ret;
+
+	if ((hlen && copy_to_user(buf, &b->hdr, hlen)) ||
+	    copy_to_user(buf + hlen, b->data + b->off, len))
+		ret = -EFAULT;
+	else
+		ret = hlen + len;
+
+	spin_lock_irqsave(&nf->lock, flags);
+	if (b->gen == nf->gen) {
+		list_add(&b->list, &nf->rx_free);
+		b = NULL;
+	}
+	spin_unlock_irqrestore(&nf->lock, flags);
+	/* The configuration changed while the frame was copied out */
+	kfree(b);
+
+	return ret;
+}
+
+static ssize_t n_frame_write(struct tty_struct *tty, struct file *file,
+			     const unsigned char *buf, size_t nr)
+{
+	const unsigned char *b = buf;
+	DECLARE_WAITQUEUE(wait, current);
+	ssize_t ret = 0;
+	int c;
+
+	add_wait_queue(&tty->write_wait, &wait);
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+		if (tty_hung_up_p(file) ||
+		    (tty->link && !tty->link->count)) {
+			ret = -EIO;
+			break;
+		}
+		c = tty->ops->write(tty, b, nr);
+		if (c < 0) {
+			ret = c;
+			break;
+		}
+		b += c;
+		nr -= c;
+		if (!nr)
+			break;
+		if (file->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			break;
+		}
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+	remove_wait_queue(&tty->write_wait, &wait);
+
+	return (b - buf) ? b - buf : ret;
+}
+
+static unsigned int n_frame_poll(struct tty_struct *tty, struct file *file,
+				 poll_table *wait)
+{
+	struct n_frame *nf = tty->disc_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &tty->read_wait, wait);
+	poll_wait(file, &tty->write_wait, wait);
+
+	if (!list_empty(&nf->rx_queue))
+		mask |= POLLIN | POLLRDNORM;
+	if (test_bit(TTY_OTHER_CLOSED, &tty->flags) || tty_hung_up_p(file))
+		mask |= POLLHUP;
+	if (tty_write_room(tty) > 0)
+		mask |= POLLOUT | POLLWRNORM;
+	return mask;
+}
+
+static int n_frame_ioctl(struct tty_struct *tty, struct file *file,
+			 unsigned int cmd, unsigned long arg)
+{
+	struct n_frame *nf = tty->disc_data;
+	struct n_frame_config cfg;
+	struct n_frame_stats stats;
+	struct n_frame_buf *b;
+	unsigned long flags;
+	int count = 0;
+
+	switch (cmd) {
+	case NFRAMEIOC_GETCONF:
+		spin_lock_irqsave(&nf->lock, flags);
+		cfg = nf->cfg;
+		spin_unlock_irqrestore(&nf->lock, flags);
+		if (copy_to_user((void __user *)arg, &cfg, sizeof(cfg)))
+			return -EFAULT;
+		return 0;
+	case NFRAMEIOC_SETCONF:
+		if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg)))
+			return -EFAULT;
+		if (n_frame_check_config(&cfg))
+			return -EINVAL;
+		return n_frame_set_config(nf, &cfg);
+	case NFRAMEIOC_GETSTATS:
+		spin_lock_irqsave(&nf->lock, flags);
+		stats = nf->stats;
+		spin_unlock_irqrestore(&nf->lock, flags);
+		if (copy_to_user((void __user *)arg, &stats, sizeof(stats)))
+			return -EFAULT;
+		return 0;
+	case FIONREAD:
+		/* Size of the next read, not of everything queued */
+		spin_lock_irqsave(&nf->lock, flags);
+		if (!list_empty(&nf->rx_queue)) {
+			b = list_first_entry(&nf->rx_queue,
+					     struct n_frame_buf, list);
+			count = b->hdr.len;
+			if (nf->cfg.flags & N_FRAME_F_HEADER)
+				count += sizeof(b->hdr);
+		}
+		spin_unlock_irqrestore(&nf->lock, flags);
+		return put_user(count, (int __user *)arg);
+	default:
+		return n_tty_ioctl_helper(tty, file, cmd, arg);
+	}
+}
+
+static int n_frame_open(struct tty_struct *tty)
+{
+	struct n_frame *nf;
+	int ret;
+
+	nf = kzalloc(sizeof(*nf), GFP_KERNEL);
+	if (!nf)
+		return -ENOMEM;
+
+	nf->tty = tty;
+	spin_lock_init(&nf->lock);
+	INIT_LIST_HEAD(&nf->rx_queue);
+	INIT_LIST_HEAD(&nf->rx_free);
+	ret = n_frame_set_config(nf, &n_frame_default_config);
+	if (ret) {
+		kfree(nf);
+		return ret;
+	}
+
+	tty->disc_data = nf;
+	/* Frames are dropped rather than the driver throttled */
+	tty->receive_room = 65536;
+	tty_driver_flush_buffer(tty);
+	return 0;
+}
+
+static void n_frame_close(struct tty_struct *tty)
+{
+	struct n_frame *nf = tty->disc_data;
+
+	n_frame_abort(nf);
+	n_frame_free_bufs(&nf->rx_queue);
+	n_frame_free_bufs(&nf->rx_free);
+	kfree(nf->scratch);
+	tty->disc_data = NULL;
+	kfree(nf);
+}
+
+static struct tty_ldisc_ops n_frame_ldisc = {
+	.owner		= THIS_MODULE,
+	.magic		= TTY_LDISC_MAGIC,
+	.name		= "n_frame",
+	.open		= n_frame_open,
+	.close		= n_frame_close,
+	.flush_buffer	= n_frame_flush_buffer,
+	.read		= n_frame_read,
+	.write		= n_frame_write,
+	.ioctl		= n_frame_ioctl,
+	.poll		= n_frame_poll,
+	.receive_buf	= n_frame_receive_buf,
+};
+
+static int __init n_frame_init(void)
+{
+	int ret;
+
+	ret = tty_register_ldisc(N_FRAME, &n_frame_ldisc);
+	if (ret)
+		pr_err("n_frame: cannot register line discipline: %d\n", ret);
+	return ret;
+}
+
+static void __exit n_frame_exit(void)
+{
+	int ret;
+
+	ret = tty_unregister_ldisc(N_FRAME);
+	if (ret)
+		pr_err("n_frame: cannot unregister line discipline: %d\n", ret);
+}
+
+module_init(n_frame_init);
+module_exit(n_frame_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Framed receive line discipline");
+MODULE_ALIAS_LDISC(N_FRAME);
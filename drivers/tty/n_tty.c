@@ -109,7 +109,7 @@ static void n_tty_set_room(struct tty_struct *tty)
 
 	/* Did this open up the receive buffer? We may need to flip */
 	if (left && !old_left)
-		schedule_work(&tty->buf.work);
+		tty_buffer_schedule(tty);
 }
 
 static void put_tty_queue_nolock(unsigned char c, struct tty_struct *tty)
@@ -1345,6 +1345,78 @@ static void n_tty_write_wakeup(struct tty_struct *tty)
 		kill_fasync(&tty->fasync, SIGIO, POLL_OUT);
 }
 
+/**
+ *	n_tty_receive_raw	-	queue a block of raw characters
+ *	@tty: terminal device
+ *	@cp: characters
+ *	@count: number of characters
+ *
+ *	Copy a run of characters straight into the read buffer. This is
+ *	what n_tty_receive_char does for each TTY_NORMAL character when
+ *	tty->raw is set, done with two memcpy calls and one lock round
+ *	trip. Characters that do not fit are dropped, as with put_tty_queue.
+ *
+ *	Locking: takes tty->read_lock
+ */
+
+static void n_tty_receive_raw(struct tty_struct *tty,
+			      const unsigned char *cp, int count)
+{
+	unsigned long cpuflags;
+	int i;
+
+	spin_lock_irqsave(&tty->read_lock, cpuflags);
+	i = min(N_TTY_BUF_SIZE - tty->read_cnt,
+		N_TTY_BUF_SIZE - tty->read_head);
+	i = min(count, i);
+	memcpy(tty->read_buf + tty->read_head, cp, i);
+	tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
+	tty->read_cnt += i;
+	cp += i;
+	count -= i;
+
+	i = min(N_TTY_BUF_SIZE - tty->read_cnt,
+		N_TTY_BUF_SIZE - tty->read_head);
+	i = min(count, i);
+	memcpy(tty->read_buf + tty->read_head, cp, i);
+	tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
+	tty->read_cnt += i;
+	spin_unlock_irqrestore(&tty->read_lock, cpuflags);
+}
+
+/**
+ *	n_tty_receive_flagged	-	receive one character with its flag
+ *	@tty: terminal device
+ *	@c: character
+ *	@flag: TTY_NORMAL or the error reported by the driver
+ */
+
+static void n_tty_receive_flagged(struct tty_struct *tty, unsigned char c,
+				  char flag)
+{
+	char buf[64];
+
+	switch (flag) {
+	case TTY_NORMAL:
+		n_tty_receive_char(tty, c);
+		break;
+	case TTY_BREAK:
+		n_tty_receive_break(tty);
+		break;
+	case TTY_PARITY:
+	case TTY_FRAME:
+		n_tty_receive_parity_error(tty, c);
+		break;
+	case TTY_OVERRUN:
+		n_tty_receive_overrun(tty);
+		break;
+	default:
+		printk(KERN_ERR "%s: unknown flag %d\n",
+		       tty_name(tty, buf), flag);
+		break;
+	}
+}
+
 /**
  *	n_tty_receive_buf	-	data receive
  *	@tty: terminal device
@@ -1364,53 +1436,40 @@ static void n_tty_receive_buf(struct tty_struct *tty, const unsigned char *cp,
 	const unsigned char *p;
 	char *f, flags = TTY_NORMAL;
 	int	i;
-	char	buf[64];
-	unsigned long cpuflags;
 
 	if (!tty->read_buf)
 		return;
 
 	if (tty->real_raw) {
-		spin_lock_irqsave(&tty->read_lock, cpuflags);
-		i = min(N_TTY_BUF_SIZE - tty->read_cnt,
-			N_TTY_BUF_SIZE - tty->read_head);
-		i = min(count, i);
-		memcpy(tty->read_buf + tty->read_head, cp, i);
-		tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
-		tty->read_cnt += i;
-		cp += i;
-		count -= i;
-
-		i = min(N_TTY_BUF_SIZE - tty->read_cnt,
-			N_TTY_BUF_SIZE - tty->read_head);
-		i = min(count, i);
-		memcpy(tty->read_buf + tty->read_head, cp, i);
-		tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
-		tty->read_cnt += i;
-		spin_unlock_irqrestore(&tty->read_lock, cpuflags);
+		n_tty_receive_raw(tty, cp, count);
+	} else if (tty->raw) {
+		/* Only error flags need the slow path, copy the runs of
+		   plain characters between them in bulk. PARMRK clears
+		   tty->raw, so those setups never get here */
+		while (count) {
+			if (fp)
+				for (i = 0; i < count && fp[i] == TTY_NORMAL; i++)
+					;
+			else
+				i = count;
+			if (i) {
+				n_tty_receive_raw(tty, cp, i);
+			} else {
+				n_tty_receive_flagged(tty, *cp, *fp);
+				i = 1;
+			}
+			cp += i;
+			if (fp)
+				fp += i;
+			count -= i;
+		}
+		if (tty->ops->flush_chars)
+			tty->ops->flush_chars(tty);
 	} else {
 		for (i = count, p = cp, f = fp; i; i--, p++) {
 			if (f)
 				flags = *f++;
-			switch (flags) {
-			case TTY_NORMAL:
-				n_tty_receive_char(tty, *p);
-				break;
-			case TTY_BREAK:
-				n_tty_receive_break(tty);
-				break;
-			case TTY_PARITY:
-			case TTY_FRAME:
-				n_tty_receive_parity_error(tty, *p);
-				break;
-			case TTY_OVERRUN:
-				n_tty_receive_overrun(tty);
-				break;
-			default:
-				printk(KERN_ERR "%s: unknown flag %d\n",
-				       tty_name(tty, buf), flags);
-				break;
-			}
+			n_tty_receive_flagged(tty, *p, flags);
 		}
 		if (tty->ops->flush_chars)
 			tty->ops->flush_chars(tty);
@@ -1613,10 +1672,10 @@ static inline int input_available_p(struct tty_struct *tty, int amt)
  *
  *	Helper function to speed up n_tty_read.  It is only called when
  *	ICANON is off; it copies characters straight from the tty queue to
- *	user space directly.  It can be profitably called twice; once to
- *	drain the space from the tail pointer to the (physical) end of the
- *	buffer, and once to drain the space from the (physical) beginning of
- *	the buffer to head pointer.
+ *	user space directly.  Both the space from the tail pointer to the
+ *	(physical) end of the buffer and the space from the (physical)
+ *	beginning of the buffer to the head pointer are drained, with a
+ *	single update of the tail and count.
  *
  *	Called under the tty->atomic_read_lock sem
  *
@@ -1628,21 +1687,30 @@ static int copy_from_read_buf(struct tty_struct *tty,
 
 {
 	int retval;
-	size_t n;
+	size_t n, first;
 	unsigned long flags;
+	unsigned char *from;
 	bool is_eof;
 
 	retval = 0;
 	spin_lock_irqsave(&tty->read_lock, flags);
-	n = min(tty->read_cnt, N_TTY_BUF_SIZE - tty->read_tail);
-	n = min(*nr, n);
+	n = min_t(size_t, tty->read_cnt, *nr);
 	spin_unlock_irqrestore(&tty->read_lock, flags);
 	if (n) {
-		retval = copy_to_user(*b, &tty->read_buf[tty->read_tail], n);
-		n -= retval;
-		is_eof = n == 1 &&
-			tty->read_buf[tty->read_tail] == EOF_CHAR(tty);
-		tty_audit_add_data(tty, &tty->read_buf[tty->read_tail], n);
+		from = &tty->read_buf[tty->read_tail];
+		first = min_t(size_t, n, N_TTY_BUF_SIZE - tty->read_tail);
+		retval = copy_to_user(*b, from, first);
+		if (retval || n == first) {
+			n = first - retval;
+		} else {
+			retval = copy_to_user(*b + first, tty->read_buf,
+					      n - first);
+			n -= retval;
+		}
+		is_eof = n == 1 && *from == EOF_CHAR(tty);
+		tty_audit_add_data(tty, from, min(n, first));
+		if (n > first)
+			tty_audit_add_data(tty, tty->read_buf, n - first);
 		spin_lock_irqsave(&tty->read_lock, flags);
 		tty->read_tail = (tty->read_tail + n) & (N_TTY_BUF_SIZE-1);
 		tty->read_cnt -= n;
@@ -1869,12 +1937,9 @@ do_it_again:
 			if (retval)
 				break;
 		} else {
-			int uncopied;
 			/* The copy function takes the read lock and handles
 			   locking internally for this case */
-			uncopied = copy_from_read_buf(tty, &b, &nr);
-			uncopied += copy_from_read_buf(tty, &b, &nr);
-			if (uncopied) {
+			if (copy_from_read_buf(tty, &b, &nr)) {
 				retval = -EFAULT;
 				break;
 			}
@@ -95,7 +95,7 @@ static void pty_unthrottle(struct tty_struct *tty)
 
 static int pty_space(struct tty_struct *to)
 {
-	int n = 8192 - to->buf.memory_used;
+	int n = 8192 - atomic_read(&to->buf.memory_used);
 	if (n < 0)
 		return 0;
 	return n;
@@ -116,18 +116,23 @@ static int pty_space(struct tty_struct *to)
 static int pty_write(struct tty_struct *tty, const unsigned char *buf, int c)
 {
 	struct tty_struct *to = tty->link;
+	unsigned long flags;
 
 	if (tty->stopped)
 		return 0;
 
 	if (c > 0) {
+		/* Writes and echoes can get here in parallel but the flip
+		   buffers take a single producer, so serialize them */
+		spin_lock_irqsave(&to->buf.lock, flags);
 		/* Stuff the data into the input queue of the other end */
 		c = tty_insert_flip_string(to, buf, c);
 		/* And shovel */
-		if (c) {
+		if (c)
 			tty_flip_buffer_push(to);
+		spin_unlock_irqrestore(&to->buf.lock, flags);
+		if (c)
 			tty_wakeup(tty);
-		}
 	}
 	return c;
 }
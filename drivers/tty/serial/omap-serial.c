@@ -60,6 +60,13 @@
 #define OMAP_UART_FCR_RX_FIFO_TRIG_SHIFT		6
 #define OMAP_UART_FCR_RX_FIFO_TRIG_MASK			(0x3 << 6)
 
+/* TLR register bitmasks */
+#define OMAP_UART_TLR_RX_FIFO_TRIG_SHIFT		4
+
+/* IIR register bitmasks */
+#define OMAP_UART_IIR_IT_TYPE_MASK	0x3e
+#define OMAP_UART_IIR_RX_TIMEOUT	0x0c
+
 /* MVR register bitmasks */
 #define OMAP_UART_MVR_SCHEME_SHIFT	30
 
@@ -75,8 +82,8 @@ static struct uart_omap_port *ui[OMAP_MAX_HSUART_PORTS];
 
 /* Forward declaration of functions */
 static void uart_tx_dma_callback(int lch, u16 ch_status, void *data);
-static void serial_omap_rxdma_poll(unsigned long uart_no);
 static int serial_omap_start_rxdma(struct uart_omap_port *up);
+static void serial_omap_rxdma_timeout(struct uart_omap_port *up);
 static void serial_omap_mdr1_errataset(struct uart_omap_port *up, u8 mdr1);
 
 static struct workqueue_struct *serial_omap_uart_wq;
@@ -129,14 +136,15 @@ serial_omap_get_divisor(struct uart_port *port, unsigned int baud)
 static void serial_omap_stop_rxdma(struct uart_omap_port *up)
 {
 	if (up->uart_dma.rx_dma_used) {
-		del_timer(&up->uart_dma.rx_timer);
 		omap_stop_dma(up->uart_dma.rx_dma_channel);
-		omap_free_dma(up->uart_dma.rx_dma_channel);
-		up->uart_dma.rx_dma_channel = OMAP_UART_DMA_CH_FREE;
 		up->uart_dma.rx_dma_used = false;
 		pm_runtime_mark_last_busy(&up->pdev->dev);
 		pm_runtime_put_autosuspend(&up->pdev->dev);
 	}
+	if (up->uart_dma.rx_dma_channel != OMAP_UART_DMA_CH_FREE) {
+		omap_free_dma(up->uart_dma.rx_dma_channel);
+		up->uart_dma.rx_dma_channel = OMAP_UART_DMA_CH_FREE;
+	}
 }
 
 static void serial_omap_enable_ms(struct uart_port *port)
@@ -206,6 +214,7 @@ static inline void receive_chars(struct uart_omap_port *up,
 	unsigned char ch = 0;
 	int max_count = 256;
 
+	tty_flip_stamp_now(tty);
 	do {
 		if (likely(lsr & UART_LSR_DR))
 			ch = serial_in(up, UART_RX);
@@ -261,8 +270,10 @@ static inline void receive_chars(struct uart_omap_port *up,
 ignore_char:
 		lsr = serial_in(up, UART_LSR);
 	} while ((lsr & (UART_LSR_DR | UART_LSR_BI)) && (max_count-- > 0));
+	/* The IRQ and the DMA paths both insert, commit under the lock */
+	tty_buffer_commit(tty);
 	spin_unlock(&up->port.lock);
-	tty_flip_buffer_push(tty);
+	tty_buffer_deliver(tty);
 	spin_lock(&up->port.lock);
 }
 
@@ -409,7 +420,7 @@ static unsigned int check_modem_status(struct uart_omap_port *up)
 static inline irqreturn_t serial_omap_irq(int irq, void *dev_id)
 {
 	struct uart_omap_port *up = dev_id;
-	unsigned int iir, lsr;
+	unsigned int iir, lsr, type;
 	unsigned long flags;
 
 	pm_runtime_get_sync(&up->pdev->dev);
@@ -426,9 +437,16 @@ static inline irqreturn_t serial_omap_irq(int irq, void *dev_id)
 		if (!up->use_dma) {
 			if (lsr & UART_LSR_DR)
 				receive_chars(up, &lsr);
+		} else if (up->uart_dma.rx_dma_used) {
+			/*
+			 * The RX DMA ring takes the data above the trigger
+			 * level, the end of a burst or an error is ours.
+			 */
+			type = iir & OMAP_UART_IIR_IT_TYPE_MASK;
+			if (type == OMAP_UART_IIR_RX_TIMEOUT ||
+					type == UART_IIR_RLSI)
+				serial_omap_rxdma_timeout(up);
 		} else {
-			up->ier &= ~(UART_IER_RDI | UART_IER_RLSI);
-			serial_out(up, UART_IER, up->ier);
 			if ((serial_omap_start_rxdma(up) != 0) &&
 					(lsr & UART_LSR_DR))
 				receive_chars(up, &lsr);
@@ -579,10 +597,6 @@ static int serial_omap_startup(struct uart_port *port)
 			UART_XMIT_SIZE,
 			(dma_addr_t *)&(up->uart_dma.tx_buf_dma_phys),
 			0);
-		init_timer(&(up->uart_dma.rx_timer));
-		up->uart_dma.rx_timer.function = serial_omap_rxdma_poll;
-		up->uart_dma.rx_timer.data = up->port.line;
-		/* Currently the buffer size is 4KB. Can increase it */
 		up->uart_dma.rx_buf = dma_alloc_coherent(NULL,
 			up->uart_dma.rx_buf_size,
 			(dma_addr_t *)&(up->uart_dma.rx_buf_dma_phys), 0);
@@ -782,6 +796,11 @@ serial_omap_set_termios(struct uart_port *port, struct ktermios *termios,
 	 * Update the per-port timeout.
 	 */
 	uart_update_timeout(port, termios->c_cflag, baud);
+	/* start bit, data bits, parity and stop bits */
+	up->uart_dma.rx_char_ns = (NSEC_PER_SEC / baud) *
+		(1 + 5 + (cval & UART_LCR_WLEN8) +
+		 ((cval & UART_LCR_PARITY) ? 1 : 0) +
+		 ((cval & UART_LCR_STOP) ? 2 : 1));
 
 	up->port.read_status_mask = UART_LSR_OE | UART_LSR_THRE | UART_LSR_DR;
 	if (termios->c_iflag & INPCK)
@@ -846,7 +865,16 @@ serial_omap_set_termios(struct uart_port *port, struct ktermios *termios,
 	up->scr |= OMAP_UART_SCR_RX_TRIG_GRANU1_MASK;
 
 	if (up->use_dma) {
-		serial_out(up, UART_TI752_TLR, 0);
+		/*
+		 * With granularity 1 the RX trigger is TLR[7:4] * 4 +
+		 * FCR[7:6]. Below it the bytes stay in the FIFO and raise
+		 * the timeout interrupt at the end of a burst.
+		 */
+		serial_out(up, UART_TI752_TLR, (up->uart_dma.rx_trigger >> 2) <<
+				OMAP_UART_TLR_RX_FIFO_TRIG_SHIFT);
+		up->fcr &= ~OMAP_UART_FCR_RX_FIFO_TRIG_MASK;
+		up->fcr |= (up->uart_dma.rx_trigger & 0x3) <<
+				OMAP_UART_FCR_RX_FIFO_TRIG_SHIFT;
 		up->scr |= UART_FCR_TRIGGER_4;
 	} else {
 		/* Set receive FIFO threshold to 1 byte */
@@ -1221,63 +1249,94 @@ static int serial_omap_resume(struct device *dev)
 }
 #endif
 
-static void serial_omap_rxdma_poll(unsigned long uart_no)
+/*
+ * RX DMA ring
+ *
+ * The channel writes the ring in two frames, so the DMA interrupts at the
+ * half and at the end; at the end it is restarted from the beginning.
+ * Bytes below the RX trigger level are left in the FIFO and, once the
+ * line goes idle, raise the RX timeout interrupt: the ring is stopped,
+ * flushed and the FIFO read out before it is restarted. Received data
+ * thus reaches the tty at most a half ring or one timeout late, with no
+ * polling in between.
+ */
+
+/* Push what the DMA wrote since the last call, with the port lock held */
+static void serial_omap_rxdma_drain(struct uart_omap_port *up)
 {
-	struct uart_omap_port *up = ui[uart_no];
-	unsigned int curr_dma_pos, curr_transmitted_size;
-	int ret = 0;
+	struct uart_omap_dma *dma = &up->uart_dma;
+	struct tty_struct *tty = up->port.state->port.tty;
+	dma_addr_t pos = omap_get_dma_dst_pos(dma->rx_dma_channel);
+	unsigned int head, count;
 
-	curr_dma_pos = omap_get_dma_dst_pos(up->uart_dma.rx_dma_channel);
-	if ((curr_dma_pos == up->uart_dma.prev_rx_dma_pos) ||
-			     (curr_dma_pos == 0)) {
-		if (jiffies_to_msecs(jiffies - up->port_activity) <
-						up->uart_dma.rx_timeout) {
-			mod_timer(&up->uart_dma.rx_timer, jiffies +
-				usecs_to_jiffies(up->uart_dma.rx_poll_rate));
-		} else {
-			serial_omap_stop_rxdma(up);
-			up->ier |= (UART_IER_RDI | UART_IER_RLSI);
-			serial_out(up, UART_IER, up->ier);
-		}
+	/* the position reads as 0 until the first byte after a start */
+	if (pos <= dma->rx_buf_dma_phys ||
+			pos > dma->rx_buf_dma_phys + dma->rx_buf_size)
 		return;
-	}
 
-	curr_transmitted_size = curr_dma_pos -
-					up->uart_dma.prev_rx_dma_pos;
-	up->port.icount.rx += curr_transmitted_size;
-	tty_insert_flip_string(up->port.state->port.tty,
-			up->uart_dma.rx_buf +
-			(up->uart_dma.prev_rx_dma_pos -
-			up->uart_dma.rx_buf_dma_phys),
-			curr_transmitted_size);
-	tty_flip_buffer_push(up->port.state->port.tty);
-	up->uart_dma.prev_rx_dma_pos = curr_dma_pos;
-	if (up->uart_dma.rx_buf_size +
-			up->uart_dma.rx_buf_dma_phys == curr_dma_pos) {
-		ret = serial_omap_start_rxdma(up);
-		if (ret < 0) {
-			serial_omap_stop_rxdma(up);
-			up->ier |= (UART_IER_RDI | UART_IER_RLSI);
-			serial_out(up, UART_IER, up->ier);
-		}
-	} else  {
-		mod_timer(&up->uart_dma.rx_timer, jiffies +
-			usecs_to_jiffies(up->uart_dma.rx_poll_rate));
-	}
-	up->port_activity = jiffies;
+	head = pos - dma->rx_buf_dma_phys;
+	if (head <= dma->rx_tail)
+		return;
+
+	count = head - dma->rx_tail;
+	up->port.icount.rx += count;
+	/*
+	 * The drain comes up to a half ring after the first byte: back-date
+	 * the stamp as if the bytes had come in back to back.
+	 */
+	if (unlikely(tty->buf.stamps))
+		tty_flip_stamp(tty, ktime_sub_ns(ktime_get_real(),
+				(u64)count * dma->rx_char_ns));
+	tty_insert_flip_string(tty, dma->rx_buf + dma->rx_tail, count);
+	dma->rx_tail = head;
+
+	/* The IRQ and the DMA paths both insert, commit under the lock */
+	tty_buffer_commit(tty);
+	spin_unlock(&up->port.lock);
+	tty_buffer_deliver(tty);
+	spin_lock(&up->port.lock);
+}
+
+static void serial_omap_rxdma_restart(struct uart_omap_port *up)
+{
+	up->uart_dma.rx_tail = 0;
+	omap_start_dma(up->uart_dma.rx_dma_channel);
+}
+
+/* End of a burst or line status error, with the port lock held */
+static void serial_omap_rxdma_timeout(struct uart_omap_port *up)
+{
+	unsigned int lsr;
+
+	omap_stop_dma(up->uart_dma.rx_dma_channel);
+	serial_omap_rxdma_drain(up);
+
+	lsr = serial_in(up, UART_LSR);
+	if (lsr & (UART_LSR_DR | UART_LSR_BI))
+		receive_chars(up, &lsr);
+
+	serial_omap_rxdma_restart(up);
 }
 
 static void uart_rx_dma_callback(int lch, u16 ch_status, void *data)
 {
-	return;
+	struct uart_omap_port *up = data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&up->port.lock, flags);
+	if (up->uart_dma.rx_dma_used) {
+		serial_omap_rxdma_drain(up);
+		if (ch_status & OMAP_DMA_BLOCK_IRQ)
+			serial_omap_rxdma_restart(up);
+	}
+	spin_unlock_irqrestore(&up->port.lock, flags);
 }
 
 static int serial_omap_start_rxdma(struct uart_omap_port *up)
 {
 	int ret = 0;
 
-	if (up->uart_dma.rx_dma_channel == -1) {
-		pm_runtime_get_sync(&up->pdev->dev);
+	if (up->uart_dma.rx_dma_channel == OMAP_UART_DMA_CH_FREE) {
 		ret = omap_request_dma(up->uart_dma.uart_dma_rx,
 				"UART Rx DMA",
 				(void *)uart_rx_dma_callback, up,
@@ -1293,16 +1352,17 @@ static int serial_omap_start_rxdma(struct uart_omap_port *up)
 				up->uart_dma.rx_buf_dma_phys, 0, 0);
 		omap_set_dma_transfer_params(up->uart_dma.rx_dma_channel,
 				OMAP_DMA_DATA_TYPE_S8,
-				up->uart_dma.rx_buf_size, 1,
+				up->uart_dma.rx_buf_size / 2, 2,
 				OMAP_DMA_SYNC_ELEMENT,
 				up->uart_dma.uart_dma_rx, 0);
+		omap_enable_dma_irq(up->uart_dma.rx_dma_channel,
+				OMAP_DMA_FRAME_IRQ);
 	}
-	up->uart_dma.prev_rx_dma_pos = up->uart_dma.rx_buf_dma_phys;
-	/* FIXME: Cache maintenance needed here? */
-	omap_start_dma(up->uart_dma.rx_dma_channel);
-	mod_timer(&up->uart_dma.rx_timer, jiffies +
-				usecs_to_jiffies(up->uart_dma.rx_poll_rate));
+
+	/* The ring keeps the port awake until it is closed */
+	pm_runtime_get_sync(&up->pdev->dev);
 	up->uart_dma.rx_dma_used = true;
+	serial_omap_rxdma_restart(up);
 	return ret;
 }
 
@@ -1515,9 +1575,14 @@ static int serial_omap_probe(struct platform_device *pdev)
 		up->uart_dma.uart_dma_tx = dma_tx->start;
 		up->uart_dma.uart_dma_rx = dma_rx->start;
 		up->use_dma = 1;
-		up->uart_dma.rx_buf_size = omap_up_info->dma_rx_buf_size;
-		up->uart_dma.rx_timeout = omap_up_info->dma_rx_timeout;
-		up->uart_dma.rx_poll_rate = omap_up_info->dma_rx_poll_rate;
+		/* the ring is split in two frames */
+		up->uart_dma.rx_buf_size = max_t(unsigned int,
+				omap_up_info->dma_rx_buf_size & ~1,
+				OMAP_UART_DMA_RX_BUF_MIN);
+		up->uart_dma.rx_trigger = omap_up_info->dma_rx_trigger;
+		if (up->uart_dma.rx_trigger < 2 ||
+				up->uart_dma.rx_trigger >= up->port.fifosize)
+			up->uart_dma.rx_trigger = OMAP_UART_DMA_RX_TRIGGER;
 		spin_lock_init(&(up->uart_dma.tx_lock));
 		spin_lock_init(&(up->uart_dma.rx_lock));
 		up->uart_dma.tx_dma_channel = OMAP_UART_DMA_CH_FREE;
@@ -25,6 +25,8 @@
 #include <linux/gpio.h>
 #include <linux/spi/spi.h>
 #include <linux/freezer.h>
+#include <linux/ktime.h>
+#include <linux/completion.h>
 #include <linux/serial_sc16is7x2.h>
 
 #define MAX_SC16IS7X2		8
@@ -33,6 +35,9 @@
 #define DRIVER_NAME		"sc16is7x2"
 #define TYPE_NAME		"SC16IS7x2"
 
+/* Upper bound of status/data rounds per interrupt */
+#define MAX_PASSES		16
+
 
 #define REG_READ	0x80
 #define REG_WRITE	0x00
@@ -81,10 +86,6 @@ struct sc16is7x2_channel {
 	struct sc16is7x2_chip	*chip;	/* back link */
 	struct uart_port	uart;
 
-	/* Workqueue that does all the magic */
-	struct workqueue_struct *workqueue;
-	struct work_struct	work;
-
 	u16		quot;		/* baud rate divisor */
 	u8		iir;		/* state of IIR register */
 	u8		lsr;		/* state of LSR register */
@@ -94,17 +95,70 @@ struct sc16is7x2_channel {
 	u8		lcr;		/* cache for LCR register */
 	u8		mcr;		/* cache for MCR register */
 	u8		efr;		/* cache for EFR register */
-#ifdef DEBUG
-	bool		handle_irq;
-#endif
+	u8		rxlvl;		/* state of RXLVL register */
+	u8		txlvl;		/* state of TXLVL register */
+	bool		active;		/* port is open */
 	bool		handle_baud;	/* baud rate needs update */
 	bool		handle_regs;	/* other regs need update */
-	u8		buf[FIFO_SIZE+1]; /* fifo transfer buffer */
+	u8		tx_mode;	/* SC16IS7X2_TX_* */
+	unsigned	baud;		/* current baud rate */
+	unsigned long	tx_bursts;	/* multi-byte TX transfers */
+	unsigned long	tx_verify_errors; /* bursts that lost bytes */
+	u8		rx_trigger;	/* RX FIFO watermark (TLR), 0: use FCR */
+	unsigned long	rx_fifo_full;	/* RXLVL found at FIFO_SIZE */
+	unsigned	txlen;		/* bytes queued in txbuf */
+	u8		buf[FIFO_SIZE+2]; /* fifo transfer buffer + NUL */
+	u8		txbuf[FIFO_SIZE+1]; /* TX fifo transfer buffer */
+
+	/*
+	 * RX double buffering: the data message reads into rxbuf[rx_fill]
+	 * while rxbuf[rx_fill ^ 1] (rx_pending bytes) is passed on to the
+	 * tty layer. rx_time[] and rx_lsr[] are the receive timestamp and
+	 * the LSR of each buffer.
+	 */
+	u8		rxbuf[2][FIFO_SIZE+2];
+	ktime_t		rx_time[2];
+	unsigned	rx_fill;
+	unsigned	rx_len;		/* bytes requested into rxbuf[rx_fill] */
+	unsigned	rx_pending;
+	u8		rx_lsr[2];
+};
+
+/* Registers read for both channels on every interrupt */
+static const u8 sc16is7x2_status_regs[] = {
+	UART_IIR, UART_LSR, UART_MSR, REG_RXLVL, REG_TXLVL,
 };
+#define NR_STATUS_REGS	ARRAY_SIZE(sc16is7x2_status_regs)
 
 struct sc16is7x2_chip {
 	struct spi_device *spi;
 	struct sc16is7x2_channel channel[2];
+	int		irq;
+	int		irq_gpio;	/* GPIO requested as the IRQ, -1: none */
+
+	/* Serializes the IRQ thread and deferred register updates */
+	struct mutex	lock;
+	struct work_struct kick;
+	ktime_t		status_time;	/* when the status was last read */
+
+	/* CLOCK_REALTIME of the interrupt, for receive timestamps */
+	spinlock_t	irq_time_lock;
+	ktime_t		irq_time;	/* 0 once used */
+	ktime_t		rx_time;	/* stamp for the RX levels just read */
+
+	/* Prebuilt message reading the status of both channels */
+	struct spi_message status_msg;
+	struct spi_transfer status_xfer[2 * NR_STATUS_REGS];
+	u8		status_tx[2 * NR_STATUS_REGS * 2];
+	u8		status_rx[2 * NR_STATUS_REGS * 2];
+
+	/* Data message, in flight while the previous RX data is pushed */
+	struct spi_message data_msg;
+	struct spi_transfer data_xfer[6];
+	struct completion data_done;
+	unsigned	burst_clkdiv;	/* 0: bursts use the default SPI clock */
+	struct mutex	selftest_lock;
+	char		selftest_result[2][48];
 
 #ifdef CONFIG_GPIOLIB
 	struct gpio_chip gpio;
@@ -155,46 +209,101 @@ static int sc16is7x2_read(struct sc16is7x2_chip *ts, unsigned reg, unsigned ch)
 	return spi_w8r8(ts->spi, read_cmd(reg, ch));
 }
 
-/* ******************************** IRQ ********************************* */
+/*
+ * sc16is7x2_burst_speed - SPI clock used for multi-byte FIFO transfers
+ *
+ * The chip runs its SPI slave off the UART crystal, so long transfers are
+ * more robust when the SPI clock is an integer fraction of uartclk.
+ * Returns 0 to leave the speed to the spi_device default.
+ */
+static u32 sc16is7x2_burst_speed(struct sc16is7x2_chip *ts)
+{
+	u32 hz;
 
-static void sc16is7x2_handle_rx(struct sc16is7x2_chip *ts, unsigned ch)
+	if (!ts->burst_clkdiv)
+		return 0;
+
+	hz = ts->channel[0].uart.uartclk / ts->burst_clkdiv;
+	if (ts->spi->max_speed_hz && hz > ts->spi->max_speed_hz)
+		hz = ts->spi->max_speed_hz;
+	return hz;
+}
+
+/*
+ * sc16is7x2_write_fifo - Write len bytes to the TX FIFO in one transfer
+ * @ch:  Channel (0 or 1)
+ * @buf: buffer holding the data at buf[1], buf[0] is used for the command
+ */
+static int sc16is7x2_write_fifo(struct sc16is7x2_chip *ts, unsigned ch,
+		u8 *buf, unsigned len)
 {
-	struct sc16is7x2_channel *chan = &ts->channel[ch];
-	struct uart_port *uart = &chan->uart;
-	struct tty_struct *tty = uart->state->port.tty;
 	struct spi_message message;
-	struct spi_transfer t[2];
-	unsigned long flags;
-	u8 lsr = chan->lsr;
-	int rxlvl;
+	struct spi_transfer t;
 
-	rxlvl = sc16is7x2_read(ts, REG_RXLVL, ch);
-	if (rxlvl <= 0) {
-		return;
-	} else if (rxlvl > FIFO_SIZE) {
-		/* Ensure sanity of RX level */
-		rxlvl = FIFO_SIZE;
-	}
+	buf[0] = write_cmd(UART_TX, ch);
 
-	dev_dbg(&ts->spi->dev, " %s (%i) %d bytes\n", __func__, ch, rxlvl);
+	memset(&t, 0, sizeof t);
+	t.tx_buf = buf;
+	t.len = len + 1;
+	if (len > 1)
+		t.speed_hz = sc16is7x2_burst_speed(ts);
+
+	spi_message_init(&message);
+	spi_message_add_tail(&t, &message);
+	return spi_sync(ts->spi, &message);
+}
+
+/*
+ * sc16is7x2_read_fifo - Read len bytes from the RX FIFO in one transfer
+ * @ch:  Channel (0 or 1)
+ * @buf: receives the data at buf[1], buf[0] is used for the command
+ */
+static int sc16is7x2_read_fifo(struct sc16is7x2_chip *ts, unsigned ch,
+		u8 *buf, unsigned len)
+{
+	struct spi_message message;
+	struct spi_transfer t[2];
 
 	memset(t, 0, sizeof t);
-	chan->buf[0] = read_cmd(UART_RX, ch);
+	buf[0] = read_cmd(UART_RX, ch);
 	t[0].len = 1;
-	t[0].tx_buf = &chan->buf[0];
-	t[1].len = rxlvl;
-	t[1].rx_buf = &chan->buf[1];
+	t[0].tx_buf = &buf[0];
+	t[1].len = len;
+	t[1].rx_buf = &buf[1];
 
 	spi_message_init(&message);
 	spi_message_add_tail(&t[0], &message);
 	spi_message_add_tail(&t[1], &message);
+	return spi_sync(ts->spi, &message);
+}
+
+/* ******************************** IRQ ********************************* */
 
-	if (spi_sync(ts->spi, &message)) {
-		dev_err(&ts->spi->dev, " SPI transfer RX handling failed\n");
+/*
+ * sc16is7x2_handle_rx - Pass received data on to the tty layer
+ *
+ * Pushes the completed RX buffer (chan->rx_pending bytes) while the next
+ * data message may already be filling the other one.
+ */
+static void sc16is7x2_handle_rx(struct sc16is7x2_chip *ts, unsigned ch)
+{
+	struct sc16is7x2_channel *chan = &ts->channel[ch];
+	struct uart_port *uart = &chan->uart;
+	struct tty_struct *tty = uart->state->port.tty;
+	unsigned long flags;
+	u8 *buf = chan->rxbuf[chan->rx_fill ^ 1];
+	u8 lsr = chan->rx_lsr[chan->rx_fill ^ 1];
+	int rxlvl = chan->rx_pending;
+	int count;
+
+	if (!rxlvl)
 		return;
-	}
-	chan->buf[rxlvl + 1] = '\0';
-	dev_dbg(&ts->spi->dev, "%s\n", &chan->buf[1]);
+	chan->rx_pending = 0;
+
+	dev_dbg(&ts->spi->dev, " %s (%i) %d bytes\n", __func__, ch, rxlvl);
+
+	buf[rxlvl + 1] = '\0';
+	dev_dbg(&ts->spi->dev, "%s\n", &buf[1]);
 
 	spin_lock_irqsave(&uart->lock, flags);
 
@@ -222,7 +331,10 @@ static void sc16is7x2_handle_rx(struct sc16is7x2_chip *ts, unsigned ch)
 	}
 
 	/* Insert received data */
-	tty_insert_flip_string(tty, &chan->buf[1], rxlvl);
+	tty_flip_stamp(tty, chan->rx_time[chan->rx_fill ^ 1]);
+	count = tty_insert_flip_string(tty, &buf[1], rxlvl);
+	if (count < rxlvl)
+		uart->icount.buf_overrun += rxlvl - count;
 	/* Update RX counter */
 	uart->icount.rx += rxlvl;
 
@@ -262,6 +374,51 @@ ignore_char:
  * properly. Replacing the crystal and changing the software divisors would then be a potential
  * hardware fix.
  *
+ * The one byte limit is kept as the SC16IS7X2_TX_SINGLE mode. SC16IS7X2_TX_BURST fills all
+ * free FIFO space in one transfer, clocked at uartclk / burst_clkdiv when that is set, and
+ * SC16IS7X2_TX_VERIFY additionally checks TXLVL after each burst and drops the port back to
+ * single byte mode if the chip lost data. The "selftest" sysfs attribute exercises bursts
+ * through the internal loopback.
+ */
+
+/*
+ * sc16is7x2_verify_burst - Check that a TX burst fully reached the FIFO
+ * @before: TXLVL (free space) read before the burst
+ * @len:    number of bytes written
+ * @start:  time at which @before was read
+ *
+ * The transmitter keeps draining while we talk to the chip, so the free space
+ * afterwards may exceed before - len by at most the number of characters that
+ * can be shifted out in the elapsed time. More free space than that means the
+ * chip dropped bytes of the burst.
+ */
+static bool sc16is7x2_verify_burst(struct sc16is7x2_chip *ts, unsigned ch,
+		int before, unsigned len, ktime_t start)
+{
+	struct sc16is7x2_channel *chan = &ts->channel[ch];
+	int after, drained;
+	u64 us;
+
+	after = sc16is7x2_read(ts, REG_TXLVL, ch);
+	if (after < 0)
+		return true;
+
+	/* The shortest character is 7 bits (5N1), round up */
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	drained = div_u64(us * chan->baud, 7 * USEC_PER_SEC) + 1;
+
+	dev_dbg(&ts->spi->dev, " %s (%i) txlvl %d -> %d, %u bytes, %d drained\n",
+			__func__, ch, before, after, len, drained);
+
+	return after <= before - (int)len + drained;
+}
+
+/*
+ * sc16is7x2_handle_tx - Queue TX data for the next data transfer
+ *
+ * Fills chan->txbuf with as much of the circular buffer as the TX FIFO
+ * (chan->txlvl, read by sc16is7x2_read_all_status()) and the TX mode allow.
+ * The transfer itself is part of the message built by sc16is7x2_start_data().
  */
 static void sc16is7x2_handle_tx(struct sc16is7x2_chip *ts, unsigned ch)
 {
@@ -270,13 +427,16 @@ static void sc16is7x2_handle_tx(struct sc16is7x2_chip *ts, unsigned ch)
 	struct circ_buf *xmit = &uart->state->xmit;
 	unsigned long flags;
 	unsigned i, len;
-	int txlvl;
+	int txlvl = chan->txlvl;
 
 	dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s (%i) ENTERING sc16is7x2_handle_tx()\n", __func__, ch); /* Added by Jim Partan */
 
+	chan->txlen = 0;
+
 	if (chan->uart.x_char && chan->lsr & UART_LSR_THRE) {
 		dev_dbg(&ts->spi->dev, " tx: x-char\n");
-		sc16is7x2_write(ts, UART_TX, ch, uart->x_char);
+		chan->txbuf[1] = uart->x_char;
+		chan->txlen = 1;
 		uart->icount.tx++;
 		uart->x_char = 0;
 		return;
@@ -287,13 +447,15 @@ static void sc16is7x2_handle_tx(struct sc16is7x2_chip *ts, unsigned ch)
 		return;
 	}
 
-	txlvl = sc16is7x2_read(ts, REG_TXLVL, ch);
 	if (txlvl <= 0) {
 		dev_dbg(&ts->spi->dev, " %s (%i) fifo full\n", __func__, ch);
 		return;
+	} else if (txlvl > FIFO_SIZE) {
+		/* Ensure sanity of TX level */
+		txlvl = FIFO_SIZE;
 	}
 	/* Hackishly force len<=1. if(txlvl>1) conditional statements added by Jim Partan, jpartan@whoi.edu, 2015-07-30. */
-	if (txlvl > 1) {
+	if (chan->tx_mode == SC16IS7X2_TX_SINGLE && txlvl > 1) {
 	  dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s (%i) %d bytes - forcing txlvl from %d to 1 to fix broken SC16IS7x2\n", __func__, ch, txlvl, txlvl);
 	        txlvl = 1;
 	}
@@ -304,23 +466,51 @@ static void sc16is7x2_handle_tx(struct sc16is7x2_chip *ts, unsigned ch)
 
 	spin_lock_irqsave(&uart->lock, flags);
 	for (i = 1; i <= len ; i++) {
-		chan->buf[i] = xmit->buf[xmit->tail];
+		chan->txbuf[i] = xmit->buf[xmit->tail];
 		xmit->tail = (xmit->tail + 1) & (UART_XMIT_SIZE - 1);
 		/* Added by Jim Partan */
-		if (isgraph_sc16is7x2(chan->buf[i])) {
-		        dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s chan(%i)->buf[%d]=0x%02x=%c\n", __func__, ch, i, chan->buf[i], chan->buf[i]);
+		if (isgraph_sc16is7x2(chan->txbuf[i])) {
+		        dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s chan(%i)->txbuf[%d]=0x%02x=%c\n", __func__, ch, i, chan->txbuf[i], chan->txbuf[i]);
 		} else {
-		        dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s chan(%i)->buf[%d]=0x%02x\n", __func__, ch, i, chan->buf[i]);
+		        dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s chan(%i)->txbuf[%d]=0x%02x\n", __func__, ch, i, chan->txbuf[i]);
 		}
 	}
 	uart->icount.tx += len;
 	spin_unlock_irqrestore(&uart->lock, flags);
 
-	chan->buf[0] = write_cmd(UART_TX, ch);
-	dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s (%i) chan->buf[0]=0x%02x (SPI tx cmd?)\n", __func__, ch, chan->buf[0]); /* Added by Jim Partan */
-	if (spi_write(ts->spi, chan->buf, len + 1)) {
+	chan->txlen = len;
+}
+
+/*
+ * sc16is7x2_finish_tx - Account for a completed TX transfer
+ * @status: result of the SPI message that carried chan->txbuf
+ */
+static void sc16is7x2_finish_tx(struct sc16is7x2_chip *ts, unsigned ch,
+		int status)
+{
+	struct sc16is7x2_channel *chan = &ts->channel[ch];
+	struct uart_port *uart = &chan->uart;
+	struct circ_buf *xmit = &uart->state->xmit;
+	unsigned len = chan->txlen;
+
+	if (!len)
+		return;
+	chan->txlen = 0;
+
+	if (status) {
 	        dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s (%i) SPI transfer TX handling failed\n", __func__, ch); /* Added by Jim Partan */
 		dev_err(&ts->spi->dev, " SPI transfer TX handling failed\n");
+	} else if (len > 1) {
+		chan->tx_bursts++;
+		if (chan->tx_mode == SC16IS7X2_TX_VERIFY &&
+		    !sc16is7x2_verify_burst(ts, ch, chan->txlvl, len,
+				ts->status_time)) {
+			chan->tx_verify_errors++;
+			chan->tx_mode = SC16IS7X2_TX_SINGLE;
+			dev_warn(&ts->spi->dev, "eser%d: %u byte TX burst lost data, "
+					"falling back to single byte mode\n",
+					uart->line, len);
+		}
 	}
 	if (uart_circ_chars_pending(xmit) < WAKEUP_CHARS) {
 	        dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s (%i) uart_write_wakeup()\n", __func__, ch); /* Added by Jim Partan */
@@ -329,7 +519,7 @@ static void sc16is7x2_handle_tx(struct sc16is7x2_chip *ts, unsigned ch)
 	        dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s (%i) WASN'T GOING TO WAKE UP... BUT FORCING WAKE UP\n", __func__, ch); /* Added by Jim Partan */
 		uart_write_wakeup(uart); /* Added by Jim Partan - didn't seem to break anything? */
 	}
-	dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s (%i) RETURNING FROM sc16is7x2_handle_tx()\n", __func__, ch); /* Added by Jim Partan */
+	dev_dbg_sc16is7x2(0, &ts->spi->dev, " %s (%i) RETURNING FROM sc16is7x2_finish_tx()\n", __func__, ch); /* Added by Jim Partan */
 } 
 
 
@@ -364,19 +554,41 @@ static void sc16is7x2_handle_regs(struct sc16is7x2_chip *ts, unsigned ch)
 	sc16is7x2_write(ts, UART_EFR, ch, chan->efr);
 	sc16is7x2_write(ts, UART_LCR, ch, chan->lcr);
 	sc16is7x2_write(ts, UART_FCR, ch, chan->fcr);
+	/* TLR is only reachable with EFR[4] and MCR[2] set, a zero
+	 * RX nibble falls back to the FCR trigger level */
+	sc16is7x2_write(ts, UART_MCR, ch, chan->mcr | UART_MCR_TCRTLR);
+	sc16is7x2_write(ts, UART_TLR, ch, (chan->rx_trigger / 4) << 4);
 	sc16is7x2_write(ts, UART_MCR, ch, chan->mcr);
 	sc16is7x2_write(ts, UART_IER, ch, chan->ier);
 
 	chan->handle_regs = false;
 }
 
-static void sc16is7x2_read_status(struct sc16is7x2_chip *ts, unsigned ch)
+static void sc16is7x2_handle_msr(struct sc16is7x2_chip *ts, unsigned ch)
 {
 	struct sc16is7x2_channel *chan = &(ts->channel[ch]);
 	struct uart_port *uart = &chan->uart;
-/*	struct spi_message m;
-	struct spi_transfer t;
-	u8 *buf = chan->buf; */
+
+	/* Handle Change in DCD */
+	if (chan->msr & UART_MSR_DDCD)
+			uart_handle_dcd_change(uart, chan->msr & UART_MSR_DCD);
+	/* Handle Change in CTS */
+	if (chan->msr & UART_MSR_DCTS)
+			uart_handle_cts_change(uart, chan->msr & UART_MSR_CTS);
+
+	/* Handle Change in RI */
+	if (chan->msr & UART_MSR_TERI)
+			uart->icount.rng++;
+
+	/* Handle Change in DSR */
+	if (chan->msr & UART_MSR_DDSR)	
+			uart->icount.dsr++;
+}
+
+/* Slow path, one transfer per register. Only used outside the IRQ path. */
+static void sc16is7x2_read_status(struct sc16is7x2_chip *ts, unsigned ch)
+{
+	struct sc16is7x2_channel *chan = &(ts->channel[ch]);
 	u8 ier;
 	u8 lcr, mcr, tcr, tlr, efcr, efr; /* Added by Jim Partan, jpartan@whoi.edu, 2015-07-29. */
 
@@ -394,19 +606,6 @@ static void sc16is7x2_read_status(struct sc16is7x2_chip *ts, unsigned ch)
 	chan->iir = sc16is7x2_read(ts, UART_IIR, ch);
 	chan->msr = sc16is7x2_read(ts, UART_MSR, ch);
 	chan->lsr = sc16is7x2_read(ts, UART_LSR, ch);
-/*
-	buf[0] = read_cmd(UART_IER, ch);
-	buf[1] = read_cmd(UART_IIR, ch);
-	buf[2] = read_cmd(UART_MSR, ch);
-	buf[3] = read_cmd(UART_LSR, ch);
-
-	t.tx_buf = buf;
-	t.rx_buf = &buf[16];
-	t.len = 5;
-
-	spi_message_init(&m);
-	spi_message_add_tail(&t, &m);
-	spi_sync(ts->spi, &m); */
 
 	dev_dbg(&ts->spi->dev, " %s ier=0x%02x iir=0x%02x msr=0x%02x lsr=0x%02x\n",
 			__func__, ier, chan->iir, chan->msr, chan->lsr);
@@ -414,74 +613,288 @@ static void sc16is7x2_read_status(struct sc16is7x2_chip *ts, unsigned ch)
 	/* Print out the status of a bunch of other registers. Added by Jim Partan, jpartan@whoi.edu, 2015-07-29. */
 	dev_dbg(&ts->spi->dev, " %s lcr=0x%02x mcr=0x%02x tcr=0x%02x tlr=0x%02x efcr=0x%02x efr=0x%02x\n",
 		__func__, lcr, mcr, tcr, tlr, efcr, efr);
+
+	sc16is7x2_handle_msr(ts, ch);
+}
+
 /*
-	dev_dbg(&ts->spi->dev, " %s ier=0x%02x iir=0x%02x msr=0x%02x lsr=0x%02x\n",
-			__func__, buf[17], buf[18], buf[19], buf[20]);
-*/
+ * sc16is7x2_init_status_msg - Build the message used by read_all_status
+ *
+ * Every register access is a separate chip select frame, so the message is
+ * a chain of two byte transfers with cs_change set on all but the last.
+ */
+static void sc16is7x2_init_status_msg(struct sc16is7x2_chip *ts)
+{
+	struct spi_transfer *t = ts->status_xfer;
+	unsigned ch, i, n = 0;
+
+	spi_message_init(&ts->status_msg);
+	for (ch = 0; ch < 2; ch++) {
+		for (i = 0; i < NR_STATUS_REGS; i++, n++) {
+			ts->status_tx[2 * n] =
+				read_cmd(sc16is7x2_status_regs[i], ch);
+			t[n].tx_buf = &ts->status_tx[2 * n];
+			t[n].rx_buf = &ts->status_rx[2 * n];
+			t[n].len = 2;
+			t[n].cs_change = 1;
+			spi_message_add_tail(&t[n], &ts->status_msg);
+		}
+	}
+	t[n - 1].cs_change = 0;
+}
 
-	/* Handle Change in DCD */
-	if (chan->msr & UART_MSR_DDCD)
-			uart_handle_dcd_change(uart, chan->msr & UART_MSR_DCD);
-	/* Handle Change in CTS */
-	if (chan->msr & UART_MSR_DCTS)
-			uart_handle_cts_change(uart, chan->msr & UART_MSR_CTS);
+/*
+ * sc16is7x2_read_all_status - Read IIR, LSR, MSR, RXLVL and TXLVL of both
+ * channels with a single SPI message
+ */
+static int sc16is7x2_read_all_status(struct sc16is7x2_chip *ts)
+{
+	const u8 *rx = ts->status_rx;
+	unsigned long flags;
+	unsigned ch;
+	int ret;
 
-	/* Handle Change in RI */
-	if (chan->msr & UART_MSR_TERI)
-			uart->icount.rng++;
+	/* Data found by the first read after an interrupt is stamped with
+	 * the interrupt time, later reads with the time of the read */
+	spin_lock_irqsave(&ts->irq_time_lock, flags);
+	if (ts->irq_time.tv64) {
+		ts->rx_time = ts->irq_time;
+		ts->irq_time.tv64 = 0;
+	} else
+		ts->rx_time = ktime_get_real();
+	spin_unlock_irqrestore(&ts->irq_time_lock, flags);
+
+	ts->status_time = ktime_get();
+	ret = spi_sync(ts->spi, &ts->status_msg);
+	if (ret) {
+		dev_err(&ts->spi->dev, " SPI status read failed\n");
+		return ret;
+	}
 
-	/* Handle Change in DSR */
-	if (chan->msr & UART_MSR_DDSR)	
-			uart->icount.dsr++;
+	for (ch = 0; ch < 2; ch++, rx += 2 * NR_STATUS_REGS) {
+		struct sc16is7x2_channel *chan = &ts->channel[ch];
+
+		chan->iir = rx[1];
+		chan->lsr = rx[3];
+		chan->msr = rx[5];
+		/* Ensure sanity of RX and TX level */
+		chan->rxlvl = min_t(u8, rx[7], FIFO_SIZE);
+		chan->txlvl = min_t(u8, rx[9], FIFO_SIZE);
+		if (chan->active && chan->rxlvl == FIFO_SIZE)
+			chan->rx_fifo_full++;
+
+		dev_dbg(&ts->spi->dev, " %s (%i) iir=0x%02x lsr=0x%02x msr=0x%02x rxlvl=%u txlvl=%u\n",
+				__func__, ch, chan->iir, chan->lsr, chan->msr,
+				chan->rxlvl, chan->txlvl);
+	}
+
+	return 0;
 }
 
-static void sc16is7x2_handle_channel(struct work_struct *w)
+static void sc16is7x2_data_complete(void *context)
 {
-	struct sc16is7x2_channel *chan =
-			container_of(w, struct sc16is7x2_channel, work);
-	struct sc16is7x2_chip *ts = chan->chip;
-	unsigned ch = (chan == ts->channel) ? 0 : 1;
+	complete(context);
+}
 
-#ifdef DEBUG
-	dev_dbg(&ts->spi->dev, "%s (%i) %s\n", __func__, ch,
-			chan->handle_irq ? "irq" : "");
-	chan->handle_irq = false;
-#endif
+/*
+ * sc16is7x2_start_data - Start draining the RX FIFOs and filling the TX
+ * FIFOs of both channels with a single asynchronous SPI message
+ *
+ * Returns the number of transfers queued, 0 if there was nothing to do.
+ */
+static int sc16is7x2_start_data(struct sc16is7x2_chip *ts)
+{
+	struct spi_message *m = &ts->data_msg;
+	struct spi_transfer *t = ts->data_xfer;
+	unsigned ch, n = 0;
+	int ret;
+
+	memset(t, 0, sizeof ts->data_xfer);
+	spi_message_init(m);
+
+	for (ch = 0; ch < 2; ch++) {
+		struct sc16is7x2_channel *chan = &ts->channel[ch];
+		u8 *buf = chan->rxbuf[chan->rx_fill];
+
+		chan->rx_len = 0;
+		if (!chan->active)
+			continue;
+
+		if (chan->rxlvl) {
+			chan->rx_len = chan->rxlvl;
+			chan->rx_lsr[chan->rx_fill] = chan->lsr;
+			chan->rx_time[chan->rx_fill] = ts->rx_time;
+			buf[0] = read_cmd(UART_RX, ch);
+			t[n].tx_buf = &buf[0];
+			t[n].len = 1;
+			spi_message_add_tail(&t[n++], m);
+			t[n].rx_buf = &buf[1];
+			t[n].len = chan->rx_len;
+			t[n].cs_change = 1;
+			spi_message_add_tail(&t[n++], m);
+		}
+
+		sc16is7x2_handle_tx(ts, ch);
+		if (chan->txlen) {
+			chan->txbuf[0] = write_cmd(UART_TX, ch);
+			t[n].tx_buf = chan->txbuf;
+			t[n].len = chan->txlen + 1;
+			if (chan->txlen > 1)
+				t[n].speed_hz = sc16is7x2_burst_speed(ts);
+			t[n].cs_change = 1;
+			spi_message_add_tail(&t[n++], m);
+		}
+	}
+
+	if (!n)
+		return 0;
+	t[n - 1].cs_change = 0;
+
+	INIT_COMPLETION(ts->data_done);
+	m->complete = sc16is7x2_data_complete;
+	m->context = &ts->data_done;
+	ret = spi_async(ts->spi, m);
+	if (ret) {
+		dev_err(&ts->spi->dev, " SPI data transfer failed\n");
+		for (ch = 0; ch < 2; ch++) {
+			sc16is7x2_finish_tx(ts, ch, ret);
+			ts->channel[ch].rx_len = 0;
+		}
+		return 0;
+	}
+
+	return n;
+}
+
+/*
+ * sc16is7x2_finish_data - Wait for the data message and flip the RX buffers
+ */
+static int sc16is7x2_finish_data(struct sc16is7x2_chip *ts)
+{
+	unsigned ch;
+	int ret;
 
-	do {
+	wait_for_completion(&ts->data_done);
+	ret = ts->data_msg.status;
+	if (ret)
+		dev_err(&ts->spi->dev, " SPI data transfer failed\n");
+
+	for (ch = 0; ch < 2; ch++) {
+		struct sc16is7x2_channel *chan = &ts->channel[ch];
+
+		sc16is7x2_finish_tx(ts, ch, ret);
+		if (!ret && chan->rx_len) {
+			chan->rx_pending = chan->rx_len;
+			chan->rx_fill ^= 1;
+		}
+		chan->rx_len = 0;
+	}
+
+	return ret;
+}
+
+static void sc16is7x2_push_rx(struct sc16is7x2_chip *ts)
+{
+	unsigned ch;
+
+	for (ch = 0; ch < 2; ch++) {
+		if (ts->channel[ch].active)
+			sc16is7x2_handle_rx(ts, ch);
+		else
+			ts->channel[ch].rx_pending = 0;
+	}
+}
+
+/*
+ * sc16is7x2_handle_chip - Service both channels
+ *
+ * Pending register updates are written first. Then, until there is nothing
+ * left to move, one message fetches the status of both channels and a
+ * second one moves the data. The data message runs asynchronously so the
+ * chip FIFOs are drained while the previous RX buffer is pushed to the tty.
+ */
+static void sc16is7x2_handle_chip(struct sc16is7x2_chip *ts)
+{
+	unsigned ch, pass;
+
+	mutex_lock(&ts->lock);
+
+	for (ch = 0; ch < 2; ch++) {
+		if (!ts->channel[ch].active)
+			continue;
 		sc16is7x2_handle_baud(ts, ch);
 		sc16is7x2_handle_regs(ts, ch);
+	}
 
-		sc16is7x2_read_status(ts, ch);
-		sc16is7x2_handle_tx(ts, ch);
-		sc16is7x2_handle_rx(ts, ch);
-	} while (!(chan->iir & UART_IIR_NO_INT));
+	if (sc16is7x2_read_all_status(ts))
+		goto out;
+
+	for (pass = 0; pass < MAX_PASSES; pass++) {
+		int busy;
+
+		for (ch = 0; ch < 2; ch++) {
+			if (ts->channel[ch].active)
+				sc16is7x2_handle_msr(ts, ch);
+		}
+
+		busy = sc16is7x2_start_data(ts);
+		sc16is7x2_push_rx(ts);
+		if (!busy)
+			break;
+
+		if (sc16is7x2_finish_data(ts))
+			break;
+		if (sc16is7x2_read_all_status(ts))
+			break;
+	}
+
+	sc16is7x2_push_rx(ts);
+
+	/* The status reads may have acknowledged a THR interrupt */
+	if (pass == MAX_PASSES)
+		queue_work(system_freezable_wq, &ts->kick);
 
-	dev_dbg(&ts->spi->dev, "%s finished\n", __func__);
+out:
+	mutex_unlock(&ts->lock);
 }
 
-/* Trigger work thread*/
-static void sc16is7x2_dowork(struct sc16is7x2_channel *chan)
+/* Hard IRQ handler, only notes the time for receive timestamps */
+static irqreturn_t sc16is7x2_hardirq(int irq, void *data)
 {
-	if (!freezing(current))
-		queue_work(chan->workqueue, &chan->work);
+	struct sc16is7x2_chip *ts = data;
+
+	spin_lock(&ts->irq_time_lock);
+	ts->irq_time = ktime_get_real();
+	spin_unlock(&ts->irq_time_lock);
+
+	return IRQ_WAKE_THREAD;
 }
 
+/* Threaded IRQ handler, the line stays masked until we return */
 static irqreturn_t sc16is7x2_irq(int irq, void *data)
 {
-	struct sc16is7x2_channel *chan = data;
+	struct sc16is7x2_chip *ts = data;
 
-#ifdef DEBUG
-	/* Indicate irq */
-	chan->handle_irq = true;
-#endif
-
-	/* Trigger work thread */
-	sc16is7x2_dowork(chan);
+	sc16is7x2_handle_chip(ts);
 
 	return IRQ_HANDLED;
 }
 
+static void sc16is7x2_kick_work(struct work_struct *w)
+{
+	struct sc16is7x2_chip *ts =
+			container_of(w, struct sc16is7x2_chip, kick);
+
+	sc16is7x2_handle_chip(ts);
+}
+
+/* Service the chip from process context, e.g. for new TX data or settings */
+static void sc16is7x2_dowork(struct sc16is7x2_channel *chan)
+{
+	if (!freezing(current))
+		queue_work(system_freezable_wq, &chan->chip->kick);
+}
+
 /* ******************************** UART ********************************* */
 
 #define to_sc16is7x2_channel(port) \
@@ -611,30 +1024,12 @@ static int sc16is7x2_startup(struct uart_port *port)
 
 	dev_dbg(&ts->spi->dev, "\n%s (%d)\n", __func__, port->line);
 
+	mutex_lock(&ts->lock);
+
 	/* Clear the interrupt registers. */
 	sc16is7x2_write(ts, UART_IER, ch, 0);
 	sc16is7x2_read_status(ts, ch);
 
-	/* Initialize work queue */
-	chan->workqueue = create_freezable_workqueue("sc16is7x2");
-	if (!chan->workqueue) {
-		dev_err(&ts->spi->dev, "Workqueue creation failed\n");
-		return -EBUSY;
-	}
-	INIT_WORK(&chan->work, sc16is7x2_handle_channel);
-
-	/* Setup IRQ. Actually we have a low active IRQ, but we want
-	 * one shot behaviour */
-	if (request_irq(ts->spi->irq, sc16is7x2_irq,
-			IRQF_TRIGGER_FALLING | IRQF_SHARED,
-			"sc16is7x2", chan)) {
-		dev_err(&ts->spi->dev, "IRQ request failed\n");
-		destroy_workqueue(chan->workqueue);
-		chan->workqueue = NULL;
-		return -EBUSY;
-	}
-
-
 	spin_lock_irqsave(&chan->uart.lock, flags);
 	chan->lcr = UART_LCR_WLEN8;
 	chan->mcr = 0;
@@ -650,6 +1045,9 @@ static int sc16is7x2_startup(struct uart_port *port)
 	sc16is7x2_write(ts, UART_MCR, ch, chan->mcr);
 	sc16is7x2_write(ts, UART_IER, ch, chan->ier);
 
+	chan->active = true;
+	mutex_unlock(&ts->lock);
+
 	return 0;
 }
 
@@ -665,21 +1063,17 @@ static void sc16is7x2_shutdown(struct uart_port *port)
 	BUG_ON(!chan);
 	BUG_ON(!ts);
 
-	/* Free the interrupt */
-	free_irq(ts->spi->irq, chan);
-
-	if (chan->workqueue) {
-		/* Flush and destroy work queue */
-		flush_workqueue(chan->workqueue);
-		destroy_workqueue(chan->workqueue);
-		chan->workqueue = NULL;
-	}
+	/* Stop servicing the channel */
+	mutex_lock(&ts->lock);
+	chan->active = false;
 
 	/* Suspend HW */
 	spin_lock_irqsave(&chan->uart.lock, flags);
 	chan->ier = UART_IERX_SLEEP;
 	spin_unlock_irqrestore(&chan->uart.lock, flags);
 	sc16is7x2_write(ts, UART_IER, ch, chan->ier);
+
+	mutex_unlock(&ts->lock);
 }
 
 static void
@@ -697,6 +1091,7 @@ sc16is7x2_set_termios(struct uart_port *port, struct ktermios *termios,
 				  port->uartclk / 16 / 0xffff,
 				  port->uartclk / 16);
 	chan->quot = uart_get_divisor(port, baud);
+	chan->baud = baud;
 	chan->handle_baud = true;
 
 	dev_dbg(&ts->spi->dev, "%s (baud %u)\n", __func__, baud);
@@ -756,7 +1151,7 @@ sc16is7x2_set_termios(struct uart_port *port, struct ktermios *termios,
 	 */
 	spin_lock_irqsave(&chan->uart.lock, flags);
 
-	/* we are sending char from a workqueue so enable */
+	/* we are pushing chars from the IRQ thread so enable */
 	chan->uart.state->port.tty->low_latency = 1;
 
 	/* Update the per-port timeout. */
@@ -1002,6 +1397,279 @@ static void sc16is7x2_set(struct gpio_chip *gpio, unsigned offset, int value)
 
 #endif /* CONFIG_GPIOLIB */
 
+/* ******************************** SYSFS ******************************** */
+
+static const char *const sc16is7x2_tx_modes[] = {
+	[SC16IS7X2_TX_SINGLE]	= "single",
+	[SC16IS7X2_TX_BURST]	= "burst",
+	[SC16IS7X2_TX_VERIFY]	= "verify",
+};
+
+/*
+ * sc16is7x2_selftest - Push TX bursts through the internal loopback
+ * @ch: Channel (0 or 1), must not be open
+ *
+ * Puts the channel into MCR loopback at the highest baud rate, writes bursts
+ * of increasing size and reads them back from the RX FIFO. Only the SPI
+ * register interface is involved, so this validates the burst path of the
+ * SPI master and the chip without any external wiring. The chip lock is held
+ * throughout, so neither the IRQ thread nor a port open touch the registers
+ * meanwhile.
+ */
+static int sc16is7x2_selftest(struct sc16is7x2_chip *ts, unsigned ch)
+{
+	static const unsigned sizes[] = { 1, 2, 16, 32, FIFO_SIZE };
+	struct sc16is7x2_channel *chan = &ts->channel[ch];
+	char *result = ts->selftest_result[ch];
+	u8 *buf = chan->buf;
+	unsigned i, j, len = 0;
+	int rxlvl = 0, tries, ret = 0;
+
+	mutex_lock(&ts->lock);
+	if (chan->active ||
+	    test_bit(ASYNCB_INITIALIZED, &chan->uart.state->port.flags)) {
+		mutex_unlock(&ts->lock);
+		return -EBUSY;
+	}
+
+	sc16is7x2_write(ts, UART_IER, ch, 0);
+	sc16is7x2_write(ts, UART_LCR, ch, UART_LCR_DLAB);
+	sc16is7x2_write(ts, UART_DLL, ch, 1);
+	sc16is7x2_write(ts, UART_DLM, ch, 0);
+	sc16is7x2_write(ts, UART_LCR, ch, UART_LCR_WLEN8);
+	sc16is7x2_write(ts, UART_FCR, ch, UART_FCR_ENABLE_FIFO |
+		       UART_FCR_CLEAR_RCVR | UART_FCR_CLEAR_XMIT);
+	sc16is7x2_write(ts, UART_MCR, ch, UART_MCR_LOOP);
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		len = sizes[i];
+		for (j = 1; j <= len; j++)
+			buf[j] = j * 37 + len;
+
+		ret = sc16is7x2_write_fifo(ts, ch, buf, len);
+		if (ret)
+			break;
+
+		/* 64 characters take ~460us at uartclk / 16 */
+		for (tries = 0; tries < 10; tries++) {
+			msleep(1);
+			rxlvl = sc16is7x2_read(ts, REG_RXLVL, ch);
+			if (rxlvl < 0 || rxlvl >= len)
+				break;
+		}
+		if (rxlvl < 0) {
+			ret = rxlvl;
+			break;
+		}
+		if (rxlvl != len) {
+			ret = -EIO;
+			break;
+		}
+
+		ret = sc16is7x2_read_fifo(ts, ch, buf, len);
+		if (ret)
+			break;
+		for (j = 1; j <= len; j++) {
+			if (buf[j] != (u8)(j * 37 + len)) {
+				rxlvl = j - 1;
+				ret = -EIO;
+				break;
+			}
+		}
+		if (ret)
+			break;
+	}
+
+	if (!ret)
+		snprintf(result, sizeof(ts->selftest_result[ch]), "pass\n");
+	else if (ret == -EIO)
+		snprintf(result, sizeof(ts->selftest_result[ch]),
+				"fail: %u byte burst, %d bytes ok\n", len, rxlvl);
+	else
+		snprintf(result, sizeof(ts->selftest_result[ch]),
+				"fail: SPI error %d\n", ret);
+
+	sc16is7x2_write(ts, UART_MCR, ch, 0);
+	sc16is7x2_write(ts, UART_FCR, ch, UART_FCR_ENABLE_FIFO |
+		       UART_FCR_CLEAR_RCVR | UART_FCR_CLEAR_XMIT);
+	sc16is7x2_write(ts, UART_FCR, ch, 0);
+	sc16is7x2_write(ts, UART_IER, ch, UART_IERX_SLEEP);
+	chan->handle_baud = true;
+	mutex_unlock(&ts->lock);
+
+	return ret;
+}
+
+static ssize_t sc16is7x2_show_tx_mode(struct sc16is7x2_chip *ts, unsigned ch,
+		char *buf)
+{
+	return sprintf(buf, "%s\n", sc16is7x2_tx_modes[ts->channel[ch].tx_mode]);
+}
+
+static ssize_t sc16is7x2_store_rx_trigger(struct sc16is7x2_chip *ts,
+		unsigned ch, const char *buf, size_t count)
+{
+	struct sc16is7x2_channel *chan = &ts->channel[ch];
+	unsigned long level;
+
+	/* TLR counts in steps of 4, 0 selects the FCR trigger level */
+	if (kstrtoul(buf, 0, &level) || level % 4 || level >= FIFO_SIZE)
+		return -EINVAL;
+
+	chan->rx_trigger = level;
+	chan->handle_regs = true;
+	sc16is7x2_dowork(chan);
+	return count;
+}
+
+static ssize_t sc16is7x2_store_tx_mode(struct sc16is7x2_chip *ts, unsigned ch,
+		const char *buf, size_t count)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(sc16is7x2_tx_modes); i++) {
+		if (sysfs_streq(buf, sc16is7x2_tx_modes[i])) {
+			ts->channel[ch].tx_mode = i;
+			return count;
+		}
+	}
+	return -EINVAL;
+}
+
+#define SC16IS7X2_CHANNEL_ATTRS(n)					\
+static ssize_t ch##n##_tx_mode_show(struct device *dev,			\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	return sc16is7x2_show_tx_mode(dev_get_drvdata(dev), n, buf);	\
+}									\
+static ssize_t ch##n##_tx_mode_store(struct device *dev,		\
+		struct device_attribute *attr, const char *buf,		\
+		size_t count)						\
+{									\
+	return sc16is7x2_store_tx_mode(dev_get_drvdata(dev), n, buf, count); \
+}									\
+static ssize_t ch##n##_tx_verify_errors_show(struct device *dev,	\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	struct sc16is7x2_chip *ts = dev_get_drvdata(dev);		\
+	return sprintf(buf, "%lu\n", ts->channel[n].tx_verify_errors);	\
+}									\
+static ssize_t ch##n##_rx_trigger_show(struct device *dev,		\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	struct sc16is7x2_chip *ts = dev_get_drvdata(dev);		\
+	return sprintf(buf, "%u\n", ts->channel[n].rx_trigger);		\
+}									\
+static ssize_t ch##n##_rx_trigger_store(struct device *dev,		\
+		struct device_attribute *attr, const char *buf,		\
+		size_t count)						\
+{									\
+	return sc16is7x2_store_rx_trigger(dev_get_drvdata(dev), n, buf, count); \
+}									\
+static ssize_t ch##n##_rx_overruns_show(struct device *dev,		\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	struct sc16is7x2_chip *ts = dev_get_drvdata(dev);		\
+	return sprintf(buf, "%u\n", ts->channel[n].uart.icount.overrun); \
+}									\
+static ssize_t ch##n##_rx_fifo_full_show(struct device *dev,		\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	struct sc16is7x2_chip *ts = dev_get_drvdata(dev);		\
+	return sprintf(buf, "%lu\n", ts->channel[n].rx_fifo_full);	\
+}									\
+static DEVICE_ATTR(ch##n##_tx_mode, S_IRUGO | S_IWUSR,			\
+		ch##n##_tx_mode_show, ch##n##_tx_mode_store);		\
+static DEVICE_ATTR(ch##n##_tx_verify_errors, S_IRUGO,			\
+		ch##n##_tx_verify_errors_show, NULL);			\
+static DEVICE_ATTR(ch##n##_rx_trigger, S_IRUGO | S_IWUSR,		\
+		ch##n##_rx_trigger_show, ch##n##_rx_trigger_store);	\
+static DEVICE_ATTR(ch##n##_rx_overruns, S_IRUGO,			\
+		ch##n##_rx_overruns_show, NULL);			\
+static DEVICE_ATTR(ch##n##_rx_fifo_full, S_IRUGO,			\
+		ch##n##_rx_fifo_full_show, NULL)
+
+SC16IS7X2_CHANNEL_ATTRS(0);
+SC16IS7X2_CHANNEL_ATTRS(1);
+
+static ssize_t burst_clkdiv_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct sc16is7x2_chip *ts = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", ts->burst_clkdiv);
+}
+
+static ssize_t burst_clkdiv_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sc16is7x2_chip *ts = dev_get_drvdata(dev);
+	unsigned long div;
+
+	if (kstrtoul(buf, 0, &div))
+		return -EINVAL;
+
+	ts->burst_clkdiv = div;
+	return count;
+}
+
+static ssize_t selftest_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct sc16is7x2_chip *ts = dev_get_drvdata(dev);
+	ssize_t ret;
+
+	mutex_lock(&ts->selftest_lock);
+	ret = sprintf(buf, "ch0: %sch1: %s", ts->selftest_result[0],
+			ts->selftest_result[1]);
+	mutex_unlock(&ts->selftest_lock);
+
+	return ret;
+}
+
+static ssize_t selftest_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sc16is7x2_chip *ts = dev_get_drvdata(dev);
+	unsigned long ch;
+	int ret;
+
+	if (kstrtoul(buf, 0, &ch) || ch > 1)
+		return -EINVAL;
+
+	mutex_lock(&ts->selftest_lock);
+	ret = sc16is7x2_selftest(ts, ch);
+	mutex_unlock(&ts->selftest_lock);
+
+	/* A failed comparison is reported through the attribute */
+	return (ret && ret != -EIO) ? ret : count;
+}
+
+static DEVICE_ATTR(burst_clkdiv, S_IRUGO | S_IWUSR,
+		burst_clkdiv_show, burst_clkdiv_store);
+static DEVICE_ATTR(selftest, S_IRUGO | S_IWUSR,
+		selftest_show, selftest_store);
+
+static struct attribute *sc16is7x2_attrs[] = {
+	&dev_attr_ch0_tx_mode.attr,
+	&dev_attr_ch0_tx_verify_errors.attr,
+	&dev_attr_ch0_rx_trigger.attr,
+	&dev_attr_ch0_rx_overruns.attr,
+	&dev_attr_ch0_rx_fifo_full.attr,
+	&dev_attr_ch1_tx_mode.attr,
+	&dev_attr_ch1_tx_verify_errors.attr,
+	&dev_attr_ch1_rx_trigger.attr,
+	&dev_attr_ch1_rx_overruns.attr,
+	&dev_attr_ch1_rx_fifo_full.attr,
+	&dev_attr_burst_clkdiv.attr,
+	&dev_attr_selftest.attr,
+	NULL
+};
+
+static const struct attribute_group sc16is7x2_attr_group = {
+	.attrs = sc16is7x2_attrs,
+};
+
 /* ******************************** INIT ********************************* */
 
 static struct uart_driver sc16is7x2_uart_driver;
@@ -1058,8 +1726,13 @@ static int sc16is7x2_register_uart_port(struct sc16is7x2_chip *ts,
 	sc16is7x2_write(ts, UART_IER, ch, UART_IERX_SLEEP);
 
 	chan->chip = ts;
+	chan->tx_mode = pdata->tx_mode;
+	if (chan->tx_mode >= ARRAY_SIZE(sc16is7x2_tx_modes))
+		chan->tx_mode = SC16IS7X2_TX_SINGLE;
+	if (pdata->rx_trigger < FIFO_SIZE)
+		chan->rx_trigger = pdata->rx_trigger & ~3;
 
-	uart->irq = ts->spi->irq;
+	uart->irq = ts->irq;
 	uart->uartclk = pdata->uartclk;
 	uart->fifosize = FIFO_SIZE;
 	uart->ops = &sc16is7x2_uart_ops;
@@ -1075,6 +1748,7 @@ static int __devinit sc16is7x2_probe(struct spi_device *spi)
 {
 	struct sc16is7x2_chip *ts;
 	struct sc16is7x2_platform_data *pdata;
+	bool irq_from_gpio;
 	int ret;
 
 	/* Only even uart base numbers are supported */
@@ -1090,6 +1764,20 @@ static int __devinit sc16is7x2_probe(struct spi_device *spi)
 
 	spi_set_drvdata(spi, ts);
 	ts->spi = spi;
+	ts->burst_clkdiv = pdata->burst_clkdiv;
+	mutex_init(&ts->lock);
+	spin_lock_init(&ts->irq_time_lock);
+	INIT_WORK(&ts->kick, sc16is7x2_kick_work);
+	init_completion(&ts->data_done);
+	sc16is7x2_init_status_msg(ts);
+	mutex_init(&ts->selftest_lock);
+	strcpy(ts->selftest_result[0], "not run\n");
+	strcpy(ts->selftest_result[1], "not run\n");
+
+	/* Without an IRQ from the board info, the IRQ comes from a GPIO */
+	irq_from_gpio = spi->irq <= 0;
+	ts->irq = irq_from_gpio ? gpio_to_irq(pdata->irq_gpio) : spi->irq;
+	ts->irq_gpio = -1;
 
 	/* Reset the chip */
 	sc16is7x2_write(ts, REG_IOC, 0, IOC_SRESET);
@@ -1105,29 +1793,55 @@ static int __devinit sc16is7x2_probe(struct spi_device *spi)
 	if (ret)
 		goto exit_uart1;
 
-    /* Initialize GPIO */
-    spi->irq = gpio_to_irq(pdata->irq_gpio);
-    ret = gpio_request(pdata->irq_gpio, "SC16IS7X2_IRQ_GPIO");
-	if (ret) {
-		pr_warning("failed to request GPIO %u\n", pdata->irq_gpio);
-		return -EINVAL;
+	if (irq_from_gpio) {
+		ret = gpio_request(pdata->irq_gpio, "SC16IS7X2_IRQ_GPIO");
+		if (ret) {
+			pr_warning("failed to request GPIO %u\n", pdata->irq_gpio);
+			ret = -EINVAL;
+			goto exit_gpio;
+		}
+
+		ret = gpio_direction_input(pdata->irq_gpio);
+		if (ret) {
+			pr_warning("failed to set pin direction to input\n");
+			ret = -EINVAL;
+			goto exit_irq_gpio;
+		}
 	}
 
-	ret = gpio_direction_input(pdata->irq_gpio);
+	/* The IRQ is low active and shared by both channels. The line stays
+	 * masked while the thread talks to the chip over SPI. */
+	ret = request_threaded_irq(ts->irq, sc16is7x2_hardirq, sc16is7x2_irq,
+			IRQF_TRIGGER_LOW | IRQF_ONESHOT, DRIVER_NAME, ts);
 	if (ret) {
-		pr_warning("failed to set pin direction to input\n");
-		gpio_free(pdata->irq_gpio);
-		return -EINVAL;
+		dev_err(&spi->dev, "IRQ request failed\n");
+		goto exit_irq_gpio;
 	}
+
+	if (irq_from_gpio)
+		ts->irq_gpio = pdata->irq_gpio;
+
+	if (sysfs_create_group(&spi->dev.kobj, &sc16is7x2_attr_group))
+		dev_warn(&spi->dev, "failed to create sysfs attributes\n");
     
 	dev_info(&spi->dev, DRIVER_NAME " at CS%d (gpio %d, irq %d), 2 UARTs, 8 GPIOs\n"
 			"    eser%d, eser%d, gpiochip%d\n",
-			spi->chip_select, pdata->irq_gpio, spi->irq,
+			spi->chip_select, pdata->irq_gpio, ts->irq,
 			pdata->uart_base, pdata->uart_base + 1,
 			pdata->gpio_base);
 
 	return 0;
 
+exit_irq_gpio:
+	if (irq_from_gpio)
+		gpio_free(pdata->irq_gpio);
+
+exit_gpio:
+#ifdef CONFIG_GPIOLIB
+	if (gpiochip_remove(&ts->gpio))
+		dev_err(&spi->dev, "failed to remove gpiochip\n");
+#endif
+
 exit_uart1:
 	uart_remove_one_port(&sc16is7x2_uart_driver, &ts->channel[1].uart);
 
@@ -1148,6 +1862,13 @@ static int __devexit sc16is7x2_remove(struct spi_device *spi)
 	if (ts == NULL)
 		return -ENODEV;
 
+	sysfs_remove_group(&spi->dev.kobj, &sc16is7x2_attr_group);
+
+	free_irq(ts->irq, ts);
+	cancel_work_sync(&ts->kick);
+	if (ts->irq_gpio >= 0)
+		gpio_free(ts->irq_gpio);
+
 	ret = uart_remove_one_port(&sc16is7x2_uart_driver, &ts->channel[0].uart);
 	if (ret)
 		return ret;
@@ -50,6 +50,12 @@ static struct lock_class_key port_lock_key;
 
 #define HIGH_BITS_OFFSET	((sizeof(long)-sizeof(int))*8)
 
+/*
+ * Flip buffers preallocated on first open, about 90ms of data at
+ * 115200 baud before the receive path falls back to kmalloc.
+ */
+#define UART_RX_PREALLOC	4
+
 #ifdef CONFIG_SERIAL_CORE_CONSOLE
 #define uart_console(port)	((port)->cons && (port)->cons->index == (port)->line)
 #else
@@ -1502,6 +1508,8 @@ static int uart_open(struct tty_struct *tty, struct file *filp)
 	tty->driver_data = state;
 	state->uart_port->state = state;
 	tty->low_latency = (state->uart_port->flags & UPF_LOW_LATENCY) ? 1 : 0;
+	tty->rx_kthread = state->rx_kthread;
+	tty->buf.lat = &state->rx_lat;
 	tty_port_tty_set(port, tty);
 
 	/*
@@ -1513,10 +1521,17 @@ static int uart_open(struct tty_struct *tty, struct file *filp)
 	}
 
 	/*
-	 * Make sure the device is in D0 state.
+	 * Make sure the device is in D0 state, and give the receive path
+	 * a few flip buffers so it does not have to allocate them from
+	 * the interrupt handler.
 	 */
-	if (port->count == 1)
+	if (port->count == 1) {
 		uart_change_pm(state, 0);
+		tty_buffer_prealloc(tty, UART_RX_PREALLOC);
+		if (state->rx_stamps && tty_rx_stamps_enable(tty))
+			dev_warn(state->uart_port->dev,
+				 "cannot enable rx timestamps\n");
+	}
 
 	/*
 	 * Start up the serial port.
@@ -2293,6 +2308,89 @@ struct tty_driver *uart_console_device(struct console *co, int *index)
 	return p->tty_driver;
 }
 
+static ssize_t uart_get_attr_rx_kthread(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct uart_state *state = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", state->rx_kthread);
+}
+
+static ssize_t uart_set_attr_rx_kthread(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct uart_state *state = dev_get_drvdata(dev);
+	struct tty_port *port = &state->port;
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&port->mutex);
+	state->rx_kthread = !!val;
+	if (port->tty)
+		port->tty->rx_kthread = state->rx_kthread;
+	mutex_unlock(&port->mutex);
+
+	return count;
+}
+
+static ssize_t uart_get_attr_rx_latency(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct uart_state *state = dev_get_drvdata(dev);
+
+	return tty_rx_latency_show(&state->rx_lat, buf);
+}
+
+static ssize_t uart_set_attr_rx_latency(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct uart_state *state = dev_get_drvdata(dev);
+
+	memset(&state->rx_lat, 0, sizeof(state->rx_lat));
+	return count;
+}
+
+static ssize_t uart_get_attr_rx_stamps(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct uart_state *state = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", state->rx_stamps);
+}
+
+static ssize_t uart_set_attr_rx_stamps(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct uart_state *state = dev_get_drvdata(dev);
+	struct tty_port *port = &state->port;
+	unsigned long val;
+	int ret;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	/* Stamps stay enabled on an open tty until its last close */
+	mutex_lock(&port->mutex);
+	state->rx_stamps = !!val;
+	if (port->tty && state->rx_stamps)
+		ret = tty_rx_stamps_enable(port->tty);
+	mutex_unlock(&port->mutex);
+
+	return ret ? ret : count;
+}
+
+static DEVICE_ATTR(rx_kthread, S_IRUGO | S_IWUSR,
+	uart_get_attr_rx_kthread, uart_set_attr_rx_kthread);
+static DEVICE_ATTR(rx_latency, S_IRUGO | S_IWUSR,
+	uart_get_attr_rx_latency, uart_set_attr_rx_latency);
+static DEVICE_ATTR(rx_stamps, S_IRUGO | S_IWUSR,
+	uart_get_attr_rx_stamps, uart_set_attr_rx_stamps);
+
 /**
  *	uart_add_one_port - attach a driver-defined port structure
  *	@drv: pointer to the uart low level driver structure for this port
@@ -2349,6 +2447,11 @@ int uart_add_one_port(struct uart_driver *drv, struct uart_port *uport)
 	tty_dev = tty_register_device(drv->tty_driver, uport->line, uport->dev);
 	if (likely(!IS_ERR(tty_dev))) {
 		device_set_wakeup_capable(tty_dev, 1);
+		dev_set_drvdata(tty_dev, state);
+		if (device_create_file(tty_dev, &dev_attr_rx_kthread) ||
+		    device_create_file(tty_dev, &dev_attr_rx_latency) ||
+		    device_create_file(tty_dev, &dev_attr_rx_stamps))
+			dev_warn(tty_dev, "cannot create rx attributes\n");
 	} else {
 		printk(KERN_ERR "Cannot register tty device on line %d\n",
 		       uport->line);
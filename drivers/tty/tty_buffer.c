@@ -1,5 +1,21 @@
 /*
  * Tty buffer allocation management
+ *
+ * The buffer queue is a single producer, single consumer structure. The
+ * driver receive path is the producer and only touches buf.tail and the
+ * used/commit counts of the tail buffer. flush_to_ldisc is the consumer
+ * and only touches buf.head and the read counts. Data is published by
+ * advancing commit and buffers are linked in after commit is final, with
+ * write barriers on the producer side paired with read barriers in
+ * flush_to_ldisc, so inserting characters takes no lock. A driver with
+ * more than one receive context for the same tty must serialize them
+ * itself, commit included: it calls tty_buffer_commit with its own lock
+ * still held and tty_buffer_deliver once it has dropped it, instead of
+ * tty_flip_buffer_push.
+ *
+ * buf.lock is only taken on the consumer side, to hand the queue over
+ * between flush_to_ldisc and tty_buffer_flush. The pty code borrows it
+ * to serialize its producers.
  */
 
 #include <linux/types.h>
@@ -16,6 +32,16 @@
 #include <linux/bitops.h>
 #include <linux/delay.h>
 #include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/llist.h>
+
+/*
+ * Shared SCHED_FIFO worker used to feed the line discipline of ttys in
+ * rx_kthread mode. It runs at the default priority of threaded IRQ
+ * handlers so data reaches the reader right after the interrupt.
+ */
+static DEFINE_KTHREAD_WORKER(tty_rx_worker);
 
 /**
  *	tty_buffer_free_all		-	free buffers used by a tty
@@ -29,18 +55,60 @@
 
 void tty_buffer_free_all(struct tty_struct *tty)
 {
-	struct tty_buffer *thead;
-	while ((thead = tty->buf.head) != NULL) {
-		tty->buf.head = thead->next;
-		kfree(thead);
+	struct tty_bufhead *buf = &tty->buf;
+	struct tty_buffer *thead, *next;
+	struct llist_node *llist;
+
+	while ((thead = buf->head) != NULL) {
+		buf->head = thead->next;
+		if (thead != &buf->sentinel)
+			kfree(thead);
 	}
-	while ((thead = tty->buf.free) != NULL) {
-		tty->buf.free = thead->next;
-		kfree(thead);
+	llist = llist_del_all(&buf->free);
+	while (llist) {
+		next = llist_entry(llist, struct tty_buffer, free);
+		llist = llist->next;
+		kfree(next);
+	}
+	buf->sentinel.next = NULL;
+	buf->sentinel.commit = buf->sentinel.read = 0;
+	buf->sentinel.seq = 0;
+	buf->head = buf->tail = &buf->sentinel;
+	atomic_set(&buf->memory_used, 0);
+	kfree(buf->stamps);
+	buf->stamps = NULL;
+	buf->rx_seq = 0;
+}
+
+/**
+ *	tty_buffer_prealloc		-	fill the free pool of a tty
+ *	@tty: tty to fill
+ *	@count: number of TTY_BUFFER_MIN buffers to keep ready
+ *
+ *	Allocate free buffers up front so that a driver receiving at a
+ *	steady rate does not have to call kmalloc from its interrupt
+ *	handler. Buffers given back by flush_to_ldisc return to the pool.
+ *	Returns the number of buffers added.
+ *
+ *	Locking: none, may sleep. Safe against a running producer.
+ */
+
+int tty_buffer_prealloc(struct tty_struct *tty, int count)
+{
+	struct tty_buffer *p;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		p = kmalloc(sizeof(struct tty_buffer) + 2 * TTY_BUFFER_MIN,
+			    GFP_KERNEL);
+		if (p == NULL)
+			break;
+		p->size = TTY_BUFFER_MIN;
+		llist_add(&p->free, &tty->buf.free);
 	}
-	tty->buf.tail = NULL;
-	tty->buf.memory_used = 0;
+	return i;
 }
+EXPORT_SYMBOL_GPL(tty_buffer_prealloc);
 
 /**
  *	tty_buffer_alloc	-	allocate a tty buffer
@@ -48,29 +116,44 @@ void tty_buffer_free_all(struct tty_struct *tty)
  *	@size: desired size (characters)
  *
  *	Allocate a new tty buffer to hold the desired number of characters.
- *	Return NULL if out of memory or the allocation would exceed the
- *	per device queue
+ *	Buffers of TTY_BUFFER_MIN or less come from the free pool when it
+ *	has any. Return NULL if out of memory or the allocation would exceed
+ *	the per device queue
  *
- *	Locking: Caller must hold tty->buf.lock
+ *	Locking: producer side
  */
 
 static struct tty_buffer *tty_buffer_alloc(struct tty_struct *tty, size_t size)
 {
+	struct llist_node *free;
 	struct tty_buffer *p;
 
-	if (tty->buf.memory_used + size > 65536)
+	/* Round the buffer size out */
+	size = (size + 0xFF) & ~0xFF;
+
+	if (atomic_read(&tty->buf.memory_used) + size > 65536)
 		return NULL;
+
+	if (size <= TTY_BUFFER_MIN) {
+		free = llist_del_first(&tty->buf.free);
+		if (free) {
+			p = llist_entry(free, struct tty_buffer, free);
+			goto found;
+		}
+	}
+
 	p = kmalloc(sizeof(struct tty_buffer) + 2 * size, GFP_ATOMIC);
 	if (p == NULL)
 		return NULL;
-	p->used = 0;
 	p->size = size;
+found:
+	p->used = 0;
 	p->next = NULL;
 	p->commit = 0;
 	p->read = 0;
 	p->char_buf_ptr = (char *)(p->data);
-	p->flag_buf_ptr = (unsigned char *)p->char_buf_ptr + size;
-	tty->buf.memory_used += size;
+	p->flag_buf_ptr = (unsigned char *)p->char_buf_ptr + p->size;
+	atomic_add(p->size, &tty->buf.memory_used);
 	return p;
 }
 
@@ -79,24 +162,24 @@ static struct tty_buffer *tty_buffer_alloc(struct tty_struct *tty, size_t size)
  *	@tty: tty owning the buffer
  *	@b: the buffer to free
  *
- *	Free a tty buffer, or add it to the free list according to our
- *	internal strategy
+ *	Free a tty buffer, or return it to the free pool if it is of the
+ *	pooled size. The sentinel is never freed.
  *
- *	Locking: Caller must hold tty->buf.lock
+ *	Locking: consumer side
  */
 
 static void tty_buffer_free(struct tty_struct *tty, struct tty_buffer *b)
 {
-	/* Dumb strategy for now - should keep some stats */
-	tty->buf.memory_used -= b->size;
-	WARN_ON(tty->buf.memory_used < 0);
+	if (b == &tty->buf.sentinel)
+		return;
 
-	if (b->size >= 512)
+	atomic_sub(b->size, &tty->buf.memory_used);
+	WARN_ON(atomic_read(&tty->buf.memory_used) < 0);
+
+	if (b->size > TTY_BUFFER_MIN)
 		kfree(b);
-	else {
-		b->next = tty->buf.free;
-		tty->buf.free = b;
-	}
+	else
+		llist_add(&b->free, &tty->buf.free);
 }
 
 /**
@@ -105,20 +188,26 @@ static void tty_buffer_free(struct tty_struct *tty, struct tty_buffer *b)
  *
  *	flush all the buffers containing receive data. Caller must
  *	hold the buffer lock and must have ensured no parallel flush to
- *	ldisc is running.
+ *	ldisc is running. The tail buffer belongs to the producer and is
+ *	kept, only its committed data is dropped.
  *
  *	Locking: Caller must hold tty->buf.lock
  */
 
 static void __tty_buffer_flush(struct tty_struct *tty)
 {
-	struct tty_buffer *thead;
+	struct tty_bufhead *buf = &tty->buf;
+	struct tty_buffer *next;
 
-	while ((thead = tty->buf.head) != NULL) {
-		tty->buf.head = thead->next;
-		tty_buffer_free(tty, thead);
+	while ((next = buf->head->next) != NULL) {
+		tty_buffer_free(tty, buf->head);
+		buf->head = next;
+	}
+	buf->head->read = ACCESS_ONCE(buf->head->commit);
+	if (buf->lat_pending) {
+		smp_mb();
+		buf->lat_pending = 0;
 	}
-	tty->buf.tail = NULL;
 }
 
 /**
@@ -152,97 +241,41 @@ void tty_buffer_flush(struct tty_struct *tty)
 }
 
 /**
- *	tty_buffer_find		-	find a free tty buffer
- *	@tty: tty owning the buffer
- *	@size: characters wanted
- *
- *	Locate an existing suitable tty buffer or if we are lacking one then
- *	allocate a new one. We round our buffers off in 256 character chunks
- *	to get better allocation behaviour.
- *
- *	Locking: Caller must hold tty->buf.lock
- */
-
-static struct tty_buffer *tty_buffer_find(struct tty_struct *tty, size_t size)
-{
-	struct tty_buffer **tbh = &tty->buf.free;
-	while ((*tbh) != NULL) {
-		struct tty_buffer *t = *tbh;
-		if (t->size >= size) {
-			*tbh = t->next;
-			t->next = NULL;
-			t->used = 0;
-			t->commit = 0;
-			t->read = 0;
-			tty->buf.memory_used += t->size;
-			return t;
-		}
-		tbh = &((*tbh)->next);
-	}
-	/* Round the buffer size out */
-	size = (size + 0xFF) & ~0xFF;
-	return tty_buffer_alloc(tty, size);
-	/* Should possibly check if this fails for the largest buffer we
-	   have queued and recycle that ? */
-}
-/**
- *	__tty_buffer_request_room		-	grow tty buffer if needed
+ *	tty_buffer_request_room		-	grow tty buffer if needed
  *	@tty: tty structure
  *	@size: size desired
  *
  *	Make at least size bytes of linear space available for the tty
  *	buffer. If we fail return the size we managed to find.
- *      Locking: Caller must hold tty->buf.lock
+ *
+ *	Locking: producer side, no locks taken
  */
-static int __tty_buffer_request_room(struct tty_struct *tty, size_t size)
+int tty_buffer_request_room(struct tty_struct *tty, size_t size)
 {
 	struct tty_buffer *b, *n;
 	int left;
-	/* OPTIMISATION: We could keep a per tty "zero" sized buffer to
-	   remove this conditional if its worth it. This would be invisible
-	   to the callers */
-	if ((b = tty->buf.tail) != NULL)
-		left = b->size - b->used;
-	else
-		left = 0;
+
+	b = tty->buf.tail;
+	left = b->size - b->used;
 
 	if (left < size) {
 		/* This is the slow path - looking for new buffers to use */
-		if ((n = tty_buffer_find(tty, size)) != NULL) {
-			if (b != NULL) {
-				b->next = n;
-				b->commit = b->used;
-			} else
-				tty->buf.head = n;
+		if ((n = tty_buffer_alloc(tty, size)) != NULL) {
+			n->seq = b->seq + b->used;
 			tty->buf.tail = n;
+			/* Publish the data and the final commit of the old
+			   tail before flush_to_ldisc can see the new buffer
+			   and move past it */
+			smp_wmb();
+			b->commit = b->used;
+			smp_wmb();
+			b->next = n;
 		} else
 			size = left;
 	}
 
 	return size;
 }
-
-
-/**
- *	tty_buffer_request_room		-	grow tty buffer if needed
- *	@tty: tty structure
- *	@size: size desired
- *
- *	Make at least size bytes of linear space available for the tty
- *	buffer. If we fail return the size we managed to find.
- *
- *	Locking: Takes tty->buf.lock
- */
-int tty_buffer_request_room(struct tty_struct *tty, size_t size)
-{
-	unsigned long flags;
-	int length;
-
-	spin_lock_irqsave(&tty->buf.lock, flags);
-	length = __tty_buffer_request_room(tty, size);
-	spin_unlock_irqrestore(&tty->buf.lock, flags);
-	return length;
-}
 EXPORT_SYMBOL_GPL(tty_buffer_request_room);
 
 /**
@@ -255,7 +288,7 @@ EXPORT_SYMBOL_GPL(tty_buffer_request_room);
  *	Queue a series of bytes to the tty buffering. All the characters
  *	passed are marked with the supplied flag. Returns the number added.
  *
- *	Locking: Called functions may take tty->buf.lock
+ *	Locking: producer side, no locks taken
  */
 
 int tty_insert_flip_string_fixed_flag(struct tty_struct *tty,
@@ -264,22 +297,14 @@ int tty_insert_flip_string_fixed_flag(struct tty_struct *tty,
 	int copied = 0;
 	do {
 		int goal = min_t(size_t, size - copied, TTY_BUFFER_PAGE);
-		int space;
-		unsigned long flags;
-		struct tty_buffer *tb;
-
-		spin_lock_irqsave(&tty->buf.lock, flags);
-		space = __tty_buffer_request_room(tty, goal);
-		tb = tty->buf.tail;
-		/* If there is no space then tb may be NULL */
-		if (unlikely(space == 0)) {
-			spin_unlock_irqrestore(&tty->buf.lock, flags);
+		int space = tty_buffer_request_room(tty, goal);
+		struct tty_buffer *tb = tty->buf.tail;
+
+		if (unlikely(space == 0))
 			break;
-		}
 		memcpy(tb->char_buf_ptr + tb->used, chars, space);
 		memset(tb->flag_buf_ptr + tb->used, flag, space);
 		tb->used += space;
-		spin_unlock_irqrestore(&tty->buf.lock, flags);
 		copied += space;
 		chars += space;
 		/* There is a small chance that we need to split the data over
@@ -300,7 +325,7 @@ EXPORT_SYMBOL(tty_insert_flip_string_fixed_flag);
  *	the flags array indicates the status of the character. Returns the
  *	number added.
  *
- *	Locking: Called functions may take tty->buf.lock
+ *	Locking: producer side, no locks taken
  */
 
 int tty_insert_flip_string_flags(struct tty_struct *tty,
@@ -309,22 +334,14 @@ int tty_insert_flip_string_flags(struct tty_struct *tty,
 	int copied = 0;
 	do {
 		int goal = min_t(size_t, size - copied, TTY_BUFFER_PAGE);
-		int space;
-		unsigned long __flags;
-		struct tty_buffer *tb;
-
-		spin_lock_irqsave(&tty->buf.lock, __flags);
-		space = __tty_buffer_request_room(tty, goal);
-		tb = tty->buf.tail;
-		/* If there is no space then tb may be NULL */
-		if (unlikely(space == 0)) {
-			spin_unlock_irqrestore(&tty->buf.lock, __flags);
+		int space = tty_buffer_request_room(tty, goal);
+		struct tty_buffer *tb = tty->buf.tail;
+
+		if (unlikely(space == 0))
 			break;
-		}
 		memcpy(tb->char_buf_ptr + tb->used, chars, space);
 		memcpy(tb->flag_buf_ptr + tb->used, flags, space);
 		tb->used += space;
-		spin_unlock_irqrestore(&tty->buf.lock, __flags);
 		copied += space;
 		chars += space;
 		flags += space;
@@ -335,6 +352,92 @@ int tty_insert_flip_string_flags(struct tty_struct *tty,
 }
 EXPORT_SYMBOL(tty_insert_flip_string_flags);
 
+/**
+ *	tty_buffer_commit	-	make pending data visible to the ldisc
+ *	@tty: tty to commit
+ *
+ *	Mark everything written to the active buffer as ready and note the
+ *	push time if the driver collects receive latency statistics. The
+ *	stamp is handed to the consumer through lat_pending, so it is only
+ *	written while the consumer is not looking at it.
+ *
+ *	Locking: producer side, no locks taken. Drivers with several
+ *	receive contexts call it with the lock serializing them held, so
+ *	that an older commit count cannot overwrite a newer one.
+ */
+
+void tty_buffer_commit(struct tty_struct *tty)
+{
+	struct tty_bufhead *buf = &tty->buf;
+
+	if (buf->lat && !ACCESS_ONCE(buf->lat_pending)) {
+		buf->lat_stamp = ktime_get();
+		smp_wmb();
+		buf->lat_pending = 1;
+	}
+	/* Data before commit, paired with flush_to_ldisc */
+	smp_wmb();
+	buf->tail->commit = buf->tail->used;
+}
+EXPORT_SYMBOL_GPL(tty_buffer_commit);
+
+/**
+ *	tty_buffer_schedule	-	queue a flush to the line discipline
+ *	@tty: tty to flush
+ *
+ *	Queue flush_to_ldisc on the rx kthread if the tty asked for it and
+ *	the worker is up, on the system workqueue otherwise. Safe if a flush
+ *	is already queued or running.
+ *
+ *	Locking: none, callable from IRQ context
+ */
+
+void tty_buffer_schedule(struct tty_struct *tty)
+{
+	if (tty->rx_kthread && tty_rx_worker.task)
+		queue_kthread_work(&tty_rx_worker, &tty->buf.kwork);
+	else
+		schedule_work(&tty->buf.work);
+}
+EXPORT_SYMBOL_GPL(tty_buffer_schedule);
+
+/**
+ *	tty_buffer_cancel_work	-	stop feeding the line discipline
+ *	@tty: tty to halt
+ *
+ *	Cancel a pending flush and wait for a running one to finish. The
+ *	caller must have cleared TTY_LDISC so that a flush still queued on
+ *	the rx kthread finds no ldisc and leaves the data alone. Returns
+ *	non zero if data may have been left behind and the caller should
+ *	reschedule once the ldisc is back.
+ *
+ *	Locking: none, may sleep
+ */
+
+int tty_buffer_cancel_work(struct tty_struct *tty)
+{
+	int pending = cancel_work_sync(&tty->buf.work);
+
+	flush_kthread_work(&tty->buf.kwork);
+	return pending || tty->rx_kthread;
+}
+
+/**
+ *	tty_buffer_flush_work	-	wait for queued flushes
+ *	@tty: tty to flush
+ *
+ *	Wait until any flush_to_ldisc queued for @tty, on either the
+ *	workqueue or the rx kthread, has completed.
+ *
+ *	Locking: none, may sleep
+ */
+
+void tty_buffer_flush_work(struct tty_struct *tty)
+{
+	flush_work_sync(&tty->buf.work);
+	flush_kthread_work(&tty->buf.kwork);
+}
+
 /**
  *	tty_schedule_flip	-	push characters to ldisc
  *	@tty: tty to push from
@@ -343,17 +446,13 @@ EXPORT_SYMBOL(tty_insert_flip_string_flags);
  *	ldisc side of the queue. It then schedules those characters for
  *	processing by the line discipline.
  *
- *	Locking: Takes tty->buf.lock
+ *	Locking: producer side, no locks taken
  */
 
 void tty_schedule_flip(struct tty_struct *tty)
 {
-	unsigned long flags;
-	spin_lock_irqsave(&tty->buf.lock, flags);
-	if (tty->buf.tail != NULL)
-		tty->buf.tail->commit = tty->buf.tail->used;
-	spin_unlock_irqrestore(&tty->buf.lock, flags);
-	schedule_work(&tty->buf.work);
+	tty_buffer_commit(tty);
+	tty_buffer_schedule(tty);
 }
 EXPORT_SYMBOL(tty_schedule_flip);
 
@@ -369,26 +468,19 @@ EXPORT_SYMBOL(tty_schedule_flip);
  *	that need their own block copy routines into the buffer. There is no
  *	guarantee the buffer is a DMA target!
  *
- *	Locking: May call functions taking tty->buf.lock
+ *	Locking: producer side, no locks taken
  */
 
 int tty_prepare_flip_string(struct tty_struct *tty, unsigned char **chars,
 								size_t size)
 {
-	int space;
-	unsigned long flags;
-	struct tty_buffer *tb;
-
-	spin_lock_irqsave(&tty->buf.lock, flags);
-	space = __tty_buffer_request_room(tty, size);
-
-	tb = tty->buf.tail;
+	int space = tty_buffer_request_room(tty, size);
 	if (likely(space)) {
+		struct tty_buffer *tb = tty->buf.tail;
 		*chars = tb->char_buf_ptr + tb->used;
 		memset(tb->flag_buf_ptr + tb->used, TTY_NORMAL, space);
 		tb->used += space;
 	}
-	spin_unlock_irqrestore(&tty->buf.lock, flags);
 	return space;
 }
 EXPORT_SYMBOL_GPL(tty_prepare_flip_string);
@@ -406,26 +498,19 @@ EXPORT_SYMBOL_GPL(tty_prepare_flip_string);
  *	that need their own block copy routines into the buffer. There is no
  *	guarantee the buffer is a DMA target!
  *
- *	Locking: May call functions taking tty->buf.lock
+ *	Locking: producer side, no locks taken
  */
 
 int tty_prepare_flip_string_flags(struct tty_struct *tty,
 			unsigned char **chars, char **flags, size_t size)
 {
-	int space;
-	unsigned long __flags;
-	struct tty_buffer *tb;
-
-	spin_lock_irqsave(&tty->buf.lock, __flags);
-	space = __tty_buffer_request_room(tty, size);
-
-	tb = tty->buf.tail;
+	int space = tty_buffer_request_room(tty, size);
 	if (likely(space)) {
+		struct tty_buffer *tb = tty->buf.tail;
 		*chars = tb->char_buf_ptr + tb->used;
 		*flags = tb->flag_buf_ptr + tb->used;
 		tb->used += space;
 	}
-	spin_unlock_irqrestore(&tty->buf.lock, __flags);
 	return space;
 }
 EXPORT_SYMBOL_GPL(tty_prepare_flip_string_flags);
@@ -433,21 +518,199 @@ EXPORT_SYMBOL_GPL(tty_prepare_flip_string_flags);
 
 
 /**
- *	flush_to_ldisc
- *	@work: tty structure passed from work queue.
+ *	tty_rx_latency_add	-	account one receive latency sample
+ *	@lat: statistics to update
+ *	@delta: time from push to delivery
+ *
+ *	Locking: consumer side
+ */
+
+static void tty_rx_latency_add(struct tty_rx_latency *lat, ktime_t delta)
+{
+	s64 us = ktime_to_us(delta);
+	u32 v = clamp_t(s64, us, 0, UINT_MAX);
+	int bucket = min_t(int, fls(v), TTY_RX_LAT_BUCKETS - 1);
+
+	if (!lat->count || v < lat->min_us)
+		lat->min_us = v;
+	if (v > lat->max_us)
+		lat->max_us = v;
+	lat->total_us += v;
+	lat->count++;
+	lat->hist[bucket]++;
+}
+
+/**
+ *	tty_rx_latency_show	-	format receive latency statistics
+ *	@lat: statistics to print
+ *	@buf: PAGE_SIZE sysfs buffer
+ *
+ *	Print the sample count, min/avg/max in microseconds and the log2
+ *	histogram, one "<limit_us count" line per bucket.
+ */
+
+ssize_t tty_rx_latency_show(struct tty_rx_latency *lat, char *buf)
+{
+	struct tty_rx_latency snap = *lat;
+	u64 avg = snap.total_us;
+	ssize_t len;
+	int i;
+
+	if (snap.count)
+		do_div(avg, snap.count);
+	len = sprintf(buf, "count %lu\nmin %u\navg %llu\nmax %u\n",
+		snap.count, snap.count ? snap.min_us : 0,
+		(unsigned long long)avg, snap.max_us);
+	for (i = 0; i < TTY_RX_LAT_BUCKETS - 1; i++)
+		len += sprintf(buf + len, "<%lu %lu\n", 1UL << i, snap.hist[i]);
+	len += sprintf(buf + len, ">=%lu %lu\n", 1UL << i, snap.hist[i]);
+	return len;
+}
+EXPORT_SYMBOL_GPL(tty_rx_latency_show);
+
+/**
+ *	tty_rx_stamps_enable	-	turn on receive timestamps
+ *	@tty: tty to stamp
+ *
+ *	Attach a timestamp ring to the tty so that tty_flip_stamp calls by
+ *	the driver are recorded. The ring stays until the tty is released.
+ *
+ *	Locking: may sleep, callers serialize against each other. Safe
+ *	against a running producer and consumer.
+ */
+
+int tty_rx_stamps_enable(struct tty_struct *tty)
+{
+	struct tty_rx_stamps *s;
+
+	if (tty->buf.stamps)
+		return 0;
+	s = kzalloc(sizeof(*s), GFP_KERNEL);
+	if (s == NULL)
+		return -ENOMEM;
+	/* Publish the ring only once it is initialised */
+	smp_wmb();
+	tty->buf.stamps = s;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(tty_rx_stamps_enable);
+
+/**
+ *	tty_flip_stamp		-	timestamp the next received bytes
+ *	@tty: tty structure
+ *	@time: CLOCK_REALTIME at which the bytes were received
+ *
+ *	Called by the driver when it drains its receive FIFO, before it
+ *	inserts the data. The stamp applies to the bytes inserted from now
+ *	until the next stamp. Does nothing when stamps are not enabled.
+ *	When the ring is about to fill up, the bytes are marked as having
+ *	no stamp instead.
+ *
+ *	Locking: producer side, no locks taken
+ */
+
+void tty_flip_stamp(struct tty_struct *tty, ktime_t time)
+{
+	struct tty_rx_stamps *s = ACCESS_ONCE(tty->buf.stamps);
+	struct tty_buffer *tb = tty->buf.tail;
+	struct tty_rx_stamp *e;
+	unsigned int head, used;
+
+	if (s == NULL)
+		return;
+	head = s->head;
+	used = head - ACCESS_ONCE(s->tail);
+	if (used >= TTY_RX_STAMPS - 1) {
+		s->dropped++;
+		/* The last entry marks the time of the bytes from here as
+		   unknown, so they do not take the previous stamp */
+		if (used >= TTY_RX_STAMPS)
+			return;
+		time.tv64 = 0;
+	}
+	e = &s->ring[head % TTY_RX_STAMPS];
+	e->pos = tb->seq + tb->used;
+	e->time = time;
+	/* Fill the entry before the consumer can see it */
+	smp_wmb();
+	s->head = head + 1;
+}
+EXPORT_SYMBOL_GPL(tty_flip_stamp);
+
+/**
+ *	tty_rx_stamps_advance	-	consume stamps up to a stream offset
+ *	@s: timestamp ring
+ *	@seq: stream offset of a received byte
+ *
+ *	Move every stamp applying to bytes up to @seq out of the ring and
+ *	return the one covering @seq, or NULL if there is none.
+ *
+ *	Locking: consumer side
+ */
+
+static struct tty_rx_stamp *tty_rx_stamps_advance(struct tty_rx_stamps *s,
+						  unsigned long seq)
+{
+	unsigned int head = ACCESS_ONCE(s->head);
+	struct tty_rx_stamp *e;
+
+	/* Read the entries only after seeing them published */
+	smp_rmb();
+	while (s->tail != head) {
+		e = &s->ring[s->tail % TTY_RX_STAMPS];
+		if ((long)(e->pos - seq) > 0)
+			break;
+		s->cur = *e;
+		/* Done with the entry before the producer may reuse it */
+		smp_mb();
+		s->tail++;
+	}
+	return s->cur.time.tv64 ? &s->cur : NULL;
+}
+
+/**
+ *	tty_rx_stamp		-	look up the arrival time of a byte
+ *	@tty: tty structure
+ *	@seq: stream offset of the byte, tty->buf.rx_seq plus its index
+ *		in the data passed to receive_buf
+ *	@time: returns the CLOCK_REALTIME of the FIFO drain it came with
+ *
+ *	For use by line disciplines from their receive_buf method. Offsets
+ *	must be looked up in increasing order. Returns false when the tty
+ *	has no stamps enabled or none was recorded for the byte.
+ *
+ *	Locking: consumer side
+ */
+
+bool tty_rx_stamp(struct tty_struct *tty, unsigned long seq, ktime_t *time)
+{
+	struct tty_rx_stamps *s = tty->buf.stamps;
+	struct tty_rx_stamp *e;
+
+	if (s == NULL)
+		return false;
+	e = tty_rx_stamps_advance(s, seq);
+	if (e == NULL)
+		return false;
+	*time = e->time;
+	return true;
+}
+EXPORT_SYMBOL_GPL(tty_rx_stamp);
+
+/**
+ *	__flush_to_ldisc
+ *	@tty: tty to flush
  *
- *	This routine is called out of the software interrupt to flush data
- *	from the buffer chain to the line discipline.
+ *	This routine is called out of the workqueue or the rx kthread to
+ *	flush data from the buffer chain to the line discipline.
  *
- *	Locking: holds tty->buf.lock to guard buffer list. Drops the lock
+ *	Locking: holds tty->buf.lock against tty_buffer_flush. Drops the lock
  *	while invoking the line discipline receive_buf method. The
  *	receive_buf method is single threaded for each tty instance.
  */
 
-static void flush_to_ldisc(struct work_struct *work)
+static void __flush_to_ldisc(struct tty_struct *tty)
 {
-	struct tty_struct *tty =
-		container_of(work, struct tty_struct, buf.work);
 	unsigned long 	flags;
 	struct tty_ldisc *disc;
 
@@ -458,17 +721,32 @@ static void flush_to_ldisc(struct work_struct *work)
 	spin_lock_irqsave(&tty->buf.lock, flags);
 
 	if (!test_and_set_bit(TTY_FLUSHING, &tty->flags)) {
-		struct tty_buffer *head;
-		while ((head = tty->buf.head) != NULL) {
+		struct tty_bufhead *buf = &tty->buf;
+		struct tty_buffer *head, *next;
+		ktime_t stamp = { .tv64 = 0 };
+
+		for (;;) {
 			int count;
 			char *char_buf;
 			unsigned char *flag_buf;
 
-			count = head->commit - head->read;
+			head = buf->head;
+			/* A stamp seen here belongs to data committed no
+			   later than the commit count read below */
+			if (buf->lat && !stamp.tv64 &&
+			    ACCESS_ONCE(buf->lat_pending)) {
+				smp_rmb();
+				stamp = buf->lat_stamp;
+			}
+			next = ACCESS_ONCE(head->next);
+			/* The producer sets the final commit of a buffer
+			   before linking the next one */
+			smp_rmb();
+			count = ACCESS_ONCE(head->commit) - head->read;
 			if (!count) {
-				if (head->next == NULL)
+				if (next == NULL)
 					break;
-				tty->buf.head = head->next;
+				buf->head = next;
 				tty_buffer_free(tty, head);
 				continue;
 			}
@@ -481,13 +759,29 @@ static void flush_to_ldisc(struct work_struct *work)
 				break;
 			if (count > tty->receive_room)
 				count = tty->receive_room;
+			/* Read the data only after its commit */
+			smp_rmb();
 			char_buf = head->char_buf_ptr + head->read;
 			flag_buf = head->flag_buf_ptr + head->read;
+			buf->rx_seq = head->seq + head->read;
 			head->read += count;
 			spin_unlock_irqrestore(&tty->buf.lock, flags);
 			disc->ops->receive_buf(tty, char_buf,
 							flag_buf, count);
+			/* Retire the stamps of the delivered data whether
+			   or not the ldisc looked at them */
+			if (buf->stamps)
+				tty_rx_stamps_advance(buf->stamps,
+						buf->rx_seq + count - 1);
 			spin_lock_irqsave(&tty->buf.lock, flags);
+			if (stamp.tv64) {
+				tty_rx_latency_add(buf->lat,
+					ktime_sub(ktime_get(), stamp));
+				stamp.tv64 = 0;
+				/* Done with lat_stamp, producer may reuse it */
+				smp_mb();
+				buf->lat_pending = 0;
+			}
 		}
 		clear_bit(TTY_FLUSHING, &tty->flags);
 	}
@@ -504,6 +798,16 @@ static void flush_to_ldisc(struct work_struct *work)
 	tty_ldisc_deref(disc);
 }
 
+static void flush_to_ldisc(struct work_struct *work)
+{
+	__flush_to_ldisc(container_of(work, struct tty_struct, buf.work));
+}
+
+static void flush_to_ldisc_kthread(struct kthread_work *work)
+{
+	__flush_to_ldisc(container_of(work, struct tty_struct, buf.kwork));
+}
+
 /**
  *	tty_flush_to_ldisc
  *	@tty: tty to push
@@ -515,6 +819,7 @@ static void flush_to_ldisc(struct work_struct *work)
 void tty_flush_to_ldisc(struct tty_struct *tty)
 {
 	flush_work(&tty->buf.work);
+	flush_kthread_work(&tty->buf.kwork);
 }
 
 /**
@@ -523,27 +828,45 @@ void tty_flush_to_ldisc(struct tty_struct *tty)
  *
  *	Queue a push of the terminal flip buffers to the line discipline. This
  *	function must not be called from IRQ context if tty->low_latency is set.
+ *	Drivers that want low latency from IRQ context should leave that
+ *	alone and let the port set tty->rx_kthread instead, which hands the
+ *	data over from a real time kthread. tty->rx_kthread takes precedence
+ *	over tty->low_latency, so a driver that pushes from its IRQ thread
+ *	with low_latency set can still be switched to the rx kthread.
  *
  *	In the event of the queue being busy for flipping the work will be
  *	held off and retried later.
  *
- *	Locking: tty buffer lock. Driver locks in low latency mode.
+ *	Locking: producer side. Driver locks in low latency mode.
  */
 
 void tty_flip_buffer_push(struct tty_struct *tty)
 {
-	unsigned long flags;
-	spin_lock_irqsave(&tty->buf.lock, flags);
-	if (tty->buf.tail != NULL)
-		tty->buf.tail->commit = tty->buf.tail->used;
-	spin_unlock_irqrestore(&tty->buf.lock, flags);
+	tty_buffer_commit(tty);
+	tty_buffer_deliver(tty);
+}
+EXPORT_SYMBOL(tty_flip_buffer_push);
+
+/**
+ *	tty_buffer_deliver	-	feed committed data to the ldisc
+ *	@tty: tty to push
+ *
+ *	The second half of tty_flip_buffer_push, for drivers that committed
+ *	the data with tty_buffer_commit under their own lock. Must not be
+ *	called with that lock held, nor from IRQ context if tty->low_latency
+ *	is set.
+ *
+ *	Locking: none
+ */
 
-	if (tty->low_latency)
-		flush_to_ldisc(&tty->buf.work);
+void tty_buffer_deliver(struct tty_struct *tty)
+{
+	if (tty->low_latency && !tty->rx_kthread)
+		__flush_to_ldisc(tty);
 	else
-		schedule_work(&tty->buf.work);
+		tty_buffer_schedule(tty);
 }
-EXPORT_SYMBOL(tty_flip_buffer_push);
+EXPORT_SYMBOL_GPL(tty_buffer_deliver);
 
 /**
  *	tty_buffer_init		-	prepare a tty buffer structure
@@ -557,11 +880,34 @@ EXPORT_SYMBOL(tty_flip_buffer_push);
 
 void tty_buffer_init(struct tty_struct *tty)
 {
-	spin_lock_init(&tty->buf.lock);
-	tty->buf.head = NULL;
-	tty->buf.tail = NULL;
-	tty->buf.free = NULL;
-	tty->buf.memory_used = 0;
+	struct tty_bufhead *buf = &tty->buf;
+
+	spin_lock_init(&buf->lock);
+	memset(&buf->sentinel, 0, sizeof(buf->sentinel));
+	buf->head = buf->tail = &buf->sentinel;
+	init_llist_head(&buf->free);
+	atomic_set(&buf->memory_used, 0);
+	buf->lat = NULL;
+	buf->lat_stamp.tv64 = 0;
+	buf->lat_pending = 0;
+	buf->stamps = NULL;
+	buf->rx_seq = 0;
 	INIT_WORK(&tty->buf.work, flush_to_ldisc);
+	init_kthread_work(&tty->buf.kwork, flush_to_ldisc_kthread);
+}
+
+static int __init tty_rx_worker_init(void)
+{
+	struct sched_param param = { .sched_priority = MAX_USER_RT_PRIO / 2 };
+	struct task_struct *task;
+
+	task = kthread_run(kthread_worker_fn, &tty_rx_worker, "tty_rx");
+	if (IS_ERR(task)) {
+		printk(KERN_ERR "tty: cannot start rx kthread\n");
+		return PTR_ERR(task);
+	}
+	sched_setscheduler(task, SCHED_FIFO, &param);
+	return 0;
 }
+core_initcall(tty_rx_worker_init);
 
@@ -303,6 +303,10 @@ int kbd_rate(struct kbd_repeat *rep)
 
 /*
  * Helper Functions.
+ *
+ * The flip buffers take a single producer. Keyboard input is queued under
+ * the kbd_event_lock, and so are the responses of the terminal emulation
+ * (see vt_kbd_respond).
  */
 static void put_queue(struct vc_data *vc, int ch)
 {
@@ -1118,6 +1122,28 @@ void vt_kbd_con_stop(int console)
 /*	spin_unlock_irqrestore(&kbd_event_lock, flags); */
 }
 
+/**
+ *	vt_kbd_respond		-	queue a terminal response
+ *	@tty: terminal device
+ *	@cp: response string
+ *
+ *	Queue a reply of the terminal emulation, such as a cursor position
+ *	report, as input of @tty. Keyboard events queue input to the same
+ *	tty from interrupt context, so this is done under the kbd_event_lock.
+ */
+void vt_kbd_respond(struct tty_struct *tty, const char *cp)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&kbd_event_lock, flags);
+	while (*cp) {
+		tty_insert_flip_char(tty, *cp, 0);
+		cp++;
+	}
+	con_schedule_flip(tty);
+	spin_unlock_irqrestore(&kbd_event_lock, flags);
+}
+
 /*
  * This is the tasklet that updates LED state on all keyboards
  * attached to the box. The reason we use tasklet is that we
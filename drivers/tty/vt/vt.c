@@ -1376,11 +1376,7 @@ static void csi_m(struct vc_data *vc)
 
 static void respond_string(const char *p, struct tty_struct *tty)
 {
-	while (*p) {
-		tty_insert_flip_char(tty, *p, 0);
-		p++;
-	}
-	con_schedule_flip(tty);
+	vt_kbd_respond(tty, p);
 }
 
 static void cursor_report(struct vc_data *vc, struct tty_struct *tty)
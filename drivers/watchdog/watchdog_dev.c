@@ -41,6 +41,9 @@
 #include <linux/miscdevice.h>	/* For handling misc devices */
 #include <linux/init.h>		/* For __init/__exit/... */
 #include <linux/uaccess.h>	/* For copy_to_user/put_user/... */
+#include <linux/timer.h>	/* For the pretimeout timer */
+#include <linux/notifier.h>	/* For the pretimeout notifier chain */
+#include <linux/kmsg_dump.h>	/* For kmsg_dump */
 
 #include "watchdog_core.h"
 
@@ -48,6 +51,65 @@
 static dev_t watchdog_devt;
 /* the watchdog device behind /dev/watchdog */
 static struct watchdog_device *old_wdd;
+/* the chain called when a watchdog device reaches its pretimeout */
+static ATOMIC_NOTIFIER_HEAD(watchdog_pretimeout_chain);
+
+/*
+ *	watchdog_pretimeout_arm: (re)arm the pretimeout timer.
+ *	@wddev: the watchdog device
+ *
+ *	Called with the device lock held whenever the watchdog is started,
+ *	pinged or stopped. The timer expires pretimeout seconds before the
+ *	hardware would reset the system if it isn't pinged again.
+ */
+
+static void watchdog_pretimeout_arm(struct watchdog_device *wddev)
+{
+	if (watchdog_active(wddev) && wddev->pretimeout &&
+	    wddev->pretimeout < wddev->timeout)
+		mod_timer(&wddev->pretimeout_timer, jiffies +
+			(wddev->timeout - wddev->pretimeout) * HZ);
+	else
+		del_timer(&wddev->pretimeout_timer);
+}
+
+/*
+ *	watchdog_pretimeout_fire: the watchdog is about to reset the system.
+ *	@data: the watchdog device
+ *
+ *	Run the pretimeout notifiers and dump the kernel log, as an oops so
+ *	it reaches pstore without printk.always_kmsg_dump.
+ */
+
+static void watchdog_pretimeout_fire(unsigned long data)
+{
+	struct watchdog_device *wddev = (struct watchdog_device *)data;
+
+	dev_emerg(wddev->dev, "pretimeout, reset in %u seconds\n",
+		wddev->pretimeout);
+	atomic_notifier_call_chain(&watchdog_pretimeout_chain, wddev->id,
+		wddev);
+	kmsg_dump(KMSG_DUMP_OOPS);
+}
+
+/*
+ *	watchdog_register_pretimeout_notifier: get told about pretimeouts
+ *	@nb: notifier block, called in atomic context with the watchdog
+ *	     device id as action and the watchdog device as data
+ */
+
+int watchdog_register_pretimeout_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&watchdog_pretimeout_chain, nb);
+}
+EXPORT_SYMBOL_GPL(watchdog_register_pretimeout_notifier);
+
+int watchdog_unregister_pretimeout_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&watchdog_pretimeout_chain,
+		nb);
+}
+EXPORT_SYMBOL_GPL(watchdog_unregister_pretimeout_notifier);
 
 /*
  *	watchdog_ping: ping the watchdog.
@@ -77,6 +139,8 @@ static int watchdog_ping(struct watchdog_device *wddev)
 		err = wddev->ops->ping(wddev);  /* ping the watchdog */
 	else
 		err = wddev->ops->start(wddev); /* restart watchdog */
+	if (err == 0)
+		watchdog_pretimeout_arm(wddev);
 
 out_ping:
 	mutex_unlock(&wddev->lock);
@@ -107,8 +171,10 @@ static int watchdog_start(struct watchdog_device *wddev)
 		goto out_start;
 
 	err = wddev->ops->start(wddev);
-	if (err == 0)
+	if (err == 0) {
 		set_bit(WDOG_ACTIVE, &wddev->status);
+		watchdog_pretimeout_arm(wddev);
+	}
 
 out_start:
 	mutex_unlock(&wddev->lock);
@@ -146,8 +212,10 @@ static int watchdog_stop(struct watchdog_device *wddev)
 	}
 
 	err = wddev->ops->stop(wddev);
-	if (err == 0)
+	if (err == 0) {
 		clear_bit(WDOG_ACTIVE, &wddev->status);
+		watchdog_pretimeout_arm(wddev);
+	}
 
 out_stop:
 	mutex_unlock(&wddev->lock);
@@ -218,6 +286,41 @@ out_timeout:
 	return err;
 }
 
+/*
+ *	watchdog_set_pretimeout: set the watchdog pretimeout
+ *	@wddev: the watchdog device to set the pretimeout for
+ *	@pretimeout: seconds before the timeout to notify, 0 to disable
+ *
+ *	The pretimeout is kept by the core, so it works for any device that
+ *	advertises WDIOF_PRETIMEOUT without handling the ioctl itself.
+ */
+
+static int watchdog_set_pretimeout(struct watchdog_device *wddev,
+							unsigned int pretimeout)
+{
+	int err = 0;
+
+	if (!(wddev->info->options & WDIOF_PRETIMEOUT))
+		return -EOPNOTSUPP;
+
+	if (pretimeout && pretimeout >= wddev->timeout)
+		return -EINVAL;
+
+	mutex_lock(&wddev->lock);
+
+	if (test_bit(WDOG_UNREGISTERED, &wddev->status)) {
+		err = -ENODEV;
+		goto out_pretimeout;
+	}
+
+	wddev->pretimeout = pretimeout;
+	watchdog_pretimeout_arm(wddev);
+
+out_pretimeout:
+	mutex_unlock(&wddev->lock);
+	return err;
+}
+
 /*
  *	watchdog_get_timeleft: wrapper to get the time left before a reboot
  *	@wddev: the watchdog device to get the remaining time from
@@ -389,6 +492,17 @@ static long watchdog_ioctl(struct file *file, unsigned int cmd,
 		if (wdd->timeout == 0)
 			return -EOPNOTSUPP;
 		return put_user(wdd->timeout, p);
+	case WDIOC_SETPRETIMEOUT:
+		if (get_user(val, p))
+			return -EFAULT;
+		err = watchdog_set_pretimeout(wdd, val);
+		if (err < 0)
+			return err;
+		/* Fall */
+	case WDIOC_GETPRETIMEOUT:
+		if (!(wdd->info->options & WDIOF_PRETIMEOUT))
+			return -EOPNOTSUPP;
+		return put_user(wdd->pretimeout, p);
 	case WDIOC_GETTIMELEFT:
 		err = watchdog_get_timeleft(wdd, &val);
 		if (err)
@@ -523,6 +637,9 @@ int watchdog_dev_register(struct watchdog_device *watchdog)
 {
 	int err, devno;
 
+	setup_timer(&watchdog->pretimeout_timer, watchdog_pretimeout_fire,
+		    (unsigned long)watchdog);
+
 	if (watchdog->id == 0) {
 		watchdog_miscdev.parent = watchdog->parent;
 		err = misc_register(&watchdog_miscdev);
@@ -568,6 +685,8 @@ int watchdog_dev_unregister(struct watchdog_device *watchdog)
 	set_bit(WDOG_UNREGISTERED, &watchdog->status);
 	mutex_unlock(&watchdog->lock);
 
+	del_timer_sync(&watchdog->pretimeout_timer);
+
 	cdev_del(&watchdog->cdev);
 	if (watchdog->id == 0) {
 		misc_deregister(&watchdog_miscdev);
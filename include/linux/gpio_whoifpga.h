@@ -50,9 +50,19 @@
  */
 #define IO_CTRL_STATUS	(0xC2) //0x61
 
+/*
+ * Each FPGA is its own platform device. Its register window is taken from
+ * an IORESOURCE_MEM resource when one is given, else from fpga_base_address.
+ */
 struct whoifpga_platform_data {
 	unsigned	gpio_base;
-	void 		*fpga_base_address;
+	unsigned long	fpga_base_address;
+
+	/* FPGA interrupt line and its trigger (rising edge if 0); when irq
+	 * is 0 the GPIOs can't be used as interrupts.
+	 */
+	int		irq;
+	unsigned long	irq_flags;
 };
 
 #endif
@@ -0,0 +1,85 @@
+/*
+ * n_frame.h - framed receive line discipline (N_FRAME)
+ *
+ * The line discipline splits the receive byte stream into frames and
+ * returns exactly one frame per read(). Frames are found either by
+ * delimiters (for example NMEA style "$...*hh\r\n" sentences) or by a
+ * sync byte followed by a length field, and may be checked against a
+ * checksum before they are queued. poll() only reports POLLIN once a
+ * complete frame is queued.
+ *
+ * When N_FRAME_F_HEADER is set, every frame is preceded by a struct
+ * n_frame_hdr carrying its length, status and the kernel receive time.
+ * On serial ports with receive timestamps enabled (the rx_stamps sysfs
+ * attribute) that is the time the driver drained the first byte of the
+ * frame from the receive FIFO.
+ */
+
+#ifndef _LINUX_N_FRAME_H
+#define _LINUX_N_FRAME_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Framing modes */
+#define N_FRAME_MODE_DELIM	0	/* [start] ... end */
+#define N_FRAME_MODE_LENGTH	1	/* start, header with length, body */
+
+/* Checksums, checked over the frame without delimiters */
+#define N_FRAME_CSUM_NONE	0
+#define N_FRAME_CSUM_NMEA	1	/* XOR between start and '*', "*hh" */
+#define N_FRAME_CSUM_SUM8	2	/* last byte: 8 bit sum of the rest */
+#define N_FRAME_CSUM_XOR8	3	/* last byte: XOR of the rest */
+#define N_FRAME_CSUM_CRC16	4	/* last two bytes: CRC-CCITT, LE */
+
+/* Configuration flags */
+#define N_FRAME_F_START		0x0001	/* start byte required */
+#define N_FRAME_F_HEADER	0x0002	/* prepend struct n_frame_hdr */
+#define N_FRAME_F_KEEP_BAD	0x0004	/* queue frames failing the checksum */
+#define N_FRAME_F_STRIP		0x0008	/* drop delimiters from the frame */
+#define N_FRAME_F_LEN_BE	0x0010	/* length field is big endian */
+
+struct n_frame_config {
+	__u32	mode;		/* N_FRAME_MODE_* */
+	__u32	flags;		/* N_FRAME_F_* */
+	__u32	csum;		/* N_FRAME_CSUM_* */
+	__u32	max_frame;	/* longest frame in bytes, 8..65535 */
+	__u32	rx_frames;	/* number of frames that can be queued */
+	__u8	start;		/* start or sync byte */
+	__u8	end;		/* end delimiter, DELIM mode */
+	__u8	len_offset;	/* LENGTH mode: offset of the length field */
+	__u8	len_size;	/* LENGTH mode: 1 or 2 bytes */
+	__s32	len_adjust;	/* LENGTH mode: frame size = length + adjust */
+	__u32	unused[4];
+};
+
+/* n_frame_hdr.status */
+#define N_FRAME_OK		0
+#define N_FRAME_BAD_CSUM	1
+
+/* n_frame_hdr.tsrc */
+#define N_FRAME_TS_LDISC	0	/* line discipline saw the first byte */
+#define N_FRAME_TS_DRIVER	1	/* driver drained the first byte */
+
+struct n_frame_hdr {
+	__u32	len;		/* bytes following this header */
+	__u32	status;		/* N_FRAME_OK or N_FRAME_BAD_CSUM */
+	__s64	tv_sec;		/* CLOCK_REALTIME at the first byte */
+	__u32	tv_nsec;
+	__u32	tsrc;		/* N_FRAME_TS_* */
+};
+
+struct n_frame_stats {
+	__u32	frames;		/* frames queued */
+	__u32	csum_errors;	/* frames failing the checksum */
+	__u32	oversize;	/* frames longer than max_frame */
+	__u32	dropped;	/* frames lost because the queue was full */
+	__u32	discarded;	/* bytes received outside any frame */
+	__u32	unused[3];
+};
+
+#define NFRAMEIOC_GETCONF	_IOR('N', 0x80, struct n_frame_config)
+#define NFRAMEIOC_SETCONF	_IOW('N', 0x81, struct n_frame_config)
+#define NFRAMEIOC_GETSTATS	_IOR('N', 0x82, struct n_frame_stats)
+
+#endif /* _LINUX_N_FRAME_H */
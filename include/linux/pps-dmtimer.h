@@ -0,0 +1,33 @@
+/*
+ * pps-dmtimer.h -- PPS client for OMAP dual mode timer input capture
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _PPS_DMTIMER_H
+#define _PPS_DMTIMER_H
+
+struct pps_dmtimer_platform_data {
+	/* dmtimer whose event pin carries the PPS signal */
+	int timer_id;
+	/* functional clock of the timer, OMAP_TIMER_SRC_* */
+	int clk_source;
+	bool assert_falling_edge;
+	/* use a software model of the timer instead of the hardware */
+	bool simulate;
+};
+
+#endif
@@ -27,6 +27,13 @@ struct pps_gpio_platform_data {
 	bool capture_clear;
 	unsigned int gpio_pin;
 	const char *gpio_label;
+	/* calibrated edge to timestamp delay, subtracted from every event */
+	unsigned int latency_ns;
+	/* take the timestamp in the IRQ flow handler, before dispatch;
+	 * the IRQ must not be shared, nothing else may request or free
+	 * it while the driver is bound
+	 */
+	bool early_capture;
 };
 
 #endif
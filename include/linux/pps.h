@@ -120,6 +120,25 @@ struct pps_bind_args {
 	int consumer;	/* selected kernel consumer */
 };
 
+/* hardpps() state after a pulse of the bound source, as read from
+ * debugfs pps/ppsN. Units follow struct timex.
+ */
+struct pps_kc_sample {
+	struct pps_ktime ts;	/* pulse time stamp */
+	__u32 sequence;		/* sample number, gaps mean lost samples */
+	__s32 offset;		/* phase error of the pulse (ns) */
+	__s32 jitter;		/* PPS jitter (ns) */
+	__s32 shift;		/* calibration interval (s) (shift) */
+	__s32 freq;		/* PPS frequency (scaled ppm) */
+	__s32 stabil;		/* PPS stability (scaled ppm) */
+	__u32 status;		/* clock status, STA_* */
+	__u32 calcnt;		/* calibration intervals */
+	__u32 jitcnt;		/* jitter limit exceeded */
+	__u32 stbcnt;		/* stability limit exceeded */
+	__u32 errcnt;		/* calibration errors */
+	__u32 reserved;
+};
+
 #include <linux/ioctl.h>
 
 #define PPS_GETPARAMS		_IOR('p', 0xa1, struct pps_kparams *)
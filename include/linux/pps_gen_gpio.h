@@ -0,0 +1,35 @@
+/*
+ * pps_gen_gpio.h -- PPS signal generator on a GPIO or dmtimer PWM pin
+ *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _PPS_GEN_GPIO_H
+#define _PPS_GEN_GPIO_H
+
+struct pps_gen_gpio_platform_data {
+	unsigned int gpio_pin;
+	const char *gpio_label;
+	bool active_low;
+	/* drive the PWM pin of this dmtimer instead of gpio_pin, if > 0 */
+	int timer_id;
+	/* pulse width, defaults to 100 ms */
+	unsigned int width_ns;
+	/* echo the events of this PPS source instead of generating */
+	const char *echo_source;
+};
+
+#endif
@@ -31,6 +31,13 @@
  * Global defines
  */
 
+#define PPS_KC_RING_SIZE	32	/* hardpps() samples kept, power of 2 */
+
+/* Deviations further than this from the second are not jitter, but
+ * missed pulses or clock steps; they are only counted.
+ */
+#define PPS_JITTER_WINDOW	NSEC_PER_MSEC
+
 struct pps_device;
 
 /* The specific PPS source info */
@@ -46,6 +53,16 @@ struct pps_source_info {
 	struct device *dev;
 };
 
+/* Statistics of the deviation of pulses from the second, see
+ * pps_jitter_add(). The owner provides the locking.
+ */
+struct pps_jitter {
+	u64 samples;
+	unsigned long outliers;			/* outside the window */
+	s64 min, max, sum;			/* in ns */
+	u64 sumsq;				/* in ns^2 */
+};
+
 struct pps_event_time {
 #ifdef CONFIG_NTP_PPS
 	struct timespec ts_raw;
@@ -73,6 +90,18 @@ struct pps_device {
 	struct device *dev;
 	struct fasync_struct *async_queue;	/* fasync method */
 	spinlock_t lock;
+
+	/* echo redirected by another driver, see pps_set_echo() */
+	void (*echo_hook)(struct pps_device *pps, int event, void *data);
+	int echo_hook_mode;			/* PPS_ECHOASSERT, ... */
+
+#ifdef CONFIG_NTP_PPS
+	/* hardpps() telemetry, protected by pps_kc_hardpps_lock */
+	struct pps_kc_sample kc_ring[PPS_KC_RING_SIZE];
+	__u32 kc_seq;				/* samples recorded */
+	wait_queue_head_t kc_queue;
+	struct dentry *kc_dentry;
+#endif
 };
 
 /*
@@ -92,6 +121,13 @@ extern int pps_register_cdev(struct pps_device *pps);
 extern void pps_unregister_cdev(struct pps_device *pps);
 extern void pps_event(struct pps_device *pps,
 		struct pps_event_time *ts, int event, void *data);
+extern void pps_set_echo(struct pps_device *pps,
+		void (*echo)(struct pps_device *pps, int event, void *data),
+		int mode);
+extern struct pps_device *pps_lookup_source(const char *name);
+extern void pps_jitter_add(struct pps_jitter *j, s64 err);
+extern ssize_t pps_jitter_print(const struct pps_jitter *j,
+		const char *outliers, char *buf);
 
 static inline void timespec_to_pps_ktime(struct pps_ktime *kt,
 		struct timespec ts)
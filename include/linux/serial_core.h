@@ -407,6 +407,10 @@ struct uart_state {
 	struct circ_buf		xmit;
 
 	struct uart_port	*uart_port;
+
+	unsigned int		rx_kthread:1;	/* feed ldisc from rx kthread */
+	unsigned int		rx_stamps:1;	/* record rx timestamps */
+	struct tty_rx_latency	rx_lat;
 };
 
 #define UART_XMIT_SIZE	PAGE_SIZE
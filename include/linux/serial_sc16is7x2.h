@@ -1,8 +1,15 @@
 #ifndef LINUX_SPI_SC16IS752_H
 #define LINUX_SPI_SC16IS752_H
 
+#include <linux/types.h>
+
 #define SC16IS7X2_NR_GPIOS 8
 
+/* TX FIFO fill strategies, selectable per port */
+#define SC16IS7X2_TX_SINGLE	0	/* one byte per SPI transfer */
+#define SC16IS7X2_TX_BURST	1	/* fill the free FIFO space in one transfer */
+#define SC16IS7X2_TX_VERIFY	2	/* burst, then check TXLVL for lost bytes */
+
 struct sc16is7x2_platform_data {
 	unsigned int	uartclk;
 	/* uart line number of the first channel */
@@ -14,6 +21,12 @@ struct sc16is7x2_platform_data {
 	const char	*const *names;
     /* GPIO used as IRQ */
     unsigned    irq_gpio;
+	/* initial TX mode of both channels (SC16IS7X2_TX_*) */
+	u8		tx_mode;
+	/* if set, clock TX bursts at uartclk / burst_clkdiv */
+	unsigned	burst_clkdiv;
+	/* RX FIFO interrupt watermark in steps of 4 (TLR), 0 keeps FCR's */
+	u8		rx_trigger;
 };
 
 #endif
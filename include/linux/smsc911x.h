@@ -59,4 +59,12 @@ struct smsc911x_platform_config {
  */
 #define SMSC911X_SWAP_FIFO			(BIT(5))
 
+/*
+ * SMSC911X_USE_DMA:
+ * Move frames between memory and the data FIFOs with the platform DMA
+ * controller instead of the CPU (OMAP only for now). Needs a 32 bit bus
+ * and no SMSC911X_SWAP_FIFO; the driver falls back to PIO otherwise.
+ */
+#define SMSC911X_USE_DMA			(BIT(6))
+
 #endif /* __LINUX_SMSC911X_H__ */
@@ -255,6 +255,7 @@ extern u64 ntp_tick_length(void);
 extern int second_overflow(unsigned long secs);
 extern int do_adjtimex(struct timex *);
 extern void hardpps(const struct timespec *, const struct timespec *);
+extern void hardpps_fill_timex(struct timex *);
 
 int read_current_timer(unsigned long *timer_val);
 
@@ -34,12 +34,16 @@
 #define N_TI_WL		22	/* for TI's WL BT, FM, GPS combo chips */
 #define N_TRACESINK	23	/* Trace data routing for MIPI P1149.7 */
 #define N_TRACEROUTER	24	/* Trace data routing for MIPI P1149.7 */
+#define N_FRAME		25	/* Framed receive, one frame per read */
 
 #ifdef __KERNEL__
 #include <linux/fs.h>
 #include <linux/major.h>
 #include <linux/termios.h>
 #include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/llist.h>
 #include <linux/tty_driver.h>
 #include <linux/tty_ldisc.h>
 #include <linux/mutex.h>
@@ -62,13 +66,17 @@
 #define __DISABLED_CHAR '\0'
 
 struct tty_buffer {
-	struct tty_buffer *next;
+	union {
+		struct tty_buffer *next;
+		struct llist_node free;
+	};
 	char *char_buf_ptr;
 	unsigned char *flag_buf_ptr;
 	int used;
 	int size;
 	int commit;
 	int read;
+	unsigned long seq;	/* Stream offset of the first byte */
 	/* Data points here */
 	unsigned long data[0];
 };
@@ -83,15 +91,63 @@ struct tty_buffer {
 
 #define TTY_BUFFER_PAGE	(((PAGE_SIZE - sizeof(struct tty_buffer)) / 2) & ~0xFF)
 
+/* Buffers of this size are recycled through the per tty free pool */
+#define TTY_BUFFER_MIN	256
+
+
+/*
+ * Receive latency statistics: time from a driver pushing the flip
+ * buffers until the line discipline has been handed the data. Bucket
+ * n counts samples below 2^n microseconds, the last one the rest.
+ */
+#define TTY_RX_LAT_BUCKETS	16
+
+struct tty_rx_latency {
+	unsigned long count;
+	u32 min_us;
+	u32 max_us;
+	u64 total_us;
+	unsigned long hist[TTY_RX_LAT_BUCKETS];
+};
+
+/*
+ * Receive timestamps. A driver may record the time of each receive FIFO
+ * drain against the stream offset of the next byte it inserts; the line
+ * discipline can then look up the arrival time of any byte it is handed.
+ * The ring is single producer (driver) single consumer (flush_to_ldisc
+ * and the line discipline), stamps are dropped while it is full.
+ */
+#define TTY_RX_STAMPS	64
+
+struct tty_rx_stamp {
+	unsigned long pos;		/* Stream offset of the first byte */
+	ktime_t time;			/* CLOCK_REALTIME */
+};
+
+struct tty_rx_stamps {
+	unsigned int head;		/* Producer owned */
+	unsigned int tail;		/* Consumer owned */
+	unsigned long dropped;		/* Stamps lost to a full ring */
+	struct tty_rx_stamp cur;	/* Newest stamp consumed */
+	struct tty_rx_stamp ring[TTY_RX_STAMPS];
+};
 
 struct tty_bufhead {
 	struct work_struct work;
-	spinlock_t lock;
-	struct tty_buffer *head;	/* Queue head */
-	struct tty_buffer *tail;	/* Active buffer */
-	struct tty_buffer *free;	/* Free queue head */
-	int memory_used;		/* Buffer space used excluding
+	struct kthread_work kwork;	/* Used when tty->rx_kthread */
+	spinlock_t lock;		/* Consumer side, pty producers */
+	struct tty_buffer *head;	/* Queue head, consumer owned */
+	struct tty_buffer *tail;	/* Active buffer, producer owned */
+	struct tty_buffer sentinel;	/* Keeps head and tail non NULL */
+	struct llist_head free;		/* Free TTY_BUFFER_MIN buffers */
+	atomic_t memory_used;		/* Buffer space used excluding
 								free queue */
+	struct tty_rx_latency *lat;	/* Optional, owned by the driver */
+	ktime_t lat_stamp;		/* Oldest undelivered push */
+	int lat_pending;		/* lat_stamp handed to consumer */
+	struct tty_rx_stamps *stamps;	/* Optional receive timestamps */
+	unsigned long rx_seq;		/* Stream offset of the data being
+					   passed to receive_buf */
 };
 /*
  * When a break, frame error, or parity error happens, these codes are
@@ -280,7 +336,7 @@ struct tty_struct {
 	int count;
 	struct winsize winsize;		/* termios mutex */
 	unsigned char stopped:1, hw_stopped:1, flow_stopped:1, packet:1;
-	unsigned char low_latency:1, warned:1;
+	unsigned char low_latency:1, warned:1, rx_kthread:1;
 	unsigned char ctrl_status;	/* ctrl_lock */
 	unsigned int receive_room;	/* Bytes free for queue */
 
@@ -444,6 +500,16 @@ extern void tty_flush_to_ldisc(struct tty_struct *tty);
 extern void tty_buffer_free_all(struct tty_struct *tty);
 extern void tty_buffer_flush(struct tty_struct *tty);
 extern void tty_buffer_init(struct tty_struct *tty);
+extern int tty_buffer_prealloc(struct tty_struct *tty, int count);
+extern void tty_buffer_schedule(struct tty_struct *tty);
+extern void tty_buffer_commit(struct tty_struct *tty);
+extern void tty_buffer_deliver(struct tty_struct *tty);
+extern int tty_buffer_cancel_work(struct tty_struct *tty);
+extern void tty_buffer_flush_work(struct tty_struct *tty);
+extern ssize_t tty_rx_latency_show(struct tty_rx_latency *lat, char *buf);
+extern int tty_rx_stamps_enable(struct tty_struct *tty);
+extern bool tty_rx_stamp(struct tty_struct *tty, unsigned long seq,
+			 ktime_t *time);
 extern speed_t tty_get_baud_rate(struct tty_struct *tty);
 extern speed_t tty_termios_baud_rate(struct ktermios *termios);
 extern speed_t tty_termios_input_baud_rate(struct ktermios *termios);
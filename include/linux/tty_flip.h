@@ -7,6 +7,7 @@ extern int tty_insert_flip_string_fixed_flag(struct tty_struct *tty, const unsig
 extern int tty_prepare_flip_string(struct tty_struct *tty, unsigned char **chars, size_t size);
 extern int tty_prepare_flip_string_flags(struct tty_struct *tty, unsigned char **chars, char **flags, size_t size);
 void tty_schedule_flip(struct tty_struct *tty);
+extern void tty_flip_stamp(struct tty_struct *tty, ktime_t time);
 
 static inline int tty_insert_flip_char(struct tty_struct *tty,
 					unsigned char ch, char flag)
@@ -25,4 +26,14 @@ static inline int tty_insert_flip_string(struct tty_struct *tty, const unsigned
 	return tty_insert_flip_string_fixed_flag(tty, chars, TTY_NORMAL, size);
 }
 
+/*
+ * Record the current time for the bytes inserted next. Costs a pointer
+ * test when the tty has no receive timestamps enabled.
+ */
+static inline void tty_flip_stamp_now(struct tty_struct *tty)
+{
+	if (unlikely(tty->buf.stamps))
+		tty_flip_stamp(tty, ktime_get_real());
+}
+
 #endif /* _LINUX_TTY_FLIP_H */
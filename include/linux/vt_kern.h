@@ -190,6 +190,7 @@ extern void vt_set_led_state(int console, int leds);
 extern void vt_set_led_state(int console, int leds);
 extern void vt_kbd_con_start(int console);
 extern void vt_kbd_con_stop(int console);
+extern void vt_kbd_respond(struct tty_struct *tty, const char *cp);
 
 
 #endif /* _VT_KERN_H */
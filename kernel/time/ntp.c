@@ -949,6 +949,25 @@ void hardpps(const struct timespec *phase_ts, const struct timespec *raw_ts)
 }
 EXPORT_SYMBOL(hardpps);
 
+/*
+ * hardpps_fill_timex() - snapshot the PPS discipline state
+ *
+ * Fills status and the PPS fields of @txc like adjtimex() does, except
+ * that the jitter is always in nanoseconds. Used to monitor hardpps()
+ * from the PPS kernel consumer after each pulse.
+ */
+void hardpps_fill_timex(struct timex *txc)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ntp_lock, flags);
+	pps_fill_timex(txc);
+	txc->jitter = pps_jitter;
+	txc->status = time_status;
+	spin_unlock_irqrestore(&ntp_lock, flags);
+}
+EXPORT_SYMBOL(hardpps_fill_timex);
+
 #endif	/* CONFIG_NTP_PPS */
 
 static int __init ntp_tick_adj_setup(char *str)